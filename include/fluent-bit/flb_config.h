@@ -196,8 +196,16 @@ struct flb_config {
     char *storage_sync;             /* sync mode */
     int   storage_metrics;          /* enable/disable storage metrics */
     int   storage_checksum;         /* checksum enabled */
+    char *storage_checksum_type;    /* checksum algorithm: crc32, crc32c */
+    int   storage_compress;         /* compress locked chunks */
+    int   storage_wal;              /* append chunks to a write-ahead log */
     int   storage_max_chunks_up;    /* max number of chunks 'up' in memory */
     char *storage_bl_mem_limit;     /* storage backlog memory limit */
+    struct timespec storage_bl_start; /* storage backlog recovery start */
+    double storage_bl_load_time;    /* seconds to scan and register chunks */
+    double storage_bl_queue_time;   /* seconds until first chunk is queued */
+    int   storage_tiers;            /* number of tiered input instances */
+    int   storage_tiers_spill;      /* a tiered instance crossed its limit */
     struct flb_storage_metrics *storage_metrics_ctx; /* storage metrics context */
 
     /* Embedded SQL Database support (SQLite3) */
@@ -237,7 +245,39 @@ struct flb_config {
     unsigned int sched_cap;
     unsigned int sched_base;
 
-    struct flb_task_map tasks_map[2048];
+    /*
+     * Tasks map: task ID to task lookup, free IDs are kept in a stack so
+     * acquiring and releasing an ID is O(1).
+     */
+    int tasks_map_size;                  /* max number of concurrent tasks */
+    struct flb_task_map *tasks_map;
+    int *tasks_map_free;                 /* stack of available task IDs  */
+    int tasks_map_free_count;
+    int tasks_map_peak;                  /* highest number of IDs in use */
+    uint64_t tasks_map_full;             /* chunks delayed, map full     */
+
+    /* Filter workers: run filter chains out of the engine thread */
+    int filter_workers;
+    void *filter_pool;
+
+    /* Router: per Tag cache of the matching filters and routes */
+    int router_cache_size;
+    void *router_cache;
+
+    /* Number of uint64_t elements of the chunks routes masks */
+    int routes_mask_size;
+
+    /*
+     * Engine profiler: wall time of every event handled by the engine
+     * loop, callbacks taking more than 'engine.stall_threshold'
+     * milliseconds are reported.
+     */
+    int engine_stall_threshold;
+    int engine_stall_reported;           /* stall already logged by a plugin */
+    void *engine_latency;
+
+    /* JSON encoding: write only the last value of a repeated map key */
+    int json_dedup_keys;
 
     int dry_run;
 };
@@ -298,6 +338,9 @@ enum conf_type {
 #define FLB_CONF_STORAGE_SYNC          "storage.sync"
 #define FLB_CONF_STORAGE_METRICS       "storage.metrics"
 #define FLB_CONF_STORAGE_CHECKSUM      "storage.checksum"
+#define FLB_CONF_STORAGE_CHECKSUM_TYPE "storage.checksum_type"
+#define FLB_CONF_STORAGE_COMPRESS      "storage.compress"
+#define FLB_CONF_STORAGE_WAL           "storage.wal"
 #define FLB_CONF_STORAGE_BL_MEM_LIMIT  "storage.backlog.mem_limit"
 #define FLB_CONF_STORAGE_MAX_CHUNKS_UP "storage.max_chunks_up"
 
@@ -308,4 +351,19 @@ enum conf_type {
 #define FLB_CONF_STR_SCHED_CAP        "scheduler.cap"
 #define FLB_CONF_STR_SCHED_BASE       "scheduler.base"
 
+/* Filters */
+#define FLB_CONF_STR_FILTER_WORKERS   "filter.workers"
+
+/* Router */
+#define FLB_CONF_STR_ROUTER_CACHE     "router.cache_size"
+
+/* Tasks */
+#define FLB_CONF_STR_TASK_MAP_SIZE    "task.map_size"
+
+/* Engine */
+#define FLB_CONF_STR_ENGINE_STALL     "engine.stall_threshold"
+
+/* JSON */
+#define FLB_CONF_STR_JSON_DEDUP_KEYS  "json.dedup_keys"
+
 #endif
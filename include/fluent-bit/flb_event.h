@@ -33,6 +33,11 @@
  * The flb_event_chunk structure is a full context used in the output plugins
  * flush callback. It contains the type of records (logs, metrics), the tag,
  * msgpack buffer, it size and a hint of the serialized msgpack events.
+ *
+ * 'data' is not a copy: it references the content of the input chunk (the
+ * mapped file for filesystem chunks), which stays locked while the task
+ * has users. Plugins must treat it as read-only; the ones that forward
+ * msgpack unchanged can write it as-is (e.g. flb_io_net_writev()).
  */
 struct flb_event_chunk {
     int type;               /* event type */
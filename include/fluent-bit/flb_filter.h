@@ -22,6 +22,7 @@
 #define FLB_FILTER_H
 
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pthread.h>
 
 #ifdef FLB_HAVE_REGEX
 #include <fluent-bit/flb_regex.h>
@@ -42,11 +43,28 @@
 #define FLB_FILTER_MODIFIED 1
 #define FLB_FILTER_NOTOUCH  2
 
+/*
+ * Plugin flags
+ * ------------
+ * FLB_FILTER_THREADSAFE: the callback only touches its own instance context,
+ * so it can be invoked from a filter worker thread (filter.workers). Calls
+ * on the same instance are serialized, so a chain made of one such filter
+ * runs in a single worker at a time whatever the number of workers.
+ *
+ * FLB_FILTER_REENTRANT: the callback does not modify its context once it is
+ * initialized, the same instance can run in several workers at once.
+ */
+#define FLB_FILTER_THREADSAFE  1
+#define FLB_FILTER_REENTRANT   2
+
+/* Filter chains up to this length are copied on the stack by flb_filter_do() */
+#define FLB_FILTER_CHAIN_STACK  32
+
 struct flb_input_instance;
 struct flb_filter_instance;
 
 struct flb_filter_plugin {
-    int flags;             /* Flags (not available at the moment */
+    int flags;             /* Flags (FLB_FILTER_THREADSAFE, ...) */
     char *name;            /* Filter short name            */
     char *description;     /* Description                  */
 
@@ -82,6 +100,13 @@ struct flb_filter_instance {
 
     struct mk_list _head;          /* link to config->filters  */
 
+    /*
+     * When filter workers are enabled the same instance can be invoked from
+     * the engine and from any worker, callbacks are serialized with this lock
+     * unless the plugin is FLB_FILTER_REENTRANT.
+     */
+    pthread_mutex_t lock;
+
     /*
      * CMetrics
      * --------
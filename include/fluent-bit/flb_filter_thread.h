@@ -0,0 +1,123 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_FILTER_THREAD_H
+#define FLB_FILTER_THREAD_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pthread.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_thread_pool.h>
+#include <monkey/mk_core.h>
+
+#include <cmetrics/cmetrics.h>
+#include <cmetrics/cmt_counter.h>
+#include <cmetrics/cmt_gauge.h>
+
+/* flb_filter_pool_submit() return value when the caller must filter inline */
+#define FLB_FILTER_POOL_INLINE     1
+
+/*
+ * Maximum number of jobs being processed by the workers, per worker. An
+ * input submitting over the limit is paused until half of it is drained.
+ */
+#define FLB_FILTER_POOL_MAX_JOBS   64
+
+struct flb_input_instance;
+struct flb_filter_instance;
+struct flb_filter_pool;
+
+/*
+ * A job is a buffer appended by an input instance. The job is numbered with
+ * the input sequence so the engine can commit the results in order.
+ */
+struct flb_filter_job {
+    uint64_t seq;                          /* input sequence number    */
+    int filtered;                          /* filters already applied? */
+    flb_sds_t tag;
+    char *buf;
+    size_t size;
+
+    int n_filters;                         /* matching filters          */
+    struct flb_filter_instance **filters;
+
+    struct flb_input_instance *in;
+    struct flb_filter_job *next;           /* link to the done stack    */
+    struct mk_list _head;                  /* link to in->filter_jobs   */
+};
+
+struct flb_filter_worker {
+    int id;
+    char name[16];                         /* metrics label             */
+    flb_pipefd_t ch_jobs[2];               /* jobs sent by the engine   */
+    struct flb_tp_thread *th;
+    struct flb_filter_pool *pool;
+};
+
+struct flb_filter_pool {
+    struct mk_event event;                 /* engine notifications      */
+
+    int n_workers;
+    struct flb_filter_worker *workers;
+    struct flb_tp *tp;
+
+    /*
+     * Backpressure: jobs submitted and not drained yet, only touched by the
+     * engine thread, and the number of inputs paused because of them.
+     */
+    int jobs;
+    int max_jobs;
+    int paused;
+
+    /* jobs still owned by the workers, flb_filter_pool_flush() waits on it */
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    /*
+     * Finished jobs: a lock-free stack filled by the workers and emptied
+     * at once by the engine, the 'ch_done' channel wakes up the engine.
+     */
+    uint64_t done;
+    flb_pipefd_t ch_done[2];
+
+    /* metrics */
+    struct cmt *cmt;
+    struct cmt_counter *cmt_jobs;
+    struct cmt_counter *cmt_records;
+    struct cmt_counter *cmt_busy;
+    struct cmt_gauge *cmt_queue;
+
+    struct flb_config *config;
+};
+
+int flb_filter_pool_create(struct flb_config *config);
+int flb_filter_pool_start(struct flb_config *config);
+void flb_filter_pool_destroy(struct flb_config *config);
+
+int flb_filter_pool_submit(struct flb_filter_pool *pool,
+                           struct flb_input_instance *in,
+                           const char *tag, int tag_len,
+                           const void *buf, size_t size);
+void flb_filter_pool_flush(struct flb_config *config);
+
+#endif
@@ -32,6 +32,7 @@
 #define FLB_HASH_EVICT_OLDER      1
 #define FLB_HASH_EVICT_LESS_USED  2
 #define FLB_HASH_EVICT_RANDOM     3
+#define FLB_HASH_EVICT_LRU        4
 
 struct flb_hash_entry {
     time_t created;
@@ -76,6 +77,7 @@ int flb_hash_get_by_id(struct flb_hash *ht, int id,
                        const char **out_buf, size_t *out_size);
 
 void *flb_hash_get_ptr(struct flb_hash *ht, const char *key, int key_len);
+int flb_hash_exists(struct flb_hash *ht, const char *key, int key_len);
 
 int flb_hash_del(struct flb_hash *ht, const char *key);
 
@@ -34,6 +34,7 @@
 #include <fluent-bit/flb_coro.h>
 #include <fluent-bit/flb_mp.h>
 #include <fluent-bit/flb_hash.h>
+#include <fluent-bit/flb_latency.h>
 
 #ifdef FLB_HAVE_METRICS
 #include <fluent-bit/flb_metrics.h>
@@ -64,6 +65,7 @@
 #define FLB_INPUT_METRICS     1
 
 struct flb_input_instance;
+struct flb_input_thread;
 
 struct flb_input_plugin {
     int flags;                /* plugin flags */
@@ -146,6 +148,8 @@ struct flb_input_instance {
     int log_level;                       /* log level for this plugin    */
     flb_pipefd_t channel[2];             /* pipe(2) channel              */
     int threaded;                        /* bool / Threaded instance ?   */
+    int dedicated_thread;                /* bool / Dedicated thread ?    */
+    struct flb_input_thread *thread;     /* dedicated thread context     */
     char name[32];                       /* numbered name (cpu -> cpu.0) */
     char *alias;                         /* alias name for the instance  */
     void *context;                       /* plugin configuration context */
@@ -184,6 +188,23 @@ struct flb_input_instance {
     /* Type of storage: CIO_STORE_FS (filesystem) or CIO_STORE_MEM (memory) */
     int storage_type;
 
+    /*
+     * Tiered storage ('storage.type tiered'): chunks are created in memory
+     * and moved to the file system once the memory they use crosses
+     * 'storage.spill_limit' bytes.
+     */
+    int storage_tiered;
+    size_t storage_spill_limit;
+
+    /*
+     * Chunk packing: a chunk is locked once it reaches 'chunk.target_size'
+     * bytes. If 'chunk.max_age' is set, smaller chunks are kept open for the
+     * same Tag until they get older than 'chunk.max_age' seconds, and small
+     * chunks of the same Tag are merged before being dispatched.
+     */
+    size_t chunk_target_size;
+    int chunk_max_age;
+
     /*
      * Buffers counter: it count the total of memory used by fixed and dynamic
      * messgage pack buffers used by the input plugin instance.
@@ -221,6 +242,14 @@ struct flb_input_instance {
      */
     int storage_buf_status;
 
+    /*
+     * Define the buffer status while the filter workers are saturated:
+     *
+     * - FLB_INPUT_RUNNING -> can append more data
+     * - FLB_INPUT_PAUSED  -> cannot append data
+     */
+    int filter_buf_status;
+
     /*
      * Optional data passed to the plugin, this info is useful when
      * running Fluent Bit in library mode and the target plugin needs
@@ -255,6 +284,15 @@ struct flb_input_instance {
 
     struct mk_list coros;                /* list of input coros         */
 
+    /*
+     * Filter workers: buffers handed to the workers are numbered so they are
+     * committed to the chunks in the same order they were ingested.
+     */
+    uint64_t filter_seq;                 /* next number to assign       */
+    uint64_t filter_seq_next;            /* next number to commit       */
+    int filter_committing;               /* commit in progress ?        */
+    struct mk_list filter_jobs;          /* finished jobs, by number    */
+
 #ifdef FLB_HAVE_METRICS
 
     /* old metrics API */
@@ -269,6 +307,9 @@ struct flb_input_instance {
     struct cmt_counter *cmt_bytes;       /* metric: input_bytes_total   */
     struct cmt_counter *cmt_records;     /* metric: input_records_total */
 
+    /* Engine profiler: wall time of the collector callbacks */
+    struct flb_latency *cb_latency;
+
     /*
      * Indexes for generated chunks: simple hash tables that keeps the latest
      * available chunks for writing data operations. This optimize the
@@ -522,6 +563,9 @@ static inline int flb_input_buf_paused(struct flb_input_instance *i)
     if (i->storage_buf_status == FLB_INPUT_PAUSED) {
         return FLB_TRUE;
     }
+    if (i->filter_buf_status == FLB_INPUT_PAUSED) {
+        return FLB_TRUE;
+    }
 
     return FLB_FALSE;
 }
@@ -580,7 +624,10 @@ void flb_input_pre_run_all(struct flb_config *config);
 void flb_input_exit_all(struct flb_config *config);
 
 void *flb_input_flush(struct flb_input_instance *ins, size_t *size);
+void flb_input_pause(struct flb_input_instance *ins);
+void flb_input_resume(struct flb_input_instance *ins);
 int flb_input_pause_all(struct flb_config *config);
+struct mk_event_loop *flb_input_event_loop(struct flb_input_instance *ins);
 const char *flb_input_name(struct flb_input_instance *ins);
 int flb_input_name_exists(const char *name, struct flb_config *config);
 
@@ -26,6 +26,7 @@
 #include <fluent-bit/flb_routes_mask.h>
 #include <monkey/mk_core.h>
 #include <msgpack.h>
+#include <time.h>
 
 /*
  * This variable defines a 'hint' size for new Chunks created, this
@@ -55,17 +56,19 @@ struct flb_input_chunk {
     int busy;                       /* buffer is being flushed  */
     int fs_backlog;                 /* chunk originated from fs backlog */
     int sp_done;                    /* sp already processed this chunk */
+    int task_delayed;               /* no task ID was available */
 #ifdef FLB_HAVE_METRICS
     int total_records;              /* total records in the chunk */
     int added_records;              /* recently added records */
 #endif
     void *chunk;                    /* context of struct cio_chunk */
+    size_t spill_up_size;           /* bytes counted in the spill tier usage */
     off_t stream_off;               /* stream offset */
+    time_t create_time;             /* chunk creation time */
     msgpack_packer mp_pck;          /* msgpack packer */
     struct flb_input_instance *in;  /* reference to parent input instance */
     struct flb_task *task;          /* reference to the outgoing task */
-    uint64_t routes_mask
-        [FLB_ROUTES_MASK_ELEMENTS]; /* track the output plugins the chunk routes to */
+    uint64_t *routes_mask;          /* track the output plugins the chunk routes to */
     struct mk_list _head;
 };
 
@@ -82,6 +85,13 @@ int flb_input_chunk_append_obj(struct flb_input_instance *in,
 int flb_input_chunk_append_raw(struct flb_input_instance *in,
                                const char *tag, size_t tag_len,
                                const void *buf, size_t buf_size);
+int flb_input_chunk_append_filtered(struct flb_input_instance *in,
+                                    const char *tag, size_t tag_len,
+                                    const void *buf, size_t buf_size,
+                                    int filtered);
+int flb_input_chunk_append_queued(struct flb_input_instance *in,
+                                  const char *tag, size_t tag_len,
+                                  const void *buf, size_t buf_size);
 const void *flb_input_chunk_flush(struct flb_input_chunk *ic, size_t *size);
 int flb_input_chunk_release_lock(struct flb_input_chunk *ic);
 flb_sds_t flb_input_chunk_get_name(struct flb_input_chunk *ic);
@@ -99,6 +109,10 @@ int flb_input_chunk_set_up_down(struct flb_input_chunk *ic);
 int flb_input_chunk_set_up(struct flb_input_chunk *ic);
 int flb_input_chunk_down(struct flb_input_chunk *ic);
 int flb_input_chunk_is_up(struct flb_input_chunk *ic);
+int flb_input_chunk_is_spillable(struct flb_input_chunk *ic);
+int flb_input_chunk_spill(struct flb_input_chunk *ic);
+int flb_input_chunk_is_ready(struct flb_input_chunk *ic, time_t now);
+int flb_input_chunk_coalesce(struct flb_input_instance *in);
 void flb_input_chunk_update_output_instances(struct flb_input_chunk *ic,
                                              size_t chunk_size);
 
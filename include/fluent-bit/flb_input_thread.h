@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_INPUT_THREAD_H
+#define FLB_INPUT_THREAD_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pthread.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_latency.h>
+#include <fluent-bit/flb_thread_pool.h>
+#include <monkey/mk_core.h>
+
+/* Messages sent by the engine to an input thread */
+#define FLB_INPUT_THREAD_START     1   /* register the collectors  */
+#define FLB_INPUT_THREAD_PAUSE     2   /* invoke cb_pause()        */
+#define FLB_INPUT_THREAD_RESUME    3   /* invoke cb_resume()       */
+#define FLB_INPUT_THREAD_STOP      4   /* invoke cb_exit() and end */
+
+/* Default limit of bytes queued by a thread before it blocks */
+#define FLB_INPUT_THREAD_QUEUE_MAX (8 * 1024 * 1024)
+
+struct flb_input_instance;
+
+/* A buffer appended by an input thread, waiting for the engine */
+struct flb_input_thread_msg {
+    flb_sds_t tag;
+    char *buf;
+    size_t size;
+    struct flb_input_instance *in;
+    struct mk_list _head;                  /* link to th->msgs          */
+};
+
+struct flb_input_thread {
+    struct mk_event event;                 /* engine: new messages      */
+    struct mk_event event_ctl;             /* thread: engine requests   */
+
+    struct mk_event_loop *evl;             /* thread event loop         */
+    struct flb_sched *sched;               /* thread scheduler          */
+
+    flb_pipefd_t ch_msgs[2];               /* thread -> engine          */
+    flb_pipefd_t ch_ctl[2];                /* engine -> thread          */
+
+    /*
+     * Pending messages: the thread links the buffers and notifies the
+     * engine only when the list was empty, the engine takes them all at
+     * once. The thread blocks while 'queued' is over 'queue_max'.
+     */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct mk_list msgs;
+    size_t queued;
+    size_t queue_max;
+
+    /*
+     * Collector samples taken by the thread, also guarded by 'mutex'. The
+     * engine moves them to the instance histogram when it drains the queue
+     * or reads the metrics.
+     */
+    struct flb_latency *latency;
+
+    int init_done;                         /* cb_init() has returned    */
+    int init_ret;                          /* cb_init() return value    */
+    int running;                           /* collectors started ?      */
+    int stopping;
+
+    struct flb_tp *tp;
+    struct flb_tp_thread *th;
+    struct flb_input_instance *ins;
+    struct flb_config *config;
+};
+
+int flb_input_thread_init(struct flb_input_instance *ins,
+                          struct flb_config *config);
+int flb_input_thread_collectors_start(struct flb_input_instance *ins);
+int flb_input_thread_signal(struct flb_input_instance *ins, uint64_t msg);
+void flb_input_thread_destroy(struct flb_input_instance *ins);
+void flb_input_thread_exit_all(struct flb_config *config);
+void flb_input_thread_latency_sync(struct flb_input_instance *ins);
+
+struct flb_input_thread *flb_input_thread_get();
+int flb_input_thread_append(struct flb_input_thread *th,
+                            struct flb_input_instance *in,
+                            const char *tag, size_t tag_len,
+                            const void *buf, size_t size);
+
+#endif
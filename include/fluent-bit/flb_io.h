@@ -42,11 +42,17 @@
 /* Other features */
 #define FLB_IO_IPV6       32  /* network I/O uses IPv6                  */
 
+/* Max number of buffers written with a single writev(2) */
+#define FLB_IO_IOV_MAX    16
+
 int flb_io_net_connect(struct flb_upstream_conn *u_conn,
                        struct flb_coro *th);
 
 int flb_io_net_write(struct flb_upstream_conn *u, const void *data,
                      size_t len, size_t *out_len);
+int flb_io_net_writev(struct flb_upstream_conn *u_conn,
+                      const struct mk_iovec *iov, int iovcnt,
+                      size_t *out_len);
 ssize_t flb_io_net_read(struct flb_upstream_conn *u, void *buf, size_t len);
 
 #endif
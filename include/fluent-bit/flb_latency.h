@@ -0,0 +1,71 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_LATENCY_H
+#define FLB_LATENCY_H
+
+#include <fluent-bit/flb_info.h>
+#include <stdint.h>
+
+/*
+ * Latency histogram
+ * -----------------
+ * Wall time of the callbacks that run in the engine thread, in microseconds.
+ * Buckets are log-linear like in HDR histograms: values under 32us have
+ * their own bucket, larger values are grouped in 16 sub-buckets per power of
+ * two (relative error under 6.25%) up to 2^41us. Adding a value is O(1) and
+ * the histogram has a fixed size, quantiles are computed when the metrics
+ * are exported.
+ */
+#define FLB_LATENCY_LINEAR      32
+#define FLB_LATENCY_SUB_BITS    4
+#define FLB_LATENCY_SUB         (1 << FLB_LATENCY_SUB_BITS)
+#define FLB_LATENCY_MAX_BIT     40
+#define FLB_LATENCY_BUCKETS     (FLB_LATENCY_LINEAR +                  \
+                                 (FLB_LATENCY_MAX_BIT - 4) * FLB_LATENCY_SUB)
+
+/* Default stall threshold in milliseconds ('engine.stall_threshold') */
+#define FLB_LATENCY_STALL_MS    500
+#define FLB_LATENCY_STALL_USEC(ms)  ((ms) > 0 ? (uint64_t) (ms) * 1000 : 0)
+
+struct flb_latency {
+    uint64_t count;           /* number of samples */
+    uint64_t max;             /* highest sample */
+    uint64_t stalls;          /* samples over the stall threshold */
+    uint32_t buckets[FLB_LATENCY_BUCKETS];
+};
+
+struct flb_latency *flb_latency_create();
+void flb_latency_destroy(struct flb_latency *lat);
+uint64_t flb_latency_now();
+int flb_latency_add(struct flb_latency *lat, uint64_t usec,
+                    uint64_t stall_usec);
+void flb_latency_merge(struct flb_latency *dst, struct flb_latency *src);
+uint64_t flb_latency_quantile(struct flb_latency *lat, double q);
+
+#ifdef FLB_HAVE_METRICS
+#include <fluent-bit/flb_metrics.h>
+
+int flb_latency_metrics_add(struct flb_metrics *metrics);
+void flb_latency_metrics_set(struct flb_latency *lat,
+                             struct flb_metrics *metrics);
+#endif
+
+#endif
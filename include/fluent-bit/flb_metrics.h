@@ -54,6 +54,12 @@
 #define FLB_METRIC_OUT_DROPPED_RECORDS 15       /* dropped_records_total */
 #define FLB_METRIC_OUT_RETRIED_RECORDS 16       /* retried_records_total */
 
+/* Callback latency in the engine thread (inputs and outputs) */
+#define FLB_METRIC_CB_P50              20       /* cb_p50_usec    */
+#define FLB_METRIC_CB_P99              21       /* cb_p99_usec    */
+#define FLB_METRIC_CB_MAX              22       /* cb_max_usec    */
+#define FLB_METRIC_CB_STALLS           23       /* cb_stalls      */
+
 struct flb_metric {
     int id;
     int title_len;
@@ -339,6 +339,9 @@ struct flb_output_instance {
     struct flb_metrics *metrics;         /* metrics                      */
 #endif
 
+    /* Engine profiler: wall time of the flush callbacks */
+    struct flb_latency *cb_latency;
+
     /* Callbacks context */
     struct flb_callback *callback;
 
@@ -365,6 +368,15 @@ struct flb_output_instance {
      */
     size_t total_limit_size;
 
+    /*
+     * Flush batching: when 'batch.size' is set, the ready chunks of the same
+     * Tag routed to this instance are merged before dispatch, up to that
+     * many bytes (and 'batch.records' records if set), so a single flush
+     * carries the content of several chunks.
+     */
+    size_t batch_size;
+    int batch_records;
+
     /* Thread Pool: this is optional for the caller */
     int tp_workers;
     struct flb_tp *tp;
@@ -49,6 +49,8 @@
 #define FLB_PACK_JSON_FORMAT_STREAM      2
 #define FLB_PACK_JSON_FORMAT_LINES       3
 
+struct flb_config;
+
 struct flb_pack_state {
     int multiple;         /* support multiple jsons? */
     int tokens_count;     /* number of parsed tokens */
@@ -58,9 +60,11 @@ struct flb_pack_state {
     jsmn_parser parser;   /* parser state              */
     char *buf_data;       /* temporary buffer           */
     size_t buf_size;      /* temporary buffer size      */
-    size_t buf_len;       /* temporary buffer length    */
+    size_t buf_len;       /* incomplete data validated  */
 };
 
+/* process-wide JSON encoder options, set once from the first config */
+int flb_pack_init(struct flb_config *config);
 int flb_json_tokenise(const char *js, size_t len, struct flb_pack_state *state);
 
 
@@ -74,6 +78,14 @@ void flb_pack_state_reset(struct flb_pack_state *s);
 int flb_pack_json_state(const char *js, size_t len,
                         char **buffer, int *size,
                         struct flb_pack_state *state);
+
+/* JSON to msgpack parser (flb_pack_json.c) */
+int flb_pack_json_msgpack(struct flb_pack_state *state,
+                          const char *js, size_t len, int partial,
+                          char **out_buf, size_t *out_size,
+                          int *root_type, int *out_records, int *last_byte);
+int flb_pack_json_scan(struct flb_pack_state *state, const char *js,
+                       size_t len);
 int flb_pack_json_valid(const char *json, size_t len);
 
 flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
@@ -39,6 +39,9 @@ struct flb_parser_types {
     int type;
 };
 
+/* Compiled time format (flb_parser_time.c) */
+struct flb_parser_time;
+
 struct flb_parser {
     /* configuration */
     int type;             /* parser type */
@@ -61,6 +64,7 @@ struct flb_parser {
     int time_with_year;   /* do time_fmt consider a year (%Y) ? */
     char *time_fmt_year;
     int time_with_tz;     /* do time_fmt consider a timezone ?  */
+    struct flb_parser_time *time_fast; /* compiled time_fmt, if supported */
     struct flb_regex *regex;
     struct mk_list _head;
 };
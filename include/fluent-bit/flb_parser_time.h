@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_PARSER_TIME_H
+#define FLB_PARSER_TIME_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_parser.h>
+
+#include <time.h>
+
+/* Compiled time formats, used by flb_parser_time_lookup() */
+int flb_parser_time_compile(struct flb_parser *parser);
+void flb_parser_time_destroy(struct flb_parser_time *pt);
+int flb_parser_time_fast(struct flb_parser *parser,
+                         const char *str, size_t len, time_t now,
+                         struct tm *tm, double *ns);
+
+#endif
@@ -24,6 +24,42 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_routes_mask.h>
+
+/* Default number of Tags in the router cache */
+#define FLB_ROUTER_CACHE_SIZE   1024
+
+struct flb_hash;
+struct flb_router_matcher;
+struct flb_filter_instance;
+
+/*
+ * Router cache entry: the result of matching a Tag against every filter and
+ * output instance. 'data' holds the routes mask (routes_size elements)
+ * followed by the matching filters, in the same order they run.
+ */
+struct flb_router_cache_entry {
+    int has_routes;
+    int routes_size;
+    int n_filters;
+    uint64_t data[];
+};
+
+#define flb_router_cache_routes(e)    ((e)->data)
+#define flb_router_cache_filters(e)                                     \
+    ((struct flb_filter_instance **) ((e)->data + (e)->routes_size))
+
+struct flb_router_cache {
+    struct flb_hash *ht;                    /* tag => entry, LRU eviction */
+    struct flb_router_cache_entry *scratch; /* last result, no caching    */
+
+    /* compiled match rules */
+    int n_filters;
+    struct flb_filter_instance **filters;   /* by matcher id (position)   */
+    uint64_t *filters_mask;
+    struct flb_router_matcher *filters_matcher;
+    struct flb_router_matcher *outputs_matcher;  /* by output id          */
+};
 
 struct flb_router_path {
     struct flb_output_instance *ins;
@@ -54,4 +90,9 @@ int flb_router_match(const char *tag, int tag_len,
                      const char *match, void *match_regex);
 int flb_router_io_set(struct flb_config *config);
 void flb_router_exit(struct flb_config *config);
+
+struct flb_router_cache_entry *flb_router_cache_get(struct flb_config *config,
+                                                    const char *tag,
+                                                    int tag_len);
+void flb_router_cache_invalidate(struct flb_config *config);
 #endif
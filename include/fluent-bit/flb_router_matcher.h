@@ -0,0 +1,87 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_ROUTER_MATCHER_H
+#define FLB_ROUTER_MATCHER_H
+
+#include <fluent-bit/flb_info.h>
+#include <monkey/mk_core.h>
+
+#include <stdint.h>
+
+/*
+ * Compiled Tag matcher: all the wildcard patterns are merged in a trie where
+ * '*' is an edge that loops on any character. Matching a Tag walks a DFA
+ * built lazily from the trie, so every Tag is scanned once no matter how
+ * many patterns were added. The result is a bitmask where each bit is the
+ * id given to a pattern (e.g: the output instance id for routes masks).
+ *
+ * Regex patterns cannot be merged and are still evaluated one by one.
+ *
+ * A matcher is not thread safe: matching updates the DFA.
+ */
+
+/* DFA states kept before the matcher flushes them */
+#define FLB_ROUTER_MATCHER_MAX_STATES    4096
+
+struct flb_router_matcher_node;
+struct flb_router_matcher_state;
+
+struct flb_router_matcher_regex {
+    int id;
+    void *regex;                                /* struct flb_regex */
+    struct mk_list _head;
+};
+
+struct flb_router_matcher {
+    int words;                                  /* mask size in uint64_t */
+
+    /* trie */
+    int n_nodes;
+    int size_nodes;
+    struct flb_router_matcher_node *nodes;
+
+    /* characters used by the patterns, any other one is class 0 */
+    int n_classes;
+    uint16_t classes[256];
+
+    /* lazy DFA */
+    int n_states;
+    struct flb_router_matcher_state *start;
+    struct flb_router_matcher_state **table;    /* states hash table */
+    struct mk_list states;
+
+    /* scratch space to compute DFA transitions */
+    int *buf;
+    uint32_t *marks;
+    uint32_t gen;
+
+    struct mk_list regex;
+};
+
+struct flb_router_matcher *flb_router_matcher_create(int max_id);
+void flb_router_matcher_destroy(struct flb_router_matcher *m);
+
+int flb_router_matcher_add(struct flb_router_matcher *m, int id,
+                           const char *pattern, void *regex);
+int flb_router_matcher_match(struct flb_router_matcher *m,
+                             const char *tag, int tag_len, uint64_t *mask);
+
+#endif
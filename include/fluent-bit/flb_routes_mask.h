@@ -27,6 +27,7 @@
 #define FLB_ROUTES_MASK_H
 
 #include <limits.h>
+#include <stdint.h>
 
 /*
  * The routing mask is an array integers used to store a bitfield. Each
@@ -36,31 +37,40 @@
  * A value of 1 in the bitfield means that output plugin is selected
  * and a value of zero means that output is deselected.
  *
- * The size of the bitmask array limits the number of output plugins
- * The router can route to. For example: with a value of 4 using
- * 64-bit integers the bitmask can represent up to 256 output plugins
+ * The size of the array (config->routes_mask_size) is set when the engine
+ * starts, from the highest output instance id, so there is no limit in the
+ * number of outputs and a chunk only carries the elements it needs.
  */
-#define FLB_ROUTES_MASK_ELEMENTS		4
 
 /*
  * How many bits are in each element of the bitmask array
  */
-#define FLB_ROUTES_MASK_ELEMENT_BITS 	(sizeof(uint64_t) * CHAR_BIT)
+#define FLB_ROUTES_MASK_ELEMENT_BITS    (sizeof(uint64_t) * CHAR_BIT)
+
+/*
+ * Size of the array until the engine sets it: 64 output plugins
+ */
+#define FLB_ROUTES_MASK_DEFAULT_SIZE    1
 
 /*
  * The maximum number of routes that can be stored in the array
  */
-#define FLB_ROUTES_MASK_MAX_VALUE		(FLB_ROUTES_MASK_ELEMENTS * FLB_ROUTES_MASK_ELEMENT_BITS)
+#define FLB_ROUTES_MASK_MAX_VALUE(c)    ((c)->routes_mask_size * FLB_ROUTES_MASK_ELEMENT_BITS)
+
+/* Size of the array in bytes */
+#define FLB_ROUTES_MASK_BYTES(c)        ((c)->routes_mask_size * sizeof(uint64_t))
 
 
 /* forward declaration */
+struct flb_config;
 struct flb_input_instance;
 
 
+void flb_routes_mask_set_size(struct flb_config *config);
 int flb_routes_mask_set_by_tag(uint64_t *routes_mask, const char *tag, int tag_len, struct flb_input_instance *in);
-int flb_routes_mask_get_bit(uint64_t *routes_mask, int value);
-void flb_routes_mask_set_bit(uint64_t *routes_mask, int value);
-void flb_routes_mask_clear_bit(uint64_t *routes_mask, int value);
-int flb_routes_mask_is_empty(uint64_t *routes_mask);
+int flb_routes_mask_get_bit(uint64_t *routes_mask, int value, struct flb_config *config);
+void flb_routes_mask_set_bit(uint64_t *routes_mask, int value, struct flb_config *config);
+void flb_routes_mask_clear_bit(uint64_t *routes_mask, int value, struct flb_config *config);
+int flb_routes_mask_is_empty(uint64_t *routes_mask, struct flb_config *config);
 
 #endif
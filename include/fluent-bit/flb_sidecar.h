@@ -0,0 +1,104 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_SIDECAR_H
+#define FLB_SIDECAR_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_upstream.h>
+
+#include <time.h>
+
+/*
+ * Sidecar client: a small request/reply client used by the enrichment
+ * filters to talk to a local helper service. Every instance owns its own
+ * upstream (keepalive connection pool) and its own circuit breaker, so
+ * multiple filter instances never share a socket.
+ *
+ * Two protocols are supported:
+ *
+ * - line: the request is a single line and the reply is whatever the
+ *   sidecar writes back in one read.
+ *
+ * - batch: the request is a 32 bits big-endian record count followed by
+ *   each record prefixed with its 32 bits big-endian length. The reply is
+ *   one length prefixed entry per record, in the same order.
+ */
+
+#define FLB_SIDECAR_FRAME_HEADER    4
+#define FLB_SIDECAR_MAX_REPLY       (64 * 1024)
+
+/* Attempts per request, a stale keepalive connection costs one of them */
+#define FLB_SIDECAR_RETRIES         2
+
+/* Circuit breaker defaults */
+#define FLB_SIDECAR_MAX_FAILURES    3
+#define FLB_SIDECAR_BACKOFF_BASE    1     /* seconds */
+#define FLB_SIDECAR_BACKOFF_MAX     60    /* seconds */
+
+/* Circuit breaker states */
+#define FLB_SIDECAR_CLOSED          0     /* requests flow normally     */
+#define FLB_SIDECAR_OPEN            1     /* requests are short-circuited */
+#define FLB_SIDECAR_HALF_OPEN       2     /* a single probe is allowed  */
+
+struct flb_sidecar {
+    char *name;                   /* owner name, used for logging   */
+    struct flb_upstream *u;       /* per instance connection pool   */
+
+    /* circuit breaker */
+    int state;
+    int failures;                 /* consecutive failures           */
+    int max_failures;             /* failures that open the circuit */
+    int backoff;                  /* current backoff in seconds     */
+    int backoff_base;
+    int backoff_max;
+    time_t retry_at;              /* when an open circuit may probe */
+
+    struct flb_config *config;
+};
+
+/* A batch request being composed */
+struct flb_sidecar_batch {
+    int count;
+    flb_sds_t buf;
+};
+
+struct flb_sidecar *flb_sidecar_create(struct flb_config *config,
+                                       const char *name,
+                                       const char *host, int port);
+void flb_sidecar_destroy(struct flb_sidecar *sc);
+
+int flb_sidecar_available(struct flb_sidecar *sc);
+
+int flb_sidecar_request(struct flb_sidecar *sc,
+                        const char *buf, size_t len,
+                        char *out, size_t out_size, size_t *out_len);
+
+int flb_sidecar_batch_init(struct flb_sidecar_batch *batch, size_t size);
+int flb_sidecar_batch_append(struct flb_sidecar_batch *batch,
+                             const char *data, size_t len);
+int flb_sidecar_batch_request(struct flb_sidecar *sc,
+                              struct flb_sidecar_batch *batch,
+                              flb_sds_t *replies);
+void flb_sidecar_batch_destroy(struct flb_sidecar_batch *batch);
+void flb_sidecar_replies_destroy(flb_sds_t *replies, int count);
+
+#endif
@@ -27,6 +27,7 @@
 
 #define FLB_STORAGE_BL_MEM_LIMIT   "100M"
 #define FLB_STORAGE_MAX_CHUNKS_UP  128
+#define FLB_STORAGE_SPILL_LIMIT    (32 * 1024 * 1024)
 
 struct flb_storage_metrics {
     int fd;
@@ -42,13 +43,23 @@ struct flb_storage_input {
     int type;                   /* CIO_STORE_FS | CIO_STORE_MEM */
     struct cio_stream *stream;
     struct cio_ctx *cio;
+
+    /* tiered storage: file system stream for the spilled chunks */
+    struct cio_stream *spill_stream;
+    size_t spill_limit;         /* memory watermark */
+    size_t spill_up_size;       /* bytes of the spilled chunks that are up */
+    uint64_t spilled;           /* chunks moved to the file system */
+    uint64_t promoted;          /* spilled chunks put up again */
 };
 
 int flb_storage_create(struct flb_config *ctx);
 int flb_storage_input_create(struct cio_ctx *cio,
                              struct flb_input_instance *in);
 void flb_storage_destroy(struct flb_config *ctx);
+int flb_storage_flush(struct flb_config *ctx);
+double flb_storage_elapsed(struct flb_config *ctx);
 void flb_storage_input_destroy(struct flb_input_instance *in);
+void flb_storage_tiers_balance(struct flb_config *ctx);
 
 struct flb_storage_metrics *flb_storage_metrics_create(struct flb_config *ctx);
 
@@ -89,6 +89,12 @@ struct flb_task {
     struct flb_config *config;           /* parent flb config             */
 };
 
+int flb_task_map_create(struct flb_config *config);
+void flb_task_map_destroy(struct flb_config *config);
+int flb_task_map_used(struct flb_config *config);
+int flb_task_map_get_id(struct flb_config *config);
+void flb_task_map_free_id(int id, struct flb_config *config);
+
 int flb_task_running_count(struct flb_config *config);
 int flb_task_running_print(struct flb_config *config);
 
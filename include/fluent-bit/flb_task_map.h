@@ -23,6 +23,16 @@
 
 #include <inttypes.h>
 
+/*
+ * Number of bits available for a task ID in the engine task events (see
+ * FLB_TASK_SET() in flb_task.h), it sets the hard limit of the tasks map.
+ */
+#define FLB_TASK_ID_BITS   14
+#define FLB_TASK_MAP_MAX   (1 << FLB_TASK_ID_BITS)
+
+/* Default number of concurrent tasks */
+#define FLB_TASK_MAP_SIZE  2048
+
 struct flb_task_map {
     void    *task;
 };
@@ -0,0 +1,47 @@
+/**
+ * \file
+ * CRC32C (Castagnoli) for chunk checksums, see crc32c.c.
+ *
+ * The init and finalize steps are the same as the ones of crc32.h, only
+ * the polynomial differs.
+ */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "crc32.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+static inline crc_t crc32c_init(void)
+{
+    return 0xffffffff;
+}
+
+
+/* hardware accelerated when available */
+crc_t crc32c_update(crc_t crc, const void *data, size_t data_len);
+
+/* table-driven version, always available */
+crc_t crc32c_update_sw(crc_t crc, const void *data, size_t data_len);
+
+/* returns 1 if crc32c_update() uses a CPU instruction */
+int crc32c_hw_available(void);
+
+
+static inline crc_t crc32c_finalize(crc_t crc)
+{
+    return crc ^ 0xffffffff;
+}
+
+
+#ifdef __cplusplus
+}           /* closing brace for extern "C" */
+#endif
+
+#endif      /* CRC32C_H */
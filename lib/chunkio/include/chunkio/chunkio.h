@@ -36,6 +36,7 @@
 /* Storage backend */
 #define CIO_STORE_FS        0
 #define CIO_STORE_MEM       1
+#define CIO_STORE_WAL       2   /* file system streams when CIO_WAL is set */
 
 /* flags */
 #define CIO_OPEN            1         /* open/create file reference */
@@ -43,6 +44,10 @@
 #define CIO_OPEN_RD         2         /* open and read/mmap content if exists */
 #define CIO_CHECKSUM        4         /* enable checksum verification (crc32) */
 #define CIO_FULL_SYNC       8         /* force sync to fs through MAP_SYNC */
+#define CIO_COMPRESS       16         /* compress locked chunks content     */
+#define CIO_WAL            32         /* store fs chunks in a write-ahead log */
+#define CIO_LAZY_LOAD      64         /* cio_load() reads chunk headers only */
+#define CIO_CRC32C        128         /* checksum new chunks with crc32c    */
 
 /* Return status */
 #define CIO_CORRUPTED      -3         /* Indicate that a chunk is corrupted */
@@ -79,6 +84,9 @@ struct cio_ctx {
 
     /* streams */
     struct mk_list streams;
+
+    /* write-ahead log context (CIO_WAL) */
+    struct cio_wal *wal;
 };
 
 #include <chunkio/cio_stream.h>
@@ -89,6 +97,7 @@ struct cio_ctx *cio_create(const char *root_path,
 void cio_destroy(struct cio_ctx *ctx);
 int cio_load(struct cio_ctx *ctx, char *chunk_extension);
 int cio_qsort(struct cio_ctx *ctx, int (*compar)(const void *, const void *));
+int cio_flush(struct cio_ctx *ctx);
 
 void cio_set_log_callback(struct cio_ctx *ctx, void (*log_cb));
 int cio_set_log_level(struct cio_ctx *ctx, int level);
@@ -21,9 +21,15 @@
 #define CIO_CRC32_H
 
 #include <crc32/crc32.h>
+#include <crc32/crc32c.h>
 
 #define cio_crc32_init()            crc_init()
 #define cio_crc32_update(a, b, c)   crc_update(a, b, c)
 #define cio_crc32_finalize(a)       crc_finalize(a)
 
+/* CRC32C (Castagnoli), hardware accelerated when the CPU supports it */
+#define cio_crc32c_init()           crc32c_init()
+#define cio_crc32c_update(a, b, c)  crc32c_update(a, b, c)
+#define cio_crc32c_finalize(a)      crc32c_finalize(a)
+
 #endif
@@ -43,9 +43,15 @@ struct cio_file {
     char *st_content;
     crc_t crc_cur;            /* crc: current value calculated */
     int crc_reset;            /* crc: must recalculate from the beginning ? */
+    int crc32c;               /* crc: crc32c instead of crc32 ? */
+
+    /* metadata read by cio_file_read_header(), only while not mapped */
+    char *hdr_meta;
+    int hdr_meta_len;
 };
 
 size_t cio_file_real_size(struct cio_file *cf);
+int cio_file_read_header(struct cio_file *cf);
 struct cio_file *cio_file_open(struct cio_ctx *ctx,
                                struct cio_stream *st,
                                struct cio_chunk *ch,
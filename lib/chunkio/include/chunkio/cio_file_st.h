@@ -28,6 +28,11 @@
  *
  * - 2 first bytes as identification: 0xC1 0x00
  * - 4 bytes for checksum of content section (CRC32)
+ * - 1 byte of flags at offset 10 (the checksum is stored from a crc_t that
+ *   may use the first padding bytes), CIO_FILE_ST_COMPRESSED is set when the
+ *   user data is stored compressed (snappy). The checksum always covers the
+ *   content as it is stored. CIO_FILE_ST_CRC32C is set when the checksum
+ *   uses the CRC32C (Castagnoli) polynomial instead of CRC32.
  * - Content section is composed by:
  *   - 2 bytes to specify the length of metadata
  *   - optional metadata
@@ -59,6 +64,11 @@
 #define CIO_FILE_ID_01          0x00    /* header: second byte */
 #define CIO_FILE_HEADER_MIN       24    /* 24 bytes for the header */
 #define CIO_FILE_CONTENT_OFFSET   22
+#define CIO_FILE_FLAGS_OFFSET     10
+
+/* header flags */
+#define CIO_FILE_ST_COMPRESSED  0x01    /* user data compressed (snappy) */
+#define CIO_FILE_ST_CRC32C      0x02    /* checksum is crc32c, not crc32 */
 
 /* Return pointer to hash position */
 static inline char *cio_file_st_get_hash(char *map)
@@ -66,6 +76,18 @@ static inline char *cio_file_st_get_hash(char *map)
     return map + 2;
 }
 
+/* Return header flags */
+static inline uint8_t cio_file_st_get_flags(char *map)
+{
+    return (uint8_t) map[CIO_FILE_FLAGS_OFFSET];
+}
+
+/* Set header flags */
+static inline void cio_file_st_set_flags(char *map, uint8_t flags)
+{
+    map[CIO_FILE_FLAGS_OFFSET] = flags;
+}
+
 /* Return metadata length */
 static inline uint16_t cio_file_st_get_meta_len(char *map)
 {
@@ -0,0 +1,178 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CIO_WAL_H
+#define CIO_WAL_H
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_stream.h>
+#include <chunkio/cio_chunk.h>
+#include <chunkio/cio_crc32.h>
+
+/*
+ * Write-ahead log backend
+ * -----------------------
+ * When the context is created with CIO_WAL, file system streams do not get
+ * a directory with one file per chunk. Every chunk operation of every
+ * stream is appended as a record to a shared segment file
+ * (root_path/wal-NNNNNNNN.log):
+ *
+ *   +--------+--------+------+-------+----------+-------------+-------+
+ *   | 0xC1   | 0x57   | type | flags | chunk id | payload len | crc32 |
+ *   +--------+--------+------+-------+----------+-------------+-------+
+ *   |   1    |   1    |  1   |   1   |    4     |      4      |   4   |
+ *   +--------+--------+------+-------+----------+-------------+-------+
+ *   | payload ...                                                     |
+ *   +-----------------------------------------------------------------+
+ *
+ * Records are staged in memory and written with a single writev(2) per
+ * group commit, followed by fdatasync(2) when CIO_FULL_SYNC is set. When a
+ * segment is rotated an index file (wal-NNNNNNNN.idx) with the record
+ * headers and the small payloads is written next to it, so a restart only
+ * reads the indexes instead of the chunks content. Segments are deleted
+ * once every chunk that has records on them has been deleted.
+ */
+
+#define CIO_WAL_MAGIC_1         0xC1
+#define CIO_WAL_MAGIC_2         0x57
+#define CIO_WAL_HEADER_SIZE     16
+
+/* record types */
+#define CIO_WAL_REC_CREATE      1  /* stream and chunk names         */
+#define CIO_WAL_REC_DATA        2  /* appended content                */
+#define CIO_WAL_REC_TRUNCATE    3  /* content length set to a value   */
+#define CIO_WAL_REC_META        4  /* metadata replaced               */
+#define CIO_WAL_REC_DELETE      5  /* chunk deleted, no payload       */
+
+/* record flags */
+#define CIO_WAL_REC_CRC         1  /* crc32 field is set              */
+#define CIO_WAL_REC_CRC32C      2  /* crc32 field is a crc32c         */
+
+/* limits */
+#define CIO_WAL_SEGMENT_SIZE    (64 * 1024 * 1024) /* rotate segment      */
+#define CIO_WAL_BATCH_SIZE      (256 * 1024)       /* group commit size   */
+#define CIO_WAL_DIRECT_SIZE     (64 * 1024)        /* writev() payload    */
+#define CIO_WAL_READ_SPAN       (1024 * 1024)      /* pread() coalescing  */
+#define CIO_WAL_COMPACT         8   /* sealed segments before compaction */
+
+/* A piece of content stored in a segment */
+struct cio_wal_extent {
+    uint32_t seg;             /* segment id */
+    uint32_t len;             /* bytes used from the record payload */
+    uint32_t rec_len;         /* record payload length */
+    uint32_t crc;             /* record crc32 (if CIO_WAL_REC_CRC) */
+    int flags;                /* record flags */
+    off_t offset;             /* payload offset inside the segment */
+};
+
+struct cio_wal_chunk {
+    uint32_t id;              /* chunk id in the log */
+    int up;                   /* content loaded in memory ? */
+    crc_t crc_cur;            /* un-finalized checksum (transactions) */
+    size_t size;              /* content length */
+
+    /* content-data, only while the chunk is up */
+    char *buf_data;
+    size_t buf_size;
+    size_t realloc_size;
+
+    /* metadata, always in memory */
+    char *meta_data;
+    int meta_len;
+
+    /* content location in the segments */
+    struct cio_wal_extent *ext;
+    int ext_count;
+    int ext_size;
+
+    /* segments holding records of this chunk */
+    uint32_t *segs;
+    int segs_count;
+    int segs_size;
+};
+
+#ifdef CIO_HAVE_WAL
+
+int cio_wal_init(struct cio_ctx *ctx);
+void cio_wal_destroy(struct cio_ctx *ctx);
+int cio_wal_load(struct cio_ctx *ctx);
+int cio_wal_flush(struct cio_ctx *ctx);
+
+struct cio_wal_chunk *cio_wal_open(struct cio_ctx *ctx, struct cio_stream *st,
+                                   struct cio_chunk *ch, int flags,
+                                   size_t size, int *err);
+void cio_wal_close(struct cio_chunk *ch, int delete);
+int cio_wal_write(struct cio_chunk *ch, const void *buf, size_t count);
+int cio_wal_write_at(struct cio_chunk *ch, off_t offset,
+                     const void *buf, size_t count);
+int cio_wal_write_metadata(struct cio_chunk *ch, char *buf, size_t size);
+int cio_wal_sync(struct cio_chunk *ch);
+int cio_wal_read_prepare(struct cio_ctx *ctx, struct cio_chunk *ch);
+int cio_wal_content_copy(struct cio_chunk *ch,
+                         void **out_buf, size_t *out_size);
+int cio_wal_is_up(struct cio_chunk *ch);
+int cio_wal_up(struct cio_chunk *ch);
+int cio_wal_up_force(struct cio_chunk *ch);
+int cio_wal_down(struct cio_chunk *ch);
+void cio_wal_scan_dump(struct cio_ctx *ctx, struct cio_stream *st);
+
+#else
+
+/* CIO_STORE_WAL streams cannot be created, keep the dispatchers linking */
+static inline int cio_wal_init(struct cio_ctx *ctx) { return -1; }
+static inline void cio_wal_destroy(struct cio_ctx *ctx) { }
+static inline int cio_wal_load(struct cio_ctx *ctx) { return -1; }
+static inline int cio_wal_flush(struct cio_ctx *ctx) { return 0; }
+static inline struct cio_wal_chunk *cio_wal_open(struct cio_ctx *ctx,
+                                                 struct cio_stream *st,
+                                                 struct cio_chunk *ch,
+                                                 int flags, size_t size,
+                                                 int *err)
+{
+    *err = CIO_ERROR;
+    return NULL;
+}
+static inline void cio_wal_close(struct cio_chunk *ch, int delete) { }
+static inline int cio_wal_write(struct cio_chunk *ch, const void *buf,
+                                size_t count) { return -1; }
+static inline int cio_wal_write_at(struct cio_chunk *ch, off_t offset,
+                                   const void *buf, size_t count)
+{
+    return -1;
+}
+static inline int cio_wal_write_metadata(struct cio_chunk *ch, char *buf,
+                                         size_t size) { return -1; }
+static inline int cio_wal_sync(struct cio_chunk *ch) { return -1; }
+static inline int cio_wal_read_prepare(struct cio_ctx *ctx,
+                                       struct cio_chunk *ch) { return -1; }
+static inline int cio_wal_content_copy(struct cio_chunk *ch,
+                                       void **out_buf, size_t *out_size)
+{
+    return -1;
+}
+static inline int cio_wal_is_up(struct cio_chunk *ch) { return CIO_FALSE; }
+static inline int cio_wal_up(struct cio_chunk *ch) { return CIO_ERROR; }
+static inline int cio_wal_up_force(struct cio_chunk *ch) { return CIO_ERROR; }
+static inline int cio_wal_down(struct cio_chunk *ch) { return CIO_ERROR; }
+static inline void cio_wal_scan_dump(struct cio_ctx *ctx,
+                                     struct cio_stream *st) { }
+
+#endif /* CIO_HAVE_WAL */
+
+#endif
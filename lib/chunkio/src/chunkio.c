@@ -28,6 +28,7 @@
 #include <chunkio/cio_stream.h>
 #include <chunkio/cio_scan.h>
 #include <chunkio/cio_utils.h>
+#include <chunkio/cio_wal.h>
 
 #include <monkey/mk_core/mk_list.h>
 
@@ -100,6 +101,36 @@ struct cio_ctx *cio_create(const char *root_path,
     cio_set_log_callback(ctx, log_cb);
     cio_set_log_level(ctx, log_level);
 
+#if !defined(CIO_HAVE_SNAPPY) || defined(_WIN32)
+    if (ctx->flags & CIO_COMPRESS) {
+        cio_log_warn(ctx, "[chunkio] compression is not supported, disabled");
+        ctx->flags &= ~CIO_COMPRESS;
+    }
+#endif
+
+#ifndef CIO_HAVE_WAL
+    if (ctx->flags & CIO_WAL) {
+        cio_log_warn(ctx, "[chunkio] write-ahead log is not supported, disabled");
+        ctx->flags &= ~CIO_WAL;
+    }
+#endif
+#ifdef _WIN32
+    if (ctx->flags & CIO_CRC32C) {
+        cio_log_warn(ctx, "[chunkio] crc32c checksum is not supported, disabled");
+        ctx->flags &= ~CIO_CRC32C;
+    }
+#endif
+
+#ifndef CIO_HAVE_LAZY_LOAD
+    if (ctx->flags & CIO_LAZY_LOAD) {
+        cio_log_warn(ctx, "[chunkio] lazy load is not supported, disabled");
+        ctx->flags &= ~CIO_LAZY_LOAD;
+    }
+#endif
+    if ((ctx->flags & CIO_WAL) && !root_path) {
+        ctx->flags &= ~CIO_WAL;
+    }
+
     /* Check or initialize file system root path */
     if (root_path) {
         ret = check_root_path(ctx, root_path);
@@ -117,6 +148,16 @@ struct cio_ctx *cio_create(const char *root_path,
         ctx->root_path = NULL;
     }
 
+    /* File system chunks are appended to a shared log */
+    if (ctx->flags & CIO_WAL) {
+        ret = cio_wal_init(ctx);
+        if (ret == -1) {
+            free(ctx->root_path);
+            free(ctx);
+            return NULL;
+        }
+    }
+
     return ctx;
 }
 
@@ -124,6 +165,10 @@ int cio_load(struct cio_ctx *ctx, char *chunk_extension)
 {
     int ret;
 
+    if (ctx->wal) {
+        return cio_wal_load(ctx);
+    }
+
     if (ctx->root_path) {
         ret = cio_scan_streams(ctx, chunk_extension);
         return ret;
@@ -132,6 +177,16 @@ int cio_load(struct cio_ctx *ctx, char *chunk_extension)
     return 0;
 }
 
+/*
+ * Write the pending records of the write-ahead log, if any. The caller
+ * decides the group commit frequency: every record queued since the
+ * previous call is stored with a single write.
+ */
+int cio_flush(struct cio_ctx *ctx)
+{
+    return cio_wal_flush(ctx);
+}
+
 static int qsort_stream(struct cio_stream *stream,
                         int (*compar)(const void *, const void *))
 {
@@ -199,6 +254,7 @@ void cio_destroy(struct cio_ctx *ctx)
     }
 
     cio_stream_destroy_all(ctx);
+    cio_wal_destroy(ctx);
     free(ctx->root_path);
     free(ctx);
 }
@@ -22,6 +22,7 @@
 #include <chunkio/cio_version.h>
 #include <chunkio/cio_file.h>
 #include <chunkio/cio_memfs.h>
+#include <chunkio/cio_wal.h>
 #include <chunkio/cio_log.h>
 #include <chunkio/cio_error.h>
 
@@ -84,6 +85,9 @@ struct cio_chunk *cio_chunk_open(struct cio_ctx *ctx, struct cio_stream *st,
         *err = CIO_OK;
         backend = cio_memfs_open(ctx, st, ch, flags, size);
     }
+    else if (st->type == CIO_STORE_WAL) {
+        backend = cio_wal_open(ctx, st, ch, flags, size, err);
+    }
 
     if (!backend) {
         mk_list_del(&ch->_head);
@@ -127,6 +131,9 @@ void cio_chunk_close(struct cio_chunk *ch, int delete)
     else if (type == CIO_STORE_FS) {
         cio_file_close(ch, delete);
     }
+    else if (type == CIO_STORE_WAL) {
+        cio_wal_close(ch, delete);
+    }
 
     mk_list_del(&ch->_head);
     mk_list_del(&ch->_state_head);
@@ -160,6 +167,10 @@ int cio_chunk_write_at(struct cio_chunk *ch, off_t offset,
         cf->data_size = offset;
         cf->crc_reset = CIO_TRUE;
     }
+    else if (type == CIO_STORE_WAL) {
+        /* the truncation must be recorded in the log too */
+        return cio_wal_write_at(ch, offset, buf, count);
+    }
 
     /*
      * By default backends (fs, mem) appends data after the it last position,
@@ -182,6 +193,9 @@ int cio_chunk_write(struct cio_chunk *ch, const void *buf, size_t count)
     else if (type == CIO_STORE_FS) {
         ret = cio_file_write(ch, buf, count);
     }
+    else if (type == CIO_STORE_WAL) {
+        ret = cio_wal_write(ch, buf, count);
+    }
 
     return ret;
 }
@@ -197,6 +211,9 @@ int cio_chunk_sync(struct cio_chunk *ch)
     if (type == CIO_STORE_FS) {
         ret = cio_file_sync(ch);
     }
+    else if (type == CIO_STORE_WAL) {
+        ret = cio_wal_sync(ch);
+    }
 
     return ret;
 }
@@ -207,6 +224,7 @@ int cio_chunk_get_content(struct cio_chunk *ch, char **buf, size_t *size)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_wal_chunk *wc;
 
     cio_error_reset(ch);
 
@@ -227,6 +245,16 @@ int cio_chunk_get_content(struct cio_chunk *ch, char **buf, size_t *size)
         *buf = cio_file_st_get_content(cf->map);
         return ret;
     }
+    else if (type == CIO_STORE_WAL) {
+        wc = ch->backend;
+        ret = cio_wal_read_prepare(ch->ctx, ch);
+        if (ret != CIO_OK) {
+            return ret;
+        }
+        *size = wc->size;
+        *buf = wc->buf_data;
+        return ret;
+    }
 
     return CIO_ERROR;
 }
@@ -246,6 +274,9 @@ int cio_chunk_get_content_copy(struct cio_chunk *ch,
     else if (type == CIO_STORE_FS) {
         return cio_file_content_copy(ch, out_buf, out_size);
     }
+    else if (type == CIO_STORE_WAL) {
+        return cio_wal_content_copy(ch, out_buf, out_size);
+    }
 
     return CIO_ERROR;
 }
@@ -256,6 +287,7 @@ size_t cio_chunk_get_content_end_pos(struct cio_chunk *ch)
     off_t pos = 0;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_wal_chunk *wc;
 
     cio_error_reset(ch);
 
@@ -268,6 +300,10 @@ size_t cio_chunk_get_content_end_pos(struct cio_chunk *ch)
         cf = ch->backend;
         pos = (off_t) (cio_file_st_get_content(cf->map) + cf->data_size);
     }
+    else if (type == CIO_STORE_WAL) {
+        wc = ch->backend;
+        pos = (off_t) (wc->buf_data + wc->size);
+    }
 
     return pos;
 }
@@ -277,6 +313,7 @@ ssize_t cio_chunk_get_content_size(struct cio_chunk *ch)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_wal_chunk *wc;
 
     cio_error_reset(ch);
 
@@ -289,6 +326,10 @@ ssize_t cio_chunk_get_content_size(struct cio_chunk *ch)
         cf = ch->backend;
         return cf->data_size;
     }
+    else if (type == CIO_STORE_WAL) {
+        wc = ch->backend;
+        return wc->size;
+    }
 
     return -1;
 }
@@ -298,6 +339,7 @@ ssize_t cio_chunk_get_real_size(struct cio_chunk *ch)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_wal_chunk *wc;
 
     cio_error_reset(ch);
 
@@ -316,6 +358,11 @@ ssize_t cio_chunk_get_real_size(struct cio_chunk *ch)
 
         return cf->fs_size;
     }
+    else if (type == CIO_STORE_WAL) {
+        /* bytes the chunk takes in the log, excluding released records */
+        wc = ch->backend;
+        return wc->size + wc->meta_len;
+    }
 
     return -1;
 }
@@ -385,6 +432,7 @@ int cio_chunk_tx_begin(struct cio_chunk *ch)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_wal_chunk *wc;
 
     cio_error_reset(ch);
 
@@ -408,6 +456,11 @@ int cio_chunk_tx_begin(struct cio_chunk *ch)
         ch->tx_crc = cf->crc_cur;
         ch->tx_content_length = cf->data_size;
     }
+    else if (type == CIO_STORE_WAL) {
+        wc = ch->backend;
+        ch->tx_crc = wc->crc_cur;
+        ch->tx_content_length = wc->size;
+    }
 
     return CIO_OK;
 }
@@ -438,6 +491,7 @@ int cio_chunk_tx_rollback(struct cio_chunk *ch)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_wal_chunk *wc;
 
     cio_error_reset(ch);
 
@@ -456,6 +510,11 @@ int cio_chunk_tx_rollback(struct cio_chunk *ch)
         cf->crc_cur = ch->tx_crc;
         cf->data_size = ch->tx_content_length;
     }
+    else if (type == CIO_STORE_WAL) {
+        wc = ch->backend;
+        wc->crc_cur = ch->tx_crc;
+        cio_wal_write_at(ch, ch->tx_content_length, NULL, 0);
+    }
 
     ch->tx_active = CIO_FALSE;
     return CIO_OK;
@@ -479,6 +538,9 @@ int cio_chunk_is_up(struct cio_chunk *ch)
         cf = ch->backend;
         return cio_file_is_up(ch, cf);
     }
+    else if (type == CIO_STORE_WAL) {
+        return cio_wal_is_up(ch);
+    }
 
     return CIO_FALSE;
 }
@@ -488,7 +550,7 @@ int cio_chunk_is_file(struct cio_chunk *ch)
     int type;
 
     type = ch->st->type;
-    if (type == CIO_STORE_FS) {
+    if (type == CIO_STORE_FS || type == CIO_STORE_WAL) {
         return CIO_TRUE;
     }
 
@@ -526,6 +588,11 @@ int cio_chunk_down(struct cio_chunk *ch)
         chunk_state_sync(ch);
         return ret;
     }
+    else if (type == CIO_STORE_WAL) {
+        ret = cio_wal_down(ch);
+        chunk_state_sync(ch);
+        return ret;
+    }
 
     return CIO_OK;
 }
@@ -543,6 +610,11 @@ int cio_chunk_up(struct cio_chunk *ch)
         chunk_state_sync(ch);
         return ret;
     }
+    else if (type == CIO_STORE_WAL) {
+        ret = cio_wal_up(ch);
+        chunk_state_sync(ch);
+        return ret;
+    }
 
     return CIO_OK;
 }
@@ -560,6 +632,11 @@ int cio_chunk_up_force(struct cio_chunk *ch)
         chunk_state_sync(ch);
         return ret;
     }
+    else if (type == CIO_STORE_WAL) {
+        ret = cio_wal_up_force(ch);
+        chunk_state_sync(ch);
+        return ret;
+    }
 
     return CIO_OK;
 }
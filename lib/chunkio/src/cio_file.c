@@ -41,6 +41,10 @@
 #include <chunkio/cio_error.h>
 #include <chunkio/cio_utils.h>
 
+#ifdef CIO_HAVE_SNAPPY
+#include <snappy.h>
+#endif
+
 char cio_file_init_bytes[] =   {
     /* file type (2 bytes)    */
     CIO_FILE_ID_00, CIO_FILE_ID_01,
@@ -60,6 +64,9 @@ char cio_file_init_bytes[] =   {
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 
+/* Content smaller than this is never compressed */
+#define CIO_FILE_COMPRESS_MIN  1024
+
 /* Get the number of bytes in the Content section */
 static size_t content_len(struct cio_file *cf)
 {
@@ -71,6 +78,17 @@ static size_t content_len(struct cio_file *cf)
     return len;
 }
 
+/* Update a checksum with the algorithm set in the chunk header */
+static inline crc_t file_crc_update(struct cio_file *cf, crc_t crc,
+                                    const void *data, size_t len)
+{
+    if (cf->crc32c) {
+        return cio_crc32c_update(crc, data, len);
+    }
+
+    return cio_crc32_update(crc, data, len);
+}
+
 /* Calculate content checksum in a variable */
 void cio_file_calculate_checksum(struct cio_file *cf, crc_t *out)
 {
@@ -80,7 +98,7 @@ void cio_file_calculate_checksum(struct cio_file *cf, crc_t *out)
 
     len = content_len(cf);
     in_data = (unsigned char *) cf->map + CIO_FILE_CONTENT_OFFSET;
-    val = cio_crc32_update(cf->crc_cur, in_data, len);
+    val = file_crc_update(cf, cf->crc_cur, in_data, len);
     *out = val;
 }
 
@@ -98,7 +116,7 @@ static void update_checksum(struct cio_file *cf,
         cf->crc_reset = CIO_FALSE;
     }
 
-    crc = cio_crc32_update(cf->crc_cur, data, len);
+    crc = file_crc_update(cf, cf->crc_cur, data, len);
     memcpy(cf->map + 2, &crc, sizeof(crc));
     cf->crc_cur = crc;
 }
@@ -198,6 +216,12 @@ static int cio_file_format_check(struct cio_chunk *ch,
         /* Initialize init bytes */
         write_init_header(ch, cf);
 
+        /* New chunks record which checksum algorithm they use */
+        if ((ch->ctx->flags & CIO_CHECKSUM) && (ch->ctx->flags & CIO_CRC32C)) {
+            cio_file_st_set_flags(cf->map, CIO_FILE_ST_CRC32C);
+            cf->crc32c = CIO_TRUE;
+        }
+
         /* Write checksum in context (note: crc32 not finalized) */
         if (ch->ctx->flags & CIO_CHECKSUM) {
             cio_file_calculate_checksum(cf, &cf->crc_cur);
@@ -212,6 +236,9 @@ static int cio_file_format_check(struct cio_chunk *ch,
             return -1;
         }
 
+        /* Chunks written before crc32c support don't have the flag */
+        cf->crc32c = (cio_file_st_get_flags(cf->map) & CIO_FILE_ST_CRC32C) != 0;
+
         /* Checksum */
         if (ch->ctx->flags & CIO_CHECKSUM) {
             /* Initialize CRC variable */
@@ -239,6 +266,316 @@ static int cio_file_format_check(struct cio_chunk *ch,
     return 0;
 }
 
+#ifdef CIO_HAVE_SNAPPY
+/*
+ * Replace the chunk file with a new image. The image is written to a hidden
+ * file in the stream directory (skipped by the scanner), synced and renamed
+ * over the chunk, so after a crash the file holds either the old or the new
+ * content. On success the chunk file descriptor and map point to the new
+ * file, 'map_size' bytes are mapped.
+ */
+static int file_replace(struct cio_chunk *ch, struct cio_file *cf,
+                        char *image, size_t size, size_t map_size)
+{
+    int fd;
+    int dir_fd;
+    char *p;
+    char *tmp_path;
+    size_t len;
+    size_t dir_len;
+    size_t off = 0;
+    ssize_t bytes;
+    void *map;
+
+    p = strrchr(cf->path, '/');
+    if (!p) {
+        return -1;
+    }
+    dir_len = (p - cf->path) + 1;
+
+    /* <stream dir>/.<chunk name>.tmp */
+    len = strlen(cf->path);
+    tmp_path = malloc(len + 6);
+    if (!tmp_path) {
+        cio_errno();
+        return -1;
+    }
+    memcpy(tmp_path, cf->path, dir_len);
+    tmp_path[dir_len] = '.';
+    memcpy(tmp_path + dir_len + 1, p + 1, len - dir_len);
+    memcpy(tmp_path + len + 1, ".tmp", 5);
+
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, (mode_t) 0600);
+    if (fd == -1) {
+        cio_errno();
+        free(tmp_path);
+        return -1;
+    }
+
+    while (off < size) {
+        bytes = write(fd, image + off, size - off);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cio_errno();
+            goto error;
+        }
+        off += bytes;
+    }
+
+    if (map_size > size && ftruncate(fd, map_size) == -1) {
+        cio_errno();
+        goto error;
+    }
+
+    if (fsync(fd) == -1) {
+        cio_errno();
+        goto error;
+    }
+
+    if (rename(tmp_path, cf->path) == -1) {
+        cio_errno();
+        goto error;
+    }
+    free(tmp_path);
+
+    /* persist the rename */
+    tmp_path = strndup(cf->path, dir_len);
+    if (tmp_path) {
+        dir_fd = open(tmp_path, O_RDONLY);
+        if (dir_fd != -1) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+        free(tmp_path);
+    }
+
+    map = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        /* the file is replaced, the old map still has the same records */
+        cio_errno();
+        cio_log_error(ch->ctx, "[cio file] cannot map replaced chunk %s:%s",
+                      ch->st->name, ch->name);
+        close(fd);
+        return -1;
+    }
+
+    munmap(cf->map, cf->alloc_size);
+    close(cf->fd);
+
+    cf->fd = fd;
+    cf->map = map;
+    cf->alloc_size = map_size;
+    cf->st_content = cio_file_st_get_content(cf->map);
+
+    return 0;
+
+ error:
+    close(fd);
+    unlink(tmp_path);
+    free(tmp_path);
+    return -1;
+}
+
+/* Set the final checksum of a chunk image, returns the running checksum */
+static crc_t file_image_checksum(struct cio_file *cf, char *image,
+                                 size_t data_size)
+{
+    crc_t crc;
+    crc_t val;
+    size_t len;
+
+    len = 2 + cio_file_st_get_meta_len(image) + data_size;
+    crc = file_crc_update(cf, cio_crc32_init(),
+                          image + CIO_FILE_CONTENT_OFFSET, len);
+
+    val = htonl(cio_crc32_finalize(crc));
+    memcpy(image + 2, &val, sizeof(val));
+
+    return crc;
+}
+
+/*
+ * Compress the content data of a locked (finalized) chunk. The metadata is
+ * kept as is so it can be read without decompressing. The compressed image
+ * replaces the chunk file, the raw content is never overwritten in place.
+ */
+static int file_compress(struct cio_chunk *ch, struct cio_file *cf)
+{
+    int ret;
+    char *buf;
+    uint8_t flags;
+    size_t hdr_size;
+    size_t out_size;
+    crc_t crc = 0;
+    struct snappy_env env;
+
+    if (!(ch->ctx->flags & CIO_COMPRESS) || ch->lock == CIO_FALSE) {
+        return 0;
+    }
+
+    if (!cf->map || (cf->flags & CIO_OPEN_RW) == 0) {
+        return 0;
+    }
+
+    flags = cio_file_st_get_flags(cf->map);
+    if (flags & CIO_FILE_ST_COMPRESSED) {
+        return 0;
+    }
+
+    if (cf->data_size < CIO_FILE_COMPRESS_MIN) {
+        return 0;
+    }
+
+    hdr_size = CIO_FILE_HEADER_MIN + cio_file_st_get_meta_len(cf->map);
+    buf = malloc(hdr_size + snappy_max_compressed_length(cf->data_size));
+    if (!buf) {
+        cio_errno();
+        return -1;
+    }
+
+    ret = snappy_init_env(&env);
+    if (ret != 0) {
+        free(buf);
+        return -1;
+    }
+
+    ret = snappy_compress(&env, cio_file_st_get_content(cf->map),
+                          cf->data_size, buf + hdr_size, &out_size);
+    snappy_free_env(&env);
+    if (ret != 0) {
+        cio_log_error(ch->ctx, "[cio file] cannot compress chunk %s:%s",
+                      ch->st->name, ch->name);
+        free(buf);
+        return -1;
+    }
+
+    /* not worth it, keep the raw content */
+    if (out_size >= cf->data_size) {
+        free(buf);
+        return 0;
+    }
+
+    /* header and metadata as they are, the flag marks the new content */
+    memcpy(buf, cf->map, hdr_size);
+    cio_file_st_set_flags(buf, flags | CIO_FILE_ST_COMPRESSED);
+
+    /* the checksum covers the stored (compressed) content */
+    if (ch->ctx->flags & CIO_CHECKSUM) {
+        crc = file_image_checksum(cf, buf, out_size);
+    }
+
+    ret = file_replace(ch, cf, buf, hdr_size + out_size, hdr_size + out_size);
+    free(buf);
+    if (ret == -1) {
+        cio_log_error(ch->ctx, "[cio file] cannot store compressed chunk "
+                      "%s:%s", ch->st->name, ch->name);
+        return -1;
+    }
+
+    cio_log_debug(ch->ctx, "[cio file] compressed %s:%s from %lu to %lu bytes",
+                  ch->st->name, ch->name, cf->data_size, out_size);
+
+    cf->data_size = out_size;
+    if (ch->ctx->flags & CIO_CHECKSUM) {
+        cf->crc_cur = crc;
+    }
+    cf->synced = CIO_TRUE;
+
+    return 0;
+}
+#endif
+
+/*
+ * If the mapped chunk content is compressed, restore the raw content so
+ * readers and writers always get the regular layout while the chunk is up.
+ * Like compression, the raw image replaces the chunk file.
+ */
+static int file_decompress(struct cio_chunk *ch, struct cio_file *cf)
+{
+#ifdef CIO_HAVE_SNAPPY
+    int ret;
+    char *buf;
+    uint8_t flags;
+    size_t size;
+    size_t hdr_size;
+    size_t new_size;
+    crc_t crc = 0;
+#endif
+
+    if (!(cio_file_st_get_flags(cf->map) & CIO_FILE_ST_COMPRESSED)) {
+        return CIO_OK;
+    }
+
+#ifndef CIO_HAVE_SNAPPY
+    cio_log_error(ch->ctx, "[cio file] chunk %s:%s is compressed, compression "
+                  "support is not available", ch->st->name, ch->name);
+    return CIO_ERROR;
+#else
+    if ((cf->flags & CIO_OPEN_RW) == 0) {
+        cio_log_error(ch->ctx, "[cio file] cannot decompress chunk %s:%s "
+                      "(read-only)", ch->st->name, ch->name);
+        cio_error_set(ch, CIO_ERR_PERMISSION);
+        return CIO_ERROR;
+    }
+
+    if (!snappy_uncompressed_length(cio_file_st_get_content(cf->map),
+                                    cf->data_size, &size)) {
+        cio_log_error(ch->ctx, "[cio file] invalid compressed content %s:%s",
+                      ch->st->name, ch->name);
+        cio_error_set(ch, CIO_ERR_BAD_LAYOUT);
+        return CIO_CORRUPTED;
+    }
+
+    hdr_size = CIO_FILE_HEADER_MIN + cio_file_st_get_meta_len(cf->map);
+    new_size = ROUND_UP(hdr_size + size, ch->ctx->page_size);
+
+    buf = malloc(hdr_size + size);
+    if (!buf) {
+        cio_errno();
+        return CIO_ERROR;
+    }
+
+    ret = snappy_uncompress(cio_file_st_get_content(cf->map), cf->data_size,
+                            buf + hdr_size);
+    if (ret != 0) {
+        cio_log_error(ch->ctx, "[cio file] cannot decompress chunk %s:%s",
+                      ch->st->name, ch->name);
+        cio_error_set(ch, CIO_ERR_BAD_LAYOUT);
+        free(buf);
+        return CIO_CORRUPTED;
+    }
+
+    memcpy(buf, cf->map, hdr_size);
+    flags = cio_file_st_get_flags(buf);
+    cio_file_st_set_flags(buf, flags & ~CIO_FILE_ST_COMPRESSED);
+
+    if (ch->ctx->flags & CIO_CHECKSUM) {
+        crc = file_image_checksum(cf, buf, size);
+    }
+
+    ret = file_replace(ch, cf, buf, hdr_size + size, new_size);
+    free(buf);
+    if (ret == -1) {
+        cio_log_error(ch->ctx, "[cio file] cannot store decompressed chunk "
+                      "%s:%s", ch->st->name, ch->name);
+        return CIO_ERROR;
+    }
+
+    cio_log_debug(ch->ctx, "[cio file] decompressed %s:%s from %lu to %lu "
+                  "bytes", ch->st->name, ch->name, cf->data_size, size);
+
+    cf->data_size = size;
+    if (ch->ctx->flags & CIO_CHECKSUM) {
+        cf->crc_cur = crc;
+    }
+    cf->synced = CIO_TRUE;
+
+    return CIO_OK;
+#endif
+}
+
 /*
  * Unmap the memory for the opened file in question. It make sure
  * to sync changes to disk first.
@@ -401,9 +738,30 @@ static int mmap_file(struct cio_ctx *ctx, struct cio_chunk *ch, size_t size)
         return CIO_CORRUPTED;
     }
 
+    /* restore compressed content */
+    if (fs_size > 0) {
+        ret = file_decompress(ch, cf);
+        if (ret != CIO_OK) {
+            if (cf->map) {
+                munmap(cf->map, cf->alloc_size);
+            }
+            cf->map = NULL;
+            cf->data_size = 0;
+            cf->alloc_size = 0;
+            return ret;
+        }
+    }
+
     cf->st_content = cio_file_st_get_content(cf->map);
     cio_log_debug(ctx, "%s:%s mapped OK", ch->st->name, ch->name);
 
+    /* metadata is read from the map from now on */
+    if (cf->hdr_meta) {
+        free(cf->hdr_meta);
+        cf->hdr_meta = NULL;
+        cf->hdr_meta_len = 0;
+    }
+
     /* The mmap succeeded, adjust the counters */
     cio_chunk_counter_total_up_add(ctx);
 
@@ -542,6 +900,81 @@ size_t cio_file_real_size(struct cio_file *cf)
     return st.st_size;
 }
 
+/*
+ * Read the header and the metadata of a chunk that is not mapped, so it can
+ * be registered without reading its content. The content checksum is
+ * verified later by mmap_file() when the chunk is put 'up'.
+ *
+ * This function is called from the scanner worker threads: it only touches
+ * the file context and it does not log, the caller reports the errors.
+ */
+int cio_file_read_header(struct cio_file *cf)
+{
+    int fd;
+    int meta_len;
+    ssize_t bytes;
+    char *meta = NULL;
+    char hdr[CIO_FILE_HEADER_MIN];
+    struct stat st;
+
+    fd = open(cf->path, O_RDONLY);
+    if (fd == -1) {
+        return CIO_ERROR;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return CIO_ERROR;
+    }
+    cf->fs_size = st.st_size;
+
+    /* a chunk that was never initialized has no header to read */
+    if (st.st_size < CIO_FILE_HEADER_MIN) {
+        close(fd);
+        return CIO_CORRUPTED;
+    }
+
+    bytes = pread(fd, hdr, sizeof(hdr), 0);
+    if (bytes != sizeof(hdr)) {
+        close(fd);
+        return CIO_ERROR;
+    }
+
+    if ((unsigned char) hdr[0] != CIO_FILE_ID_00 ||
+        (unsigned char) hdr[1] != CIO_FILE_ID_01) {
+        close(fd);
+        return CIO_CORRUPTED;
+    }
+
+    meta_len = cio_file_st_get_meta_len(hdr);
+    if (CIO_FILE_HEADER_MIN + meta_len > st.st_size) {
+        close(fd);
+        return CIO_CORRUPTED;
+    }
+
+    if (meta_len > 0) {
+        meta = malloc(meta_len);
+        if (!meta) {
+            close(fd);
+            return CIO_ERROR;
+        }
+
+        bytes = pread(fd, meta, meta_len, CIO_FILE_HEADER_MIN);
+        if (bytes != meta_len) {
+            free(meta);
+            close(fd);
+            return CIO_ERROR;
+        }
+    }
+    close(fd);
+
+    free(cf->hdr_meta);
+    cf->hdr_meta = meta;
+    cf->hdr_meta_len = meta_len;
+
+    return CIO_OK;
+}
+
 /*
  * Open or create a data file: the following behavior is expected depending
  * of the passed flags:
@@ -608,6 +1041,12 @@ struct cio_file *cio_file_open(struct cio_ctx *ctx,
     cf->map = NULL;
     ch->backend = cf;
 
+    /* Lazy load: the scanner reads the header, the content stays 'down' */
+    if (flags & CIO_LAZY_LOAD) {
+        *err = CIO_OK;
+        return cf;
+    }
+
     /* Should we open and put this file up ? */
     ret = open_and_up(ctx);
     if (ret == CIO_FALSE) {
@@ -743,6 +1182,11 @@ int cio_file_down(struct cio_chunk *ch)
         return -1;
     }
 
+#ifdef CIO_HAVE_SNAPPY
+    /* a locked chunk is not written anymore, store it compressed */
+    file_compress(ch, cf);
+#endif
+
     /* unmap memory */
     munmap_file(ch->ctx, ch);
 
@@ -776,6 +1220,12 @@ void cio_file_close(struct cio_chunk *ch, int delete)
         return;
     }
 
+#ifdef CIO_HAVE_SNAPPY
+    if (delete == CIO_FALSE) {
+        file_compress(ch, cf);
+    }
+#endif
+
     /* Safe unmap of the file content */
     munmap_file(ch->ctx, ch);
 
@@ -795,6 +1245,7 @@ void cio_file_close(struct cio_chunk *ch, int delete)
         close(cf->fd);
     }
 
+    free(cf->hdr_meta);
     free(cf->path);
     free(cf);
 }
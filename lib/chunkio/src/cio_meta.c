@@ -25,6 +25,7 @@
 #include <chunkio/cio_file.h>
 #include <chunkio/cio_file_st.h>
 #include <chunkio/cio_memfs.h>
+#include <chunkio/cio_wal.h>
 #include <chunkio/cio_stream.h>
 #include <chunkio/cio_log.h>
 
@@ -69,6 +70,9 @@ int cio_meta_write(struct cio_chunk *ch, char *buf, size_t size)
     else if (ch->st->type == CIO_STORE_FS) {
         return cio_file_write_metadata(ch, buf, size);
     }
+    else if (ch->st->type == CIO_STORE_WAL) {
+        return cio_wal_write_metadata(ch, buf, size);
+    }
     return -1;
 }
 
@@ -78,12 +82,22 @@ int cio_meta_size(struct cio_chunk *ch) {
         return mf->meta_len;
     }
     else if (ch->st->type == CIO_STORE_FS) {
+        struct cio_file *cf = ch->backend;
+
+        /* header loaded by a lazy scan, the chunk is still 'down' */
+        if (!cf->map && cf->hdr_meta) {
+            return cf->hdr_meta_len;
+        }
+
         if (cio_file_read_prepare(ch->ctx, ch)) {
             return -1;
         }
-        struct cio_file *cf = ch->backend;
         return cio_file_st_get_meta_len(cf->map);
     }
+    else if (ch->st->type == CIO_STORE_WAL) {
+        struct cio_wal_chunk *wc = (struct cio_wal_chunk *) ch->backend;
+        return wc->meta_len;
+    }
 
     return -1;
 }
@@ -94,6 +108,7 @@ int cio_meta_read(struct cio_chunk *ch, char **meta_buf, int *meta_len)
     char *meta;
     struct cio_file *cf;
     struct cio_memfs *mf;
+    struct cio_wal_chunk *wc;
 
     /* In-memory type */
     if (ch->st->type == CIO_STORE_MEM) {
@@ -109,12 +124,32 @@ int cio_meta_read(struct cio_chunk *ch, char **meta_buf, int *meta_len)
 
         return 0;
     }
+    else if (ch->st->type == CIO_STORE_WAL) {
+        /* metadata is always kept in memory */
+        wc = (struct cio_wal_chunk *) ch->backend;
+        if (!wc->meta_data) {
+            return -1;
+        }
+
+        *meta_buf = wc->meta_data;
+        *meta_len = wc->meta_len;
+
+        return 0;
+    }
     else if (ch->st->type == CIO_STORE_FS) {
+        cf = ch->backend;
+
+        /* header loaded by a lazy scan, the chunk is still 'down' */
+        if (!cf->map && cf->hdr_meta) {
+            *meta_buf = cf->hdr_meta;
+            *meta_len = cf->hdr_meta_len;
+            return 0;
+        }
+
         if (cio_file_read_prepare(ch->ctx, ch)) {
             return -1;
         }
 
-        cf = ch->backend;
         len = cio_file_st_get_meta_len(cf->map);
         if (len <= 0) {
             return -1;
@@ -137,6 +172,7 @@ int cio_meta_cmp(struct cio_chunk *ch, char *meta_buf, int meta_len)
     char *meta;
     struct cio_file *cf = ch->backend;
     struct cio_memfs *mf;
+    struct cio_wal_chunk *wc;
 
     /* In-memory type */
     if (ch->st->type == CIO_STORE_MEM) {
@@ -159,6 +195,31 @@ int cio_meta_cmp(struct cio_chunk *ch, char *meta_buf, int meta_len)
 
         return -1;
     }
+    else if (ch->st->type == CIO_STORE_WAL) {
+        wc = (struct cio_wal_chunk *) ch->backend;
+        if (!wc->meta_data || wc->meta_len != meta_len) {
+            return -1;
+        }
+
+        if (memcmp(wc->meta_data, meta_buf, meta_len) == 0) {
+            return 0;
+        }
+
+        return -1;
+    }
+
+    /* File system type, header loaded by a lazy scan */
+    if (!cf->map && cf->hdr_meta) {
+        if (cf->hdr_meta_len != meta_len) {
+            return -1;
+        }
+
+        if (memcmp(cf->hdr_meta, meta_buf, meta_len) == 0) {
+            return 0;
+        }
+
+        return -1;
+    }
 
     if (cio_file_read_prepare(ch->ctx, ch)) {
         return -1;
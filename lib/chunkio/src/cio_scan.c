@@ -27,6 +27,7 @@
 #include <chunkio/cio_stream.h>
 #include <chunkio/cio_file.h>
 #include <chunkio/cio_memfs.h>
+#include <chunkio/cio_wal.h>
 #include <chunkio/cio_chunk.h>
 #include <chunkio/cio_log.h>
 
@@ -34,9 +35,151 @@
 #include "win32/dirent.h"
 #endif
 
+#ifdef CIO_HAVE_LAZY_LOAD
+#include <pthread.h>
+#include <unistd.h>
+
+#define CIO_SCAN_WORKERS_MAX   8    /* header reader threads           */
+#define CIO_SCAN_WORKER_CHUNKS 64   /* minimum chunks per reader thread */
+
+/* Chunks registered by a lazy scan, waiting for their header to be read */
+struct cio_scan_queue {
+    struct cio_chunk **chunks;
+    int *status;
+    int count;
+    int size;
+    int workers;
+};
+
+struct cio_scan_worker {
+    int id;
+    int started;
+    pthread_t tid;
+    struct cio_scan_queue *queue;
+};
+
+static int scan_queue_add(struct cio_scan_queue *q, struct cio_chunk *ch)
+{
+    int size;
+    struct cio_chunk **tmp;
+
+    if (q->count == q->size) {
+        size = q->size ? q->size * 2 : 256;
+        tmp = realloc(q->chunks, sizeof(struct cio_chunk *) * size);
+        if (!tmp) {
+            cio_errno();
+            return -1;
+        }
+        q->chunks = tmp;
+        q->size = size;
+    }
+
+    q->chunks[q->count++] = ch;
+    return 0;
+}
+
+/* Each worker reads the headers of one every 'workers' chunks */
+static void *scan_worker(void *data)
+{
+    int i;
+    struct cio_scan_worker *w = data;
+    struct cio_scan_queue *q = w->queue;
+
+    for (i = w->id; i < q->count; i += q->workers) {
+        q->status[i] = cio_file_read_header(q->chunks[i]->backend);
+    }
+
+    return NULL;
+}
+
+/*
+ * Read the header (and metadata) of every chunk registered by the scan
+ * using a small pool of threads. Chunks whose header cannot be read are
+ * released, the files are kept in the file system.
+ */
+static int scan_queue_process(struct cio_ctx *ctx, struct cio_scan_queue *q)
+{
+    int i;
+    int ret;
+    long cpus;
+    struct cio_chunk *ch;
+    struct cio_scan_worker workers[CIO_SCAN_WORKERS_MAX];
+
+    if (q->count == 0) {
+        return 0;
+    }
+
+    q->status = malloc(sizeof(int) * q->count);
+    if (!q->status) {
+        cio_errno();
+        return -1;
+    }
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+
+    q->workers = (q->count / CIO_SCAN_WORKER_CHUNKS) + 1;
+    if (q->workers > cpus) {
+        q->workers = cpus;
+    }
+    if (q->workers > CIO_SCAN_WORKERS_MAX) {
+        q->workers = CIO_SCAN_WORKERS_MAX;
+    }
+
+    for (i = 0; i < q->workers; i++) {
+        workers[i].id = i;
+        workers[i].started = CIO_FALSE;
+        workers[i].queue = q;
+    }
+
+    /* the calling thread takes the first share */
+    for (i = 1; i < q->workers; i++) {
+        ret = pthread_create(&workers[i].tid, NULL, scan_worker, &workers[i]);
+        if (ret == 0) {
+            workers[i].started = CIO_TRUE;
+        }
+        else {
+            /* do the work of this share ourselves */
+            scan_worker(&workers[i]);
+        }
+    }
+    scan_worker(&workers[0]);
+
+    for (i = 1; i < q->workers; i++) {
+        if (workers[i].started == CIO_TRUE) {
+            pthread_join(workers[i].tid, NULL);
+        }
+    }
+
+    for (i = 0; i < q->count; i++) {
+        if (q->status[i] == CIO_OK) {
+            continue;
+        }
+
+        ch = q->chunks[i];
+        if (q->status[i] == CIO_CORRUPTED) {
+            cio_log_error(ctx, "[cio scan] invalid chunk header %s/%s",
+                          ch->st->name, ch->name);
+        }
+        else {
+            cio_log_error(ctx, "[cio scan] cannot read chunk header %s/%s",
+                          ch->st->name, ch->name);
+        }
+        cio_chunk_close(ch, CIO_FALSE);
+    }
+
+    cio_log_debug(ctx, "[cio scan] %i chunk headers read by %i threads",
+                  q->count, q->workers);
+
+    return 0;
+}
+#endif
+
 #ifdef CIO_HAVE_BACKEND_FILESYSTEM
 static int cio_scan_stream_files(struct cio_ctx *ctx, struct cio_stream *st,
-                                 char *chunk_extension)
+                                 char *chunk_extension, void *queue)
 {
     int len;
     int ret;
@@ -46,6 +189,7 @@ static int cio_scan_stream_files(struct cio_ctx *ctx, struct cio_stream *st,
     char *path;
     DIR *dir;
     struct dirent *ent;
+    struct cio_chunk *ch;
 
     len = strlen(ctx->root_path) + strlen(st->name) + 2;
     path = malloc(len);
@@ -98,8 +242,15 @@ static int cio_scan_stream_files(struct cio_ctx *ctx, struct cio_stream *st,
             }
         }
 
-        /* register every directory as a stream */
-        cio_chunk_open(ctx, st, ent->d_name, ctx->flags, 0, &err);
+        /* register every file as a chunk */
+        ch = cio_chunk_open(ctx, st, ent->d_name, ctx->flags, 0, &err);
+#ifdef CIO_HAVE_LAZY_LOAD
+        if (ch && (ctx->flags & CIO_LAZY_LOAD)) {
+            if (scan_queue_add(queue, ch) == -1) {
+                cio_chunk_close(ch, CIO_FALSE);
+            }
+        }
+#endif
     }
 
     closedir(dir);
@@ -111,9 +262,16 @@ static int cio_scan_stream_files(struct cio_ctx *ctx, struct cio_stream *st,
 /* Given a cio context, scan it root_path and populate stream/files */
 int cio_scan_streams(struct cio_ctx *ctx, char *chunk_extension)
 {
+    int ret = 0;
     DIR *dir;
     struct dirent *ent;
     struct cio_stream *st;
+    void *queue = NULL;
+#ifdef CIO_HAVE_LAZY_LOAD
+    struct cio_scan_queue q = {0};
+
+    queue = &q;
+#endif
 
     dir = opendir(ctx->root_path);
     if (!dir) {
@@ -137,12 +295,19 @@ int cio_scan_streams(struct cio_ctx *ctx, char *chunk_extension)
         /* register every directory as a stream */
         st = cio_stream_create(ctx, ent->d_name, CIO_STORE_FS);
         if (st) {
-            cio_scan_stream_files(ctx, st, chunk_extension);
+            cio_scan_stream_files(ctx, st, chunk_extension, queue);
         }
     }
 
     closedir(dir);
-    return 0;
+
+#ifdef CIO_HAVE_LAZY_LOAD
+    ret = scan_queue_process(ctx, &q);
+    free(q.chunks);
+    free(q.status);
+#endif
+
+    return ret;
 }
 #else
 int cio_scan_streams(struct cio_ctx *ctx)
@@ -171,5 +336,8 @@ void cio_scan_dump(struct cio_ctx *ctx)
         else if (st->type == CIO_STORE_FS) {
             cio_file_scan_dump(ctx, st);
         }
+        else if (st->type == CIO_STORE_WAL) {
+            cio_wal_scan_dump(ctx, st);
+        }
     }
 }
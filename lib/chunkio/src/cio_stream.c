@@ -139,6 +139,15 @@ struct cio_stream *cio_stream_create(struct cio_ctx *ctx, const char *name,
     }
 #endif
 
+    /* With a write-ahead log, file system streams don't use a directory */
+    if (type == CIO_STORE_FS && ctx->wal) {
+        type = CIO_STORE_WAL;
+    }
+    else if (type == CIO_STORE_WAL && !ctx->wal) {
+        cio_log_error(ctx, "[stream create] write-ahead log is not enabled");
+        return NULL;
+    }
+
     /* Find duplicated */
     st = cio_stream_get(ctx, name);
     if (st) {
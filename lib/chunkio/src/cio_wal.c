@@ -0,0 +1,2009 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <chunkio/chunkio.h>
+#include <chunkio/chunkio_compat.h>
+#include <chunkio/cio_crc32.h>
+#include <chunkio/cio_chunk.h>
+#include <chunkio/cio_stream.h>
+#include <chunkio/cio_wal.h>
+#include <chunkio/cio_log.h>
+#include <chunkio/cio_error.h>
+#include <chunkio/cio_utils.h>
+
+#ifdef __APPLE__
+#define wal_fdatasync(fd)   fsync(fd)
+#else
+#define wal_fdatasync(fd)   fdatasync(fd)
+#endif
+
+/* index file trailer: 'CWIX', covered segment size (8), crc32 of entries */
+#define CIO_WAL_INDEX_TRAILER  16
+
+struct cio_wal_segment {
+    uint32_t id;
+    int fd;
+    int refs;                 /* number of chunks with records here */
+    off_t size;               /* bytes written to the file */
+
+    /* index entries, only kept for the active segment */
+    char *index;
+    size_t index_len;
+    size_t index_size;
+
+    struct mk_list _head;     /* link to cio_wal->segments */
+};
+
+/* chunk id lookup table, only used while loading */
+struct cio_wal_entry {
+    uint32_t id;
+    struct cio_chunk *ch;
+};
+
+struct cio_wal {
+    uint32_t next_seg_id;
+    uint32_t next_chunk_id;
+    struct cio_wal_segment *active;
+
+    /* records pending to be written (group commit) */
+    char *batch;
+    size_t batch_len;
+    size_t batch_size;
+
+    /* read buffer used to load chunks content */
+    char *scratch;
+    size_t scratch_size;
+
+    /* load state */
+    int loading;
+    uint32_t load_id;
+    struct cio_wal_entry *entries;
+    int entries_count;
+    int entries_size;
+
+    int compacting;
+    struct mk_list segments;  /* ordered from the oldest to the newest */
+};
+
+struct wal_record {
+    off_t offset;
+    int type;
+    int flags;
+    uint32_t id;
+    uint32_t len;
+    uint32_t crc;
+};
+
+static inline void put16(char *p, uint16_t v)
+{
+    p[0] = (v >> 8) & 0xff;
+    p[1] = v & 0xff;
+}
+
+static inline uint16_t get16(const char *p)
+{
+    return ((uint16_t) (unsigned char) p[0] << 8) |
+            (uint16_t) (unsigned char) p[1];
+}
+
+static inline void put32(char *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+static inline uint32_t get32(const char *p)
+{
+    return ((uint32_t) (unsigned char) p[0] << 24) |
+           ((uint32_t) (unsigned char) p[1] << 16) |
+           ((uint32_t) (unsigned char) p[2] << 8)  |
+            (uint32_t) (unsigned char) p[3];
+}
+
+static inline void put64(char *p, uint64_t v)
+{
+    put32(p, v >> 32);
+    put32(p + 4, v & 0xffffffff);
+}
+
+static inline uint64_t get64(const char *p)
+{
+    return ((uint64_t) get32(p) << 32) | get32(p + 4);
+}
+
+static uint32_t wal_crc(const void *buf, size_t len)
+{
+    crc_t crc;
+
+    crc = cio_crc32_init();
+    crc = cio_crc32_update(crc, buf, len);
+    return (uint32_t) cio_crc32_finalize(crc);
+}
+
+/* record payload checksum, the algorithm is set in the record flags */
+static uint32_t rec_crc(int flags, const void *buf, size_t len)
+{
+    crc_t crc;
+
+    if (flags & CIO_WAL_REC_CRC32C) {
+        crc = cio_crc32c_init();
+        crc = cio_crc32c_update(crc, buf, len);
+        return (uint32_t) cio_crc32c_finalize(crc);
+    }
+
+    return wal_crc(buf, len);
+}
+
+static void header_pack(char *p, int type, int flags,
+                        uint32_t id, uint32_t len, uint32_t crc)
+{
+    p[0] = CIO_WAL_MAGIC_1;
+    p[1] = CIO_WAL_MAGIC_2;
+    p[2] = type;
+    p[3] = flags;
+    put32(p + 4, id);
+    put32(p + 8, len);
+    put32(p + 12, crc);
+}
+
+static int header_unpack(const char *p, struct wal_record *rec)
+{
+    if ((unsigned char) p[0] != CIO_WAL_MAGIC_1 ||
+        (unsigned char) p[1] != CIO_WAL_MAGIC_2) {
+        return -1;
+    }
+
+    rec->type = p[2];
+    if (rec->type < CIO_WAL_REC_CREATE || rec->type > CIO_WAL_REC_DELETE) {
+        return -1;
+    }
+
+    rec->flags = p[3];
+    rec->id = get32(p + 4);
+    rec->len = get32(p + 8);
+    rec->crc = get32(p + 12);
+
+    /* only content records can be large */
+    if (rec->type != CIO_WAL_REC_DATA && rec->len > (2 * 65536) + 4) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Records which payload is stored in the index besides the header */
+static inline int record_indexed_payload(int type)
+{
+    return type == CIO_WAL_REC_CREATE || type == CIO_WAL_REC_TRUNCATE ||
+           type == CIO_WAL_REC_META;
+}
+
+static int buf_reserve(char **buf, size_t *size, size_t used, size_t need)
+{
+    size_t new_size;
+    char *tmp;
+
+    if (used + need <= *size) {
+        return 0;
+    }
+
+    new_size = *size ? *size : 4096;
+    while (new_size < used + need) {
+        new_size *= 2;
+    }
+
+    tmp = realloc(*buf, new_size);
+    if (!tmp) {
+        cio_errno();
+        return -1;
+    }
+
+    *buf = tmp;
+    *size = new_size;
+    return 0;
+}
+
+static int write_iov(int fd, struct iovec *iov, int count)
+{
+    ssize_t ret;
+
+    while (count > 0) {
+        ret = writev(fd, iov, count);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        while (count > 0 && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t count, off_t offset)
+{
+    ssize_t ret;
+    size_t total = 0;
+
+    while (total < count) {
+        ret = pread(fd, (char *) buf + total, count - total, offset + total);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cio_errno();
+            return -1;
+        }
+        else if (ret == 0) {
+            return -1;
+        }
+        total += ret;
+    }
+
+    return 0;
+}
+
+static char *segment_path(struct cio_ctx *ctx, uint32_t id, const char *ext)
+{
+    int len;
+    char *path;
+
+    len = strlen(ctx->root_path) + 32;
+    path = malloc(len);
+    if (!path) {
+        cio_errno();
+        return NULL;
+    }
+
+    snprintf(path, len, "%s/wal-%08u.%s", ctx->root_path, id, ext);
+    return path;
+}
+
+static struct cio_wal_segment *segment_get(struct cio_wal *wal, uint32_t id)
+{
+    struct mk_list *head;
+    struct cio_wal_segment *seg;
+
+    /* newest segments are the most referenced */
+    mk_list_foreach_r(head, &wal->segments) {
+        seg = mk_list_entry(head, struct cio_wal_segment, _head);
+        if (seg->id == id) {
+            return seg;
+        }
+    }
+
+    return NULL;
+}
+
+static struct cio_wal_segment *segment_open(struct cio_ctx *ctx, uint32_t id,
+                                            int create)
+{
+    int oflags;
+    char *path;
+    struct stat st;
+    struct cio_wal_segment *seg;
+
+    path = segment_path(ctx, id, "log");
+    if (!path) {
+        return NULL;
+    }
+
+    seg = calloc(1, sizeof(struct cio_wal_segment));
+    if (!seg) {
+        cio_errno();
+        free(path);
+        return NULL;
+    }
+    seg->id = id;
+
+    oflags = O_RDWR | O_APPEND;
+    if (create) {
+        oflags |= O_CREAT | O_TRUNC;
+    }
+
+    seg->fd = open(path, oflags, (mode_t) 0600);
+    if (seg->fd == -1) {
+        cio_errno();
+        cio_log_error(ctx, "[wal] cannot open segment %s", path);
+        free(path);
+        free(seg);
+        return NULL;
+    }
+    free(path);
+
+    if (!create) {
+        if (fstat(seg->fd, &st) == -1) {
+            cio_errno();
+            close(seg->fd);
+            free(seg);
+            return NULL;
+        }
+        seg->size = st.st_size;
+    }
+
+    mk_list_add(&seg->_head, &((struct cio_wal *) ctx->wal)->segments);
+    return seg;
+}
+
+static void segment_destroy(struct cio_ctx *ctx, struct cio_wal_segment *seg,
+                            int delete)
+{
+    char *path;
+
+    close(seg->fd);
+
+    if (delete == CIO_TRUE) {
+        path = segment_path(ctx, seg->id, "log");
+        if (path) {
+            unlink(path);
+            free(path);
+        }
+        path = segment_path(ctx, seg->id, "idx");
+        if (path) {
+            unlink(path);
+            free(path);
+        }
+        cio_log_debug(ctx, "[wal] segment %u released", seg->id);
+    }
+
+    mk_list_del(&seg->_head);
+    free(seg->index);
+    free(seg);
+}
+
+static int index_append(struct cio_wal_segment *seg, off_t offset,
+                        const char *header, const void *payload, size_t len)
+{
+    int ret;
+
+    ret = buf_reserve(&seg->index, &seg->index_size, seg->index_len,
+                      8 + CIO_WAL_HEADER_SIZE + len);
+    if (ret == -1) {
+        return -1;
+    }
+
+    put64(seg->index + seg->index_len, offset);
+    memcpy(seg->index + seg->index_len + 8, header, CIO_WAL_HEADER_SIZE);
+    if (len > 0) {
+        memcpy(seg->index + seg->index_len + 8 + CIO_WAL_HEADER_SIZE,
+               payload, len);
+    }
+    seg->index_len += 8 + CIO_WAL_HEADER_SIZE + len;
+
+    return 0;
+}
+
+/*
+ * Store the index of a segment that will not receive more records. The
+ * index is written to a temporary file and renamed, so a partial index
+ * is never found; a missing index only means the segment must be scanned.
+ */
+static int segment_write_index(struct cio_ctx *ctx,
+                               struct cio_wal_segment *seg)
+{
+    int fd;
+    int ret;
+    char *path;
+    char *tmp_path;
+    char trailer[CIO_WAL_INDEX_TRAILER];
+    struct iovec iov[2];
+
+    path = segment_path(ctx, seg->id, "idx");
+    tmp_path = segment_path(ctx, seg->id, "idx.tmp");
+    if (!path || !tmp_path) {
+        free(path);
+        free(tmp_path);
+        return -1;
+    }
+
+    trailer[0] = 'C';
+    trailer[1] = 'W';
+    trailer[2] = 'I';
+    trailer[3] = 'X';
+    put64(trailer + 4, seg->size);
+    put32(trailer + 12, wal_crc(seg->index, seg->index_len));
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, (mode_t) 0600);
+    if (fd == -1) {
+        cio_errno();
+        free(path);
+        free(tmp_path);
+        return -1;
+    }
+
+    iov[0].iov_base = seg->index;
+    iov[0].iov_len = seg->index_len;
+    iov[1].iov_base = trailer;
+    iov[1].iov_len = sizeof(trailer);
+
+    ret = write_iov(fd, iov, 2);
+    if (ret == 0 && (ctx->flags & CIO_FULL_SYNC)) {
+        ret = wal_fdatasync(fd);
+    }
+    close(fd);
+
+    if (ret == 0) {
+        ret = rename(tmp_path, path);
+    }
+
+    if (ret == -1) {
+        cio_errno();
+        unlink(tmp_path);
+    }
+
+    free(path);
+    free(tmp_path);
+
+    free(seg->index);
+    seg->index = NULL;
+    seg->index_len = 0;
+    seg->index_size = 0;
+
+    return ret;
+}
+
+/*
+ * Group commit: write every pending record of the active segment with a
+ * single writev(2). An optional 'extra' buffer is written right after the
+ * batch, it's used to append large payloads without copying them.
+ *
+ * On failure the segment is truncated to its last good size and the batch
+ * is kept so the write can be retried.
+ */
+static int wal_write(struct cio_ctx *ctx, const void *extra, size_t extra_len)
+{
+    int ret;
+    struct iovec iov[2];
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_segment *seg = wal->active;
+
+    if (!seg || (wal->batch_len == 0 && extra_len == 0)) {
+        return 0;
+    }
+
+    iov[0].iov_base = wal->batch;
+    iov[0].iov_len = wal->batch_len;
+    iov[1].iov_base = (void *) extra;
+    iov[1].iov_len = extra_len;
+
+    ret = write_iov(seg->fd, iov, 2);
+    if (ret == -1) {
+        cio_errno();
+        cio_log_error(ctx, "[wal] cannot write to segment %u", seg->id);
+        if (ftruncate(seg->fd, seg->size) == -1) {
+            cio_errno();
+        }
+        return -1;
+    }
+
+    seg->size += wal->batch_len + extra_len;
+    wal->batch_len = 0;
+
+    if (ctx->flags & CIO_FULL_SYNC) {
+        ret = wal_fdatasync(seg->fd);
+        if (ret == -1) {
+            cio_errno();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Delete the oldest segments once no chunk has records on them */
+static void wal_reclaim(struct cio_ctx *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_segment *seg;
+
+    /*
+     * Deletions are records too: a segment can only go away when all the
+     * older ones are gone, otherwise a deleted chunk could be found again.
+     */
+    mk_list_foreach_safe(head, tmp, &wal->segments) {
+        seg = mk_list_entry(head, struct cio_wal_segment, _head);
+        if (seg == wal->active || seg->refs > 0) {
+            break;
+        }
+        segment_destroy(ctx, seg, CIO_TRUE);
+    }
+}
+
+static int chunk_ref(struct cio_wal *wal, struct cio_wal_chunk *wc,
+                     struct cio_wal_segment *seg)
+{
+    int i;
+    uint32_t *tmp;
+
+    /* most records of a chunk land in the same segment */
+    if (wc->segs_count > 0 && wc->segs[wc->segs_count - 1] == seg->id) {
+        return 0;
+    }
+
+    for (i = 0; i < wc->segs_count; i++) {
+        if (wc->segs[i] == seg->id) {
+            return 0;
+        }
+    }
+
+    if (wc->segs_count == wc->segs_size) {
+        tmp = realloc(wc->segs, sizeof(uint32_t) * (wc->segs_size + 4));
+        if (!tmp) {
+            cio_errno();
+            return -1;
+        }
+        wc->segs = tmp;
+        wc->segs_size += 4;
+    }
+
+    wc->segs[wc->segs_count++] = seg->id;
+    seg->refs++;
+
+    return 0;
+}
+
+static void chunk_unref_all(struct cio_wal *wal, struct cio_wal_chunk *wc)
+{
+    int i;
+    struct cio_wal_segment *seg;
+
+    for (i = 0; i < wc->segs_count; i++) {
+        seg = segment_get(wal, wc->segs[i]);
+        if (seg) {
+            seg->refs--;
+        }
+    }
+    wc->segs_count = 0;
+}
+
+static int ext_reserve(struct cio_wal_chunk *wc)
+{
+    int size;
+    struct cio_wal_extent *tmp;
+
+    if (wc->ext_count < wc->ext_size) {
+        return 0;
+    }
+
+    size = wc->ext_size ? wc->ext_size * 2 : 16;
+    tmp = realloc(wc->ext, sizeof(struct cio_wal_extent) * size);
+    if (!tmp) {
+        cio_errno();
+        return -1;
+    }
+    wc->ext = tmp;
+    wc->ext_size = size;
+
+    return 0;
+}
+
+/* Drop the content extents beyond 'size' bytes */
+static void ext_trim(struct cio_wal_chunk *wc, size_t size)
+{
+    int i;
+    size_t total = 0;
+
+    for (i = 0; i < wc->ext_count; i++) {
+        if (total + wc->ext[i].len >= size) {
+            wc->ext[i].len = size - total;
+            wc->ext_count = wc->ext[i].len > 0 ? i + 1 : i;
+            return;
+        }
+        total += wc->ext[i].len;
+    }
+}
+
+static int wal_rotate(struct cio_ctx *ctx);
+
+/*
+ * Queue a record for the chunk in the active segment. If 'ext' is set it
+ * receives the location of the payload.
+ */
+static int wal_append(struct cio_ctx *ctx, struct cio_wal_chunk *wc, int type,
+                      const void *data, size_t len,
+                      struct cio_wal_extent *ext)
+{
+    int ret;
+    int flags = 0;
+    int direct;
+    char *header;
+    off_t offset;
+    size_t need;
+    size_t saved_batch;
+    size_t saved_index;
+    uint32_t crc = 0;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_segment *seg;
+
+    if (len > UINT32_MAX) {
+        cio_log_error(ctx, "[wal] record too large: %zu bytes", len);
+        return -1;
+    }
+
+    seg = wal->active;
+    if (seg && seg->size + wal->batch_len > 0 &&
+        seg->size + wal->batch_len + CIO_WAL_HEADER_SIZE + len >
+        CIO_WAL_SEGMENT_SIZE) {
+        ret = wal_rotate(ctx);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
+    if (!wal->active) {
+        seg = segment_open(ctx, wal->next_seg_id, CIO_TRUE);
+        if (!seg) {
+            return -1;
+        }
+        wal->next_seg_id++;
+        wal->active = seg;
+    }
+    seg = wal->active;
+
+    /* reference the segment before the record exists */
+    ret = chunk_ref(wal, wc, seg);
+    if (ret == -1) {
+        return -1;
+    }
+
+    direct = (type == CIO_WAL_REC_DATA && len >= CIO_WAL_DIRECT_SIZE);
+    need = CIO_WAL_HEADER_SIZE + (direct ? 0 : len);
+
+    ret = buf_reserve(&wal->batch, &wal->batch_size, wal->batch_len, need);
+    if (ret == -1) {
+        return -1;
+    }
+
+    if (ctx->flags & CIO_CHECKSUM) {
+        flags |= CIO_WAL_REC_CRC;
+        if (ctx->flags & CIO_CRC32C) {
+            flags |= CIO_WAL_REC_CRC32C;
+        }
+        crc = rec_crc(flags, data, len);
+    }
+
+    saved_batch = wal->batch_len;
+    saved_index = seg->index_len;
+    offset = seg->size + wal->batch_len;
+
+    header = wal->batch + wal->batch_len;
+    header_pack(header, type, flags, wc->id, len, crc);
+    if (!direct && len > 0) {
+        memcpy(header + CIO_WAL_HEADER_SIZE, data, len);
+    }
+    wal->batch_len += need;
+
+    if (record_indexed_payload(type)) {
+        ret = index_append(seg, offset, header, data, len);
+    }
+    else {
+        ret = index_append(seg, offset, header, NULL, 0);
+    }
+    if (ret == -1) {
+        wal->batch_len = saved_batch;
+        return -1;
+    }
+
+    if (direct) {
+        ret = wal_write(ctx, data, len);
+        if (ret == -1) {
+            wal->batch_len = saved_batch;
+            seg->index_len = saved_index;
+            return -1;
+        }
+    }
+    else if (wal->batch_len >= CIO_WAL_BATCH_SIZE) {
+        /* a failure keeps the records queued for the next commit */
+        wal_write(ctx, NULL, 0);
+    }
+
+    if (ext) {
+        ext->seg = seg->id;
+        ext->len = len;
+        ext->rec_len = len;
+        ext->crc = crc;
+        ext->flags = flags;
+        ext->offset = offset + CIO_WAL_HEADER_SIZE;
+    }
+
+    return 0;
+}
+
+static int append_create(struct cio_ctx *ctx, struct cio_chunk *ch,
+                         struct cio_wal_chunk *wc)
+{
+    int ret;
+    int st_len;
+    int ch_len;
+    char *buf;
+
+    st_len = strlen(ch->st->name);
+    ch_len = strlen(ch->name);
+    if (st_len > 65535 || ch_len > 65535) {
+        cio_log_error(ctx, "[wal] invalid name length: %s/%s",
+                      ch->st->name, ch->name);
+        return -1;
+    }
+
+    buf = malloc(4 + st_len + ch_len);
+    if (!buf) {
+        cio_errno();
+        return -1;
+    }
+
+    put16(buf, st_len);
+    memcpy(buf + 2, ch->st->name, st_len);
+    put16(buf + 2 + st_len, ch_len);
+    memcpy(buf + 4 + st_len, ch->name, ch_len);
+
+    ret = wal_append(ctx, wc, CIO_WAL_REC_CREATE, buf, 4 + st_len + ch_len,
+                     NULL);
+    free(buf);
+
+    return ret;
+}
+
+static int reserve_scratch(struct cio_wal *wal, size_t size)
+{
+    char *tmp;
+
+    if (wal->scratch_size >= size) {
+        return 0;
+    }
+
+    tmp = realloc(wal->scratch, size);
+    if (!tmp) {
+        cio_errno();
+        return -1;
+    }
+    wal->scratch = tmp;
+    wal->scratch_size = size;
+
+    return 0;
+}
+
+/*
+ * Read the content of a chunk from its extents into a new buffer. Extents
+ * that are close in the same segment are read with a single pread(2).
+ */
+static int chunk_read(struct cio_ctx *ctx, struct cio_chunk *ch, char **out)
+{
+    int i;
+    int j;
+    int k;
+    int ret;
+    char *p;
+    char *buf;
+    off_t span;
+    size_t pos = 0;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_chunk *wc = ch->backend;
+    struct cio_wal_extent *ext;
+    struct cio_wal_segment *seg;
+
+    /* the content might still be in the batch */
+    if (wal->batch_len > 0) {
+        ret = wal_write(ctx, NULL, 0);
+        if (ret == -1) {
+            return CIO_ERROR;
+        }
+    }
+
+    buf = malloc(wc->size + 1);
+    if (!buf) {
+        cio_errno();
+        return CIO_ERROR;
+    }
+
+    i = 0;
+    while (i < wc->ext_count) {
+        ext = wc->ext;
+        seg = segment_get(wal, ext[i].seg);
+        if (!seg) {
+            cio_log_error(ctx, "[wal] segment %u of chunk %s/%s is missing",
+                          ext[i].seg, ch->st->name, ch->name);
+            cio_error_set(ch, CIO_ERR_BAD_LAYOUT);
+            free(buf);
+            return CIO_CORRUPTED;
+        }
+
+        j = i;
+        while (j + 1 < wc->ext_count &&
+               ext[j + 1].seg == ext[i].seg &&
+               ext[j + 1].offset >= ext[j].offset + ext[j].rec_len &&
+               ext[j + 1].offset + ext[j + 1].rec_len - ext[i].offset <=
+               CIO_WAL_READ_SPAN) {
+            j++;
+        }
+
+        span = ext[j].offset + ext[j].rec_len - ext[i].offset;
+        ret = reserve_scratch(wal, span);
+        if (ret == -1) {
+            free(buf);
+            return CIO_ERROR;
+        }
+
+        ret = read_full(seg->fd, wal->scratch, span, ext[i].offset);
+        if (ret == -1) {
+            cio_log_error(ctx, "[wal] cannot read chunk %s/%s from segment %u",
+                          ch->st->name, ch->name, seg->id);
+            cio_error_set(ch, CIO_ERR_BAD_LAYOUT);
+            free(buf);
+            return CIO_CORRUPTED;
+        }
+
+        for (k = i; k <= j; k++) {
+            p = wal->scratch + (ext[k].offset - ext[i].offset);
+            if ((ctx->flags & CIO_CHECKSUM) &&
+                (ext[k].flags & CIO_WAL_REC_CRC) &&
+                rec_crc(ext[k].flags, p, ext[k].rec_len) != ext[k].crc) {
+                cio_log_error(ctx, "[wal] invalid crc32 at %s/%s",
+                              ch->st->name, ch->name);
+                cio_error_set(ch, CIO_ERR_BAD_CHECKSUM);
+                free(buf);
+                return CIO_CORRUPTED;
+            }
+            memcpy(buf + pos, p, ext[k].len);
+            pos += ext[k].len;
+        }
+
+        i = j + 1;
+    }
+
+    /* don't keep large read buffers around */
+    if (wal->scratch_size > CIO_WAL_READ_SPAN) {
+        free(wal->scratch);
+        wal->scratch = NULL;
+        wal->scratch_size = 0;
+    }
+
+    if (pos != wc->size) {
+        cio_log_error(ctx, "[wal] content size mismatch at %s/%s",
+                      ch->st->name, ch->name);
+        cio_error_set(ch, CIO_ERR_BAD_LAYOUT);
+        free(buf);
+        return CIO_CORRUPTED;
+    }
+
+    buf[pos] = '\0';
+    *out = buf;
+
+    return CIO_OK;
+}
+
+/*
+ * Append the current state of a chunk as new records and drop its
+ * references to older segments.
+ */
+static int chunk_relocate(struct cio_ctx *ctx, struct cio_chunk *ch)
+{
+    int i;
+    int ret;
+    int segs_count;
+    uint32_t *segs;
+    char *buf = NULL;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_chunk *wc = ch->backend;
+    struct cio_wal_extent ext;
+    struct cio_wal_segment *seg;
+
+    if (wc->up) {
+        buf = wc->buf_data;
+    }
+    else if (wc->size > 0) {
+        ret = chunk_read(ctx, ch, &buf);
+        if (ret != CIO_OK) {
+            return -1;
+        }
+    }
+
+    ret = ext_reserve(wc);
+    if (ret == -1) {
+        goto out;
+    }
+
+    /* new records reference the segments from scratch */
+    segs = wc->segs;
+    segs_count = wc->segs_count;
+    wc->segs = NULL;
+    wc->segs_count = 0;
+    wc->segs_size = 0;
+
+    ret = append_create(ctx, ch, wc);
+    if (ret == 0 && wc->meta_len > 0) {
+        ret = wal_append(ctx, wc, CIO_WAL_REC_META,
+                         wc->meta_data, wc->meta_len, NULL);
+    }
+    if (ret == 0 && wc->size > 0) {
+        ret = wal_append(ctx, wc, CIO_WAL_REC_DATA, buf, wc->size, &ext);
+    }
+
+    if (ret == -1) {
+        /* keep the old records alive, they are still the valid ones */
+        for (i = 0; i < segs_count; i++) {
+            seg = segment_get(wal, segs[i]);
+            if (seg) {
+                chunk_ref(wal, wc, seg);
+                seg->refs--;
+            }
+        }
+        free(segs);
+        goto out;
+    }
+
+    for (i = 0; i < segs_count; i++) {
+        seg = segment_get(wal, segs[i]);
+        if (seg) {
+            seg->refs--;
+        }
+    }
+    free(segs);
+
+    wc->ext_count = 0;
+    if (wc->size > 0) {
+        wc->ext[wc->ext_count++] = ext;
+    }
+
+out:
+    if (!wc->up) {
+        free(buf);
+    }
+    return ret;
+}
+
+/*
+ * A single long living chunk would keep every newer segment in place, when
+ * there are too many sealed segments the chunks of the oldest one are
+ * appended again to the active segment so it can be released.
+ */
+static void wal_compact(struct cio_ctx *ctx)
+{
+    int i;
+    int ret;
+    int sealed;
+    int count = 0;
+    struct mk_list *head;
+    struct mk_list *c_head;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_segment *oldest;
+    struct cio_wal_chunk *wc;
+    struct cio_stream *st;
+    struct cio_chunk *ch;
+
+    sealed = mk_list_size(&wal->segments);
+    if (wal->active) {
+        sealed--;
+    }
+
+    if (sealed <= CIO_WAL_COMPACT) {
+        return;
+    }
+
+    oldest = mk_list_entry_first(&wal->segments, struct cio_wal_segment,
+                                 _head);
+    if (oldest == wal->active) {
+        return;
+    }
+
+    wal->compacting = CIO_TRUE;
+
+    mk_list_foreach(head, &ctx->streams) {
+        st = mk_list_entry(head, struct cio_stream, _head);
+        if (st->type != CIO_STORE_WAL) {
+            continue;
+        }
+
+        mk_list_foreach(c_head, &st->chunks) {
+            ch = mk_list_entry(c_head, struct cio_chunk, _head);
+            wc = ch->backend;
+
+            /* chunks being opened are not linked to their backend yet */
+            if (!wc) {
+                continue;
+            }
+
+            for (i = 0; i < wc->segs_count; i++) {
+                if (wc->segs[i] == oldest->id) {
+                    break;
+                }
+            }
+            if (i == wc->segs_count) {
+                continue;
+            }
+
+            ret = chunk_relocate(ctx, ch);
+            if (ret == -1) {
+                cio_log_warn(ctx, "[wal] cannot relocate chunk %s/%s",
+                             st->name, ch->name);
+                continue;
+            }
+            count++;
+        }
+    }
+
+    /* relocated records must be stored before older ones are released */
+    ret = wal_write(ctx, NULL, 0);
+    wal->compacting = CIO_FALSE;
+
+    if (ret == 0) {
+        cio_log_debug(ctx, "[wal] %i chunks relocated from segment %u",
+                      count, oldest->id);
+        wal_reclaim(ctx);
+    }
+}
+
+/* Close the active segment: write pending records and its index */
+static int wal_rotate(struct cio_ctx *ctx)
+{
+    int ret;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_segment *seg = wal->active;
+
+    if (!seg) {
+        return 0;
+    }
+
+    ret = wal_write(ctx, NULL, 0);
+    if (ret == -1) {
+        return -1;
+    }
+
+    wal->active = NULL;
+
+    if (seg->size == 0 && seg->refs == 0) {
+        segment_destroy(ctx, seg, CIO_TRUE);
+        return 0;
+    }
+
+    ret = segment_write_index(ctx, seg);
+    if (ret == -1) {
+        /* not fatal: the segment will be scanned on the next load */
+        cio_log_warn(ctx, "[wal] cannot write index of segment %u", seg->id);
+    }
+
+    wal_reclaim(ctx);
+    if (wal->compacting == CIO_FALSE) {
+        wal_compact(ctx);
+    }
+
+    return 0;
+}
+
+int cio_wal_init(struct cio_ctx *ctx)
+{
+    struct cio_wal *wal;
+
+    wal = calloc(1, sizeof(struct cio_wal));
+    if (!wal) {
+        cio_errno();
+        return -1;
+    }
+    mk_list_init(&wal->segments);
+    wal->next_seg_id = 1;
+    wal->next_chunk_id = 1;
+
+    ctx->wal = wal;
+    return 0;
+}
+
+void cio_wal_destroy(struct cio_ctx *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_segment *seg;
+
+    if (!wal) {
+        return;
+    }
+
+    wal->compacting = CIO_TRUE;
+    wal_rotate(ctx);
+
+    mk_list_foreach_safe(head, tmp, &wal->segments) {
+        seg = mk_list_entry(head, struct cio_wal_segment, _head);
+        segment_destroy(ctx, seg, CIO_FALSE);
+    }
+
+    free(wal->batch);
+    free(wal->scratch);
+    free(wal->entries);
+    free(wal);
+    ctx->wal = NULL;
+}
+
+int cio_wal_flush(struct cio_ctx *ctx)
+{
+    if (!ctx->wal) {
+        return 0;
+    }
+
+    return wal_write(ctx, NULL, 0);
+}
+
+/*
+ * Load helpers
+ * ------------
+ */
+
+static int entry_find(struct cio_wal *wal, uint32_t id)
+{
+    int low = 0;
+    int mid;
+    int high = wal->entries_count - 1;
+
+    while (low <= high) {
+        mid = (low + high) / 2;
+        if (wal->entries[mid].id == id) {
+            return mid;
+        }
+        else if (wal->entries[mid].id < id) {
+            low = mid + 1;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+
+    return -1;
+}
+
+static int entry_add(struct cio_wal *wal, uint32_t id, struct cio_chunk *ch)
+{
+    int i;
+    int size;
+    struct cio_wal_entry *tmp;
+
+    if (wal->entries_count == wal->entries_size) {
+        size = wal->entries_size ? wal->entries_size * 2 : 256;
+        tmp = realloc(wal->entries, sizeof(struct cio_wal_entry) * size);
+        if (!tmp) {
+            cio_errno();
+            return -1;
+        }
+        wal->entries = tmp;
+        wal->entries_size = size;
+    }
+
+    /* ids are increasing, only relocated chunks can show up out of order */
+    i = wal->entries_count;
+    while (i > 0 && wal->entries[i - 1].id > id) {
+        wal->entries[i] = wal->entries[i - 1];
+        i--;
+    }
+    wal->entries[i].id = id;
+    wal->entries[i].ch = ch;
+    wal->entries_count++;
+
+    return 0;
+}
+
+static int load_create(struct cio_ctx *ctx, struct cio_wal_segment *seg,
+                       struct wal_record *rec, const char *payload)
+{
+    int i;
+    int err;
+    int ret;
+    int st_len;
+    int ch_len;
+    char *st_name;
+    char *ch_name;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_stream *st;
+    struct cio_chunk *ch;
+    struct cio_wal_chunk *wc;
+
+    if (rec->len < 4) {
+        return -1;
+    }
+    st_len = get16(payload);
+    if (st_len == 0 || 2 + st_len + 2 > rec->len) {
+        return -1;
+    }
+    ch_len = get16(payload + 2 + st_len);
+    if (ch_len == 0 || 4 + st_len + ch_len != rec->len) {
+        return -1;
+    }
+
+    i = entry_find(wal, rec->id);
+    if (i >= 0) {
+        ch = wal->entries[i].ch;
+        if (!ch) {
+            return 0;
+        }
+
+        /* chunk relocated: the records that follow replace the old ones */
+        wc = ch->backend;
+        chunk_unref_all(wal, wc);
+        wc->ext_count = 0;
+        wc->size = 0;
+        free(wc->meta_data);
+        wc->meta_data = NULL;
+        wc->meta_len = 0;
+
+        return chunk_ref(wal, wc, seg);
+    }
+
+    st_name = strndup(payload + 2, st_len);
+    ch_name = strndup(payload + 4 + st_len, ch_len);
+    if (!st_name || !ch_name) {
+        cio_errno();
+        free(st_name);
+        free(ch_name);
+        return -1;
+    }
+
+    ret = -1;
+    st = cio_stream_get(ctx, st_name);
+    if (!st) {
+        st = cio_stream_create(ctx, st_name, CIO_STORE_WAL);
+    }
+
+    if (st && st->type == CIO_STORE_WAL) {
+        wal->load_id = rec->id;
+        ch = cio_chunk_open(ctx, st, ch_name, CIO_OPEN, 0, &err);
+        if (ch) {
+            ret = entry_add(wal, rec->id, ch);
+            if (ret == 0) {
+                ret = chunk_ref(wal, ch->backend, seg);
+            }
+        }
+    }
+
+    if (ret == -1) {
+        cio_log_error(ctx, "[wal] cannot restore chunk %s/%s",
+                      st_name, ch_name);
+    }
+
+    if (rec->id >= wal->next_chunk_id) {
+        wal->next_chunk_id = rec->id + 1;
+    }
+
+    free(st_name);
+    free(ch_name);
+
+    return ret;
+}
+
+static int load_record(struct cio_ctx *ctx, struct cio_wal_segment *seg,
+                       struct wal_record *rec, const char *payload)
+{
+    int i;
+    int ret;
+    uint64_t size;
+    char *meta;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_chunk *ch;
+    struct cio_wal_chunk *wc;
+    struct cio_wal_extent *ext;
+
+    if (rec->type == CIO_WAL_REC_CREATE) {
+        return load_create(ctx, seg, rec, payload);
+    }
+
+    /* records of chunks already deleted or from released segments */
+    i = entry_find(wal, rec->id);
+    if (i == -1 || !wal->entries[i].ch) {
+        return 0;
+    }
+    ch = wal->entries[i].ch;
+    wc = ch->backend;
+
+    switch (rec->type) {
+    case CIO_WAL_REC_DATA:
+        ret = ext_reserve(wc);
+        if (ret == -1) {
+            return -1;
+        }
+        ext = &wc->ext[wc->ext_count++];
+        ext->seg = seg->id;
+        ext->len = rec->len;
+        ext->rec_len = rec->len;
+        ext->crc = rec->crc;
+        ext->flags = rec->flags;
+        ext->offset = rec->offset + CIO_WAL_HEADER_SIZE;
+        wc->size += rec->len;
+        break;
+    case CIO_WAL_REC_TRUNCATE:
+        if (rec->len != 8) {
+            return -1;
+        }
+        size = get64(payload);
+        if (size > wc->size) {
+            return -1;
+        }
+        ext_trim(wc, size);
+        wc->size = size;
+        break;
+    case CIO_WAL_REC_META:
+        meta = NULL;
+        if (rec->len > 0) {
+            meta = malloc(rec->len);
+            if (!meta) {
+                cio_errno();
+                return -1;
+            }
+            memcpy(meta, payload, rec->len);
+        }
+        free(wc->meta_data);
+        wc->meta_data = meta;
+        wc->meta_len = rec->len;
+        break;
+    case CIO_WAL_REC_DELETE:
+        cio_chunk_close(ch, CIO_TRUE);
+        wal->entries[i].ch = NULL;
+        return 0;
+    }
+
+    return chunk_ref(wal, wc, seg);
+}
+
+/* Load the records of a segment from its index file */
+static int segment_load_index(struct cio_ctx *ctx, struct cio_wal_segment *seg)
+{
+    int fd;
+    int ret;
+    int pass;
+    char *p;
+    char *end;
+    char *buf;
+    char *path;
+    size_t len;
+    struct stat st;
+    struct wal_record rec;
+
+    path = segment_path(ctx, seg->id, "idx");
+    if (!path) {
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ret = fstat(fd, &st);
+    if (ret == -1 || st.st_size < CIO_WAL_INDEX_TRAILER) {
+        close(fd);
+        return -1;
+    }
+
+    len = st.st_size;
+    buf = malloc(len);
+    if (!buf) {
+        cio_errno();
+        close(fd);
+        return -1;
+    }
+
+    ret = read_full(fd, buf, len, 0);
+    close(fd);
+    if (ret == -1) {
+        free(buf);
+        return -1;
+    }
+
+    end = buf + len - CIO_WAL_INDEX_TRAILER;
+    if (memcmp(end, "CWIX", 4) != 0 ||
+        get64(end + 4) != (uint64_t) seg->size ||
+        get32(end + 12) != wal_crc(buf, end - buf)) {
+        cio_log_warn(ctx, "[wal] invalid index for segment %u", seg->id);
+        free(buf);
+        return -1;
+    }
+
+    /* validate the whole index first, then apply it */
+    for (pass = 0; pass < 2; pass++) {
+        p = buf;
+        while (p < end) {
+            if (end - p < 8 + CIO_WAL_HEADER_SIZE) {
+                free(buf);
+                return -1;
+            }
+
+            rec.offset = get64(p);
+            ret = header_unpack(p + 8, &rec);
+            if (ret == -1 ||
+                rec.offset + CIO_WAL_HEADER_SIZE + rec.len > seg->size) {
+                free(buf);
+                return -1;
+            }
+            p += 8 + CIO_WAL_HEADER_SIZE;
+
+            if (record_indexed_payload(rec.type)) {
+                if ((size_t) (end - p) < rec.len) {
+                    free(buf);
+                    return -1;
+                }
+            }
+
+            if (pass == 1) {
+                ret = load_record(ctx, seg, &rec, p);
+                if (ret == -1) {
+                    cio_log_warn(ctx, "[wal] invalid record at segment %u "
+                                 "offset %lld", seg->id,
+                                 (long long) rec.offset);
+                }
+            }
+
+            if (record_indexed_payload(rec.type)) {
+                p += rec.len;
+            }
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+/*
+ * Load the records of a segment reading their headers, this is needed when
+ * the service stopped before the segment was rotated. A torn record at the
+ * end of the segment is discarded.
+ */
+static int segment_scan(struct cio_ctx *ctx, struct cio_wal_segment *seg)
+{
+    int ret;
+    off_t off = 0;
+    char header[CIO_WAL_HEADER_SIZE];
+    char *payload = NULL;
+    size_t payload_size = 0;
+    struct wal_record rec;
+
+    while (off + CIO_WAL_HEADER_SIZE <= seg->size) {
+        ret = read_full(seg->fd, header, sizeof(header), off);
+        if (ret == -1) {
+            break;
+        }
+
+        ret = header_unpack(header, &rec);
+        if (ret == -1 || off + CIO_WAL_HEADER_SIZE + rec.len > seg->size) {
+            break;
+        }
+        rec.offset = off;
+
+        if (record_indexed_payload(rec.type)) {
+            ret = buf_reserve(&payload, &payload_size, 0, rec.len + 1);
+            if (ret == -1) {
+                break;
+            }
+
+            ret = read_full(seg->fd, payload, rec.len,
+                            off + CIO_WAL_HEADER_SIZE);
+            if (ret == -1) {
+                break;
+            }
+
+            if ((rec.flags & CIO_WAL_REC_CRC) &&
+                rec_crc(rec.flags, payload, rec.len) != rec.crc) {
+                break;
+            }
+
+            ret = index_append(seg, off, header, payload, rec.len);
+        }
+        else {
+            ret = index_append(seg, off, header, NULL, 0);
+        }
+        if (ret == -1) {
+            free(payload);
+            return -1;
+        }
+
+        ret = load_record(ctx, seg, &rec, payload);
+        if (ret == -1) {
+            cio_log_warn(ctx, "[wal] invalid record at segment %u "
+                         "offset %lld", seg->id, (long long) off);
+        }
+
+        off += CIO_WAL_HEADER_SIZE + rec.len;
+    }
+    free(payload);
+
+    if (off < seg->size) {
+        cio_log_warn(ctx, "[wal] segment %u: discarding %lld bytes of an "
+                     "incomplete record", seg->id,
+                     (long long) (seg->size - off));
+        ret = ftruncate(seg->fd, off);
+        if (ret == -1) {
+            cio_errno();
+        }
+        seg->size = off;
+    }
+
+    return 0;
+}
+
+static int cmp_ids(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Restore the streams and chunks registered in the log. Chunks are loaded
+ * 'down': their content is read from the segments when they are put 'up'.
+ */
+int cio_wal_load(struct cio_ctx *ctx)
+{
+    int i;
+    int ret;
+    int count = 0;
+    int size = 0;
+    char *end;
+    uint32_t id;
+    uint32_t *tmp;
+    uint32_t *ids = NULL;
+    unsigned long val;
+    DIR *dir;
+    struct dirent *ent;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_segment *seg;
+
+    dir = opendir(ctx->root_path);
+    if (!dir) {
+        cio_errno();
+        return -1;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strlen(ent->d_name) != 16 ||
+            strncmp(ent->d_name, "wal-", 4) != 0 ||
+            strcmp(ent->d_name + 12, ".log") != 0) {
+            continue;
+        }
+
+        val = strtoul(ent->d_name + 4, &end, 10);
+        if (end != ent->d_name + 12 || val > UINT32_MAX) {
+            continue;
+        }
+
+        if (count == size) {
+            size = size ? size * 2 : 16;
+            tmp = realloc(ids, sizeof(uint32_t) * size);
+            if (!tmp) {
+                cio_errno();
+                free(ids);
+                closedir(dir);
+                return -1;
+            }
+            ids = tmp;
+        }
+        ids[count++] = val;
+    }
+    closedir(dir);
+
+    if (count > 0) {
+        qsort(ids, count, sizeof(uint32_t), cmp_ids);
+    }
+
+    wal->loading = CIO_TRUE;
+    ret = 0;
+    for (i = 0; i < count; i++) {
+        id = ids[i];
+        seg = segment_open(ctx, id, CIO_FALSE);
+        if (!seg) {
+            ret = -1;
+            break;
+        }
+        wal->next_seg_id = id + 1;
+
+        if (segment_load_index(ctx, seg) == 0) {
+            continue;
+        }
+
+        ret = segment_scan(ctx, seg);
+        if (ret == -1) {
+            break;
+        }
+
+        /* next time this segment is loaded from its index */
+        segment_write_index(ctx, seg);
+    }
+    wal->loading = CIO_FALSE;
+
+    free(ids);
+    free(wal->entries);
+    wal->entries = NULL;
+    wal->entries_count = 0;
+    wal->entries_size = 0;
+
+    if (ret == -1) {
+        return -1;
+    }
+
+    wal_reclaim(ctx);
+
+    cio_log_debug(ctx, "[wal] %i segments loaded, next chunk id %u",
+                  mk_list_size(&wal->segments), wal->next_chunk_id);
+    return 0;
+}
+
+/*
+ * Chunk interface
+ * ---------------
+ */
+
+static int wal_chunk_up(struct cio_chunk *ch, int enforced)
+{
+    int ret;
+    char *buf;
+    struct cio_ctx *ctx = ch->ctx;
+    struct cio_wal_chunk *wc = ch->backend;
+
+    if (wc->up) {
+        return CIO_OK;
+    }
+
+    if (enforced == CIO_TRUE &&
+        ctx->total_chunks_up >= ctx->max_chunks_up) {
+        return CIO_ERROR;
+    }
+
+    ret = chunk_read(ctx, ch, &buf);
+    if (ret != CIO_OK) {
+        return ret;
+    }
+
+    wc->buf_data = buf;
+    wc->buf_size = wc->size + 1;
+    wc->up = CIO_TRUE;
+    cio_chunk_counter_total_up_add(ctx);
+
+    return CIO_OK;
+}
+
+struct cio_wal_chunk *cio_wal_open(struct cio_ctx *ctx, struct cio_stream *st,
+                                   struct cio_chunk *ch, int flags,
+                                   size_t size, int *err)
+{
+    int ret;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_chunk *wc;
+
+    *err = CIO_ERROR;
+
+    wc = calloc(1, sizeof(struct cio_wal_chunk));
+    if (!wc) {
+        cio_errno();
+        return NULL;
+    }
+    wc->crc_cur = cio_crc32_init();
+    wc->realloc_size = cio_getpagesize() * 8;
+
+    if (wal->loading) {
+        wc->id = wal->load_id;
+        *err = CIO_OK;
+        return wc;
+    }
+
+    wc->id = wal->next_chunk_id++;
+    ret = append_create(ctx, ch, wc);
+    if (ret == -1) {
+        chunk_unref_all(wal, wc);
+        free(wc->segs);
+        free(wc);
+        return NULL;
+    }
+
+    /* same as file chunks: over the limit new chunks are created 'down' */
+    if (ctx->total_chunks_up < ctx->max_chunks_up) {
+        if (size == 0) {
+            size = wc->realloc_size;
+        }
+        wc->buf_data = malloc(size);
+        if (!wc->buf_data) {
+            cio_errno();
+            chunk_unref_all(wal, wc);
+            free(wc->segs);
+            free(wc);
+            return NULL;
+        }
+        wc->buf_size = size;
+        wc->up = CIO_TRUE;
+        cio_chunk_counter_total_up_add(ctx);
+    }
+
+    *err = CIO_OK;
+    return wc;
+}
+
+void cio_wal_close(struct cio_chunk *ch, int delete)
+{
+    int ret;
+    struct cio_ctx *ctx = ch->ctx;
+    struct cio_wal *wal = ctx->wal;
+    struct cio_wal_chunk *wc = ch->backend;
+
+    if (!wc) {
+        return;
+    }
+
+    if (wal->loading) {
+        /* delete record found while loading */
+        chunk_unref_all(wal, wc);
+    }
+    else if (delete == CIO_TRUE) {
+        ret = wal_append(ctx, wc, CIO_WAL_REC_DELETE, NULL, 0, NULL);
+        if (ret == -1) {
+            cio_log_error(ctx, "[wal] cannot delete chunk %s/%s",
+                          ch->st->name, ch->name);
+        }
+        else {
+            chunk_unref_all(wal, wc);
+            wal_reclaim(ctx);
+        }
+    }
+    /*
+     * a chunk closed without being deleted keeps its segments references:
+     * it's still part of the log and will be loaded again.
+     */
+
+    if (wc->up) {
+        cio_chunk_counter_total_up_sub(ctx);
+    }
+
+    free(wc->buf_data);
+    free(wc->meta_data);
+    free(wc->ext);
+    free(wc->segs);
+    free(wc);
+    ch->backend = NULL;
+}
+
+int cio_wal_write(struct cio_chunk *ch, const void *buf, size_t count)
+{
+    int ret;
+    char *tmp;
+    size_t new_size;
+    struct cio_wal_extent ext;
+    struct cio_wal_chunk *wc = ch->backend;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if (!wc->up) {
+        cio_log_error(ch->ctx, "[wal] chunk is not up: %s:%s",
+                      ch->st->name, ch->name);
+        return -1;
+    }
+
+    if (wc->buf_size - wc->size < count) {
+        new_size = wc->buf_size + wc->realloc_size;
+        while (new_size < wc->size + count) {
+            new_size += wc->realloc_size;
+        }
+
+        tmp = realloc(wc->buf_data, new_size);
+        if (!tmp) {
+            cio_errno();
+            return -1;
+        }
+        wc->buf_data = tmp;
+        wc->buf_size = new_size;
+    }
+
+    ret = ext_reserve(wc);
+    if (ret == -1) {
+        return -1;
+    }
+
+    /*
+     * the append can relocate this chunk (compaction), so the extents
+     * array is only updated once the record is queued.
+     */
+    ret = wal_append(ch->ctx, wc, CIO_WAL_REC_DATA, buf, count, &ext);
+    if (ret == -1) {
+        return -1;
+    }
+    wc->ext[wc->ext_count++] = ext;
+
+    memcpy(wc->buf_data + wc->size, buf, count);
+    wc->size += count;
+
+    return 0;
+}
+
+int cio_wal_write_at(struct cio_chunk *ch, off_t offset,
+                     const void *buf, size_t count)
+{
+    int ret;
+    char value[8];
+    struct cio_wal_chunk *wc = ch->backend;
+
+    if (offset < 0 || (size_t) offset > wc->size) {
+        cio_log_error(ch->ctx, "[wal] invalid offset %lld for %s:%s",
+                      (long long) offset, ch->st->name, ch->name);
+        return -1;
+    }
+
+    if ((size_t) offset < wc->size) {
+        put64(value, offset);
+        ret = wal_append(ch->ctx, wc, CIO_WAL_REC_TRUNCATE,
+                         value, sizeof(value), NULL);
+        if (ret == -1) {
+            return -1;
+        }
+        ext_trim(wc, offset);
+        wc->size = offset;
+    }
+
+    return cio_wal_write(ch, buf, count);
+}
+
+int cio_wal_write_metadata(struct cio_chunk *ch, char *buf, size_t size)
+{
+    int ret;
+    char *meta = NULL;
+    struct cio_wal_chunk *wc = ch->backend;
+
+    if (size > 0) {
+        meta = malloc(size);
+        if (!meta) {
+            cio_errno();
+            return -1;
+        }
+        memcpy(meta, buf, size);
+    }
+
+    ret = wal_append(ch->ctx, wc, CIO_WAL_REC_META, buf, size, NULL);
+    if (ret == -1) {
+        free(meta);
+        return -1;
+    }
+
+    free(wc->meta_data);
+    wc->meta_data = meta;
+    wc->meta_len = size;
+
+    return 0;
+}
+
+/*
+ * Syncing a chunk commits the records of every chunk, this is what makes
+ * the group commit: a single write (and fdatasync) covers all of them.
+ */
+int cio_wal_sync(struct cio_chunk *ch)
+{
+    return wal_write(ch->ctx, NULL, 0);
+}
+
+int cio_wal_read_prepare(struct cio_ctx *ctx, struct cio_chunk *ch)
+{
+    return wal_chunk_up(ch, CIO_FALSE);
+}
+
+int cio_wal_content_copy(struct cio_chunk *ch,
+                         void **out_buf, size_t *out_size)
+{
+    int ret;
+    char *buf;
+    struct cio_wal_chunk *wc = ch->backend;
+
+    if (!wc->up) {
+        /* read the content straight from the log, no need to put it up */
+        ret = chunk_read(ch->ctx, ch, &buf);
+        if (ret != CIO_OK) {
+            return -1;
+        }
+    }
+    else {
+        buf = malloc(wc->size + 1);
+        if (!buf) {
+            cio_errno();
+            return -1;
+        }
+        memcpy(buf, wc->buf_data, wc->size);
+        buf[wc->size] = '\0';
+    }
+
+    *out_buf = buf;
+    *out_size = wc->size;
+
+    return 0;
+}
+
+int cio_wal_is_up(struct cio_chunk *ch)
+{
+    struct cio_wal_chunk *wc = ch->backend;
+
+    return wc->up;
+}
+
+int cio_wal_up(struct cio_chunk *ch)
+{
+    return wal_chunk_up(ch, CIO_TRUE);
+}
+
+int cio_wal_up_force(struct cio_chunk *ch)
+{
+    return wal_chunk_up(ch, CIO_FALSE);
+}
+
+int cio_wal_down(struct cio_chunk *ch)
+{
+    int ret;
+    struct cio_wal_chunk *wc = ch->backend;
+
+    if (!wc->up) {
+        return CIO_OK;
+    }
+
+    /* the content lives in the log from now on */
+    ret = wal_write(ch->ctx, NULL, 0);
+
+    free(wc->buf_data);
+    wc->buf_data = NULL;
+    wc->buf_size = 0;
+    wc->up = CIO_FALSE;
+    cio_chunk_counter_total_up_sub(ch->ctx);
+
+    return ret;
+}
+
+void cio_wal_scan_dump(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    char tmp[PATH_MAX];
+    struct mk_list *head;
+    struct cio_wal_chunk *wc;
+    struct cio_chunk *ch;
+
+    mk_list_foreach(head, &st->chunks) {
+        ch = mk_list_entry(head, struct cio_chunk, _head);
+        wc = ch->backend;
+
+        snprintf(tmp, sizeof(tmp) -1, "%s/%s", ch->st->name, ch->name);
+        printf("        %-60s", tmp);
+        printf("meta_len=%i, data_size=%zu, extents=%i, %s\n",
+               wc->meta_len, wc->size, wc->ext_count,
+               wc->up ? "up" : "down");
+    }
+}
@@ -20,8 +20,10 @@
 #ifndef _WIN32
 #include <sys/mman.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 #endif
 #include <fcntl.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -660,6 +662,347 @@ void test_issue_write_at()
     TEST_CHECK(cf->fd <= 0);
 }
 
+#ifdef CIO_HAVE_SNAPPY
+/* Number of entries in a directory, hidden files included */
+static int dir_entries(const char *path)
+{
+    int count = 0;
+    DIR *dir;
+    struct dirent *ent;
+
+    dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+/* Compress a locked chunk on down and restore it on up */
+static void test_fs_compress()
+{
+    int i;
+    int ret;
+    int err;
+    int len;
+    char *in_data;
+    char *out_data;
+    size_t in_size;
+    size_t out_size;
+    ssize_t raw_size;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+    struct cio_file *cf;
+
+    /* Dummy break line for clarity on acutest output */
+    printf("\n");
+
+    /* cleanup environment */
+    cio_utils_recursive_delete(CIO_ENV);
+
+    /* compressible content: log like records */
+    in_size = 256 * 1024;
+    in_data = malloc(in_size);
+    TEST_CHECK(in_data != NULL);
+    for (i = 0, out_size = 0; out_size < in_size; i++) {
+        len = snprintf(in_data + out_size, in_size - out_size,
+                       "{\"id\": %i, \"level\": \"info\", "
+                       "\"message\": \"chunk compression test\"}\n", i);
+        out_size += len;
+    }
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_COMPRESS);
+    TEST_CHECK(ctx != NULL);
+
+    stream = cio_stream_create(ctx, "test-compress", CIO_STORE_FS);
+    TEST_CHECK(stream != NULL);
+
+    chunk = cio_chunk_open(ctx, stream, "test1.out", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+
+    ret = cio_meta_write(chunk, "meta", 4);
+    TEST_CHECK(ret == 0);
+
+    ret = cio_chunk_write(chunk, in_data, in_size);
+    TEST_CHECK(ret == 0);
+    cio_chunk_sync(chunk);
+    raw_size = cio_chunk_get_real_size(chunk);
+
+    /* an unlocked chunk is stored as is */
+    ret = cio_chunk_down(chunk);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cio_chunk_get_real_size(chunk) == raw_size);
+
+    /* a locked chunk is compressed */
+    ret = cio_chunk_up(chunk);
+    TEST_CHECK(ret == 0);
+    cio_chunk_lock(chunk);
+    ret = cio_chunk_down(chunk);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cio_chunk_get_real_size(chunk) < raw_size);
+
+    /* the compressed image replaced the file, no temporary file is left */
+    TEST_CHECK(dir_entries(CIO_ENV "test-compress") == 1);
+
+    /* up again, content and metadata must be restored */
+    ret = cio_chunk_up(chunk);
+    TEST_CHECK(ret == CIO_OK);
+    cf = (struct cio_file *) chunk->backend;
+    TEST_CHECK((cio_file_st_get_flags(cf->map) & CIO_FILE_ST_COMPRESSED) == 0);
+
+    ret = cio_chunk_get_content(chunk, &out_data, &out_size);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(out_size == in_size);
+    TEST_CHECK(memcmp(out_data, in_data, in_size) == 0);
+
+    ret = cio_meta_cmp(chunk, "meta", 4);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(dir_entries(CIO_ENV "test-compress") == 1);
+
+    /* close it compressed, then scan it back */
+    cio_destroy(ctx);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_COMPRESS);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    stream = cio_stream_get(ctx, "test-compress");
+    TEST_CHECK(stream != NULL);
+    TEST_CHECK(mk_list_size(&stream->chunks) == 1);
+    if (mk_list_size(&stream->chunks) != 1) {
+        cio_destroy(ctx);
+        free(in_data);
+        return;
+    }
+
+    chunk = mk_list_entry_first(&stream->chunks, struct cio_chunk, _head);
+    TEST_CHECK(cio_chunk_get_content_size(chunk) == in_size);
+    ret = cio_chunk_get_content_copy(chunk, (void **) &out_data, &out_size);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(out_size == in_size);
+    TEST_CHECK(memcmp(out_data, in_data, in_size) == 0);
+    free(out_data);
+
+    cio_destroy(ctx);
+    free(in_data);
+}
+#endif
+
+/* New chunks use crc32c, chunks written with crc32 are still verified */
+static void test_fs_crc32c()
+{
+    int i;
+    int fd;
+    int ret;
+    int err;
+    int flags;
+    char path[256];
+    struct mk_list *head;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+    struct cio_file *cf;
+
+    /* Dummy break line for clarity on acutest output */
+    printf("\n");
+
+    /* cleanup environment */
+    cio_utils_recursive_delete(CIO_ENV);
+
+    /* one chunk per algorithm */
+    for (i = 0; i < 2; i++) {
+        flags = CIO_OPEN | CIO_CHECKSUM;
+        if (i == 1) {
+            flags |= CIO_CRC32C;
+        }
+
+        ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, flags);
+        TEST_CHECK(ctx != NULL);
+
+        stream = cio_stream_create(ctx, "test-crc", CIO_STORE_FS);
+        TEST_CHECK(stream != NULL);
+
+        chunk = cio_chunk_open(ctx, stream, i ? "crc32c" : "crc32",
+                               CIO_OPEN, 1000, &err);
+        TEST_CHECK(chunk != NULL);
+
+        ret = cio_meta_write(chunk, "meta", 4);
+        TEST_CHECK(ret == 0);
+        ret = cio_chunk_write(chunk, "checksum content", 16);
+        TEST_CHECK(ret == 0);
+        cio_chunk_sync(chunk);
+
+        cf = (struct cio_file *) chunk->backend;
+        TEST_CHECK(cf->crc32c == i);
+        TEST_CHECK(((cio_file_st_get_flags(cf->map) & CIO_FILE_ST_CRC32C) != 0) == i);
+
+        cio_destroy(ctx);
+    }
+
+    /* load both with crc32c enabled, each one keeps its algorithm */
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_CRC32C);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    stream = cio_stream_get(ctx, "test-crc");
+    TEST_CHECK(stream != NULL);
+    TEST_CHECK(mk_list_size(&stream->chunks) == 2);
+
+    mk_list_foreach(head, &stream->chunks) {
+        chunk = mk_list_entry(head, struct cio_chunk, _head);
+        TEST_CHECK(cio_chunk_is_up(chunk) == CIO_TRUE);
+
+        cf = (struct cio_file *) chunk->backend;
+        TEST_CHECK(cf->crc32c == (strcmp(chunk->name, "crc32c") == 0));
+        TEST_CHECK(cio_chunk_get_content_size(chunk) == 16);
+    }
+    cio_destroy(ctx);
+
+    /* corrupt the content of the crc32c chunk */
+    snprintf(path, sizeof(path), "%s/test-crc/crc32c", CIO_ENV);
+    fd = open(path, O_WRONLY);
+    TEST_CHECK(fd != -1);
+    ret = pwrite(fd, "X", 1, CIO_FILE_HEADER_MIN + 4 + 1);
+    TEST_CHECK(ret == 1);
+    close(fd);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_OPEN | CIO_CHECKSUM);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    stream = cio_stream_get(ctx, "test-crc");
+    TEST_CHECK(stream != NULL);
+    TEST_CHECK(mk_list_size(&stream->chunks) == 1);
+    if (mk_list_size(&stream->chunks) == 1) {
+        chunk = mk_list_entry_first(&stream->chunks, struct cio_chunk, _head);
+        TEST_CHECK(strcmp(chunk->name, "crc32") == 0);
+    }
+    cio_destroy(ctx);
+}
+
+#ifdef CIO_HAVE_LAZY_LOAD
+/* Load chunk headers only, verify the content when the chunk is put up */
+static void test_fs_lazy_load()
+{
+    int i;
+    int fd;
+    int ret;
+    int err;
+    int len;
+    int meta_len;
+    int corrupted;
+    char *meta_buf;
+    char name[64];
+    char meta[64];
+    char path[256];
+    struct mk_list *head;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+
+    /* Dummy break line for clarity on acutest output */
+    printf("\n");
+
+    /* cleanup environment */
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_OPEN | CIO_CHECKSUM);
+    TEST_CHECK(ctx != NULL);
+    cio_set_max_chunks_up(ctx, 1000);
+
+    stream = cio_stream_create(ctx, "test-lazy", CIO_STORE_FS);
+    TEST_CHECK(stream != NULL);
+
+    /* enough chunks to spread the headers over several threads */
+    for (i = 0; i < 300; i++) {
+        snprintf(name, sizeof(name), "chunk-%03i", i);
+        chunk = cio_chunk_open(ctx, stream, name, CIO_OPEN, 1000, &err);
+        TEST_CHECK(chunk != NULL);
+
+        len = snprintf(meta, sizeof(meta), "meta-%03i", i);
+        ret = cio_meta_write(chunk, meta, len);
+        TEST_CHECK(ret == 0);
+
+        ret = cio_chunk_write(chunk, "lazy load content", 17);
+        TEST_CHECK(ret == 0);
+    }
+    cio_destroy(ctx);
+
+    /* break the header of one chunk and the content of another */
+    snprintf(path, sizeof(path), "%s/test-lazy/chunk-010", CIO_ENV);
+    fd = open(path, O_WRONLY);
+    TEST_CHECK(fd != -1);
+    ret = pwrite(fd, "XX", 2, 0);
+    TEST_CHECK(ret == 2);
+    close(fd);
+
+    snprintf(path, sizeof(path), "%s/test-lazy/chunk-020", CIO_ENV);
+    fd = open(path, O_WRONLY);
+    TEST_CHECK(fd != -1);
+    ret = pwrite(fd, "X", 1, CIO_FILE_HEADER_MIN + 8 + 2);
+    TEST_CHECK(ret == 1);
+    close(fd);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_LAZY_LOAD);
+    TEST_CHECK(ctx != NULL);
+    cio_set_max_chunks_up(ctx, 1000);
+
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    /* the chunk with the broken header is not registered */
+    stream = cio_stream_get(ctx, "test-lazy");
+    TEST_CHECK(stream != NULL);
+    TEST_CHECK(mk_list_size(&stream->chunks) == 299);
+    TEST_CHECK(ctx->total_chunks_up == 0);
+
+    corrupted = 0;
+    mk_list_foreach(head, &stream->chunks) {
+        chunk = mk_list_entry(head, struct cio_chunk, _head);
+        TEST_CHECK(cio_chunk_is_up(chunk) == CIO_FALSE);
+
+        /* metadata is available while the chunk is down */
+        len = snprintf(meta, sizeof(meta), "meta-%s", chunk->name + 6);
+        ret = cio_meta_read(chunk, &meta_buf, &meta_len);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(meta_len == len && memcmp(meta_buf, meta, len) == 0);
+        TEST_CHECK(cio_meta_cmp(chunk, meta, len) == 0);
+        TEST_CHECK(cio_chunk_get_real_size(chunk) > 0);
+
+        /* the checksum is verified on up */
+        ret = cio_chunk_up(chunk);
+        if (strcmp(chunk->name, "chunk-020") == 0) {
+            TEST_CHECK(ret == CIO_CORRUPTED);
+            corrupted++;
+            continue;
+        }
+        TEST_CHECK(ret == CIO_OK);
+        TEST_CHECK(cio_chunk_get_content_size(chunk) == 17);
+        TEST_CHECK(cio_meta_cmp(chunk, meta, len) == 0);
+        cio_chunk_down(chunk);
+    }
+    TEST_CHECK(corrupted == 1);
+
+    cio_destroy(ctx);
+}
+#endif
+
 TEST_LIST = {
     {"fs_write",   test_fs_write},
     {"fs_checksum",  test_fs_checksum},
@@ -668,5 +1011,12 @@ TEST_LIST = {
     {"issue_51",   test_issue_51},
     {"issue_flb_2025", test_issue_flb_2025},
     {"issue_write_at", test_issue_write_at},
+#ifdef CIO_HAVE_SNAPPY
+    {"fs_compress", test_fs_compress},
+#endif
+    {"fs_crc32c", test_fs_crc32c},
+#ifdef CIO_HAVE_LAZY_LOAD
+    {"fs_lazy_load", test_fs_lazy_load},
+#endif
     { 0 }
 };
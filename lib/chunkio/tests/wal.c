@@ -0,0 +1,335 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_log.h>
+#include <chunkio/cio_meta.h>
+#include <chunkio/cio_stream.h>
+#include <chunkio/cio_utils.h>
+#include <chunkio/cio_wal.h>
+
+#include "cio_tests_internal.h"
+
+#define CIO_ENV           "/tmp/cio-wal-test"
+#define CIO_WAL_SEGMENT1  CIO_ENV "/wal-00000001.log"
+#define CIO_WAL_INDEX1    CIO_ENV "/wal-00000001.idx"
+
+/* Logging callback, once called it just turn on the log_check flag */
+static int log_cb(struct cio_ctx *ctx, int level, const char *file, int line,
+                  char *str)
+{
+    (void) ctx;
+
+    printf("[cio-test-wal] %-60s => %s:%i\n",  str, file, line);
+    return 0;
+}
+
+static int file_exists(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0;
+}
+
+static struct cio_chunk *chunk_get(struct cio_ctx *ctx, const char *stream,
+                                   const char *name)
+{
+    struct mk_list *head;
+    struct cio_stream *st;
+    struct cio_chunk *ch;
+
+    st = cio_stream_get(ctx, stream);
+    if (!st) {
+        return NULL;
+    }
+
+    mk_list_foreach(head, &st->chunks) {
+        ch = mk_list_entry(head, struct cio_chunk, _head);
+        if (strcmp(ch->name, name) == 0) {
+            return ch;
+        }
+    }
+
+    return NULL;
+}
+
+static void check_content(struct cio_chunk *ch, char *data, size_t size)
+{
+    int ret;
+    char *buf;
+    size_t len;
+
+    ret = cio_chunk_get_content_copy(ch, (void **) &buf, &len);
+    TEST_CHECK(ret == 0);
+    if (ret != 0) {
+        return;
+    }
+
+    TEST_CHECK(len == size);
+    TEST_CHECK(memcmp(buf, data, size) == 0);
+    free(buf);
+}
+
+/* Write chunks of different streams, restart and read them back */
+static void test_wal_write_load()
+{
+    int i;
+    int ret;
+    int err;
+    char line[64];
+    char expected[14 * 1000 + 16];
+    char *meta;
+    int meta_len;
+    struct cio_ctx *ctx;
+    struct cio_stream *st_a;
+    struct cio_stream *st_b;
+    struct cio_chunk *ch_a;
+    struct cio_chunk *ch_b;
+    struct cio_chunk *ch_c;
+
+    /* Dummy break line for clarity on acutest output */
+    printf("\n");
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_WAL);
+    TEST_CHECK(ctx != NULL);
+
+    /* file system streams are stored in the log */
+    st_a = cio_stream_create(ctx, "stream-a", CIO_STORE_FS);
+    TEST_CHECK(st_a != NULL);
+    TEST_CHECK(st_a->type == CIO_STORE_WAL);
+
+    st_b = cio_stream_create(ctx, "stream-b", CIO_STORE_FS);
+    TEST_CHECK(st_b != NULL);
+
+    ch_a = cio_chunk_open(ctx, st_a, "chunk-a", CIO_OPEN, 1000, &err);
+    TEST_CHECK(ch_a != NULL);
+    ch_b = cio_chunk_open(ctx, st_b, "chunk-b", CIO_OPEN, 1000, &err);
+    TEST_CHECK(ch_b != NULL);
+    ch_c = cio_chunk_open(ctx, st_b, "chunk-c", CIO_OPEN, 1000, &err);
+    TEST_CHECK(ch_c != NULL);
+
+    ret = cio_meta_write(ch_a, "meta-a", 6);
+    TEST_CHECK(ret == 0);
+
+    /* interleaved writes */
+    for (i = 0; i < 1000; i++) {
+        snprintf(line, sizeof(line), "{\"key\": %04i}\n", i);
+        memcpy(expected + (i * 14), line, 14);
+        ret = cio_chunk_write(ch_a, line, 14);
+        TEST_CHECK(ret == 0);
+        ret = cio_chunk_write(ch_b, line, 14);
+        TEST_CHECK(ret == 0);
+        ret = cio_chunk_write(ch_c, line, 14);
+        TEST_CHECK(ret == 0);
+    }
+
+    /* truncate 'chunk-a' and append again */
+    ret = cio_chunk_write_at(ch_a, 14 * 500, "end\n", 4);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cio_chunk_get_content_size(ch_a) == 14 * 500 + 4);
+
+    /* a rolled back transaction must be rolled back in the log too */
+    cio_chunk_tx_begin(ch_b);
+    cio_chunk_write(ch_b, "rollback", 8);
+    cio_chunk_tx_rollback(ch_b);
+    TEST_CHECK(cio_chunk_get_content_size(ch_b) == 14 * 1000);
+
+    /* put 'chunk-b' down and up again */
+    ret = cio_chunk_down(ch_b);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(cio_chunk_is_up(ch_b) == CIO_FALSE);
+    ret = cio_chunk_up(ch_b);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(cio_chunk_get_content_size(ch_b) == 14 * 1000);
+
+    /* deleted chunks are not restored */
+    cio_chunk_close(ch_c, CIO_TRUE);
+
+    cio_destroy(ctx);
+
+    /* one segment with its index, no stream directories */
+    TEST_CHECK(file_exists(CIO_WAL_SEGMENT1) == 1);
+    TEST_CHECK(file_exists(CIO_WAL_INDEX1) == 1);
+    TEST_CHECK(file_exists(CIO_ENV "/stream-a") == 0);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_WAL);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    TEST_CHECK(mk_list_size(&ctx->streams) == 2);
+    TEST_CHECK(ctx->total_chunks == 2);
+    TEST_CHECK(chunk_get(ctx, "stream-b", "chunk-c") == NULL);
+
+    ch_a = chunk_get(ctx, "stream-a", "chunk-a");
+    ch_b = chunk_get(ctx, "stream-b", "chunk-b");
+    TEST_CHECK(ch_a != NULL && ch_b != NULL);
+    if (!ch_a || !ch_b) {
+        cio_destroy(ctx);
+        return;
+    }
+
+    /* restored 'down' */
+    TEST_CHECK(cio_chunk_is_up(ch_a) == CIO_FALSE);
+    TEST_CHECK(cio_chunk_get_content_size(ch_a) == 14 * 500 + 4);
+
+    ret = cio_meta_read(ch_a, &meta, &meta_len);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(meta_len == 6 && memcmp(meta, "meta-a", 6) == 0);
+
+    ret = cio_chunk_up(ch_a);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(cio_chunk_get_content_size(ch_a) == 14 * 500 + 4);
+
+    /* the content keeps growing after a restart */
+    ret = cio_chunk_write(ch_a, "more\n", 5);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cio_chunk_get_content_size(ch_a) == 14 * 500 + 9);
+
+    check_content(ch_b, expected, 14 * 1000);
+    memcpy(expected + (14 * 500), "end\nmore\n", 9);
+    check_content(ch_a, expected, 14 * 500 + 9);
+
+    cio_destroy(ctx);
+}
+
+/* A segment without index and with a torn record at its end */
+static void test_wal_torn_tail()
+{
+    int fd;
+    int ret;
+    int err;
+    char *data = "0123456789";
+    struct stat st_before;
+    struct stat st_after;
+    struct cio_ctx *ctx;
+    struct cio_stream *st;
+    struct cio_chunk *ch;
+
+    /* Dummy break line for clarity on acutest output */
+    printf("\n");
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_WAL);
+    TEST_CHECK(ctx != NULL);
+
+    st = cio_stream_create(ctx, "stream", CIO_STORE_FS);
+    ch = cio_chunk_open(ctx, st, "chunk", CIO_OPEN, 0, &err);
+    TEST_CHECK(ch != NULL);
+
+    ret = cio_chunk_write(ch, data, 10);
+    TEST_CHECK(ret == 0);
+    cio_destroy(ctx);
+
+    /* simulate a crash: no index and half a record */
+    unlink(CIO_WAL_INDEX1);
+    stat(CIO_WAL_SEGMENT1, &st_before);
+
+    fd = open(CIO_WAL_SEGMENT1, O_WRONLY | O_APPEND);
+    TEST_CHECK(fd != -1);
+    ret = write(fd, "\xc1\x57\x02\x00\x00\x00", 6);
+    TEST_CHECK(ret == 6);
+    close(fd);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO,
+                     CIO_OPEN | CIO_CHECKSUM | CIO_WAL);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    /* the torn record is discarded and the index is written */
+    stat(CIO_WAL_SEGMENT1, &st_after);
+    TEST_CHECK(st_after.st_size == st_before.st_size);
+    TEST_CHECK(file_exists(CIO_WAL_INDEX1) == 1);
+
+    ch = chunk_get(ctx, "stream", "chunk");
+    TEST_CHECK(ch != NULL);
+    if (ch) {
+        check_content(ch, data, 10);
+    }
+
+    cio_destroy(ctx);
+}
+
+/* Segments are removed once all their chunks are deleted */
+static void test_wal_reclaim()
+{
+    int ret;
+    int err;
+    struct cio_ctx *ctx;
+    struct cio_stream *st;
+    struct cio_chunk *ch;
+
+    /* Dummy break line for clarity on acutest output */
+    printf("\n");
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_OPEN | CIO_WAL);
+    TEST_CHECK(ctx != NULL);
+
+    st = cio_stream_create(ctx, "stream", CIO_STORE_FS);
+    ch = cio_chunk_open(ctx, st, "chunk", CIO_OPEN, 0, &err);
+    TEST_CHECK(ch != NULL);
+    ret = cio_chunk_write(ch, "data", 4);
+    TEST_CHECK(ret == 0);
+    cio_destroy(ctx);
+
+    /* segment 1 is kept while its chunk exists */
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_OPEN | CIO_WAL);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(file_exists(CIO_WAL_SEGMENT1) == 1);
+
+    ch = chunk_get(ctx, "stream", "chunk");
+    TEST_CHECK(ch != NULL);
+    if (ch) {
+        cio_chunk_close(ch, CIO_TRUE);
+    }
+    TEST_CHECK(file_exists(CIO_WAL_SEGMENT1) == 0);
+    TEST_CHECK(file_exists(CIO_WAL_INDEX1) == 0);
+    cio_destroy(ctx);
+
+    /* nothing left to load */
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_OPEN | CIO_WAL);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(ctx->total_chunks == 0);
+    cio_destroy(ctx);
+}
+
+TEST_LIST = {
+    {"wal_write_load", test_wal_write_load},
+    {"wal_torn_tail",  test_wal_torn_tail},
+    {"wal_reclaim",    test_wal_reclaim},
+    { 0 }
+};
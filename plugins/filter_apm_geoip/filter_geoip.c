@@ -7,6 +7,9 @@
 #include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_time.h>
 #include <msgpack.h>
+#ifdef FLB_HAVE_METRICS
+#include <cmetrics/cmt_gauge.h>
+#endif
 #include "filter_geoip.h"
 #define PLUGIN_NAME "filter_apm_geoip"
 static int geoip_configure(struct geoip_ctx *ctx, struct flb_filter_instance *f_ins)
@@ -15,6 +18,8 @@ static int geoip_configure(struct geoip_ctx *ctx, struct flb_filter_instance *f_
     struct mk_list *head = NULL;
     ctx->lookup_key_check = NOT_AVAILABLE;
     ctx->db_availability = NOT_AVAILABLE;
+    ctx->cache_size = DEFAULT_CACHE_SIZE;
+    memset(&ctx->cache, '\0', sizeof(struct geoip_cache));
     ctx->mmdb = flb_malloc(sizeof(MMDB_s));
     mk_list_foreach(head, &f_ins->properties) {
         kv = mk_list_entry(head, struct flb_kv, _head);
@@ -27,6 +32,9 @@ static int geoip_configure(struct geoip_ctx *ctx, struct flb_filter_instance *f_
                 return -1;
             }
         }
+        if (!strcasecmp(kv->key, CACHE_SIZE_KEY)) {
+            ctx->cache_size = atoi(kv->val);
+        }
         if (!strcasecmp(kv->key, "Lookup_key")) {
             ctx->lookup_key_check = AVAILABLE;
             ctx->lookup_key = flb_strndup(kv->val, flb_sds_len(kv->val));
@@ -41,6 +49,28 @@ static int geoip_configure(struct geoip_ctx *ctx, struct flb_filter_instance *f_
         flb_error("[%s] no GeoIp db specified", PLUGIN_NAME);
         return -1;
     }
+
+    /* a cache_size of zero disables the networks cache */
+    if (geoip_cache_init(&ctx->cache, ctx->cache_size) == -1) {
+        flb_error("[%s] could not create the networks cache", PLUGIN_NAME);
+        return -1;
+    }
+
+#ifdef FLB_HAVE_METRICS
+    ctx->cmt_cache_hits = cmt_counter_create(f_ins->cmt,
+                                             "fluentbit", "filter", "geoip_cache_hits_total",
+                                             "Total number of GeoIP networks cache hits",
+                                             1, (char *[]) {"name"});
+    ctx->cmt_cache_misses = cmt_counter_create(f_ins->cmt,
+                                               "fluentbit", "filter", "geoip_cache_misses_total",
+                                               "Total number of GeoIP networks cache misses",
+                                               1, (char *[]) {"name"});
+    ctx->cmt_cache_hit_ratio = cmt_gauge_create(f_ins->cmt,
+                                                "fluentbit", "filter", "geoip_cache_hit_ratio",
+                                                "Ratio of GeoIP lookups served by the networks cache",
+                                                1, (char *[]) {"name"});
+#endif
+    ctx->ins = f_ins;
     return 0;
 }
 
@@ -55,6 +85,7 @@ static int cb_modifier_init_apm(struct flb_filter_instance *f_ins,
         return -1;
     }
     if ( geoip_configure(ctx, f_ins) < 0 ){
+        geoip_cache_destroy(&ctx->cache);
         flb_free(ctx);
         ctx = NULL;
         return -1;
@@ -64,24 +95,11 @@ static int cb_modifier_init_apm(struct flb_filter_instance *f_ins,
     return 0;
 }
 
-static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
-    int gai_error, mmdb_error;
-    MMDB_lookup_result_s result = MMDB_lookup_string(mmdb, ip, &gai_error, &mmdb_error);
-    if (0 != gai_error) {
-       flb_debug("Error from getaddrinfo for %s- %s",ip, gai_strerror(gai_error));
-       return data_unavailable;
-    }
-    if (MMDB_SUCCESS != mmdb_error) {
-        flb_debug("Got an error from libmaxminddb: %s",MMDB_strerror(mmdb_error));
-        return data_unavailable;
-    }
-    if (!result.found_entry){
-        flb_debug("Could not find an entry for this IP address: %s",ip);
-        return data_unavailable;
-    }
+static void pack_geo_info(MMDB_lookup_result_s *lookup, msgpack_packer *packer)
+{
     MMDB_entry_data_s entry_data;
     //Adding City Name
-    MMDB_get_value(&result.entry, &entry_data, CITY,NAME,LANGUAGE_ENG,NULL);
+    MMDB_get_value(&lookup->entry, &entry_data, CITY,NAME,LANGUAGE_ENG,NULL);
     msgpack_pack_str(packer, CITY_LEN);
     msgpack_pack_str_body(packer, CITY, CITY_LEN );
     if (entry_data.has_data){
@@ -92,7 +110,7 @@ static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
         msgpack_pack_str_body(packer, UNKNOWN, UNKNOWN_LEN);
     }
     //Adding Country Name
-    MMDB_get_value(&result.entry, &entry_data,COUNTRY,NAME,LANGUAGE_ENG,NULL);
+    MMDB_get_value(&lookup->entry, &entry_data,COUNTRY,NAME,LANGUAGE_ENG,NULL);
     msgpack_pack_str(packer, COUNTRY_NAME_LEN);
     msgpack_pack_str_body(packer, COUNTRY_NAME, COUNTRY_NAME_LEN);
     if (entry_data.has_data){
@@ -103,7 +121,7 @@ static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
         msgpack_pack_str_body(packer, UNKNOWN, UNKNOWN_LEN);
     }
     //Adding Country Code
-    MMDB_get_value(&result.entry, &entry_data,COUNTRY,ISO_CODE,NULL);
+    MMDB_get_value(&lookup->entry, &entry_data,COUNTRY,ISO_CODE,NULL);
     msgpack_pack_str(packer,COUNTRY_LEN);
     msgpack_pack_str_body(packer, COUNTRY, COUNTRY_LEN);
     if (entry_data.has_data){
@@ -114,7 +132,7 @@ static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
         msgpack_pack_str_body(packer, UNKNOWN, UNKNOWN_LEN);
     }
     //Adding Region Name
-    MMDB_get_value(&result.entry, &entry_data,REGION,"0",NAME,LANGUAGE_ENG,NULL);
+    MMDB_get_value(&lookup->entry, &entry_data,REGION,"0",NAME,LANGUAGE_ENG,NULL);
     msgpack_pack_str(packer, REGION_NAME_LEN);
     msgpack_pack_str_body(packer, REGION_NAME, REGION_NAME_LEN);
     if (entry_data.has_data){
@@ -125,7 +143,7 @@ static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
         msgpack_pack_str_body(packer, UNKNOWN, UNKNOWN_LEN);
     }
     //Adding Region Code
-    MMDB_get_value(&result.entry, &entry_data,REGION,"0",ISO_CODE,NULL);
+    MMDB_get_value(&lookup->entry, &entry_data,REGION,"0",ISO_CODE,NULL);
     msgpack_pack_str(packer, REGION_CODE_LEN);
     msgpack_pack_str_body(packer, REGION_CODE, REGION_CODE_LEN);
     if (entry_data.has_data){
@@ -136,7 +154,7 @@ static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
         msgpack_pack_str_body(packer, UNKNOWN, UNKNOWN_LEN);
     }
     //Adding Latitude info
-    MMDB_get_value(&result.entry, &entry_data,LOCATION,LATITUDE,NULL);
+    MMDB_get_value(&lookup->entry, &entry_data,LOCATION,LATITUDE,NULL);
     msgpack_pack_str(packer, LATITUDE_LEN);
     msgpack_pack_str_body(packer, LATITUDE,LATITUDE_LEN);
     if (entry_data.has_data){
@@ -145,7 +163,7 @@ static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
         msgpack_pack_double(packer, -1);
     }
     //Adding Longitude info
-    MMDB_get_value(&result.entry, &entry_data,LOCATION,LONGITUDE,NULL);
+    MMDB_get_value(&lookup->entry, &entry_data,LOCATION,LONGITUDE,NULL);
     msgpack_pack_str(packer, LONGITUDE_LEN);
     msgpack_pack_str_body(packer, LONGITUDE, LONGITUDE_LEN);
     if (entry_data.has_data){
@@ -153,7 +171,6 @@ static int get_geo_info(char *ip, MMDB_s *mmdb,msgpack_packer *packer){
     }else{
         msgpack_pack_double(packer,-1);
     }
-    return data_collected;
 }
 static void add_default_geo_info(msgpack_packer *packer)
 {
@@ -192,6 +209,74 @@ static void add_default_geo_info(msgpack_packer *packer)
     msgpack_pack_double(packer,-1);
 }
 
+static int get_geo_info(const char *ip, size_t ip_len, struct geoip_ctx *ctx,
+                        msgpack_sbuffer *sbuffer, msgpack_packer *packer){
+    int family;
+    int prefix;
+    int mmdb_error;
+    size_t off;
+    uint8_t *addr;
+    char buf[INET6_ADDRSTRLEN + 1];
+    struct sockaddr_storage ss;
+    struct sockaddr_in *sin = (struct sockaddr_in *) &ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &ss;
+    MMDB_s *mmdb = ctx->mmdb;
+    MMDB_lookup_result_s result;
+
+    /* parse the address in place, no getaddrinfo(3) round trip */
+    if (ip_len == 0 || ip_len > INET6_ADDRSTRLEN) {
+        flb_debug("Invalid IP address: %.*s", (int) ip_len, ip);
+        return data_unavailable;
+    }
+    memcpy(buf, ip, ip_len);
+    buf[ip_len] = '\0';
+
+    memset(&ss, '\0', sizeof(ss));
+    if (inet_pton(AF_INET, buf, &sin->sin_addr) == 1) {
+        family = AF_INET;
+        sin->sin_family = AF_INET;
+        addr = (uint8_t *) &sin->sin_addr;
+    }
+    else if (inet_pton(AF_INET6, buf, &sin6->sin6_addr) == 1) {
+        family = AF_INET6;
+        sin6->sin6_family = AF_INET6;
+        addr = (uint8_t *) &sin6->sin6_addr;
+    }
+    else {
+        flb_debug("Invalid IP address: %s", buf);
+        return data_unavailable;
+    }
+
+    if (geoip_cache_get(&ctx->cache, family, addr, sbuffer) == FLB_TRUE) {
+        return data_collected;
+    }
+
+    result = MMDB_lookup_sockaddr(mmdb, (struct sockaddr *) &ss, &mmdb_error);
+    if (MMDB_SUCCESS != mmdb_error) {
+        flb_debug("Got an error from libmaxminddb: %s",MMDB_strerror(mmdb_error));
+        return data_unavailable;
+    }
+
+    /* IPv4 addresses live under ::/96 when the database is IPv6 */
+    prefix = result.netmask;
+    if (family == AF_INET && mmdb->metadata.ip_version == 6) {
+        prefix = (prefix >= 96) ? prefix - 96 : 0;
+    }
+
+    off = sbuffer->size;
+    if (!result.found_entry){
+        flb_debug("Could not find an entry for this IP address: %s",buf);
+        add_default_geo_info(packer);
+    }
+    else {
+        pack_geo_info(&result, packer);
+    }
+    geoip_cache_set(&ctx->cache, family, addr, prefix,
+                    sbuffer->data + off, sbuffer->size - off);
+
+    return data_collected;
+}
+
 static int cb_modifier_filter_apm(const void *data, size_t bytes,
                               const char *tag, int tag_len,
                               void **out_buf, size_t *out_size,
@@ -202,6 +287,10 @@ static int cb_modifier_filter_apm(const void *data, size_t bytes,
     struct geoip_ctx *ctx = context;
     //flb_info("ppm %d",ctx->lookup_key->len);
     size_t off = 0;
+#ifdef FLB_HAVE_METRICS
+    uint64_t ts;
+    char *name;
+#endif
     int geoinfo_status = remote_addr_not_available;
     int map_num = 0;
     struct flb_time tm;
@@ -236,10 +325,10 @@ static int cb_modifier_filter_apm(const void *data, size_t bytes,
             old_record_value = &(kv+i)->val;
             if (old_record_key->type == MSGPACK_OBJECT_STR && !strncasecmp(old_record_key->via.str.ptr,ctx->lookup_key,ctx->lookup_key_len))
             {
-                char *ip_address = flb_strndup(old_record_value->via.str.ptr, old_record_value->via.str.size);
                 //populates record map with geo information
-                geoinfo_status = get_geo_info(ip_address,ctx->mmdb,&packer);
-                flb_free(ip_address);
+                geoinfo_status = get_geo_info(old_record_value->via.str.ptr,
+                                              old_record_value->via.str.size,
+                                              ctx, &sbuffer, &packer);
             }
             msgpack_pack_object(&packer, (kv + i)->key);
             msgpack_pack_object(&packer, (kv + i)->val);
@@ -249,6 +338,24 @@ static int cb_modifier_filter_apm(const void *data, size_t bytes,
         }
     }
     msgpack_unpacked_destroy(&unpacked);
+
+#ifdef FLB_HAVE_METRICS
+    if (ctx->cache.ht) {
+        ts = cmt_time_now();
+        name = (char *) flb_filter_name(f_ins);
+        cmt_counter_set(ctx->cmt_cache_hits, ts, ctx->cache.hits,
+                        1, (char *[]) {name});
+        cmt_counter_set(ctx->cmt_cache_misses, ts, ctx->cache.misses,
+                        1, (char *[]) {name});
+        if (ctx->cache.hits + ctx->cache.misses > 0) {
+            cmt_gauge_set(ctx->cmt_cache_hit_ratio, ts,
+                          (double) ctx->cache.hits /
+                          (double) (ctx->cache.hits + ctx->cache.misses),
+                          1, (char *[]) {name});
+        }
+    }
+#endif
+
     if(geoinfo_status == remote_addr_not_available)
     {
         flb_error("Lookup key %s not found",ctx->lookup_key);
@@ -264,6 +371,7 @@ static int cb_modifier_exit_apm(void *data, struct flb_config *config)
     struct geoip_ctx *ctx = data;
 
     if (ctx != NULL) {
+        geoip_cache_destroy(&ctx->cache);
         MMDB_close(ctx->mmdb);
         flb_free(ctx->mmdb);
         ctx->mmdb = NULL;
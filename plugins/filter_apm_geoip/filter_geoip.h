@@ -25,6 +25,8 @@
 #define LANGUAGE_ENG "en"
 #define UNKNOWN "-unknown-"
 #define UNKNOWN_LEN 9
+#define CACHE_SIZE_KEY "cache_size"
+#define DEFAULT_CACHE_SIZE 4096
 enum geo_info_status {
     remote_addr_not_available,
     remote_addr_available,
@@ -32,8 +34,17 @@ enum geo_info_status {
     data_unavailable
 };
 #include <maxminddb.h>
+#include "geoip_cache.h"
+
 struct geoip_ctx {
     MMDB_s *mmdb;
+    int cache_size;
+    struct geoip_cache cache;
+#ifdef FLB_HAVE_METRICS
+    struct cmt_counter *cmt_cache_hits;
+    struct cmt_counter *cmt_cache_misses;
+    struct cmt_gauge *cmt_cache_hit_ratio;
+#endif
     char *lookup_key;
     int lookup_key_len; 
     int lookup_key_check;
@@ -0,0 +1,132 @@
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_network.h>
+
+#include "geoip_cache.h"
+
+int geoip_cache_init(struct geoip_cache *cache, int size)
+{
+    memset(cache, '\0', sizeof(struct geoip_cache));
+    if (size <= 0) {
+        return 0;
+    }
+
+    cache->ht = flb_hash_create(FLB_HASH_EVICT_LRU, size, size);
+    if (!cache->ht) {
+        return -1;
+    }
+    return 0;
+}
+
+void geoip_cache_destroy(struct geoip_cache *cache)
+{
+    if (cache->ht) {
+        flb_hash_destroy(cache->ht);
+        cache->ht = NULL;
+    }
+}
+
+/*
+ * Compose the cache key of the network 'addr' belongs to: family, prefix
+ * length and the significant bytes of the masked address in hex.
+ */
+static int cache_key(char *key, int family, const uint8_t *addr, int prefix)
+{
+    int i;
+    int bits;
+    int bytes;
+    uint8_t b;
+    char *p = key;
+    static const char hex[] = "0123456789abcdef";
+
+    *p++ = (family == AF_INET) ? '4' : '6';
+    *p++ = '/';
+    if (prefix >= 100) {
+        *p++ = '0' + (prefix / 100);
+    }
+    if (prefix >= 10) {
+        *p++ = '0' + ((prefix / 10) % 10);
+    }
+    *p++ = '0' + (prefix % 10);
+    *p++ = '/';
+
+    bytes = (prefix + 7) / 8;
+    for (i = 0; i < bytes; i++) {
+        bits = prefix - (i * 8);
+        b = addr[i];
+        if (bits < 8) {
+            b &= (uint8_t) (0xff << (8 - bits));
+        }
+        *p++ = hex[b >> 4];
+        *p++ = hex[b & 0x0f];
+    }
+    *p = '\0';
+
+    return p - key;
+}
+
+int geoip_cache_get(struct geoip_cache *cache, int family, const uint8_t *addr,
+                    msgpack_sbuffer *sbuffer)
+{
+    int ret;
+    int len;
+    int prefix;
+    int max_prefix;
+    uint8_t *prefixes;
+    void *fragment;
+    size_t size;
+    char key[GEOIP_CACHE_KEY_SIZE];
+
+    if (!cache->ht) {
+        return FLB_FALSE;
+    }
+
+    if (family == AF_INET) {
+        prefixes = cache->prefixes_v4;
+        max_prefix = 32;
+    }
+    else {
+        prefixes = cache->prefixes_v6;
+        max_prefix = 128;
+    }
+
+    /* networks are disjoint, at most one known prefix can match */
+    for (prefix = max_prefix; prefix >= 0; prefix--) {
+        if (!prefixes[prefix]) {
+            continue;
+        }
+
+        len = cache_key(key, family, addr, prefix);
+        ret = flb_hash_get(cache->ht, key, len, &fragment, &size);
+        if (ret >= 0) {
+            msgpack_sbuffer_write(sbuffer, fragment, size);
+            cache->hits++;
+            return FLB_TRUE;
+        }
+    }
+
+    cache->misses++;
+    return FLB_FALSE;
+}
+
+void geoip_cache_set(struct geoip_cache *cache, int family, const uint8_t *addr,
+                     int prefix, const char *fragment, size_t size)
+{
+    int len;
+    char key[GEOIP_CACHE_KEY_SIZE];
+
+    if (!cache->ht) {
+        return;
+    }
+
+    len = cache_key(key, family, addr, prefix);
+    if (flb_hash_add(cache->ht, key, len, (void *) fragment, size) == -1) {
+        return;
+    }
+
+    if (family == AF_INET) {
+        cache->prefixes_v4[prefix] = FLB_TRUE;
+    }
+    else {
+        cache->prefixes_v6[prefix] = FLB_TRUE;
+    }
+}
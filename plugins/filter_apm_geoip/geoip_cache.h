@@ -0,0 +1,35 @@
+#ifndef FLB_FILTER_APM_GEOIP_CACHE_H
+#define FLB_FILTER_APM_GEOIP_CACHE_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_hash.h>
+#include <msgpack.h>
+
+/* family, prefix length and up to 16 address bytes in hex */
+#define GEOIP_CACHE_KEY_SIZE (2 + 4 + 4 + 32 + 1)
+
+/*
+ * Resolved networks cache: MaxMind networks never overlap, so once an address
+ * has been resolved every address of the same network (result.netmask) maps
+ * to the same packed geo fields. The prefix lengths seen so far are tracked
+ * per family to know which masks must be tried on lookup.
+ */
+struct geoip_cache {
+    struct flb_hash *ht;
+    uint8_t prefixes_v4[33];
+    uint8_t prefixes_v6[129];
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/* a size of zero leaves the cache disabled, every lookup is a miss */
+int geoip_cache_init(struct geoip_cache *cache, int size);
+void geoip_cache_destroy(struct geoip_cache *cache);
+
+/* append the cached fields of the network 'addr' belongs to */
+int geoip_cache_get(struct geoip_cache *cache, int family, const uint8_t *addr,
+                    msgpack_sbuffer *sbuffer);
+void geoip_cache_set(struct geoip_cache *cache, int family, const uint8_t *addr,
+                     int prefix, const char *fragment, size_t size);
+
+#endif
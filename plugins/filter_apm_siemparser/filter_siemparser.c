@@ -7,45 +7,14 @@
 #include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_time.h>
 #include <msgpack.h>
+#include <fluent-bit/flb_sidecar.h>
 #include <string.h>
-#include <io.h>
 #include <stdlib.h>
 #include "filter_siemparser.h"
 #define PLUGIN_NAME "filter:apm_siemparser"
 
-// Define global siemSock socket
-int siemSock = 0;
-
-static int connect_socket(int port)
-{
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0)
-    {
-        flb_error("[%s] Invalid address/ Address not supported", PLUGIN_NAME);
-        return -1;
-    }
-    if ((siemSock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    {
-        flb_error("[%s] Socket creation error on port %d",PLUGIN_NAME, port);
-        return -1;
-    }
-    if (connect(siemSock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-    {
-        flb_error("[%s] Connection Failed on port %d", PLUGIN_NAME, port);
-        return -1;
-    }
-    else
-    {
-        flb_info("[%s] Connected to port %d", PLUGIN_NAME, port);
-    }
-    return siemSock;
-}
-
-static int configure(struct siemparser_ctx *ctx, struct flb_filter_instance *f_ins)
+static int configure(struct siemparser_ctx *ctx, struct flb_filter_instance *f_ins,
+                     struct flb_config *config)
 {
     struct flb_kv *kv = NULL;
     struct mk_list *head = NULL;
@@ -79,9 +48,11 @@ static int configure(struct siemparser_ctx *ctx, struct flb_filter_instance *f_i
         flb_error("[%s] port key not found", PLUGIN_NAME);
         return -1;
     }
-    if (connect_socket(atoi(ctx->port)) < 0)
+    ctx->sidecar = flb_sidecar_create(config, flb_filter_name(f_ins),
+                                      DEFAULT_HOST, atoi(ctx->port));
+    if (!ctx->sidecar)
     {
-        return 0;
+        return -1;
     }
     return 0;
 }
@@ -91,14 +62,17 @@ static int cb_modifier_init_apm_siem(struct flb_filter_instance *f_ins,
                             void *data)
 {
     struct siemparser_ctx *ctx = NULL;
-    ctx = flb_malloc(sizeof(struct siemparser_ctx));
+    ctx = flb_calloc(1, sizeof(struct siemparser_ctx));
     if (!ctx)
     {
         flb_errno();
         return -1;
     }
-    if (configure(ctx, f_ins) < 0)
+    if (configure(ctx, f_ins, config) < 0)
     {
+        flb_sidecar_destroy(ctx->sidecar);
+        flb_free(ctx->Agent_key);
+        flb_free(ctx->port);
         flb_free(ctx);
         ctx = NULL;
         return -1;
@@ -108,41 +82,18 @@ static int cb_modifier_init_apm_siem(struct flb_filter_instance *f_ins,
     return 0;
 }
 
-static int get_agent_info(char *agent, int port, msgpack_packer *packer)
+static int get_agent_info(struct siemparser_ctx *ctx, char *message, msgpack_packer *packer)
 {
-    int valread = 0, retry = 0;
+    int ret;
+    size_t valread = 0;
     char buffer[1024] = {0};
     char *entry;
-    if (send(siemSock, agent, strlen(agent), 0) == -1)
-    {
-        flb_error("[%s] Error in sending the agent %s", PLUGIN_NAME, agent);
-        goto retry;
-    }
-    valread = recv(siemSock, buffer, 1024, 0);
-    if (valread == 0 || valread == -1)
+
+    ret = flb_sidecar_request(ctx->sidecar, message, strlen(message),
+                              buffer, sizeof(buffer), &valread);
+    if (ret == -1)
     {
-        retry:
-        do
-        {
-            flb_info("[%s] Trying to reconnect the socket: retry %d/%d", PLUGIN_NAME, retry, RETRIES) ;
-            if (connect_socket(port) < 0)
-            {
-                flb_info("[%s] Unable to reconnect the socket", PLUGIN_NAME);
-                if (retry++ > RETRIES) {
-                    return unable_to_connect;
-                }
-                continue;
-            }
-            if (send(siemSock, agent, strlen(agent), 0) == -1)
-            {
-                flb_error("[%s] Error in sending the agent %s: retry %d/%d", PLUGIN_NAME, agent,  retry, RETRIES);
-                if (retry++ > RETRIES) {
-                    return unable_to_connect;
-                }
-                continue;
-            }
-            valread = recv(siemSock, buffer, 1024, 0);
-        } while (valread == 0);
+        return unable_to_connect;
     }
 
     entry = strtok(buffer, "}");
@@ -286,7 +237,7 @@ static int cb_modifier_filter(const void* data, size_t bytes,
         strncat(SendingMessage, endln, strlen(endln));
         flb_trace("[%s] Sending siem message: %s", PLUGIN_NAME, SendingMessage);
 
-        siem_parser_status = get_agent_info(SendingMessage, atoi(ctx->port), &packer);
+        siem_parser_status = get_agent_info(ctx, SendingMessage, &packer);
 
         if (siem_parser_status == unable_to_connect)
         {
@@ -304,9 +255,10 @@ static int cb_modifier_filter(const void* data, size_t bytes,
 static int cb_modifier_exit(void *data, struct flb_config *config)
 {
     struct siemparser_ctx *ctx = data;
-    close(siemSock);
     if (ctx != NULL)
     {
+        flb_sidecar_destroy(ctx->sidecar);
+        ctx->sidecar = NULL;
         flb_free(ctx->Agent_key);
         ctx->Agent_key = NULL;
         flb_free(ctx->port);
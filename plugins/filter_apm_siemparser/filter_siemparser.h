@@ -1,14 +1,12 @@
 #define AVAILABLE 1
 #define NOT_AVAILABLE 0
-#define RETRIES 2
-#define GLOBALRETRIES 100
-#define DELAYINSEC 2
 #define LOOKUPKEY "agent_key"
 #define DEFAULT "Unknown"
 #define ACCOUNTYPE_LEN 11
 #define ACCOUNTYPE "accountType"
 #define DEFAULT_LEN 7
 #define PORTKEY "port"
+#define DEFAULT_HOST "127.0.0.1"
 
 enum siem_parser_status {
     agent_not_available,
@@ -24,6 +22,6 @@ struct siemparser_ctx {
     int port_key_check;
     int Agent_key_len;
     int lookup_key_check;
-    int sock;
+    struct flb_sidecar *sidecar;
     struct flb_filter_instance *ins;
 };
@@ -6,52 +6,29 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_hash.h>
+#include <fluent-bit/flb_sidecar.h>
 #include <msgpack.h>
 #include <string.h>
-#include <io.h>
 #include <stdlib.h>
 #include "filter_uaparser.h"
 #define PLUGIN_NAME "filter:apm_uaparser"
 
-// Define global sock socket
-int sock = 0;
-int retryCounter = 0;
-
-static int connect_socket(int port)
-{
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0)
-    {
-        flb_error("[%s] Invalid address/ Address not supported", PLUGIN_NAME);
-        return -1;
-    }
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    {
-        flb_error("[%s] Socket creation error on port %d",PLUGIN_NAME, port);
-        return -1;
-    }
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-    {
-        flb_error("[%s] Connection Failed on port %d", PLUGIN_NAME, port);
-        return -1;
-    }
-    else
-    {
-        flb_info("[%s] Connected to port %d", PLUGIN_NAME, port);
-    }
-    return sock;
-}
-
-static int configure(struct uaparser_ctx *ctx, struct flb_filter_instance *f_ins)
+static int configure(struct uaparser_ctx *ctx, struct flb_filter_instance *f_ins,
+                     struct flb_config *config)
 {
     struct flb_kv *kv = NULL;
     struct mk_list *head = NULL;
     ctx->lookup_key_check = NOT_AVAILABLE;
     ctx->port_key_check = NOT_AVAILABLE;
+    ctx->batch = FLB_FALSE;
+    ctx->cache_size = DEFAULT_CACHE_SIZE;
+    ctx->cache_ttl = 0;
+    ctx->cache_evict = FLB_HASH_EVICT_LRU;
+    ctx->cache = NULL;
+    ctx->sidecar = NULL;
+    ctx->host = NULL;
+    ctx->ins = f_ins;
     mk_list_foreach(head, &f_ins->properties)
     {
         kv = mk_list_entry(head, struct flb_kv, _head);
@@ -69,6 +46,57 @@ static int configure(struct uaparser_ctx *ctx, struct flb_filter_instance *f_ins
             ctx->port = flb_strndup(kv->val, flb_sds_len(kv->val));
             ctx->port_key_len = flb_sds_len(kv->val);
         }
+
+        if (!strcasecmp(kv->key, HOSTKEY))
+        {
+            flb_free(ctx->host);
+            ctx->host = flb_strndup(kv->val, flb_sds_len(kv->val));
+        }
+
+        if (!strcasecmp(kv->key, BATCHKEY))
+        {
+            ctx->batch = flb_utils_bool(kv->val);
+            if (ctx->batch == -1)
+            {
+                flb_error("[%s] invalid value '%s' for %s", PLUGIN_NAME, kv->val, BATCHKEY);
+                return -1;
+            }
+        }
+
+        if (!strcasecmp(kv->key, CACHE_SIZE_KEY))
+        {
+            ctx->cache_size = atoi(kv->val);
+        }
+
+        if (!strcasecmp(kv->key, CACHE_TTL_KEY))
+        {
+            ctx->cache_ttl = atoi(kv->val);
+        }
+
+        if (!strcasecmp(kv->key, CACHE_EVICT_KEY))
+        {
+            if (!strcasecmp(kv->val, "lru"))
+            {
+                ctx->cache_evict = FLB_HASH_EVICT_LRU;
+            }
+            else if (!strcasecmp(kv->val, "lfu"))
+            {
+                ctx->cache_evict = FLB_HASH_EVICT_LESS_USED;
+            }
+            else if (!strcasecmp(kv->val, "older"))
+            {
+                ctx->cache_evict = FLB_HASH_EVICT_OLDER;
+            }
+            else if (!strcasecmp(kv->val, "random"))
+            {
+                ctx->cache_evict = FLB_HASH_EVICT_RANDOM;
+            }
+            else
+            {
+                flb_error("[%s] invalid %s '%s', use lru, lfu, older or random", PLUGIN_NAME, CACHE_EVICT_KEY, kv->val);
+                return -1;
+            }
+        }
     }
     if (ctx->lookup_key_check == NOT_AVAILABLE)
     {
@@ -80,9 +108,40 @@ static int configure(struct uaparser_ctx *ctx, struct flb_filter_instance *f_ins
         flb_error("[%s] port key not found", PLUGIN_NAME);
         return -1;
     }
-    if (connect_socket(atoi(ctx->port)) < 0)
+
+    /* a cache_size of zero disables the cache */
+    if (ctx->cache_size > 0)
     {
-        return 0;
+        ctx->cache = flb_hash_create_with_ttl(ctx->cache_ttl, ctx->cache_evict,
+                                              ctx->cache_size, ctx->cache_size);
+        if (!ctx->cache)
+        {
+            flb_error("[%s] could not create the user agent cache", PLUGIN_NAME);
+            return -1;
+        }
+    }
+
+#ifdef FLB_HAVE_METRICS
+    ctx->cmt_cache_hits = cmt_counter_create(f_ins->cmt,
+                                             "fluentbit", "filter", "uaparser_cache_hits_total",
+                                             "Total number of user agent cache hits",
+                                             1, (char *[]) {"name"});
+    ctx->cmt_cache_misses = cmt_counter_create(f_ins->cmt,
+                                               "fluentbit", "filter", "uaparser_cache_misses_total",
+                                               "Total number of user agent cache misses",
+                                               1, (char *[]) {"name"});
+    ctx->cmt_cache_evictions = cmt_counter_create(f_ins->cmt,
+                                                  "fluentbit", "filter", "uaparser_cache_evictions_total",
+                                                  "Total number of user agent cache evictions",
+                                                  1, (char *[]) {"name"});
+#endif
+
+    ctx->sidecar = flb_sidecar_create(config, flb_filter_name(f_ins),
+                                      ctx->host ? ctx->host : DEFAULT_HOST,
+                                      atoi(ctx->port));
+    if (!ctx->sidecar)
+    {
+        return -1;
     }
     return 0;
 }
@@ -92,14 +151,22 @@ static int cb_modifier_init_apm_ua(struct flb_filter_instance *f_ins,
                             void *data)
 {
     struct uaparser_ctx *ctx = NULL;
-    ctx = flb_malloc(sizeof(struct uaparser_ctx));
+    ctx = flb_calloc(1, sizeof(struct uaparser_ctx));
     if (!ctx)
     {
         flb_errno();
         return -1;
     }
-    if (configure(ctx, f_ins) < 0)
+    if (configure(ctx, f_ins, config) < 0)
     {
+        if (ctx->cache)
+        {
+            flb_hash_destroy(ctx->cache);
+        }
+        flb_sidecar_destroy(ctx->sidecar);
+        flb_free(ctx->lookup_key);
+        flb_free(ctx->port);
+        flb_free(ctx->host);
         flb_free(ctx);
         ctx = NULL;
         return -1;
@@ -109,53 +176,6 @@ static int cb_modifier_init_apm_ua(struct flb_filter_instance *f_ins,
     return 0;
 }
 
-static int get_agent_info(char *agent, int port, msgpack_packer *packer)
-{
-    int valread = 0, retry = 0;
-    char buffer[1024] = {0};
-    char *entry;
-    if (send(sock, agent, strlen(agent), 0) == -1)
-    {
-        flb_error("[%s] Error in sending the agent %s", PLUGIN_NAME, agent);
-        goto retry;
-    }
-    valread = recv(sock, buffer, 1024, 0);
-    if (valread == 0 || valread == -1)
-    {
-        retry:
-        do
-        {
-            flb_info("[%s] Trying to reconnect the socket: retry %d/%d", PLUGIN_NAME, retry, RETRIES) ;
-            if (connect_socket(port) < 0)
-            {
-                flb_info("[%s] Unable to reconnect the socket", PLUGIN_NAME);
-                if (retry++ > RETRIES) {
-                    return unable_to_connect;
-                }
-                continue;
-            }
-            if (send(sock, agent, strlen(agent), 0) == -1)
-            {
-                flb_error("[%s] Error in sending the agent %s: retry %d/%d", PLUGIN_NAME, agent,  retry, RETRIES);
-                if (retry++ > RETRIES) {
-                    return unable_to_connect;
-                }
-                continue;
-            }
-            valread = recv(sock, buffer, 1024, 0);
-        } while (valread == 0);
-    }
-
-    entry = strtok(buffer, "}");
-    while (entry != NULL)
-    {
-        msgpack_pack_str(packer, strlen(entry));
-        msgpack_pack_str_body(packer, entry, strlen(entry));
-        entry = strtok(NULL, "}");
-    }
-    return data_collected;
-}
-
 static void add_default_ua_fields(msgpack_packer *packer)
 {
     flb_trace("[%s] Adding Default agent fields", PLUGIN_NAME);
@@ -206,6 +226,412 @@ static void add_default_ua_fields(msgpack_packer *packer)
     msgpack_pack_str_body(packer, DEFAULT, DEFAULT_LEN);
 }
 
+/* Count the '}' separated fields of a sidecar reply, same rules as strtok() */
+static int count_reply_fields(const char *reply, size_t len)
+{
+    size_t i;
+    int fields = 0;
+    int in_field = FLB_FALSE;
+
+    for (i = 0; i < len; i++)
+    {
+        if (reply[i] == '}')
+        {
+            in_field = FLB_FALSE;
+        }
+        else if (in_field == FLB_FALSE)
+        {
+            in_field = FLB_TRUE;
+            fields++;
+        }
+    }
+    return fields;
+}
+
+static void pack_reply_fields(const char *reply, size_t len, msgpack_packer *packer)
+{
+    size_t i;
+    size_t start = 0;
+
+    for (i = 0; i <= len; i++)
+    {
+        if (i == len || reply[i] == '}')
+        {
+            if (i > start)
+            {
+                msgpack_pack_str(packer, i - start);
+                msgpack_pack_str_body(packer, reply + start, i - start);
+            }
+            start = i + 1;
+        }
+    }
+}
+
+static int get_agent_info(struct uaparser_ctx *ctx, char *agent, size_t len,
+                          msgpack_packer *packer)
+{
+    int ret;
+    size_t valread = 0;
+    char buffer[1024] = {0};
+
+    ret = flb_sidecar_request(ctx->sidecar, agent, len, buffer, sizeof(buffer), &valread);
+    if (ret == -1)
+    {
+        return unable_to_connect;
+    }
+
+    /* a short or garbled reply would break the record map, use the defaults */
+    if (count_reply_fields(buffer, valread) != NEW_ENTRIES * 2)
+    {
+        flb_debug("[%s] invalid sidecar reply: %.*s", PLUGIN_NAME,
+                  (int) valread, buffer);
+        return add_default;
+    }
+
+    pack_reply_fields(buffer, valread, packer);
+    return data_collected;
+}
+
+static int is_agent_field(struct uaparser_ctx *ctx, msgpack_object *key, msgpack_object *val)
+{
+    if (key->type != MSGPACK_OBJECT_STR || val->type != MSGPACK_OBJECT_STR)
+    {
+        return FLB_FALSE;
+    }
+    if (strncasecmp(key->via.str.ptr, ctx->lookup_key, ctx->lookup_key_len) != 0)
+    {
+        return FLB_FALSE;
+    }
+    return FLB_TRUE;
+}
+
+/*
+ * Look up the packed user agent fields in the cache. On a hit the msgpack
+ * key/value fragment is copied straight into the output buffer.
+ */
+static int cache_get(struct uaparser_ctx *ctx, const char *agent, size_t len,
+                     msgpack_sbuffer *sbuffer)
+{
+    int ret;
+    void *fragment;
+    size_t size;
+#ifdef FLB_HAVE_METRICS
+    uint64_t ts;
+    char *name;
+#endif
+
+    if (!ctx->cache)
+    {
+        return FLB_FALSE;
+    }
+
+    ret = flb_hash_get(ctx->cache, agent, len, &fragment, &size);
+#ifdef FLB_HAVE_METRICS
+    ts = cmt_time_now();
+    name = (char *) flb_filter_name(ctx->ins);
+    if (ret == -1)
+    {
+        cmt_counter_inc(ctx->cmt_cache_misses, ts, 1, (char *[]) {name});
+    }
+    else
+    {
+        cmt_counter_inc(ctx->cmt_cache_hits, ts, 1, (char *[]) {name});
+    }
+#endif
+    if (ret == -1)
+    {
+        return FLB_FALSE;
+    }
+
+    msgpack_sbuffer_write(sbuffer, fragment, size);
+    return FLB_TRUE;
+}
+
+static void cache_set(struct uaparser_ctx *ctx, const char *agent, size_t len,
+                      const char *fragment, size_t size)
+{
+    if (!ctx->cache || len == 0 || size == 0)
+    {
+        return;
+    }
+
+#ifdef FLB_HAVE_METRICS
+    /* replacing a known user agent does not push another one out */
+    if (ctx->cache->max_entries > 0 &&
+        ctx->cache->total_count >= ctx->cache->max_entries &&
+        flb_hash_exists(ctx->cache, agent, len) == FLB_FALSE)
+    {
+        cmt_counter_inc(ctx->cmt_cache_evictions, cmt_time_now(),
+                        1, (char *[]) {(char *) flb_filter_name(ctx->ins)});
+    }
+#endif
+
+    flb_hash_add(ctx->cache, agent, len, (void *) fragment, size);
+}
+
+/*
+ * Batch mode: resolve every user agent of the chunk with a single request to
+ * the sidecar instead of one blocking round trip per record. User agents
+ * already known by the cache are not sent, repeated ones are sent once.
+ */
+static int cb_modifier_filter_batch(struct uaparser_ctx *ctx,
+                                    const void *data, size_t bytes,
+                                    void **out_buf, size_t *out_size)
+{
+    int i;
+    int ret;
+    int map_num;
+    int count = 0;
+    int agents = 0;
+    int agents_size = 0;
+    int index = 0;
+    int agent_index;
+    int reply;
+    int status = add_default;
+    size_t off = 0;
+    size_t fragment_off;
+    size_t pack_off;
+    size_t size;
+    size_t agent_len;
+    void *pending_reply;
+    const char *agent;
+    flb_sds_t *replies = NULL;
+    struct flb_hash *pending = NULL;
+    struct flb_sidecar_batch request;
+    struct agent_slot *slots = NULL;
+    struct agent_slot *tmp;
+    struct flb_time tm;
+    msgpack_sbuffer cached;
+    msgpack_sbuffer sbuffer;
+    msgpack_packer packer;
+    msgpack_unpacked unpacked;
+    msgpack_object *obj;
+    msgpack_object_kv *kv;
+
+    if (flb_sidecar_batch_init(&request, bytes) == -1)
+    {
+        flb_errno();
+        return FLB_FILTER_NOTOUCH;
+    }
+
+    /* holds the cached fragments found while the request is composed */
+    msgpack_sbuffer_init(&cached);
+    msgpack_sbuffer_init(&sbuffer);
+
+    /* First pass: collect the user agents of the chunk */
+    msgpack_unpacked_init(&unpacked);
+    while (msgpack_unpack_next(&unpacked, data, bytes, &off) == MSGPACK_UNPACK_SUCCESS)
+    {
+        if (unpacked.data.type != MSGPACK_OBJECT_ARRAY)
+        {
+            continue;
+        }
+        flb_time_pop_from_msgpack(&tm, &unpacked, &obj);
+        if (obj->type != MSGPACK_OBJECT_MAP)
+        {
+            continue;
+        }
+
+        kv = obj->via.map.ptr;
+        for (i = 0; i < obj->via.map.size; i++)
+        {
+            if (is_agent_field(ctx, &kv[i].key, &kv[i].val) == FLB_FALSE)
+            {
+                continue;
+            }
+
+            if (agents == agents_size)
+            {
+                agents_size = agents_size ? agents_size * 2 : 64;
+                tmp = flb_realloc(slots, sizeof(struct agent_slot) * agents_size);
+                if (!tmp)
+                {
+                    flb_errno();
+                    goto error;
+                }
+                slots = tmp;
+            }
+
+            agent = kv[i].val.via.str.ptr;
+            agent_len = kv[i].val.via.str.size;
+            fragment_off = cached.size;
+            if (pending &&
+                flb_hash_get(pending, agent, agent_len, &pending_reply, &size) >= 0)
+            {
+                /* already part of the request, share its reply */
+                slots[agents].reply = *(int *) pending_reply;
+                slots[agents].first = FLB_FALSE;
+            }
+            else if (cache_get(ctx, agent, agent_len, &cached) == FLB_TRUE)
+            {
+                slots[agents].reply = -1;
+                slots[agents].fragment_off = fragment_off;
+                slots[agents].fragment_size = cached.size - fragment_off;
+            }
+            else
+            {
+                if (!pending)
+                {
+                    pending = flb_hash_create(FLB_HASH_EVICT_NONE, 256, 0);
+                    if (!pending)
+                    {
+                        goto error;
+                    }
+                }
+                ret = flb_sidecar_batch_append(&request, agent, agent_len);
+                if (ret == -1)
+                {
+                    flb_errno();
+                    goto error;
+                }
+                /* empty agents can not be hashed, they are just sent again */
+                if (agent_len > 0 &&
+                    flb_hash_add(pending, agent, agent_len, &count, sizeof(int)) == -1)
+                {
+                    goto error;
+                }
+                slots[agents].reply = count++;
+                slots[agents].first = FLB_TRUE;
+            }
+            agents++;
+            break;
+        }
+    }
+
+    if (pending)
+    {
+        flb_hash_destroy(pending);
+        pending = NULL;
+    }
+
+    if (agents == 0)
+    {
+        msgpack_unpacked_destroy(&unpacked);
+        msgpack_sbuffer_destroy(&cached);
+        msgpack_sbuffer_destroy(&sbuffer);
+        flb_sidecar_batch_destroy(&request);
+        flb_error("[%s] Lookup key %s not found", PLUGIN_NAME, ctx->lookup_key);
+        return FLB_FILTER_NOTOUCH;
+    }
+
+    if (count > 0)
+    {
+        replies = flb_calloc(count, sizeof(flb_sds_t));
+        if (!replies)
+        {
+            flb_errno();
+            goto error;
+        }
+
+        flb_trace("[%s] Sending a batch of %d agents", PLUGIN_NAME, count);
+        if (flb_sidecar_batch_request(ctx->sidecar, &request, replies) == 0)
+        {
+            status = data_collected;
+        }
+        else
+        {
+            flb_debug("[%s] sidecar unavailable, using default agent fields", PLUGIN_NAME);
+        }
+    }
+    flb_sidecar_batch_destroy(&request);
+
+    /* Second pass: compose the records with the collected information */
+    msgpack_packer_init(&packer, &sbuffer, msgpack_sbuffer_write);
+
+    off = 0;
+    while (msgpack_unpack_next(&unpacked, data, bytes, &off) == MSGPACK_UNPACK_SUCCESS)
+    {
+        if (unpacked.data.type != MSGPACK_OBJECT_ARRAY)
+        {
+            continue;
+        }
+        flb_time_pop_from_msgpack(&tm, &unpacked, &obj);
+        if (obj->type != MSGPACK_OBJECT_MAP)
+        {
+            continue;
+        }
+
+        map_num = obj->via.map.size;
+        kv = obj->via.map.ptr;
+
+        agent_index = -1;
+        for (i = 0; i < map_num; i++)
+        {
+            if (is_agent_field(ctx, &kv[i].key, &kv[i].val) == FLB_TRUE)
+            {
+                agent_index = index++;
+                break;
+            }
+        }
+
+        msgpack_pack_array(&packer, 2);
+        flb_time_append_to_msgpack(&tm, &packer, 0);
+        if (agent_index == -1)
+        {
+            msgpack_pack_map(&packer, map_num);
+        }
+        else
+        {
+            msgpack_pack_map(&packer, map_num + NEW_ENTRIES);
+            reply = slots[agent_index].reply;
+            if (reply == -1)
+            {
+                msgpack_sbuffer_write(&sbuffer,
+                                      cached.data + slots[agent_index].fragment_off,
+                                      slots[agent_index].fragment_size);
+            }
+            else if (status == data_collected &&
+                     count_reply_fields(replies[reply],
+                                        flb_sds_len(replies[reply])) == NEW_ENTRIES * 2)
+            {
+                pack_off = sbuffer.size;
+                pack_reply_fields(replies[reply], flb_sds_len(replies[reply]), &packer);
+                if (slots[agent_index].first == FLB_TRUE)
+                {
+                    cache_set(ctx, kv[i].val.via.str.ptr, kv[i].val.via.str.size,
+                              sbuffer.data + pack_off, sbuffer.size - pack_off);
+                }
+            }
+            else
+            {
+                add_default_ua_fields(&packer);
+            }
+        }
+
+        for (i = 0; i < map_num; i++)
+        {
+            msgpack_pack_object(&packer, kv[i].key);
+            msgpack_pack_object(&packer, kv[i].val);
+        }
+    }
+    msgpack_unpacked_destroy(&unpacked);
+
+    if (replies)
+    {
+        flb_sidecar_replies_destroy(replies, count);
+        flb_free(replies);
+    }
+    flb_free(slots);
+    msgpack_sbuffer_destroy(&cached);
+
+    *out_buf = sbuffer.data;
+    *out_size = sbuffer.size;
+    return FLB_FILTER_MODIFIED;
+
+error:
+    if (pending)
+    {
+        flb_hash_destroy(pending);
+    }
+    msgpack_unpacked_destroy(&unpacked);
+    msgpack_sbuffer_destroy(&cached);
+    msgpack_sbuffer_destroy(&sbuffer);
+    flb_sidecar_batch_destroy(&request);
+    flb_free(replies);
+    flb_free(slots);
+    return FLB_FILTER_NOTOUCH;
+}
+
 static int cb_modifier_filter(const void *data, size_t bytes,
                               const char *tag, int tag_len,
                               void **out_buf, size_t *out_size,
@@ -216,6 +642,8 @@ static int cb_modifier_filter(const void *data, size_t bytes,
     struct uaparser_ctx *ctx = context;
     //flb_info("ppm %d",ctx->lookup_key->len);
     size_t off = 0;
+    size_t pack_off;
+    flb_sds_t agent;
     int uaparser_status = agent_not_available;
     int map_num = 0;
     struct flb_time tm;
@@ -224,6 +652,12 @@ static int cb_modifier_filter(const void *data, size_t bytes,
     msgpack_unpacked unpacked;
     msgpack_object *obj, *old_record_key, *old_record_value;
     msgpack_object_kv *kv;
+
+    if (ctx->batch == FLB_TRUE)
+    {
+        return cb_modifier_filter_batch(ctx, data, bytes, out_buf, out_size);
+    }
+
     msgpack_sbuffer_init(&sbuffer);
     msgpack_packer_init(&packer, &sbuffer, msgpack_sbuffer_write);
     msgpack_unpacked_init(&unpacked);
@@ -255,25 +689,38 @@ static int cb_modifier_filter(const void *data, size_t bytes,
             old_record_value = &(kv + i)->val;
             if (old_record_key->type == MSGPACK_OBJECT_STR && !strncasecmp(old_record_key->via.str.ptr, ctx->lookup_key, ctx->lookup_key_len))
             {
-                char *agentString = flb_strndup(old_record_value->via.str.ptr, old_record_value->via.str.size);
-                char *endln = "\n" ;
-                char *agent = (char *)flb_malloc(old_record_value->via.str.size + 4);
-                strcpy(agent, agentString);
-                strncat(agent, endln, strlen(endln));
-                flb_trace("[%s] Sending agent: %s", PLUGIN_NAME, agentString);
+                flb_trace("[%s] Sending agent: %.*s", PLUGIN_NAME,
+                          (int) old_record_value->via.str.size, old_record_value->via.str.ptr);
                 //populates record map with agent information
-                if (retryCounter <= GLOBALRETRIES)
+                if (cache_get(ctx, old_record_value->via.str.ptr, old_record_value->via.str.size, &sbuffer) == FLB_TRUE)
                 {
-                    uaparser_status = get_agent_info(agent, atoi(ctx->port), &packer);
+                    uaparser_status = data_collected;
                 }
                 else
                 {
-                    flb_debug("[%s] Max retry limit exceed, skipping agent fields", PLUGIN_NAME);
-                    uaparser_status = add_default;
-                    // add_default_ua_fields(&packer);
+                    agent = flb_sds_create_size(old_record_value->via.str.size + 1);
+                    if (agent)
+                    {
+                        flb_sds_cat_safe(&agent, old_record_value->via.str.ptr, old_record_value->via.str.size);
+                        flb_sds_cat_safe(&agent, "\n", 1);
+                    }
+                    pack_off = sbuffer.size;
+                    uaparser_status = agent ? get_agent_info(ctx, agent, flb_sds_len(agent), &packer) : unable_to_connect;
+                    if (uaparser_status == data_collected)
+                    {
+                        cache_set(ctx, old_record_value->via.str.ptr, old_record_value->via.str.size,
+                                  sbuffer.data + pack_off, sbuffer.size - pack_off);
+                    }
+                    else
+                    {
+                        /* the sidecar is down, keep the record consistent with defaults */
+                        add_default_ua_fields(&packer);
+                    }
+                    if (agent)
+                    {
+                        flb_sds_destroy(agent);
+                    }
                 }
-                flb_free(agent);
-                flb_free(agentString);
             }
             msgpack_pack_object(&packer, (kv + i)->key);
             msgpack_pack_object(&packer, (kv + i)->val);
@@ -288,9 +735,7 @@ static int cb_modifier_filter(const void *data, size_t bytes,
     }
     else if (uaparser_status == unable_to_connect)
     {
-        flb_error("[%s] Unable to establish connection with the socket server: Log retry %d/%d", PLUGIN_NAME, retryCounter, GLOBALRETRIES);
-        retryCounter++;
-        add_default_ua_fields(&packer);
+        flb_debug("[%s] sidecar unavailable, default agent fields added", PLUGIN_NAME);
     }
     *out_buf = sbuffer.data;
     *out_size = sbuffer.size;
@@ -299,13 +744,20 @@ static int cb_modifier_filter(const void *data, size_t bytes,
 static int cb_modifier_exit(void *data, struct flb_config *config)
 {
     struct uaparser_ctx *ctx = data;
-    close(sock);
     if (ctx != NULL)
     {
+        flb_sidecar_destroy(ctx->sidecar);
+        ctx->sidecar = NULL;
+        flb_free(ctx->host);
+        ctx->host = NULL;
         flb_free(ctx->lookup_key);
         ctx->lookup_key = NULL;
         flb_free(ctx->port);
         ctx->port = NULL;
+        if (ctx->cache)
+        {
+            flb_hash_destroy(ctx->cache);
+        }
         flb_free(ctx);
         ctx = NULL;
     }
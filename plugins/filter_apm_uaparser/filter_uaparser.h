@@ -1,9 +1,6 @@
 #define AVAILABLE 1
 #define NOT_AVAILABLE 0
 #define NEW_ENTRIES 9
-#define RETRIES 2
-#define GLOBALRETRIES 100
-#define DELAYINSEC 2
 #define LOOKUPKEY "agent_key"
 #define DEFAULT "Unknown"
 #define DEFAULT_LEN 7
@@ -27,6 +24,13 @@
 #define DEVICE_MODEL_LEN 12
 
 #define PORTKEY "port"
+#define HOSTKEY "host"
+#define DEFAULT_HOST "127.0.0.1"
+#define BATCHKEY "batch"
+#define CACHE_SIZE_KEY "cache_size"
+#define CACHE_TTL_KEY "cache_ttl"
+#define CACHE_EVICT_KEY "cache_evict"
+#define DEFAULT_CACHE_SIZE 1024
 
 enum ua_parser_status {
     agent_not_available,
@@ -35,6 +39,17 @@ enum ua_parser_status {
     unable_to_connect,
     add_default
 };
+/*
+ * user agent of a batch: a cached fragment or the index of a sidecar reply,
+ * 'first' marks the record that sent it, the one caching the reply.
+ */
+struct agent_slot {
+    int reply;
+    int first;
+    size_t fragment_off;
+    size_t fragment_size;
+};
+
 struct uaparser_ctx {
     char *lookup_key;
     char *port;
@@ -42,6 +57,23 @@ struct uaparser_ctx {
     int port_key_check;
     int lookup_key_len; 
     int lookup_key_check;
-    int sock;
+    char *host;
+    int batch;
+
+    /* connection pool and circuit breaker to the sidecar */
+    struct flb_sidecar *sidecar;
+
+    /* user agent -> packed msgpack fields */
+    int cache_size;
+    int cache_ttl;
+    int cache_evict;
+    struct flb_hash *cache;
+
+#ifdef FLB_HAVE_METRICS
+    struct cmt_counter *cmt_cache_hits;
+    struct cmt_counter *cmt_cache_misses;
+    struct cmt_counter *cmt_cache_evictions;
+#endif
+
     struct flb_filter_instance *ins;
 };
@@ -7,51 +7,26 @@
 #include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_time.h>
 #include <msgpack.h>
+#include <fluent-bit/flb_sidecar.h>
 #include <string.h>
-#include <io.h>
 #include <stdlib.h>
 #include "filter_url_normalize.h"
+#include "url_normalize_native.h"
 #define PLUGIN_NAME "filter:apm_url_normalizer"
 
-// Define global socketFD socket
-int socketFD = 0;
-int retryConnectCounter = 0;
-
-static int connect_socket(int port)
-{
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0)
-    {
-        flb_error("[%s] Invalid address/ Address not supported", PLUGIN_NAME);
-        return -1;
-    }
-    if ((socketFD = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    {
-        flb_error("[%s] Socket creation error on port %d",PLUGIN_NAME, port);
-        return -1;
-    }
-    if (connect(socketFD, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-    {
-        flb_error("[%s] Connection Failed on port %d", PLUGIN_NAME, port);
-        return -1;
-    }
-    else
-    {
-        flb_info("[%s] Connected to port %d", PLUGIN_NAME, port);
-    }
-    return socketFD;
-}
-
-static int configure(struct urlnormalizer_ctx *ctx, struct flb_filter_instance *f_ins)
+static int configure(struct urlnormalizer_ctx *ctx, struct flb_filter_instance *f_ins,
+                     struct flb_config *config)
 {
     struct flb_kv *kv = NULL;
     struct mk_list *head = NULL;
     ctx->lookup_key_check = NOT_AVAILABLE;
     ctx->port_key_check = NOT_AVAILABLE;
+    ctx->mode = mode_socket;
+    ctx->native = url_normalizer_create();
+    if (!ctx->native)
+    {
+        return -1;
+    }
     mk_list_foreach(head, &f_ins->properties)
     {
         kv = mk_list_entry(head, struct flb_kv, _head);
@@ -69,20 +44,60 @@ static int configure(struct urlnormalizer_ctx *ctx, struct flb_filter_instance *
             ctx->port = flb_strndup(kv->val, flb_sds_len(kv->val));
             ctx->port_key_len = flb_sds_len(kv->val);
         }
+
+        if (!strcasecmp(kv->key, MODEKEY))
+        {
+            if (!strcasecmp(kv->val, "native"))
+            {
+                ctx->mode = mode_native;
+            }
+            else if (!strcasecmp(kv->val, "socket"))
+            {
+                ctx->mode = mode_socket;
+            }
+            else
+            {
+                flb_error("[%s] invalid mode '%s', use native or socket", PLUGIN_NAME, kv->val);
+                return -1;
+            }
+        }
+
+        if (!strcasecmp(kv->key, TEMPLATEKEY))
+        {
+            if (url_normalizer_add_template(ctx->native, kv->val) == -1)
+            {
+                return -1;
+            }
+        }
+
+        if (!strcasecmp(kv->key, RULEKEY))
+        {
+            if (url_normalizer_add_rule(ctx->native, kv->val) == -1)
+            {
+                return -1;
+            }
+        }
     }
     if (ctx->lookup_key_check == NOT_AVAILABLE)
     {
         flb_error("[%s] lookup key not found", PLUGIN_NAME);
         return -1;
     }
+    if (ctx->mode == mode_native)
+    {
+        flb_info("[%s] normalizing url paths in process", PLUGIN_NAME);
+        return 0;
+    }
     if (ctx->port_key_check == NOT_AVAILABLE)
     {
         flb_error("[%s] port key not found", PLUGIN_NAME);
         return -1;
     }
-    if (connect_socket(atoi(ctx->port)) < 0)
+    ctx->sidecar = flb_sidecar_create(config, flb_filter_name(f_ins),
+                                      DEFAULT_HOST, atoi(ctx->port));
+    if (!ctx->sidecar)
     {
-        return 0;
+        return -1;
     }
     return 0;
 }
@@ -92,14 +107,18 @@ static int cb_modifier_init_apm_url_norm(struct flb_filter_instance *f_ins,
                             void *data)
 {
     struct urlnormalizer_ctx *ctx = NULL;
-    ctx = flb_malloc(sizeof(struct urlnormalizer_ctx));
+    ctx = flb_calloc(1, sizeof(struct urlnormalizer_ctx));
     if (!ctx)
     {
         flb_errno();
         return -1;
     }
-    if (configure(ctx, f_ins) < 0)
+    if (configure(ctx, f_ins, config) < 0)
     {
+        flb_sidecar_destroy(ctx->sidecar);
+        url_normalizer_destroy(ctx->native);
+        flb_free(ctx->lookup_key);
+        flb_free(ctx->port);
         flb_free(ctx);
         ctx = NULL;
         return -1;
@@ -109,51 +128,127 @@ static int cb_modifier_init_apm_url_norm(struct flb_filter_instance *f_ins,
     return 0;
 }
 
-static int get_norm_url(char *path, int port, msgpack_packer *packer)
+static int get_norm_url(struct urlnormalizer_ctx *ctx, char *message, msgpack_packer *packer)
 {
-    int valread = 0, retry = 0;
+    int ret;
+    size_t valread = 0;
     char buffer[1024] = {0};
     char *entry;
-    if (send(socketFD, path, strlen(path), 0) == -1)
+
+    ret = flb_sidecar_request(ctx->sidecar, message, strlen(message),
+                              buffer, sizeof(buffer), &valread);
+    if (ret == -1)
     {
-        flb_error("[%s] Error in sending the agent %s", PLUGIN_NAME, path);
-        goto retry;
+        return unable_to_connect;
+    }
+
+    entry = strtok(buffer, "}");
+    while (entry != NULL)
+    {
+        msgpack_pack_str(packer, strlen(entry));
+        msgpack_pack_str_body(packer, entry, strlen(entry));
+        entry = strtok(NULL, "}");
     }
-    valread = recv(socketFD, buffer, 1024, 0);
-    if (valread == 0 || valread == -1)
+    return data_collected;
+}
+
+/* Native mode: normalize the url paths in process, no sidecar involved */
+static int cb_modifier_filter_native(struct urlnormalizer_ctx *ctx,
+                                     const void *data, size_t bytes,
+                                     void **out_buf, size_t *out_size)
+{
+    int i;
+    int ret;
+    int map_num;
+    int found = FLB_FALSE;
+    int path_index;
+    size_t off = 0;
+    flb_sds_t normalized;
+    struct flb_time tm;
+    msgpack_sbuffer sbuffer;
+    msgpack_packer packer;
+    msgpack_unpacked unpacked;
+    msgpack_object *obj;
+    msgpack_object_kv *kv;
+
+    msgpack_sbuffer_init(&sbuffer);
+    msgpack_packer_init(&packer, &sbuffer, msgpack_sbuffer_write);
+    msgpack_unpacked_init(&unpacked);
+    while (msgpack_unpack_next(&unpacked, data, bytes, &off) == MSGPACK_UNPACK_SUCCESS)
     {
-        retry:
-        do
+        if (unpacked.data.type != MSGPACK_OBJECT_ARRAY)
+        {
+            continue;
+        }
+        flb_time_pop_from_msgpack(&tm, &unpacked, &obj);
+        if (obj->type != MSGPACK_OBJECT_MAP)
         {
-            flb_info("[%s] Trying to reconnect the socket: retry %d/%d", PLUGIN_NAME, retry, RETRIES) ;
-            if (connect_socket(port) < 0)
+            continue;
+        }
+
+        map_num = obj->via.map.size;
+        kv = obj->via.map.ptr;
+
+        path_index = -1;
+        for (i = 0; i < map_num; i++)
+        {
+            if (kv[i].key.type == MSGPACK_OBJECT_STR &&
+                kv[i].val.type == MSGPACK_OBJECT_STR &&
+                !strncasecmp(kv[i].key.via.str.ptr, ctx->lookup_key, ctx->lookup_key_len))
             {
-                flb_info("[%s] Unable to reconnect the socket", PLUGIN_NAME);
-                if (retry++ > RETRIES) {
-                    return unable_to_connect;
-                }
-                continue;
+                path_index = i;
+                break;
             }
-            if (send(socketFD, path, strlen(path), 0) == -1)
+        }
+
+        normalized = NULL;
+        if (path_index >= 0)
+        {
+            ret = url_normalizer_do(ctx->native,
+                                    kv[path_index].val.via.str.ptr,
+                                    kv[path_index].val.via.str.size,
+                                    &normalized);
+            if (ret == -1)
             {
-                flb_error("[%s] Error in sending the agent %s: retry %d/%d", PLUGIN_NAME, path,  retry, RETRIES);
-                if (retry++ > RETRIES) {
-                    return unable_to_connect;
-                }
-                continue;
+                normalized = NULL;
             }
-            valread = recv(socketFD, buffer, 1024, 0);
-        } while (valread == 0);
+        }
+
+        msgpack_pack_array(&packer, 2);
+        flb_time_append_to_msgpack(&tm, &packer, 0);
+        if (normalized)
+        {
+            found = FLB_TRUE;
+            msgpack_pack_map(&packer, map_num + NEW_ENTRIES);
+            msgpack_pack_str(&packer, NORMALIZED_PATH_LEN);
+            msgpack_pack_str_body(&packer, NORMALIZED_PATH, NORMALIZED_PATH_LEN);
+            msgpack_pack_str(&packer, flb_sds_len(normalized));
+            msgpack_pack_str_body(&packer, normalized, flb_sds_len(normalized));
+            flb_sds_destroy(normalized);
+        }
+        else
+        {
+            msgpack_pack_map(&packer, map_num);
+        }
+
+        for (i = 0; i < map_num; i++)
+        {
+            msgpack_pack_object(&packer, kv[i].key);
+            msgpack_pack_object(&packer, kv[i].val);
+        }
     }
+    msgpack_unpacked_destroy(&unpacked);
 
-    entry = strtok(buffer, "}");
-    while (entry != NULL)
+    if (found == FLB_FALSE)
     {
-        msgpack_pack_str(packer, strlen(entry));
-        msgpack_pack_str_body(packer, entry, strlen(entry));
-        entry = strtok(NULL, "}");
+        msgpack_sbuffer_destroy(&sbuffer);
+        flb_debug("[%s] Lookup key %s not found", PLUGIN_NAME, ctx->lookup_key);
+        return FLB_FILTER_NOTOUCH;
     }
-    return data_collected;
+
+    *out_buf = sbuffer.data;
+    *out_size = sbuffer.size;
+    return FLB_FILTER_MODIFIED;
 }
 
 static int cb_modifier_filter_apm_url_norm(const void *data, size_t bytes,
@@ -174,11 +269,16 @@ static int cb_modifier_filter_apm_url_norm(const void *data, size_t bytes,
     msgpack_unpacked unpacked;
     msgpack_object *obj, *old_record_key, *old_record_value;
     msgpack_object_kv *kv;
+
+    if (ctx->mode == mode_native)
+    {
+        return cb_modifier_filter_native(ctx, data, bytes, out_buf, out_size);
+    }
+
     msgpack_sbuffer_init(&sbuffer);
     msgpack_packer_init(&packer, &sbuffer, msgpack_sbuffer_write);
     msgpack_unpacked_init(&unpacked);
-    size_t urlpath_len = 0;
-    char *urlpath;
+    flb_sds_t urlpath;
     while (msgpack_unpack_next(&unpacked, data, bytes, &off) == MSGPACK_UNPACK_SUCCESS)
     {
 
@@ -207,24 +307,28 @@ static int cb_modifier_filter_apm_url_norm(const void *data, size_t bytes,
             old_record_value = &(kv + i)->val;
             if (old_record_key->type == MSGPACK_OBJECT_STR && !strncasecmp(old_record_key->via.str.ptr, ctx->lookup_key, ctx->lookup_key_len))
             {
-                urlpath = flb_strndup(old_record_value->via.str.ptr, old_record_value->via.str.size);
-                urlpath_len =  old_record_value->via.str.size;
-                char *endln = "\n" ;
-                char *formattedPath = (char *)flb_malloc(old_record_value->via.str.size + 4);
-                strcpy(formattedPath, urlpath);
-                strncat(formattedPath, endln, strlen(endln));
-                flb_trace("[%s] Sending url path for normalization: %s", PLUGIN_NAME, urlpath);
-                //populates record map with agent information
-                if (retryConnectCounter <= GLOBALRETRIES)
+                urlpath = flb_sds_create_size(old_record_value->via.str.size + 1);
+                if (urlpath)
                 {
-                    collection_status = get_norm_url(formattedPath, atoi(ctx->port), &packer);
+                    flb_sds_cat_safe(&urlpath, old_record_value->via.str.ptr, old_record_value->via.str.size);
+                    flb_sds_cat_safe(&urlpath, "\n", 1);
+                    flb_trace("[%s] Sending url path for normalization: %s", PLUGIN_NAME, urlpath);
+                    //populates record map with agent information
+                    collection_status = get_norm_url(ctx, urlpath, &packer);
+                    flb_sds_destroy(urlpath);
                 }
                 else
                 {
-                    flb_debug("[%s] Max retry limit exceed, skipping agent fields", PLUGIN_NAME);
-                    //collection_status = add_default;
+                    collection_status = unable_to_connect;
+                }
+                if (collection_status == unable_to_connect)
+                {
+                    /* the sidecar is down, keep the original path */
+                    msgpack_pack_str(&packer, NORMALIZED_PATH_LEN);
+                    msgpack_pack_str_body(&packer, NORMALIZED_PATH, NORMALIZED_PATH_LEN);
+                    msgpack_pack_str(&packer, old_record_value->via.str.size);
+                    msgpack_pack_str_body(&packer, old_record_value->via.str.ptr, old_record_value->via.str.size);
                 }
-                flb_free(formattedPath);
             }
             msgpack_pack_object(&packer, (kv + i)->key);
             msgpack_pack_object(&packer, (kv + i)->val);
@@ -240,13 +344,7 @@ static int cb_modifier_filter_apm_url_norm(const void *data, size_t bytes,
     }
     else if (collection_status == unable_to_connect)
     {
-        flb_error("[%s] Unable to establish connection with the socket server: Log retry %d/%d", PLUGIN_NAME, retryConnectCounter, GLOBALRETRIES);
-        retryConnectCounter++;
-        msgpack_pack_str(&packer, NORMALIZED_PATH_LEN);
-        msgpack_pack_str_body(&packer, NORMALIZED_PATH, NORMALIZED_PATH_LEN);
-        msgpack_pack_str(&packer, urlpath_len);
-        msgpack_pack_str_body(&packer, urlpath, urlpath_len);
-        flb_free(urlpath);
+        flb_debug("[%s] sidecar unavailable, original url path kept", PLUGIN_NAME);
     }
     
     *out_buf = sbuffer.data;
@@ -256,13 +354,15 @@ static int cb_modifier_filter_apm_url_norm(const void *data, size_t bytes,
 static int cb_modifier_exit_apm_url_norm(void *data, struct flb_config *config)
 {
     struct urlnormalizer_ctx *ctx = data;
-    close(socketFD);
     if (ctx != NULL)
     {
+        flb_sidecar_destroy(ctx->sidecar);
+        ctx->sidecar = NULL;
         flb_free(ctx->lookup_key);
         ctx->lookup_key = NULL;
         flb_free(ctx->port);
         ctx->port = NULL;
+        url_normalizer_destroy(ctx->native);
         flb_free(ctx);
         ctx = NULL;
     }
@@ -1,15 +1,21 @@
 #define AVAILABLE 1
 #define NOT_AVAILABLE 0
 #define NEW_ENTRIES 1
-#define RETRIES 2
-#define GLOBALRETRIES 100
-#define DELAYINSEC 2
 #define LOOKUPKEY "url_path_key"
 #define DEFAULT "Unknown"
 #define DEFAULT_LEN 7
 #define NORMALIZED_PATH "normalized_path"
 #define NORMALIZED_PATH_LEN 15
 #define PORTKEY "port"
+#define DEFAULT_HOST "127.0.0.1"
+#define MODEKEY "mode"
+#define TEMPLATEKEY "template"
+#define RULEKEY "rule"
+
+enum url_normalize_mode {
+    mode_socket,
+    mode_native
+};
 
 enum url_normalize_status {
     url_path_not_available,
@@ -24,6 +30,8 @@ struct urlnormalizer_ctx {
     int port_key_check;
     int lookup_key_len; 
     int lookup_key_check;
-    int sock;
+    int mode;
+    struct url_normalizer *native;
+    struct flb_sidecar *sidecar;
     struct flb_filter_instance *ins;
 };
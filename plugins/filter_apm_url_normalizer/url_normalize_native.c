@@ -0,0 +1,571 @@
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_regex.h>
+#include <string.h>
+#include <ctype.h>
+#include "url_normalize_native.h"
+
+struct url_segment
+{
+    const char *ptr;
+    size_t len;
+};
+
+static struct url_trie_node *trie_node_create(const char *segment, size_t len)
+{
+    struct url_trie_node *node;
+
+    node = flb_calloc(1, sizeof(struct url_trie_node));
+    if (!node)
+    {
+        flb_errno();
+        return NULL;
+    }
+    mk_list_init(&node->children);
+
+    if (segment)
+    {
+        node->segment = flb_sds_create_len(segment, len);
+        if (!node->segment)
+        {
+            flb_free(node);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+static void trie_node_destroy(struct url_trie_node *node)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct url_trie_node *child;
+
+    mk_list_foreach_safe(head, tmp, &node->children)
+    {
+        child = mk_list_entry(head, struct url_trie_node, _head);
+        mk_list_del(&child->_head);
+        trie_node_destroy(child);
+    }
+
+    if (node->segment)
+    {
+        flb_sds_destroy(node->segment);
+    }
+    if (node->template)
+    {
+        flb_sds_destroy(node->template);
+    }
+    flb_free(node);
+}
+
+/*
+ * Split a path in segments. The query string and the fragment are not part
+ * of the path. Returns the number of segments or -1 if there are too many.
+ */
+static int split_path(const char *path, size_t len,
+                      struct url_segment *segs, int max)
+{
+    int n = 0;
+    size_t i;
+    size_t start;
+
+    for (i = 0; i < len; i++)
+    {
+        if (path[i] == '?' || path[i] == '#')
+        {
+            len = i;
+            break;
+        }
+    }
+
+    i = 0;
+    if (len > 0 && path[0] == '/')
+    {
+        i = 1;
+    }
+
+    start = i;
+    for (; i <= len; i++)
+    {
+        if (i == len || path[i] == '/')
+        {
+            /* a trailing slash does not open a new segment */
+            if (i == len && i == start && n > 0)
+            {
+                break;
+            }
+            if (i == len && i == start && len <= 1)
+            {
+                break;
+            }
+            if (n == max)
+            {
+                return -1;
+            }
+            segs[n].ptr = path + start;
+            segs[n].len = i - start;
+            n++;
+            start = i + 1;
+        }
+    }
+
+    return n;
+}
+
+static int is_wildcard(const char *segment, size_t len)
+{
+    if (len == 1 && segment[0] == '*')
+    {
+        return FLB_TRUE;
+    }
+    if (len > 1 && segment[0] == ':')
+    {
+        return FLB_TRUE;
+    }
+    if (len > 2 && segment[0] == '{' && segment[len - 1] == '}')
+    {
+        return FLB_TRUE;
+    }
+    return FLB_FALSE;
+}
+
+static struct url_trie_node *trie_match(struct url_trie_node *node,
+                                        struct url_segment *segs, int n, int i)
+{
+    struct mk_list *head;
+    struct url_trie_node *child;
+    struct url_trie_node *found;
+
+    if (i == n)
+    {
+        return node->template ? node : NULL;
+    }
+
+    /* literal segments take precedence over wildcards */
+    mk_list_foreach(head, &node->children)
+    {
+        child = mk_list_entry(head, struct url_trie_node, _head);
+        if (child->segment &&
+            flb_sds_len(child->segment) == segs[i].len &&
+            memcmp(child->segment, segs[i].ptr, segs[i].len) == 0)
+        {
+            found = trie_match(child, segs, n, i + 1);
+            if (found)
+            {
+                return found;
+            }
+        }
+    }
+
+    mk_list_foreach(head, &node->children)
+    {
+        child = mk_list_entry(head, struct url_trie_node, _head);
+        if (!child->segment)
+        {
+            found = trie_match(child, segs, n, i + 1);
+            if (found)
+            {
+                return found;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int is_numeric(const char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (s[i] < '0' || s[i] > '9')
+        {
+            return FLB_FALSE;
+        }
+    }
+    return len > 0;
+}
+
+static int is_uuid(const char *s, size_t len)
+{
+    size_t i;
+
+    if (len != 36)
+    {
+        return FLB_FALSE;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if (i == 8 || i == 13 || i == 18 || i == 23)
+        {
+            if (s[i] != '-')
+            {
+                return FLB_FALSE;
+            }
+        }
+        else if (!isxdigit((unsigned char) s[i]))
+        {
+            return FLB_FALSE;
+        }
+    }
+    return FLB_TRUE;
+}
+
+/* hexadecimal identifiers must contain at least one digit, 'deadbeef' stays */
+static int is_hex_id(const char *s, size_t len)
+{
+    size_t i;
+    int digits = 0;
+
+    if (len < URL_NORM_HEX_MIN_LEN)
+    {
+        return FLB_FALSE;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if (s[i] >= '0' && s[i] <= '9')
+        {
+            digits++;
+        }
+        else if (!isxdigit((unsigned char) s[i]))
+        {
+            return FLB_FALSE;
+        }
+    }
+    return digits > 0;
+}
+
+static int normalize_segment(struct url_normalizer *un, struct url_segment *seg,
+                             flb_sds_t *out)
+{
+#ifdef FLB_HAVE_REGEX
+    struct mk_list *head;
+    struct url_rule *rule;
+
+    mk_list_foreach(head, &un->rules)
+    {
+        rule = mk_list_entry(head, struct url_rule, _head);
+        if (flb_regex_match(rule->regex, (unsigned char *) seg->ptr, seg->len) > 0)
+        {
+            return flb_sds_cat_safe(out, rule->replacement,
+                                    flb_sds_len(rule->replacement));
+        }
+    }
+#endif
+
+    if (is_numeric(seg->ptr, seg->len))
+    {
+        return flb_sds_cat_safe(out, URL_NORM_NUM, sizeof(URL_NORM_NUM) - 1);
+    }
+    if (is_uuid(seg->ptr, seg->len))
+    {
+        return flb_sds_cat_safe(out, URL_NORM_UUID, sizeof(URL_NORM_UUID) - 1);
+    }
+    if (is_hex_id(seg->ptr, seg->len))
+    {
+        return flb_sds_cat_safe(out, URL_NORM_HEX, sizeof(URL_NORM_HEX) - 1);
+    }
+    return flb_sds_cat_safe(out, seg->ptr, seg->len);
+}
+
+/*
+ * Normalize every segment of the path with the user rules and the built-in
+ * classifiers. The path is walked in place, so it works with any number of
+ * segments; empty segments are kept and a trailing slash is dropped, like
+ * split_path() does.
+ */
+static int normalize_path_segments(struct url_normalizer *un,
+                                   const char *path, size_t len,
+                                   flb_sds_t *out)
+{
+    int n = 0;
+    int ret;
+    size_t i;
+    size_t start;
+    struct url_segment seg;
+
+    for (i = 0; i < len; i++)
+    {
+        if (path[i] == '?' || path[i] == '#')
+        {
+            len = i;
+            break;
+        }
+    }
+
+    i = 0;
+    if (len > 0 && path[0] == '/')
+    {
+        i = 1;
+    }
+
+    start = i;
+    for (; i <= len; i++)
+    {
+        if (i < len && path[i] != '/')
+        {
+            continue;
+        }
+        if (i == len && i == start && (n > 0 || len <= 1))
+        {
+            break;
+        }
+
+        if (n > 0 || path[0] == '/')
+        {
+            ret = flb_sds_cat_safe(out, "/", 1);
+            if (ret == -1)
+            {
+                return -1;
+            }
+        }
+
+        seg.ptr = path + start;
+        seg.len = i - start;
+        ret = normalize_segment(un, &seg, out);
+        if (ret == -1)
+        {
+            return -1;
+        }
+        n++;
+        start = i + 1;
+    }
+
+    if (n == 0 && len > 0 && path[0] == '/')
+    {
+        return flb_sds_cat_safe(out, "/", 1);
+    }
+
+    return 0;
+}
+
+struct url_normalizer *url_normalizer_create()
+{
+    struct url_normalizer *un;
+
+    un = flb_calloc(1, sizeof(struct url_normalizer));
+    if (!un)
+    {
+        flb_errno();
+        return NULL;
+    }
+    mk_list_init(&un->rules);
+
+    un->templates = trie_node_create(NULL, 0);
+    if (!un->templates)
+    {
+        flb_free(un);
+        return NULL;
+    }
+    return un;
+}
+
+void url_normalizer_destroy(struct url_normalizer *un)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct url_rule *rule;
+
+    if (!un)
+    {
+        return;
+    }
+
+    mk_list_foreach_safe(head, tmp, &un->rules)
+    {
+        rule = mk_list_entry(head, struct url_rule, _head);
+        mk_list_del(&rule->_head);
+#ifdef FLB_HAVE_REGEX
+        flb_regex_destroy(rule->regex);
+#endif
+        flb_sds_destroy(rule->replacement);
+        flb_free(rule);
+    }
+
+    trie_node_destroy(un->templates);
+    flb_free(un);
+}
+
+int url_normalizer_add_template(struct url_normalizer *un, const char *template)
+{
+    int i;
+    int n;
+    int found;
+    size_t len;
+    struct mk_list *head;
+    struct url_trie_node *node;
+    struct url_trie_node *child;
+    struct url_segment segs[URL_NORM_MAX_SEGMENTS];
+
+    len = strlen(template);
+    n = split_path(template, len, segs, URL_NORM_MAX_SEGMENTS);
+    if (n <= 0)
+    {
+        flb_error("[url_normalizer] invalid template '%s'", template);
+        return -1;
+    }
+
+    node = un->templates;
+    for (i = 0; i < n; i++)
+    {
+        found = FLB_FALSE;
+        mk_list_foreach(head, &node->children)
+        {
+            child = mk_list_entry(head, struct url_trie_node, _head);
+            if (is_wildcard(segs[i].ptr, segs[i].len))
+            {
+                if (!child->segment)
+                {
+                    found = FLB_TRUE;
+                    break;
+                }
+            }
+            else if (child->segment &&
+                     flb_sds_len(child->segment) == segs[i].len &&
+                     memcmp(child->segment, segs[i].ptr, segs[i].len) == 0)
+            {
+                found = FLB_TRUE;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            if (is_wildcard(segs[i].ptr, segs[i].len))
+            {
+                child = trie_node_create(NULL, 0);
+            }
+            else
+            {
+                child = trie_node_create(segs[i].ptr, segs[i].len);
+            }
+            if (!child)
+            {
+                return -1;
+            }
+            mk_list_add(&child->_head, &node->children);
+        }
+        node = child;
+    }
+
+    if (node->template)
+    {
+        flb_warn("[url_normalizer] template '%s' overrides '%s'",
+                 template, node->template);
+        flb_sds_destroy(node->template);
+    }
+    node->template = flb_sds_create_len(template, len);
+    if (!node->template)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* A rule has the format '<regex> <replacement>' */
+int url_normalizer_add_rule(struct url_normalizer *un, const char *rule)
+{
+#ifdef FLB_HAVE_REGEX
+    char *sep;
+    flb_sds_t pattern;
+    struct url_rule *r;
+
+    sep = strrchr(rule, ' ');
+    if (!sep || sep == rule || *(sep + 1) == '\0')
+    {
+        flb_error("[url_normalizer] invalid rule '%s', expected '<regex> <replacement>'",
+                  rule);
+        return -1;
+    }
+
+    r = flb_calloc(1, sizeof(struct url_rule));
+    if (!r)
+    {
+        flb_errno();
+        return -1;
+    }
+
+    pattern = flb_sds_create_len(rule, sep - rule);
+    if (!pattern)
+    {
+        flb_free(r);
+        return -1;
+    }
+
+    r->regex = flb_regex_create(pattern);
+    flb_sds_destroy(pattern);
+    if (!r->regex)
+    {
+        flb_error("[url_normalizer] invalid regex in rule '%s'", rule);
+        flb_free(r);
+        return -1;
+    }
+
+    r->replacement = flb_sds_create(sep + 1);
+    if (!r->replacement)
+    {
+        flb_regex_destroy(r->regex);
+        flb_free(r);
+        return -1;
+    }
+
+    mk_list_add(&r->_head, &un->rules);
+    return 0;
+#else
+    flb_error("[url_normalizer] rules require regex support");
+    return -1;
+#endif
+}
+
+/*
+ * Normalize a path: if it matches a template the template is returned,
+ * otherwise every segment goes through the user rules and the built-in
+ * numeric, UUID and hexadecimal identifier classifiers. Paths with more
+ * than URL_NORM_MAX_SEGMENTS segments are not matched against the
+ * templates.
+ */
+int url_normalizer_do(struct url_normalizer *un, const char *path, size_t len,
+                      flb_sds_t *out)
+{
+    int n;
+    int ret;
+    flb_sds_t buf;
+    struct url_trie_node *node = NULL;
+    struct url_segment segs[URL_NORM_MAX_SEGMENTS];
+
+    buf = flb_sds_create_size(len + 1);
+    if (!buf)
+    {
+        return -1;
+    }
+
+    n = split_path(path, len, segs, URL_NORM_MAX_SEGMENTS);
+    if (n != -1)
+    {
+        node = trie_match(un->templates, segs, n, 0);
+    }
+
+    if (node)
+    {
+        ret = flb_sds_cat_safe(&buf, node->template, flb_sds_len(node->template));
+    }
+    else
+    {
+        ret = normalize_path_segments(un, path, len, &buf);
+    }
+
+    if (ret == -1)
+    {
+        flb_sds_destroy(buf);
+        return -1;
+    }
+
+    *out = buf;
+    return 0;
+}
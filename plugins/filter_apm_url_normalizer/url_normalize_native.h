@@ -0,0 +1,59 @@
+#ifndef FLB_FILTER_URL_NORMALIZE_NATIVE_H
+#define FLB_FILTER_URL_NORMALIZE_NATIVE_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_regex.h>
+#include <monkey/mk_core.h>
+
+/* Placeholders used by the built-in segment classifiers */
+#define URL_NORM_NUM "{num}"
+#define URL_NORM_UUID "{uuid}"
+#define URL_NORM_HEX "{hex}"
+
+/* Minimum length of a segment to be considered an hexadecimal identifier */
+#define URL_NORM_HEX_MIN_LEN 8
+
+/* Paths with more segments skip the templates, segments are still normalized */
+#define URL_NORM_MAX_SEGMENTS 64
+
+/*
+ * Template trie: every node is a path segment. A node without a literal
+ * segment is a wildcard ('*' or ':name' in the template) and matches any
+ * segment. When the walk ends on a node carrying a template, the whole path
+ * is normalized to that template.
+ */
+struct url_trie_node
+{
+    flb_sds_t segment;
+    flb_sds_t template;
+    struct mk_list children;
+    struct mk_list _head;
+};
+
+/* User supplied rule: segments matching 'regex' become 'replacement' */
+struct url_rule
+{
+#ifdef FLB_HAVE_REGEX
+    struct flb_regex *regex;
+#endif
+    flb_sds_t replacement;
+    struct mk_list _head;
+};
+
+struct url_normalizer
+{
+    struct url_trie_node *templates;
+    struct mk_list rules;
+};
+
+struct url_normalizer *url_normalizer_create();
+void url_normalizer_destroy(struct url_normalizer *un);
+
+int url_normalizer_add_template(struct url_normalizer *un, const char *template);
+int url_normalizer_add_rule(struct url_normalizer *un, const char *rule);
+
+int url_normalizer_do(struct url_normalizer *un, const char *path, size_t len,
+                      flb_sds_t *out);
+
+#endif
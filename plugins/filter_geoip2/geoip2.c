@@ -451,5 +451,5 @@ struct flb_filter_plugin filter_geoip2_plugin = {
     .cb_init = cb_geoip2_init,
     .cb_filter = cb_geoip2_filter,
     .cb_exit = cb_geoip2_exit,
-    .flags = 0,
+    .flags = FLB_FILTER_THREADSAFE | FLB_FILTER_REENTRANT,
 };
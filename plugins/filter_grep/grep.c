@@ -282,5 +282,5 @@ struct flb_filter_plugin filter_grep_plugin = {
     .cb_init      = cb_grep_init,
     .cb_filter    = cb_grep_filter,
     .cb_exit      = cb_grep_exit,
-    .flags        = 0
+    .flags        = FLB_FILTER_THREADSAFE | FLB_FILTER_REENTRANT
 };
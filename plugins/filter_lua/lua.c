@@ -691,5 +691,5 @@ struct flb_filter_plugin filter_lua_plugin = {
     .cb_filter    = cb_lua_filter,
     .cb_exit      = cb_lua_exit,
     .config_map   = config_map,
-    .flags        = 0
+    .flags        = FLB_FILTER_THREADSAFE
 };
@@ -1353,5 +1353,5 @@ struct flb_filter_plugin filter_modify_plugin = {
     .cb_init = cb_modify_init,
     .cb_filter = cb_modify_filter,
     .cb_exit = cb_modify_exit,
-    .flags = 0
+    .flags = FLB_FILTER_THREADSAFE | FLB_FILTER_REENTRANT
 };
@@ -633,5 +633,5 @@ struct flb_filter_plugin filter_nest_plugin = {
     .cb_init = cb_nest_init,
     .cb_filter = cb_nest_filter,
     .cb_exit = cb_nest_exit,
-    .flags = 0
+    .flags = FLB_FILTER_THREADSAFE | FLB_FILTER_REENTRANT
 };
@@ -388,5 +388,5 @@ struct flb_filter_plugin filter_record_modifier_plugin = {
     .cb_init      = cb_modifier_init,
     .cb_filter    = cb_modifier_filter,
     .cb_exit      = cb_modifier_exit,
-    .flags        = 0
+    .flags        = FLB_FILTER_THREADSAFE | FLB_FILTER_REENTRANT
 };
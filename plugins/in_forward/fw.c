@@ -155,7 +155,7 @@ static int in_fw_init(struct flb_input_instance *ins,
     }
     flb_net_socket_nonblocking(ctx->server_fd);
 
-    ctx->evl = config->evl;
+    ctx->evl = flb_input_event_loop(ins);
 
     /* Collect upon data available on the standard input */
     ret = flb_input_set_collector_socket(ins,
@@ -77,7 +77,7 @@ static int in_http_init(struct flb_input_instance *ins,
     /* Set the context */
     flb_input_set_context(ins, ctx);
 
-    ctx->evl = config->evl;
+    ctx->evl = flb_input_event_loop(ins);
 
     /* Create HTTP listener */
     ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
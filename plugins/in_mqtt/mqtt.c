@@ -58,7 +58,7 @@ static int in_mqtt_init(struct flb_input_instance *in,
         mqtt_config_free(ctx);
         return -1;
     }
-    ctx->evl = config->evl;
+    ctx->evl = flb_input_event_loop(in);
 
     /* Collect upon data available on the standard input */
     ret = flb_input_set_collector_event(in,
@@ -47,6 +47,7 @@ struct sb_out_queue {
 
 struct flb_sb {
     int coll_fd;                    /* collector id */
+    int queued;                     /* any chunk queued since startup ? */
     size_t mem_limit;               /* memory limit */
     struct flb_input_instance *ins; /* input instance */
     struct cio_ctx *cio;            /* chunk i/o instance */
@@ -280,6 +281,7 @@ static int sb_append_chunk_to_segregated_backlogs(struct cio_chunk  *target_chun
     int                     tag_len;
     const char *            tag_buf;
     int                     result;
+    uint64_t               *routes_mask;
 
     memset(&dummy_input_chunk, 0, sizeof(struct flb_input_chunk));
 
@@ -302,22 +304,33 @@ static int sb_append_chunk_to_segregated_backlogs(struct cio_chunk  *target_chun
         return -2;
     }
 
-    flb_routes_mask_set_by_tag(dummy_input_chunk.routes_mask, tag_buf, tag_len,
-                               context->ins);
+    routes_mask = flb_calloc(context->ins->config->routes_mask_size,
+                             sizeof(uint64_t));
+    if (routes_mask == NULL) {
+        flb_errno();
+
+        return -1;
+    }
+
+    flb_routes_mask_set_by_tag(routes_mask, tag_buf, tag_len, context->ins);
 
     mk_list_foreach(backlog_iterator, &context->backlogs) {
         backlog = mk_list_entry(backlog_iterator, struct sb_out_queue, _head);
 
-        if (flb_routes_mask_get_bit(dummy_input_chunk.routes_mask,
-                                    backlog->ins->id)) {
+        if (flb_routes_mask_get_bit(routes_mask, backlog->ins->id,
+                                    context->ins->config)) {
             result = sb_append_chunk_to_segregated_backlog(target_chunk, stream,
                                                            chunk_size, backlog);
             if (result) {
+                flb_free(routes_mask);
+
                 return -3;
             }
         }
     }
 
+    flb_free(routes_mask);
+
     return 0;
 }
 
@@ -327,6 +340,8 @@ int sb_segregate_chunks(struct flb_config *config)
     struct mk_list    *chunk_iterator;
     struct flb_sb     *context;
     int                result;
+    int                lazy;
+    size_t             count;
     struct cio_stream *stream;
     struct cio_chunk  *chunk;
 
@@ -342,18 +357,26 @@ int sb_segregate_chunks(struct flb_config *config)
         return -2;
     }
 
+    /*
+     * With a lazy load (or the write-ahead log) the chunks metadata is
+     * already in memory: they are registered while 'down' and their content
+     * is mapped and verified only when cb_queue_chunks() picks them.
+     */
+    lazy = (context->cio->flags & (CIO_LAZY_LOAD | CIO_WAL)) != 0;
+    count = 0;
+
     mk_list_foreach(stream_iterator, &context->cio->streams) {
         stream = mk_list_entry(stream_iterator, struct cio_stream, _head);
 
         mk_list_foreach(chunk_iterator, &stream->chunks) {
             chunk = mk_list_entry(chunk_iterator, struct cio_chunk, _head);
 
-            if (!cio_chunk_is_up(chunk)) {
+            if (!lazy && !cio_chunk_is_up(chunk)) {
                 cio_chunk_up_force(chunk);
-            }
 
-            if (!cio_chunk_is_up(chunk)) {
-                return -3;
+                if (!cio_chunk_is_up(chunk)) {
+                    return -3;
+                }
             }
 
             result = sb_append_chunk_to_segregated_backlogs(chunk, stream, context);
@@ -364,13 +387,24 @@ int sb_segregate_chunks(struct flb_config *config)
             }
 
             /* lock the chunk */
-            flb_plg_info(context->ins, "register %s/%s", stream->name, chunk->name);
+            flb_plg_debug(context->ins, "register %s/%s", stream->name, chunk->name);
 
             cio_chunk_lock(chunk);
-            cio_chunk_down(chunk);
+
+            if (cio_chunk_is_up(chunk)) {
+                cio_chunk_down(chunk);
+            }
+            count++;
         }
     }
 
+    config->storage_bl_load_time = flb_storage_elapsed(config);
+
+    if (count > 0) {
+        flb_plg_info(context->ins, "registered %zu chunks in %.3f seconds",
+                     count, config->storage_bl_load_time);
+    }
+
     return 0;
 }
 
@@ -585,6 +619,12 @@ static int cb_queue_chunks(struct flb_input_instance *in,
                 flb_plg_info(ctx->ins, "queueing %s:%s",
                              chunk_instance->stream->name, chunk_instance->chunk->name);
 
+                /* time to recover the first chunk from the backlog */
+                if (ctx->queued == FLB_FALSE) {
+                    config->storage_bl_queue_time = flb_storage_elapsed(config);
+                    ctx->queued = FLB_TRUE;
+                }
+
                 /* We are removing this chunk reference from this specific backlog
                  * queue but we need to leave it in the remainder queues.
                  */
@@ -618,6 +658,7 @@ static int cb_sb_init(struct flb_input_instance *in,
 
     ctx->cio = data;
     ctx->ins = in;
+    ctx->queued = FLB_FALSE;
     ctx->mem_limit = flb_utils_size_to_bytes(config->storage_bl_mem_limit);
 
     mk_list_init(&ctx->backlogs);
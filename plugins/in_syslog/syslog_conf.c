@@ -42,7 +42,7 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *ins,
         flb_errno();
         return NULL;
     }
-    ctx->evl = config->evl;
+    ctx->evl = flb_input_event_loop(ins);
     ctx->ins = ins;
     ctx->buffer_data = NULL;
     mk_list_init(&ctx->connections);
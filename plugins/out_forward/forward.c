@@ -955,12 +955,14 @@ static int flush_message_mode(struct flb_forward *ctx,
  */
 static int flush_forward_mode(struct flb_forward *ctx,
                               struct flb_forward_config *fc,
+                              struct flb_forward_flush *ff,
                               struct flb_upstream_conn *u_conn,
                               const char *tag, int tag_len,
                               const void *data, size_t bytes,
                               char *opts_buf, size_t opts_size)
 {
     int ret;
+    int iov_count;
     int entries;
     size_t off = 0;
     size_t bytes_sent;
@@ -971,6 +973,7 @@ static int flush_forward_mode(struct flb_forward *ctx,
     msgpack_packer mp_pck;
     void *final_data;
     size_t final_bytes;
+    struct mk_iovec iov[3];
 
     /* Pack message header */
     msgpack_sbuffer_init(&mp_sbuf);
@@ -998,43 +1001,41 @@ static int flush_forward_mode(struct flb_forward *ctx,
         final_data = (void *) data;
         final_bytes = bytes;
 
-        entries = flb_mp_count(data, bytes);
+        /* the formatter already counted the entries if options are sent */
+        if (ff->entries >= 0) {
+            entries = ff->entries;
+        }
+        else {
+            entries = flb_mp_count(data, bytes);
+        }
         msgpack_pack_array(&mp_pck, entries);
     }
 
-    /* Write message header */
-    ret = flb_io_net_write(u_conn, mp_sbuf.data, mp_sbuf.size, &bytes_sent);
-    if (ret == -1) {
-        flb_plg_error(ctx->ins, "could not write forward header");
-        msgpack_sbuffer_destroy(&mp_sbuf);
-        if (fc->compress == COMPRESS_GZIP) {
-            flb_free(final_data);
-        }
-        return FLB_RETRY;
-    }
-    msgpack_sbuffer_destroy(&mp_sbuf);
+    /*
+     * Write the message header, the entries and the options with a single
+     * call. The entries are the chunk content as handed by the engine, so
+     * they go to the socket without being copied into a new buffer.
+     */
+    iov[0].iov_base = mp_sbuf.data;
+    iov[0].iov_len = mp_sbuf.size;
+    iov[1].iov_base = final_data;
+    iov[1].iov_len = final_bytes;
+    iov_count = 2;
 
-    /* Write entries */
-    ret = flb_io_net_write(u_conn, final_data, final_bytes, &bytes_sent);
-    if (ret == -1) {
-        flb_plg_error(ctx->ins, "could not write forward entries");
-        if (fc->compress == COMPRESS_GZIP) {
-            flb_free(final_data);
-        }
-        return FLB_RETRY;
+    if (fc->send_options == FLB_TRUE) {
+        iov[2].iov_base = opts_buf;
+        iov[2].iov_len = opts_size;
+        iov_count++;
     }
 
+    ret = flb_io_net_writev(u_conn, iov, iov_count, &bytes_sent);
+    msgpack_sbuffer_destroy(&mp_sbuf);
     if (fc->compress == COMPRESS_GZIP) {
         flb_free(final_data);
     }
-
-    /* Write options */
-    if (fc->send_options == FLB_TRUE) {
-        ret = flb_io_net_write(u_conn, opts_buf, opts_size, &bytes_sent);
-        if (ret == -1) {
-            flb_plg_error(ctx->ins, "could not write forward options");
-            return FLB_RETRY;
-        }
+    if (ret == -1) {
+        flb_plg_error(ctx->ins, "could not write forward entries");
+        return FLB_RETRY;
     }
 
     /* If the sender requires 'ack' from the remote end-point */
@@ -1170,6 +1171,7 @@ static void cb_forward_flush(struct flb_event_chunk *event_chunk,
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
     flush_ctx->fc = fc;
+    flush_ctx->entries = -1;
 
     /* Format the right payload and retrieve the 'forward mode' used */
     mode = flb_forward_format(config, i_ins, ctx, flush_ctx,
@@ -1217,7 +1219,7 @@ static void cb_forward_flush(struct flb_event_chunk *event_chunk,
         flb_free(out_buf);
     }
     else if (mode == MODE_FORWARD) {
-        ret = flush_forward_mode(ctx, fc, u_conn,
+        ret = flush_forward_mode(ctx, fc, flush_ctx, u_conn,
                                  event_chunk->tag, flb_sds_len(event_chunk->tag),
                                  event_chunk->data, event_chunk->size,
                                  out_buf, out_size);
@@ -106,6 +106,7 @@ struct flb_forward_ping {
 struct flb_forward_flush {
     struct flb_forward_config *fc;
     char checksum_hex[33];
+    int entries;                 /* records in the chunk, -1 if unknown */
 };
 
 struct flb_forward_config *flb_forward_target(struct flb_forward *ctx,
@@ -328,6 +328,9 @@ static int flb_forward_format_forward_mode(struct flb_forward *ctx,
 
     if (fc->send_options == FLB_TRUE) {
         entries = flb_mp_count(data, bytes);
+        if (ff) {
+            ff->entries = entries;
+        }
         append_options(ctx, fc, &mp_pck, entries, (char *) data, bytes, chunk);
     }
 
@@ -38,9 +38,12 @@
 #include <fluent-bit/flb_kernel.h>
 #include <fluent-bit/flb_worker.h>
 #include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_task.h>
 #include <fluent-bit/flb_http_server.h>
 #include <fluent-bit/flb_plugin.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_latency.h>
 #include <fluent-bit/multiline/flb_ml.h>
 
 const char *FLB_CONF_ENV_LOGLEVEL = "FLB_LOG_LEVEL";
@@ -124,6 +127,15 @@ struct flb_service_config service_configs[] = {
     {FLB_CONF_STORAGE_CHECKSUM,
      FLB_CONF_TYPE_BOOL,
      offsetof(struct flb_config, storage_checksum)},
+    {FLB_CONF_STORAGE_CHECKSUM_TYPE,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, storage_checksum_type)},
+    {FLB_CONF_STORAGE_COMPRESS,
+     FLB_CONF_TYPE_BOOL,
+     offsetof(struct flb_config, storage_compress)},
+    {FLB_CONF_STORAGE_WAL,
+     FLB_CONF_TYPE_BOOL,
+     offsetof(struct flb_config, storage_wal)},
     {FLB_CONF_STORAGE_BL_MEM_LIMIT,
      FLB_CONF_TYPE_STR,
      offsetof(struct flb_config, storage_bl_mem_limit)},
@@ -144,6 +156,31 @@ struct flb_service_config service_configs[] = {
      FLB_CONF_TYPE_INT,
      offsetof(struct flb_config, sched_base)},
 
+    /* Filters */
+    {FLB_CONF_STR_FILTER_WORKERS,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, filter_workers)},
+
+    /* Router */
+    {FLB_CONF_STR_ROUTER_CACHE,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, router_cache_size)},
+
+    /* Tasks */
+    {FLB_CONF_STR_TASK_MAP_SIZE,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, tasks_map_size)},
+
+    /* Engine */
+    {FLB_CONF_STR_ENGINE_STALL,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, engine_stall_threshold)},
+
+    /* JSON */
+    {FLB_CONF_STR_JSON_DEDUP_KEYS,
+     FLB_CONF_TYPE_BOOL,
+     offsetof(struct flb_config, json_dedup_keys)},
+
 #ifdef FLB_HAVE_STREAM_PROCESSOR
     {FLB_CONF_STR_STREAMS_FILE,
      FLB_CONF_TYPE_STR,
@@ -214,6 +251,20 @@ struct flb_config *flb_config_init()
     config->sched_cap  = FLB_SCHED_CAP;
     config->sched_base = FLB_SCHED_BASE;
 
+    /* Router */
+    config->router_cache_size = FLB_ROUTER_CACHE_SIZE;
+
+    /* Tasks */
+    config->tasks_map_size = FLB_TASK_MAP_SIZE;
+    config->routes_mask_size = FLB_ROUTES_MASK_DEFAULT_SIZE;
+
+    /* Engine profiler */
+    config->engine_stall_threshold = FLB_LATENCY_STALL_MS;
+    config->engine_latency = flb_latency_create();
+
+    /* JSON encoding */
+    config->json_dedup_keys = FLB_TRUE;
+
 #ifdef FLB_HAVE_SQLDB
     mk_list_init(&config->sqldb_list);
 #endif
@@ -247,8 +298,6 @@ struct flb_config *flb_config_init()
     mk_list_init(&config->upstreams);
     mk_list_init(&config->cmetrics);
 
-    memset(&config->tasks_map, '\0', sizeof(config->tasks_map));
-
     /* Environment */
     config->env = flb_env_create();
 
@@ -375,6 +424,11 @@ void flb_config_exit(struct flb_config *config)
     /* Destroy any DSO context */
     flb_plugin_destroy(config->dso_plugins);
 
+    /* Engine profiler */
+    if (config->engine_latency) {
+        flb_latency_destroy(config->engine_latency);
+    }
+
     /* Workers */
     flb_worker_exit(config);
 
@@ -408,6 +462,9 @@ void flb_config_exit(struct flb_config *config)
     if (config->storage_sync) {
         flb_free(config->storage_sync);
     }
+    if (config->storage_checksum_type) {
+        flb_free(config->storage_checksum_type);
+    }
     if (config->storage_bl_mem_limit) {
         flb_free(config->storage_bl_mem_limit);
     }
@@ -424,6 +481,9 @@ void flb_config_exit(struct flb_config *config)
         mk_event_loop_destroy(config->evl);
     }
 
+    flb_router_cache_invalidate(config);
+    flb_task_map_destroy(config);
+
     flb_plugins_unregister(config);
     flb_free(config);
 }
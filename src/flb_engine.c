@@ -30,7 +30,9 @@
 #include <fluent-bit/flb_pipe.h>
 #include <fluent-bit/flb_custom.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_thread.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_filter_thread.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_config.h>
@@ -39,9 +41,11 @@
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_task.h>
 #include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_routes_mask.h>
 #include <fluent-bit/flb_http_server.h>
 #include <fluent-bit/flb_scheduler.h>
 #include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_sosreport.h>
 #include <fluent-bit/flb_storage.h>
 #include <fluent-bit/flb_http_server.h>
@@ -125,6 +129,11 @@ static void cb_engine_sched_timer(struct flb_config *ctx, void *data)
 
     /* Upstream connections timeouts handling */
     flb_upstream_conn_timeouts(&ctx->upstreams);
+
+    /* Tiered storage: promote spilled chunks once the outputs drained */
+    if (ctx->storage_tiers > 0) {
+        flb_storage_tiers_balance(ctx);
+    }
 }
 
 static inline int handle_output_event(flb_pipefd_t fd, uint64_t ts,
@@ -381,6 +390,25 @@ static inline int flb_engine_manager(flb_pipefd_t fd, struct flb_config *config)
     return 0;
 }
 
+/*
+ * Engine profiler: account the time spent handling an event. Stalls caused
+ * by a plugin callback are reported by the plugin instance itself.
+ */
+static void engine_latency(struct flb_config *config, struct mk_event *event,
+                           uint64_t start)
+{
+    int ret;
+    uint64_t usec;
+
+    usec = flb_latency_now() - start;
+    ret = flb_latency_add(config->engine_latency, usec,
+                          FLB_LATENCY_STALL_USEC(config->engine_stall_threshold));
+    if (ret == FLB_TRUE && config->engine_stall_reported == FLB_FALSE) {
+        flb_warn("[engine] event (type=%i) blocked the engine for %.2f ms",
+                 event->type, usec / 1000.0);
+    }
+}
+
 static FLB_INLINE int flb_engine_handle_event(flb_pipefd_t fd, int mask,
                                               struct flb_config *config)
 {
@@ -503,6 +531,7 @@ int flb_engine_start(struct flb_config *config)
 {
     int ret;
     uint64_t ts;
+    uint64_t start;
     char tmp[16];
     struct flb_time t_flush;
     struct mk_event *event;
@@ -536,6 +565,9 @@ int flb_engine_start(struct flb_config *config)
 
     flb_info("[engine] started (pid=%i)", getpid());
 
+    /* JSON encoding options (process-wide, set by the first engine) */
+    flb_pack_init(config);
+
     /* Debug coroutine stack size */
     flb_utils_bytes_to_human_readable_size(config->coro_stack_size,
                                            tmp, sizeof(tmp));
@@ -562,6 +594,15 @@ int flb_engine_start(struct flb_config *config)
         return -1;
     }
 
+    /* Every output instance exists now: size the chunks routes masks */
+    flb_routes_mask_set_size(config);
+
+    /* Tasks map: allocate the task IDs */
+    ret = flb_task_map_create(config);
+    if (ret == -1) {
+        return -1;
+    }
+
     /* Start the Storage engine */
     ret = flb_storage_create(config);
     if (ret == -1) {
@@ -597,6 +638,14 @@ int flb_engine_start(struct flb_config *config)
         return -1;
     }
 
+    /* Filter workers (optional) */
+    ret = flb_filter_pool_create(config);
+    if (ret == -1) {
+        flb_error("[engine] could not create filter workers");
+        return -1;
+    }
+    flb_filter_pool_start(config);
+
     /* Inputs pre-run */
     flb_input_pre_run_all(config);
 
@@ -694,9 +743,15 @@ int flb_engine_start(struct flb_config *config)
     while (1) {
         mk_event_wait(evl);
         mk_event_foreach(event, evl) {
+            start = flb_latency_now();
+            config->engine_stall_reported = FLB_FALSE;
+
             if (event->type == FLB_ENGINE_EV_CORE) {
                 ret = flb_engine_handle_event(event->fd, event->mask, config);
                 if (ret == FLB_ENGINE_STOP) {
+                    /* commit the records still being filtered */
+                    flb_filter_pool_flush(config);
+
                     if (config->grace_count == 0) {
                         flb_warn("[engine] service will shutdown in max %u seconds",
                                  config->grace);
@@ -791,6 +846,18 @@ int flb_engine_start(struct flb_config *config)
                  */
                 handle_output_event(event->fd, ts, config);
             }
+
+            engine_latency(config, event, start);
+        }
+
+        /* Group commit of the chunks written on this iteration */
+        if (config->storage_wal == FLB_TRUE) {
+            flb_storage_flush(config);
+        }
+
+        /* Tiered storage: an instance crossed its memory spill limit */
+        if (config->storage_tiers_spill == FLB_TRUE) {
+            flb_storage_tiers_balance(config);
         }
 
         /* Cleanup functions associated to events and timers */
@@ -819,6 +886,12 @@ int flb_engine_shutdown(struct flb_config *config)
     config->is_running = FLB_FALSE;
     flb_input_pause_all(config);
 
+    /* stop input threads, the records they queued are appended first */
+    flb_input_thread_exit_all(config);
+
+    /* stop filter workers, pending records are committed first */
+    flb_filter_pool_destroy(config);
+
 #ifdef FLB_HAVE_STREAM_PROCESSOR
     if (config->stream_processor_ctx) {
         flb_sp_destroy(config->stream_processor_ctx);
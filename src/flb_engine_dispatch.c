@@ -228,6 +228,7 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
     size_t buf_size = 0;
     const char *tag_buf;
     int tag_len;
+    time_t now;
     struct mk_list *tmp;
     struct mk_list *head;
     struct flb_input_plugin *p;
@@ -239,13 +240,22 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
         return 0;
     }
 
+    /* Merge small chunks of the same Tag (packing, output batching) */
+    flb_input_chunk_coalesce(in);
+
     /* Look for chunks ready to go */
+    now = time(NULL);
     mk_list_foreach_safe(head, tmp, &in->chunks) {
         ic = mk_list_entry(head, struct flb_input_chunk, _head);
         if (ic->busy == FLB_TRUE) {
             continue;
         }
 
+        /* Keep small chunks open until they reach their target or age */
+        if (flb_input_chunk_is_ready(ic, now) == FLB_FALSE) {
+            continue;
+        }
+
         /* There is a match, get the buffer */
         buf_data = flb_input_chunk_flush(ic, &buf_size);
         if (buf_size == 0) {
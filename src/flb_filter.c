@@ -54,6 +54,27 @@ static inline int prop_key_check(const char *key, const char *kv, int k_len)
     return -1;
 }
 
+#ifdef FLB_HAVE_METRICS
+/*
+ * The old metrics API is not atomic and a filter worker might be updating
+ * the counters of the same instance, take the instance lock as it does.
+ */
+static inline void filter_metrics_sum(struct flb_config *config,
+                                      struct flb_filter_instance *f_ins,
+                                      int id, size_t val)
+{
+    if (config->filter_pool) {
+        pthread_mutex_lock(&f_ins->lock);
+    }
+
+    flb_metrics_sum(id, val, f_ins->metrics);
+
+    if (config->filter_pool) {
+        pthread_mutex_unlock(&f_ins->lock);
+    }
+}
+#endif
+
 void flb_filter_do(struct flb_input_chunk *ic,
                    const void *data, size_t bytes,
                    const char *tag, int tag_len,
@@ -68,6 +89,9 @@ void flb_filter_do(struct flb_input_chunk *ic,
     uint64_t ts;
     char *name;
 #endif
+    int i;
+    int n_filters;
+    int serialize;
     char *ntag;
     const char *work_data;
     size_t work_size;
@@ -76,14 +100,46 @@ void flb_filter_do(struct flb_input_chunk *ic,
     size_t out_size;
     ssize_t content_size;
     ssize_t write_at;
-    struct mk_list *head;
     struct flb_filter_instance *f_ins;
+    struct flb_filter_instance **filters;
+    struct flb_filter_instance *filters_buf[FLB_FILTER_CHAIN_STACK];
+    struct flb_router_cache_entry *match;
+
+    /* Lookup the filters matching the Tag */
+    match = flb_router_cache_get(config, tag, tag_len);
+    if (!match) {
+        flb_error("[filter] could not filter record due to memory problems");
+        return;
+    }
+    if (match->n_filters == 0) {
+        return;
+    }
+
+    /*
+     * Filters can append records again (e.g: rewrite_tag), which might evict
+     * the cache entry: keep our own copy of the chain.
+     */
+    n_filters = match->n_filters;
+    filters = filters_buf;
+    if (n_filters > FLB_FILTER_CHAIN_STACK) {
+        filters = flb_malloc(sizeof(struct flb_filter_instance *) * n_filters);
+        if (!filters) {
+            flb_errno();
+            flb_error("[filter] could not filter record due to memory problems");
+            return;
+        }
+    }
+    memcpy(filters, flb_router_cache_filters(match),
+           sizeof(struct flb_filter_instance *) * n_filters);
 
     /* For the incoming Tag make sure to create a NULL terminated reference */
     ntag = flb_malloc(tag_len + 1);
     if (!ntag) {
         flb_errno();
         flb_error("[filter] could not filter record due to memory problems");
+        if (filters != filters_buf) {
+            flb_free(filters);
+        }
         return;
     }
     memcpy(ntag, tag, tag_len);
@@ -102,114 +158,120 @@ void flb_filter_do(struct flb_input_chunk *ic,
 #endif
 
     /* Iterate filters */
-    mk_list_foreach(head, &config->filters) {
-        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
-        if (flb_router_match(ntag, tag_len, f_ins->match
-#ifdef FLB_HAVE_REGEX
-        , f_ins->match_regex
-#else
-        , NULL
-#endif
-           )) {
-            /* Reset filtered buffer */
-            out_buf = NULL;
-            out_size = 0;
-
-            content_size = cio_chunk_get_content_size(ic->chunk);
-
-            /* where to position the new content if modified ? */
-            write_at = (content_size - work_size);
-
-            /* Invoke the filter callback */
-            ret = f_ins->p->cb_filter(work_data,      /* msgpack buffer   */
-                                      work_size,      /* msgpack size     */
-                                      ntag, tag_len,  /* input tag        */
-                                      &out_buf,       /* new data         */
-                                      &out_size,      /* new data size    */
-                                      f_ins,          /* filter instance  */
-                                      f_ins->context, /* filter priv data */
-                                      config);
+    for (i = 0; i < n_filters; i++) {
+        f_ins = filters[i];
+        /* Reset filtered buffer */
+        out_buf = NULL;
+        out_size = 0;
+
+        content_size = cio_chunk_get_content_size(ic->chunk);
+
+        /* where to position the new content if modified ? */
+        write_at = (content_size - work_size);
+
+        /* The instance might be running in a filter worker too */
+        serialize = (config->filter_pool &&
+                     !(f_ins->p->flags & FLB_FILTER_REENTRANT));
+        if (serialize) {
+            pthread_mutex_lock(&f_ins->lock);
+        }
+
+        /* Invoke the filter callback */
+        ret = f_ins->p->cb_filter(work_data,      /* msgpack buffer   */
+                                  work_size,      /* msgpack size     */
+                                  ntag, tag_len,  /* input tag        */
+                                  &out_buf,       /* new data         */
+                                  &out_size,      /* new data size    */
+                                  f_ins,          /* filter instance  */
+                                  f_ins->context, /* filter priv data */
+                                  config);
+
+        if (serialize) {
+            pthread_mutex_unlock(&f_ins->lock);
+        }
 
 #ifdef FLB_HAVE_METRICS
-            name = (char *) flb_filter_name(f_ins);
+        name = (char *) flb_filter_name(f_ins);
 #endif
 
-            /* Override buffer just if it was modified */
-            if (ret == FLB_FILTER_MODIFIED) {
-                /* all records removed, no data to continue processing */
-                if (out_size == 0) {
-                    /* reset data content length */
-                    flb_input_chunk_write_at(ic, write_at, "", 0);
+        /* Override buffer just if it was modified */
+        if (ret == FLB_FILTER_MODIFIED) {
+            /* all records removed, no data to continue processing */
+            if (out_size == 0) {
+                /* reset data content length */
+                flb_input_chunk_write_at(ic, write_at, "", 0);
 
 #ifdef FLB_HAVE_METRICS
-                    ic->total_records = pre_records;
+                ic->total_records = pre_records;
 
-                    /* cmetrics */
-                    cmt_counter_add(f_ins->cmt_drop_records, ts, in_records,
-                                    1, (char *[]) {name});
+                /* cmetrics */
+                cmt_counter_add(f_ins->cmt_drop_records, ts, in_records,
+                                1, (char *[]) {name});
 
-                    /* [OLD] Summarize all records removed */
-                    flb_metrics_sum(FLB_METRIC_N_DROPPED,
-                                    in_records, f_ins->metrics);
+                /* [OLD] Summarize all records removed */
+                filter_metrics_sum(config, f_ins, FLB_METRIC_N_DROPPED,
+                                   in_records);
 #endif
-                    break;
-                }
-                else {
+                break;
+            }
+            else {
 #ifdef FLB_HAVE_METRICS
-                    out_records = flb_mp_count(out_buf, out_size);
-                    if (out_records > in_records) {
-                        diff = (out_records - in_records);
-
-                        /* cmetrics */
-                        cmt_counter_add(f_ins->cmt_add_records, ts, diff,
-                                    1, (char *[]) {name});
-
-                        /* [OLD] Summarize new records */
-                        flb_metrics_sum(FLB_METRIC_N_ADDED,
-                                        diff, f_ins->metrics);
-                    }
-                    else if (out_records < in_records) {
-                        diff = (in_records - out_records);
-
-                        /* cmetrics */
-                        cmt_counter_add(f_ins->cmt_drop_records, ts, diff,
-                                    1, (char *[]) {name});
-
-                        /* [OLD] Summarize dropped records */
-                        flb_metrics_sum(FLB_METRIC_N_DROPPED,
-                                        diff, f_ins->metrics);
-                    }
-
-                    /* set number of records in new chunk */
-                    in_records = out_records;
-                    ic->total_records = pre_records + in_records;
-#endif
-                }
-                ret = flb_input_chunk_write_at(ic, write_at,
-                                               out_buf, out_size);
-                if (ret == -1) {
-                    flb_error("[filter] could not write data to storage. "
-                              "Skipping filtering.");
-                    flb_free(out_buf);
-                    continue;
-                }
+                out_records = flb_mp_count(out_buf, out_size);
+                if (out_records > in_records) {
+                    diff = (out_records - in_records);
 
-                /* Point back the 'data' pointer to the new address */
-                ret = cio_chunk_get_content(ic->chunk,
-                                            (char **) &work_data, &cur_size);
-                if (ret != CIO_OK) {
-                    flb_error("[filter] error retrieving data chunk");
+                    /* cmetrics */
+                    cmt_counter_add(f_ins->cmt_add_records, ts, diff,
+                                1, (char *[]) {name});
+
+                    /* [OLD] Summarize new records */
+                    filter_metrics_sum(config, f_ins, FLB_METRIC_N_ADDED,
+                                       diff);
                 }
-                else {
-                    work_data += (cur_size - out_size);
-                    work_size = out_size;
+                else if (out_records < in_records) {
+                    diff = (in_records - out_records);
+
+                    /* cmetrics */
+                    cmt_counter_add(f_ins->cmt_drop_records, ts, diff,
+                                1, (char *[]) {name});
+
+                    /* [OLD] Summarize dropped records */
+                    filter_metrics_sum(config, f_ins, FLB_METRIC_N_DROPPED,
+                                       diff);
                 }
+
+                /* set number of records in new chunk */
+                in_records = out_records;
+                ic->total_records = pre_records + in_records;
+#endif
+            }
+            ret = flb_input_chunk_write_at(ic, write_at,
+                                           out_buf, out_size);
+            if (ret == -1) {
+                flb_error("[filter] could not write data to storage. "
+                          "Skipping filtering.");
                 flb_free(out_buf);
+                continue;
+            }
+
+            /* Point back the 'data' pointer to the new address */
+            ret = cio_chunk_get_content(ic->chunk,
+                                        (char **) &work_data, &cur_size);
+            if (ret != CIO_OK) {
+                flb_error("[filter] error retrieving data chunk");
+            }
+            else {
+                work_data += (cur_size - out_size);
+                work_size = out_size;
             }
+            flb_free(out_buf);
         }
     }
 
     flb_free(ntag);
+    if (filters != filters_buf) {
+        flb_free(filters);
+    }
 }
 
 int flb_filter_set_property(struct flb_filter_instance *ins,
@@ -349,9 +411,11 @@ struct flb_filter_instance *flb_filter_new(struct flb_config *config,
     instance->match_regex = NULL;
 #endif
     instance->log_level = -1;
+    pthread_mutex_init(&instance->lock, NULL);
 
     mk_list_init(&instance->properties);
     mk_list_add(&instance->_head, &config->filters);
+    flb_router_cache_invalidate(config);
 
     return instance;
 }
@@ -370,6 +434,7 @@ const char *flb_filter_name(struct flb_filter_instance *ins)
 int flb_filter_init_all(struct flb_config *config)
 {
     int ret;
+    uint64_t ts;
     char *name;
     struct mk_list *tmp;
     struct mk_list *head;
@@ -421,6 +486,17 @@ int flb_filter_init_all(struct flb_config *config)
                                                   "drop_records_total",
                                                   "Total number of dropped records.",
                                                   1, (char *[]) {"name"});
+
+        /*
+         * With filter workers the counters are updated from several threads,
+         * create the metric entries upfront so updates never insert.
+         */
+        if (config->filter_workers > 0) {
+            ts = cmt_time_now();
+            cmt_counter_set(ins->cmt_add_records, ts, 0, 1, (char *[]) {name});
+            cmt_counter_set(ins->cmt_drop_records, ts, 0, 1, (char *[]) {name});
+        }
+
         /* OLD Metrics API */
 #ifdef FLB_HAVE_METRICS
 
@@ -521,7 +597,9 @@ void flb_filter_instance_destroy(struct flb_filter_instance *ins)
         flb_sds_destroy(ins->alias);
     }
 
+    pthread_mutex_destroy(&ins->lock);
     mk_list_del(&ins->_head);
+    flb_router_cache_invalidate(ins->config);
     flb_free(ins);
 }
 
@@ -0,0 +1,718 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_mp.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_filter.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_input_plugin.h>
+#include <fluent-bit/flb_thread_pool.h>
+#include <fluent-bit/flb_filter_thread.h>
+
+#include <cmetrics/cmt_atomic.h>
+
+/*
+ * Filter workers
+ * ==============
+ *
+ * When 'filter.workers' is set, buffers appended by the inputs are not
+ * filtered in the engine thread: the buffer is copied into a job and sent
+ * to a worker (round-robin) which runs the matching filters. Finished jobs
+ * are pushed to a lock-free stack and the engine is notified through a
+ * channel, then the engine commits the jobs of every input in the same
+ * order they were submitted.
+ *
+ * Only filters flagged as FLB_FILTER_THREADSAFE run in a worker. If the
+ * filter chain for a buffer contains any other filter the buffer is
+ * filtered by the engine, after the buffers of the same input still being
+ * processed. Calls on one instance are serialized unless the plugin is also
+ * FLB_FILTER_REENTRANT.
+ *
+ * The engine never waits for the workers: an input submitting a job over
+ * the in-flight limit is paused, like with mem_buf_limit, and resumed once
+ * the workers drained half of the queue.
+ */
+
+static void job_destroy(struct flb_filter_job *job)
+{
+    if (job->tag) {
+        flb_sds_destroy(job->tag);
+    }
+    if (job->buf) {
+        flb_free(job->buf);
+    }
+    if (job->filters) {
+        flb_free(job->filters);
+    }
+    flb_free(job);
+}
+
+static struct flb_filter_job *job_create(struct flb_input_instance *in,
+                                         flb_sds_t tag,
+                                         const void *buf, size_t size)
+{
+    struct flb_filter_job *job;
+
+    job = flb_calloc(1, sizeof(struct flb_filter_job));
+    if (!job) {
+        flb_errno();
+        return NULL;
+    }
+
+    job->buf = flb_malloc(size);
+    if (!job->buf) {
+        flb_errno();
+        flb_free(job);
+        return NULL;
+    }
+    memcpy(job->buf, buf, size);
+    job->size = size;
+    job->tag = tag;
+    job->in = in;
+
+    return job;
+}
+
+/* Run the filters of a job, this runs in a worker thread */
+static void job_run(struct flb_filter_worker *worker, struct flb_filter_job *job)
+{
+    int i;
+    int ret;
+    int serialize;
+    int in_records;
+    int out_records;
+    uint64_t ts;
+    uint64_t start;
+    void *out_buf;
+    size_t out_size;
+#ifdef FLB_HAVE_METRICS
+    char *name;
+#endif
+    struct flb_filter_instance *f_ins;
+    struct flb_filter_pool *pool = worker->pool;
+
+    start = cmt_time_now();
+    in_records = flb_mp_count(job->buf, job->size);
+
+    for (i = 0; i < job->n_filters; i++) {
+        f_ins = job->filters[i];
+        out_buf = NULL;
+        out_size = 0;
+
+        serialize = !(f_ins->p->flags & FLB_FILTER_REENTRANT);
+        if (serialize) {
+            pthread_mutex_lock(&f_ins->lock);
+        }
+
+        ret = f_ins->p->cb_filter(job->buf, job->size,
+                                  job->tag, flb_sds_len(job->tag),
+                                  &out_buf, &out_size,
+                                  f_ins, f_ins->context, pool->config);
+
+        if (serialize) {
+            pthread_mutex_unlock(&f_ins->lock);
+        }
+
+        if (ret != FLB_FILTER_MODIFIED) {
+            continue;
+        }
+
+        out_records = 0;
+        if (out_size > 0) {
+            out_records = flb_mp_count(out_buf, out_size);
+        }
+
+#ifdef FLB_HAVE_METRICS
+        /* the old metrics API is not atomic */
+        pthread_mutex_lock(&f_ins->lock);
+        name = (char *) flb_filter_name(f_ins);
+        ts = cmt_time_now();
+
+        if (out_records > in_records) {
+            cmt_counter_add(f_ins->cmt_add_records, ts,
+                            out_records - in_records,
+                            1, (char *[]) {name});
+            flb_metrics_sum(FLB_METRIC_N_ADDED,
+                            out_records - in_records, f_ins->metrics);
+        }
+        else if (out_records < in_records) {
+            cmt_counter_add(f_ins->cmt_drop_records, ts,
+                            in_records - out_records,
+                            1, (char *[]) {name});
+            flb_metrics_sum(FLB_METRIC_N_DROPPED,
+                            in_records - out_records, f_ins->metrics);
+        }
+        pthread_mutex_unlock(&f_ins->lock);
+#endif
+
+        flb_free(job->buf);
+        job->buf = out_buf;
+        job->size = out_size;
+        in_records = out_records;
+
+        /* all records removed, no data to continue processing */
+        if (out_size == 0) {
+            break;
+        }
+    }
+    job->filtered = FLB_TRUE;
+
+    ts = cmt_time_now();
+    cmt_counter_inc(pool->cmt_jobs, ts, 1, (char *[]) {worker->name});
+    cmt_counter_add(pool->cmt_records, ts, in_records,
+                    1, (char *[]) {worker->name});
+    cmt_counter_add(pool->cmt_busy, ts, (double) (ts - start) / 1000000000.0,
+                    1, (char *[]) {worker->name});
+}
+
+/* Push a finished job, returns FLB_TRUE if the stack was empty */
+static int done_push(struct flb_filter_pool *pool, struct flb_filter_job *job)
+{
+    uint64_t head;
+
+    do {
+        head = cmt_atomic_load(&pool->done);
+        job->next = (struct flb_filter_job *) (uintptr_t) head;
+    } while (cmt_atomic_compare_exchange(&pool->done, head,
+                                         (uint64_t) (uintptr_t) job) == 0);
+
+    return (head == 0);
+}
+
+/* Take all the finished jobs at once */
+static struct flb_filter_job *done_pop_all(struct flb_filter_pool *pool)
+{
+    uint64_t head;
+
+    do {
+        head = cmt_atomic_load(&pool->done);
+    } while (head != 0 &&
+             cmt_atomic_compare_exchange(&pool->done, head, 0) == 0);
+
+    return (struct flb_filter_job *) (uintptr_t) head;
+}
+
+static void filter_worker(void *data)
+{
+    int n;
+    char tmp[32];
+    uint64_t val = 1;
+    struct flb_filter_job *job;
+    struct flb_filter_worker *worker = data;
+    struct flb_filter_pool *pool = worker->pool;
+
+    snprintf(tmp, sizeof(tmp) - 1, "flb-filter-w%i", worker->id);
+    mk_utils_worker_rename(tmp);
+
+    flb_debug("[filter] worker #%i started", worker->id);
+
+    while (1) {
+        n = flb_pipe_r(worker->ch_jobs[0], &job, sizeof(job));
+        if (n <= 0) {
+            flb_errno();
+            break;
+        }
+
+        /* a NULL job means the worker must stop */
+        if (!job) {
+            break;
+        }
+
+        job_run(worker, job);
+
+        /* wake up the engine only if it does not have pending work */
+        if (done_push(pool, job) == FLB_TRUE) {
+            n = flb_pipe_w(pool->ch_done[1], &val, sizeof(val));
+            if (n == -1) {
+                flb_errno();
+            }
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    flb_debug("[filter] worker #%i stopped", worker->id);
+}
+
+/* Link a job in the input list, jobs are sorted by sequence number */
+static void job_enqueue(struct flb_filter_job *job)
+{
+    struct mk_list *head;
+    struct mk_list *list;
+    struct flb_filter_job *entry;
+
+    list = &job->in->filter_jobs;
+
+    /* jobs finish mostly in order, look from the tail */
+    mk_list_foreach_r(head, list) {
+        entry = mk_list_entry(head, struct flb_filter_job, _head);
+        if (entry->seq < job->seq) {
+            break;
+        }
+    }
+
+    /* insert after 'head', which can be the list itself */
+    job->_head.prev = head;
+    job->_head.next = head->next;
+    head->next->prev = &job->_head;
+    head->next = &job->_head;
+}
+
+/* Commit the jobs of an input instance that are next in order */
+static void input_commit(struct flb_input_instance *in)
+{
+    int ret;
+    struct flb_filter_job *job;
+
+    /* appending might call back into the pool (e.g: emitter inputs) */
+    if (in->filter_committing == FLB_TRUE) {
+        return;
+    }
+    in->filter_committing = FLB_TRUE;
+
+    while (mk_list_is_empty(&in->filter_jobs) != 0) {
+        job = mk_list_entry_first(&in->filter_jobs, struct flb_filter_job,
+                                  _head);
+        if (job->seq != in->filter_seq_next) {
+            break;
+        }
+        mk_list_del(&job->_head);
+        in->filter_seq_next++;
+
+        if (job->size > 0) {
+            ret = flb_input_chunk_append_filtered(in, job->tag,
+                                                  flb_sds_len(job->tag),
+                                                  job->buf, job->size,
+                                                  job->filtered);
+            if (ret == -1) {
+                flb_plg_error(in, "could not append filtered records");
+            }
+        }
+        job_destroy(job);
+    }
+
+    in->filter_committing = FLB_FALSE;
+}
+
+/* Resume the inputs paused because the workers were saturated */
+static void pool_resume_inputs(struct flb_filter_pool *pool)
+{
+    struct mk_list *head;
+    struct flb_input_instance *in;
+    struct flb_config *config = pool->config;
+
+    if (config->is_running == FLB_FALSE ||
+        config->is_ingestion_active == FLB_FALSE) {
+        return;
+    }
+
+    mk_list_foreach(head, &config->inputs) {
+        in = mk_list_entry(head, struct flb_input_instance, _head);
+        if (in->filter_buf_status != FLB_INPUT_PAUSED) {
+            continue;
+        }
+
+        in->filter_buf_status = FLB_INPUT_RUNNING;
+        if (flb_input_buf_paused(in) == FLB_FALSE && in->p->cb_resume) {
+            flb_input_resume(in);
+            flb_info("[input] %s resume (filter workers)", in->name);
+        }
+    }
+    pool->paused = 0;
+}
+
+static void pool_drain(struct flb_filter_pool *pool)
+{
+    struct flb_input_instance *in;
+    struct flb_filter_job *job;
+    struct flb_filter_job *next;
+
+    job = done_pop_all(pool);
+    while (job) {
+        next = job->next;
+        in = job->in;
+        pool->jobs--;
+
+        job_enqueue(job);
+        input_commit(in);
+
+        job = next;
+    }
+
+    if (pool->paused > 0 && pool->jobs <= pool->max_jobs / 2) {
+        pool_resume_inputs(pool);
+    }
+
+#ifdef FLB_HAVE_METRICS
+    cmt_gauge_set(pool->cmt_queue, cmt_time_now(), pool->jobs, 0, NULL);
+#endif
+}
+
+/* Engine callback: some jobs have finished */
+static int cb_pool_done(void *data)
+{
+    int n;
+    uint64_t val;
+    struct flb_filter_pool *pool = data;
+
+    n = flb_pipe_r(pool->ch_done[0], &val, sizeof(val));
+    if (n == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    pool_drain(pool);
+    return 0;
+}
+
+int flb_filter_pool_submit(struct flb_filter_pool *pool,
+                           struct flb_input_instance *in,
+                           const char *tag, int tag_len,
+                           const void *buf, size_t size)
+{
+    int i;
+    int n;
+    int ret;
+    int offload = FLB_TRUE;
+    int pending;
+    flb_sds_t ntag;
+    struct flb_tp_thread *th;
+    struct flb_filter_job *job;
+    struct flb_filter_worker *worker;
+    struct flb_filter_instance **filters = NULL;
+    struct flb_router_cache_entry *match;
+
+    /* Lookup the filter chain for this Tag */
+    match = flb_router_cache_get(pool->config, tag, tag_len);
+    if (!match) {
+        return -1;
+    }
+
+    n = match->n_filters;
+    for (i = 0; i < n; i++) {
+        if (!(flb_router_cache_filters(match)[i]->p->flags & FLB_FILTER_THREADSAFE)) {
+            offload = FLB_FALSE;
+            break;
+        }
+    }
+
+    if (n == 0) {
+        offload = FLB_FALSE;
+    }
+
+    pending = (in->filter_seq != in->filter_seq_next);
+
+    if (offload == FLB_FALSE) {
+        /* nothing in flight, the engine can filter it right away */
+        if (!pending) {
+            return FLB_FILTER_POOL_INLINE;
+        }
+
+        /* filter it in the engine after the buffers being processed */
+        ntag = flb_sds_create_len(tag, tag_len);
+        if (!ntag) {
+            return -1;
+        }
+        job = job_create(in, ntag, buf, size);
+        if (!job) {
+            flb_sds_destroy(ntag);
+            return -1;
+        }
+        job->filtered = FLB_FALSE;
+        job->seq = in->filter_seq++;
+        job_enqueue(job);
+        input_commit(in);
+        return 0;
+    }
+
+    /* the job owns a copy of the chain, the cache entry can be evicted */
+    filters = flb_malloc(sizeof(struct flb_filter_instance *) * n);
+    if (!filters) {
+        flb_errno();
+        return -1;
+    }
+    memcpy(filters, flb_router_cache_filters(match), sizeof(struct flb_filter_instance *) * n);
+
+    ntag = flb_sds_create_len(tag, tag_len);
+    if (!ntag) {
+        flb_free(filters);
+        return -1;
+    }
+
+    job = job_create(in, ntag, buf, size);
+    if (!job) {
+        flb_sds_destroy(ntag);
+        flb_free(filters);
+        return -1;
+    }
+    job->filters = filters;
+    job->n_filters = n;
+    job->seq = in->filter_seq;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->running++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    th = flb_tp_thread_get_rr(pool->tp);
+    worker = th->params.data;
+
+    ret = flb_pipe_w(worker->ch_jobs[1], &job, sizeof(job));
+    if (ret == -1) {
+        flb_errno();
+        flb_plg_error(in, "could not send records to filter worker #%i",
+                      worker->id);
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        pthread_mutex_unlock(&pool->mutex);
+        job_destroy(job);
+        return -1;
+    }
+    in->filter_seq++;
+
+    /*
+     * Backpressure: the engine never waits for the workers, the input is
+     * paused instead and resumed by pool_drain() once the queue drained.
+     */
+    pool->jobs++;
+    if (pool->jobs >= pool->max_jobs &&
+        in->filter_buf_status == FLB_INPUT_RUNNING) {
+        flb_warn("[input] %s paused (filter workers busy %i/%i)",
+                 in->name, pool->jobs, pool->max_jobs);
+        if (!flb_input_buf_paused(in)) {
+            flb_input_pause(in);
+        }
+        in->filter_buf_status = FLB_INPUT_PAUSED;
+        pool->paused++;
+    }
+
+    return 0;
+}
+
+/* Wait for the jobs being processed and commit them */
+void flb_filter_pool_flush(struct flb_config *config)
+{
+    struct flb_filter_pool *pool = config->filter_pool;
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool_drain(pool);
+}
+
+static void pool_destroy(struct flb_filter_pool *pool)
+{
+    int i;
+
+    if (pool->workers) {
+        for (i = 0; i < pool->n_workers; i++) {
+            if (pool->workers[i].ch_jobs[0] > 0) {
+                flb_pipe_destroy(pool->workers[i].ch_jobs);
+            }
+        }
+        flb_free(pool->workers);
+    }
+
+    if (pool->ch_done[0] > 0) {
+        mk_event_del(pool->config->evl, &pool->event);
+        flb_pipe_destroy(pool->ch_done);
+    }
+
+    if (pool->tp) {
+        flb_tp_destroy(pool->tp);
+    }
+    if (pool->cmt) {
+        cmt_destroy(pool->cmt);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    flb_free(pool);
+}
+
+int flb_filter_pool_create(struct flb_config *config)
+{
+    int i;
+    int ret;
+    uint64_t ts;
+    struct flb_tp_thread *th;
+    struct flb_filter_pool *pool;
+    struct flb_filter_worker *worker;
+
+    if (config->filter_workers <= 0) {
+        return 0;
+    }
+
+    pool = flb_calloc(1, sizeof(struct flb_filter_pool));
+    if (!pool) {
+        flb_errno();
+        return -1;
+    }
+    pool->config = config;
+    pool->n_workers = config->filter_workers;
+    pool->max_jobs = pool->n_workers * FLB_FILTER_POOL_MAX_JOBS;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pool->tp = flb_tp_create(config);
+    if (!pool->tp) {
+        pool_destroy(pool);
+        return -1;
+    }
+
+    /* Channel used by the workers to wake up the engine */
+    ret = mk_event_channel_create(config->evl,
+                                  &pool->ch_done[0], &pool->ch_done[1],
+                                  &pool->event);
+    if (ret == -1) {
+        flb_error("[filter] could not create workers channel");
+        pool_destroy(pool);
+        return -1;
+    }
+    pool->event.type = FLB_ENGINE_EV_CUSTOM;
+    pool->event.handler = cb_pool_done;
+
+    /* Metrics */
+    pool->cmt = cmt_create();
+    if (!pool->cmt) {
+        pool_destroy(pool);
+        return -1;
+    }
+    pool->cmt_jobs = cmt_counter_create(pool->cmt,
+                                        "fluentbit", "filter", "worker_jobs_total",
+                                        "Number of buffers filtered by the worker.",
+                                        1, (char *[]) {"worker"});
+    pool->cmt_records = cmt_counter_create(pool->cmt,
+                                           "fluentbit", "filter",
+                                           "worker_records_total",
+                                           "Number of records returned by the worker.",
+                                           1, (char *[]) {"worker"});
+    pool->cmt_busy = cmt_counter_create(pool->cmt,
+                                        "fluentbit", "filter",
+                                        "worker_busy_seconds_total",
+                                        "Time spent by the worker running filters.",
+                                        1, (char *[]) {"worker"});
+    pool->cmt_queue = cmt_gauge_create(pool->cmt,
+                                       "fluentbit", "filter", "worker_pending_jobs",
+                                       "Number of buffers waiting or being filtered.",
+                                       0, NULL);
+
+    pool->workers = flb_calloc(pool->n_workers,
+                               sizeof(struct flb_filter_worker));
+    if (!pool->workers) {
+        flb_errno();
+        pool_destroy(pool);
+        return -1;
+    }
+
+    ts = cmt_time_now();
+    for (i = 0; i < pool->n_workers; i++) {
+        worker = &pool->workers[i];
+        worker->id = i;
+        worker->pool = pool;
+        snprintf(worker->name, sizeof(worker->name) - 1, "%i", i);
+
+        ret = flb_pipe_create(worker->ch_jobs);
+        if (ret == -1) {
+            flb_errno();
+            pool_destroy(pool);
+            return -1;
+        }
+
+        th = flb_tp_thread_create(pool->tp, filter_worker, worker, config);
+        if (!th) {
+            flb_error("[filter] could not register worker #%i", i);
+            pool_destroy(pool);
+            return -1;
+        }
+        worker->th = th;
+
+        /* workers only update existing metric entries */
+        cmt_counter_set(pool->cmt_jobs, ts, 0, 1, (char *[]) {worker->name});
+        cmt_counter_set(pool->cmt_records, ts, 0, 1, (char *[]) {worker->name});
+        cmt_counter_set(pool->cmt_busy, ts, 0, 1, (char *[]) {worker->name});
+    }
+    cmt_gauge_set(pool->cmt_queue, ts, 0, 0, NULL);
+
+    config->filter_pool = pool;
+    return 0;
+}
+
+int flb_filter_pool_start(struct flb_config *config)
+{
+    struct flb_filter_pool *pool = config->filter_pool;
+
+    if (!pool) {
+        return 0;
+    }
+
+    flb_tp_thread_start_all(pool->tp);
+    flb_info("[filter] %i filter workers started", pool->n_workers);
+
+    return 0;
+}
+
+void flb_filter_pool_destroy(struct flb_config *config)
+{
+    int i;
+    int n;
+    struct flb_filter_job *stop = NULL;
+    struct flb_filter_worker *worker;
+    struct flb_filter_pool *pool = config->filter_pool;
+
+    if (!pool) {
+        return;
+    }
+
+    /* commit everything in flight before stopping */
+    flb_filter_pool_flush(config);
+
+    for (i = 0; i < pool->n_workers; i++) {
+        worker = &pool->workers[i];
+        if (!worker->th || worker->th->status != FLB_THREAD_POOL_RUNNING) {
+            continue;
+        }
+
+        n = flb_pipe_w(worker->ch_jobs[1], &stop, sizeof(stop));
+        if (n == -1) {
+            flb_errno();
+            continue;
+        }
+        pthread_join(worker->th->tid, NULL);
+    }
+
+    pool_destroy(pool);
+    config->filter_pool = NULL;
+}
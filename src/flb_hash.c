@@ -194,6 +194,20 @@ static void flb_hash_evict_older(struct flb_hash *ht)
     flb_hash_entry_free(ht, entry);
 }
 
+/*
+ * In LRU mode the parent list is kept sorted by access time: every hit moves
+ * the entry to the tail so the least recently used one is always the first.
+ */
+static inline void flb_hash_entry_touch(struct flb_hash *ht,
+                                        struct flb_hash_entry *entry)
+{
+    entry->hits++;
+    if (ht->evict_mode == FLB_HASH_EVICT_LRU) {
+        mk_list_del(&entry->_head_parent);
+        mk_list_add(&entry->_head_parent, &ht->entries);
+    }
+}
+
 static struct flb_hash_entry *hash_get_entry(struct flb_hash *ht,
                                              const char *key, int key_len, int *out_id)
 {
@@ -306,22 +320,6 @@ int flb_hash_add(struct flb_hash *ht,
         return -1;
     }
 
-    /* Check capacity */
-    if (ht->max_entries > 0 && ht->total_count >= ht->max_entries) {
-        if (ht->evict_mode == FLB_HASH_EVICT_NONE) {
-            /* Do nothing */
-        }
-        else if (ht->evict_mode == FLB_HASH_EVICT_OLDER) {
-            flb_hash_evict_older(ht);
-        }
-        else if (ht->evict_mode == FLB_HASH_EVICT_LESS_USED) {
-            flb_hash_evict_less_used(ht);
-        }
-        else if (ht->evict_mode == FLB_HASH_EVICT_RANDOM) {
-            flb_hash_evict_random(ht);
-        }
-    }
-
     /* Check if this is a replacement */
     entry = hash_get_entry(ht, key, key_len, &id);
     if (entry) {
@@ -334,6 +332,11 @@ int flb_hash_add(struct flb_hash *ht,
             return -1;
         }
 
+        if (ht->evict_mode == FLB_HASH_EVICT_LRU) {
+            mk_list_del(&entry->_head_parent);
+            mk_list_add(&entry->_head_parent, &ht->entries);
+        }
+
         return id;
     }
 
@@ -341,6 +344,24 @@ int flb_hash_add(struct flb_hash *ht,
      * Below is just code to handle the creation of a new entry in the table
      */
 
+    /* Check capacity, only a new entry can push an existing one out */
+    if (ht->max_entries > 0 && ht->total_count >= ht->max_entries) {
+        if (ht->evict_mode == FLB_HASH_EVICT_NONE) {
+            /* Do nothing */
+        }
+        else if (ht->evict_mode == FLB_HASH_EVICT_OLDER ||
+                 ht->evict_mode == FLB_HASH_EVICT_LRU) {
+            /* the first entry is the oldest or the least recently used one */
+            flb_hash_evict_older(ht);
+        }
+        else if (ht->evict_mode == FLB_HASH_EVICT_LESS_USED) {
+            flb_hash_evict_less_used(ht);
+        }
+        else if (ht->evict_mode == FLB_HASH_EVICT_RANDOM) {
+            flb_hash_evict_random(ht);
+        }
+    }
+
     /* Generate hash number */
     hash = XXH3_64bits(key, key_len);
     id = (hash % ht->size);
@@ -402,7 +423,7 @@ int flb_hash_get(struct flb_hash *ht,
         }
     }
 
-    entry->hits++;
+    flb_hash_entry_touch(ht, entry);
     *out_buf = entry->val;
     *out_size = entry->val_size;
 
@@ -465,10 +486,21 @@ void *flb_hash_get_ptr(struct flb_hash *ht,
         return NULL;
     }
 
-    entry->hits++;
+    flb_hash_entry_touch(ht, entry);
     return entry->val;
 }
 
+/* Check if 'key' is stored, the entry is not touched */
+int flb_hash_exists(struct flb_hash *ht, const char *key, int key_len)
+{
+    int id;
+
+    if (hash_get_entry(ht, key, key_len, &id)) {
+        return FLB_TRUE;
+    }
+    return FLB_FALSE;
+}
+
 int flb_hash_del(struct flb_hash *ht, const char *key)
 {
     int id;
@@ -35,6 +35,7 @@
 #include <fluent-bit/flb_storage.h>
 #include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_hash.h>
+#include <fluent-bit/flb_input_thread.h>
 
 struct flb_libco_in_params libco_in_param;
 
@@ -206,8 +207,14 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         instance->context  = NULL;
         instance->data     = data;
         instance->threaded = FLB_FALSE;
+        instance->dedicated_thread = FLB_FALSE;
+        instance->thread = NULL;
         instance->storage  = NULL;
         instance->storage_type = -1;
+        instance->storage_tiered = FLB_FALSE;
+        instance->storage_spill_limit = 0;
+        instance->chunk_target_size = FLB_INPUT_CHUNK_FS_MAX_SIZE;
+        instance->chunk_max_age = 0;
         instance->log_level = -1;
 
         /* net */
@@ -224,6 +231,7 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         mk_list_init(&instance->chunks);
         mk_list_init(&instance->collectors);
         mk_list_init(&instance->coros);
+        mk_list_init(&instance->filter_jobs);
 
         /* Initialize properties list */
         flb_kv_init(&instance->properties);
@@ -247,6 +255,7 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         instance->mem_buf_limit = 0;
         instance->mem_chunks_size = 0;
         instance->storage_buf_status = FLB_INPUT_RUNNING;
+        instance->filter_buf_status = FLB_INPUT_RUNNING;
         mk_list_add(&instance->_head, &config->inputs);
     }
 
@@ -323,6 +332,14 @@ int flb_input_set_property(struct flb_input_instance *ins,
         ins->routable = flb_utils_bool(tmp);
         flb_sds_destroy(tmp);
     }
+    else if (prop_key_check("dedicated_thread", k, len) == 0 && tmp) {
+        ret = flb_utils_bool(tmp);
+        flb_sds_destroy(tmp);
+        if (ret == -1) {
+            return -1;
+        }
+        ins->dedicated_thread = ret;
+    }
     else if (prop_key_check("alias", k, len) == 0 && tmp) {
         ins->alias = tmp;
     }
@@ -358,12 +375,40 @@ int flb_input_set_property(struct flb_input_instance *ins,
         else if (strcasecmp(tmp, "memory") == 0) {
             ins->storage_type = CIO_STORE_MEM;
         }
+        else if (strcasecmp(tmp, "tiered") == 0) {
+            ins->storage_type = CIO_STORE_MEM;
+            ins->storage_tiered = FLB_TRUE;
+        }
         else {
             flb_sds_destroy(tmp);
             return -1;
         }
         flb_sds_destroy(tmp);
     }
+    else if (prop_key_check("storage.spill_limit", k, len) == 0 && tmp) {
+        limit = flb_utils_size_to_bytes(tmp);
+        flb_sds_destroy(tmp);
+        if (limit <= 0) {
+            return -1;
+        }
+        ins->storage_spill_limit = (size_t) limit;
+    }
+    else if (prop_key_check("chunk.target_size", k, len) == 0 && tmp) {
+        limit = flb_utils_size_to_bytes(tmp);
+        flb_sds_destroy(tmp);
+        if (limit <= 0) {
+            return -1;
+        }
+        ins->chunk_target_size = (size_t) limit;
+    }
+    else if (prop_key_check("chunk.max_age", k, len) == 0 && tmp) {
+        ret = flb_utils_time_to_seconds(tmp);
+        flb_sds_destroy(tmp);
+        if (ret < 0) {
+            return -1;
+        }
+        ins->chunk_max_age = ret;
+    }
     else if (prop_key_check("storage.pause_on_chunks_overlimit", k, len) == 0 && tmp) {
         if (ins->storage_type == CIO_STORE_FS) {
             ret = flb_utils_bool(tmp);
@@ -409,6 +454,11 @@ const char *flb_input_name(struct flb_input_instance *ins)
 
 void flb_input_instance_destroy(struct flb_input_instance *ins)
 {
+    /* Stop the dedicated thread */
+    if (ins->thread) {
+        flb_input_thread_destroy(ins);
+    }
+
     if (ins->alias) {
         flb_sds_destroy(ins->alias);
     }
@@ -448,6 +498,10 @@ void flb_input_instance_destroy(struct flb_input_instance *ins)
     }
 #endif
 
+    if (ins->cb_latency) {
+        flb_latency_destroy(ins->cb_latency);
+    }
+
     if (ins->storage) {
         flb_storage_input_destroy(ins);
     }
@@ -519,9 +573,16 @@ int flb_input_instance_init(struct flb_input_instance *ins,
     if (ins->metrics) {
         flb_metrics_add(FLB_METRIC_N_RECORDS, "records", ins->metrics);
         flb_metrics_add(FLB_METRIC_N_BYTES, "bytes", ins->metrics);
+        flb_latency_metrics_add(ins->metrics);
     }
 #endif
 
+    /* Engine profiler */
+    ins->cb_latency = flb_latency_create();
+    if (!ins->cb_latency) {
+        return -1;
+    }
+
     /*
      * Before to call the initialization callback, make sure that the received
      * configuration parameters are valid if the plugin is registering a config map.
@@ -560,7 +621,13 @@ int flb_input_instance_init(struct flb_input_instance *ins,
             flb_input_set_property(ins, "tag", ins->name);
         }
 
-        ret = p->cb_init(ins, config, ins->data);
+        /* Threaded mode: cb_init() runs in the instance thread */
+        if (ins->dedicated_thread == FLB_TRUE) {
+            ret = flb_input_thread_init(ins, config);
+        }
+        else {
+            ret = p->cb_init(ins, config, ins->data);
+        }
         if (ret != 0) {
             flb_error("Failed initialize input %s",
                       ins->name);
@@ -631,6 +698,12 @@ void flb_input_instance_exit(struct flb_input_instance *ins,
 {
     struct flb_input_plugin *p;
 
+    /* the thread invokes cb_exit() before it ends */
+    if (ins->dedicated_thread == FLB_TRUE) {
+        flb_input_thread_destroy(ins);
+        return;
+    }
+
     p = ins->p;
     if (p->cb_exit && ins->context) {
         p->cb_exit(ins->context, config);
@@ -790,7 +863,7 @@ static int collector_start(struct flb_input_collector *coll,
     }
 
     event = &coll->event;
-    evl = config->evl;
+    evl = flb_input_event_loop(coll->instance);
 
     if (coll->type == FLB_COLLECT_TIME) {
         event->mask = MK_EVENT_EMPTY;
@@ -851,14 +924,26 @@ int flb_input_collector_start(int coll_id, struct flb_input_instance *in)
 int flb_input_collectors_start(struct flb_config *config)
 {
     struct mk_list *head;
+    struct flb_input_instance *ins;
     struct flb_input_collector *collector;
 
     /* For each Collector, register the event into the main loop */
     mk_list_foreach(head, &config->collectors) {
         collector = mk_list_entry(head, struct flb_input_collector, _head);
+        if (collector->instance->thread) {
+            continue;
+        }
         collector_start(collector, config);
     }
 
+    /* Threaded instances register their collectors in their own loop */
+    mk_list_foreach(head, &config->inputs) {
+        ins = mk_list_entry(head, struct flb_input_instance, _head);
+        if (ins->thread) {
+            flb_input_thread_collectors_start(ins);
+        }
+    }
+
     return 0;
 }
 
@@ -891,6 +976,48 @@ int flb_input_collector_running(int coll_id, struct flb_input_instance *in)
 }
 
 
+/* Event loop where the collectors of an instance are registered */
+struct mk_event_loop *flb_input_event_loop(struct flb_input_instance *ins)
+{
+    if (ins->thread) {
+        return ins->thread->evl;
+    }
+
+    return ins->config->evl;
+}
+
+/*
+ * Invoke the plugin pause and resume callbacks. Threaded instances receive
+ * the request in their own thread.
+ */
+void flb_input_pause(struct flb_input_instance *ins)
+{
+    if (!ins->p->cb_pause || !ins->context) {
+        return;
+    }
+
+    if (ins->thread) {
+        flb_input_thread_signal(ins, FLB_INPUT_THREAD_PAUSE);
+        return;
+    }
+
+    ins->p->cb_pause(ins->context, ins->config);
+}
+
+void flb_input_resume(struct flb_input_instance *ins)
+{
+    if (!ins->p->cb_resume || !ins->context) {
+        return;
+    }
+
+    if (ins->thread) {
+        flb_input_thread_signal(ins, FLB_INPUT_THREAD_RESUME);
+        return;
+    }
+
+    ins->p->cb_resume(ins->context, ins->config);
+}
+
 int flb_input_pause_all(struct flb_config *config)
 {
     int paused = 0;
@@ -902,7 +1029,7 @@ int flb_input_pause_all(struct flb_config *config)
         if (flb_input_buf_paused(in) == FLB_FALSE) {
             if (in->p->cb_pause && in->context) {
                 flb_info("[input] pausing %s", flb_input_name(in));
-                in->p->cb_pause(in->context, in->config);
+                flb_input_pause(in);
             }
             paused++;
         }
@@ -916,7 +1043,7 @@ int flb_input_collector_pause(int coll_id, struct flb_input_instance *in)
 {
     int ret;
     flb_pipefd_t fd;
-    struct flb_config *config;
+    struct mk_event_loop *evl;
     struct flb_input_collector *coll;
 
     coll = get_collector(coll_id, in);
@@ -928,7 +1055,7 @@ int flb_input_collector_pause(int coll_id, struct flb_input_instance *in)
         return 0;
     }
 
-    config = in->config;
+    evl = flb_input_event_loop(in);
     if (coll->type == FLB_COLLECT_TIME) {
         /*
          * For a collector time, it's better to just remove the file
@@ -940,11 +1067,11 @@ int flb_input_collector_pause(int coll_id, struct flb_input_instance *in)
          */
         fd = coll->fd_timer;
         coll->fd_timer = -1;
-        mk_event_timeout_destroy(config->evl, &coll->event);
+        mk_event_timeout_destroy(evl, &coll->event);
         mk_event_closesocket(fd);
     }
     else if (coll->type & (FLB_COLLECT_FD_SERVER | FLB_COLLECT_FD_EVENT)) {
-        ret = mk_event_del(config->evl, &coll->event);
+        ret = mk_event_del(evl, &coll->event);
         if (ret != 0) {
             flb_warn("[input] cannot disable event for %s", in->name);
             return -1;
@@ -980,6 +1107,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
     int ret;
     struct flb_input_collector *coll;
     struct flb_config *config;
+    struct mk_event_loop *evl;
     struct mk_event *event;
 
     coll = get_collector(coll_id, in);
@@ -994,6 +1122,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
     }
 
     config = in->config;
+    evl = flb_input_event_loop(in);
     event = &coll->event;
 
     /* If data ingestion has been paused, the collector cannot resume */
@@ -1004,7 +1133,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
     if (coll->type == FLB_COLLECT_TIME) {
         event->mask = MK_EVENT_EMPTY;
         event->status = MK_EVENT_NONE;
-        fd = mk_event_timeout_create(config->evl, coll->seconds,
+        fd = mk_event_timeout_create(evl, coll->seconds,
                                      coll->nanoseconds, event);
         if (fd == -1) {
             flb_error("[input collector] resume COLLECT_TIME failed");
@@ -1017,7 +1146,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
         event->mask   = MK_EVENT_EMPTY;
         event->status = MK_EVENT_NONE;
 
-        ret = mk_event_add(config->evl,
+        ret = mk_event_add(evl,
                            coll->fd_event,
                            FLB_ENGINE_EV_CORE,
                            MK_EVENT_READ, event);
@@ -1063,8 +1192,26 @@ int flb_input_set_collector_socket(struct flb_input_instance *in,
     return collector->id;
 }
 
+/* Engine profiler: account the time spent in a collector callback */
+static void input_collector_latency(struct flb_input_instance *ins,
+                                    uint64_t start, struct flb_config *config)
+{
+    int ret;
+    uint64_t usec;
+
+    usec = flb_latency_now() - start;
+    ret = flb_latency_add(ins->cb_latency, usec,
+                          FLB_LATENCY_STALL_USEC(config->engine_stall_threshold));
+    if (ret == FLB_TRUE) {
+        flb_warn("[input] %s collector callback blocked the engine for "
+                 "%.2f ms", flb_input_name(ins), usec / 1000.0);
+        config->engine_stall_reported = FLB_TRUE;
+    }
+}
+
 int flb_input_collector_fd(flb_pipefd_t fd, struct flb_config *config)
 {
+    uint64_t start;
     struct mk_list *head;
     struct flb_input_collector *collector = NULL;
     struct flb_coro *co;
@@ -1091,6 +1238,7 @@ int flb_input_collector_fd(flb_pipefd_t fd, struct flb_config *config)
     }
 
     /* Trigger the collector callback */
+    start = flb_latency_now();
     if (collector->instance->threaded == FLB_TRUE) {
         co = flb_input_coro_collect(collector, config);
         if (!co) {
@@ -1102,6 +1250,7 @@ int flb_input_collector_fd(flb_pipefd_t fd, struct flb_config *config)
         collector->cb_collect(collector->instance, config,
                               collector->instance->context);
     }
+    input_collector_latency(collector->instance, start, config);
 
     return 0;
 }
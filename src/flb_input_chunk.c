@@ -28,6 +28,9 @@
 #include <fluent-bit/flb_task.h>
 #include <fluent-bit/flb_routes_mask.h>
 #include <fluent-bit/flb_metrics.h>
+#include <fluent-bit/flb_mp.h>
+#include <fluent-bit/flb_filter_thread.h>
+#include <fluent-bit/flb_input_thread.h>
 #include <fluent-bit/stream_processor/flb_sp.h>
 #include <chunkio/chunkio.h>
 
@@ -65,7 +68,9 @@ static ssize_t flb_input_chunk_get_releasable_space(
     mk_list_foreach(input_chunk_iterator, &input_plugin->chunks) {
         old_input_chunk = mk_list_entry(input_chunk_iterator, struct flb_input_chunk, _head);
 
-        if (!flb_routes_mask_get_bit(old_input_chunk->routes_mask, output_plugin->id)) {
+        if (!flb_routes_mask_get_bit(old_input_chunk->routes_mask,
+                                     output_plugin->id,
+                                     old_input_chunk->in->config)) {
             continue;
         }
 
@@ -108,7 +113,8 @@ static int flb_input_chunk_release_space(
                                              struct flb_input_chunk, _head);
 
         if (!flb_routes_mask_get_bit(old_input_chunk->routes_mask,
-                                     output_plugin->id)) {
+                                     output_plugin->id,
+                                     old_input_chunk->in->config)) {
             continue;
         }
 
@@ -125,12 +131,14 @@ static int flb_input_chunk_release_space(
 
         if (release_scope == FLB_INPUT_CHUNK_RELEASE_SCOPE_LOCAL) {
             flb_routes_mask_clear_bit(old_input_chunk->routes_mask,
-                                      output_plugin->id);
+                                      output_plugin->id,
+                                      old_input_chunk->in->config);
 
             output_plugin->fs_chunks_size -= chunk_size;
 
             chunk_destroy_flag = flb_routes_mask_is_empty(
-                                                old_input_chunk->routes_mask);
+                                                old_input_chunk->routes_mask,
+                                                old_input_chunk->in->config);
 
             chunk_released = FLB_TRUE;
         }
@@ -293,7 +301,7 @@ static int flb_input_chunk_safe_delete(struct flb_input_chunk *ic,
      * the routes_mask could be modified when new chunks is ingested. Therefore,
      * we still need to do the validation on the routes_mask with o_id.
      */
-    if (flb_routes_mask_get_bit(old_ic->routes_mask, o_id) == 0) {
+    if (flb_routes_mask_get_bit(old_ic->routes_mask, o_id, old_ic->in->config) == 0) {
         return FLB_FALSE;
     }
 
@@ -491,7 +499,7 @@ int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
         o_ins = mk_list_entry(head, struct flb_output_instance, _head);
 
         if ((o_ins->total_limit_size == -1) || ((1 << o_ins->id) & overlimit) == 0 ||
-           (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id) == 0)) {
+           (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id, ic->in->config) == 0)) {
             continue;
         }
 
@@ -525,8 +533,8 @@ int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
             flb_error("[input chunk] chunk %s would exceed total limit size in plugin %s",
                       flb_input_chunk_get_name(ic), o_ins->name);
 
-            flb_routes_mask_clear_bit(ic->routes_mask, o_ins->id);
-            if (flb_routes_mask_is_empty(ic->routes_mask)) {
+            flb_routes_mask_clear_bit(ic->routes_mask, o_ins->id, ic->in->config);
+            if (flb_routes_mask_is_empty(ic->routes_mask, ic->in->config)) {
                 bytes = flb_input_chunk_get_size(ic);
                 if (bytes != 0) {
                     /*
@@ -561,14 +569,15 @@ int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
             old_ic_bytes = flb_input_chunk_get_real_size(old_ic);
 
             /* drop chunk by adjusting the routes_mask */
-            flb_routes_mask_clear_bit(old_ic->routes_mask, o_ins->id);
+            flb_routes_mask_clear_bit(old_ic->routes_mask, o_ins->id,
+                                      old_ic->in->config);
             o_ins->fs_chunks_size -= old_ic_bytes;
 
             flb_debug("[input chunk] remove route of chunk %s with size %ld bytes to output plugin %s "
                       "to place the incoming data with size %ld bytes", flb_input_chunk_get_name(old_ic),
                       old_ic_bytes, o_ins->name, chunk_size);
 
-            if (flb_routes_mask_is_empty(old_ic->routes_mask)) {
+            if (flb_routes_mask_is_empty(old_ic->routes_mask, old_ic->in->config)) {
                 if (old_ic->task != NULL) {
                     /*
                      * If the chunk is referenced by a task and task has no active route,
@@ -617,7 +626,7 @@ int flb_input_chunk_has_overlimit_routes(struct flb_input_chunk *ic,
         o_ins = mk_list_entry(head, struct flb_output_instance, _head);
 
         if ((o_ins->total_limit_size == -1) ||
-            (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id) == 0)) {
+            (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id, ic->in->config) == 0)) {
             continue;
         }
 
@@ -649,7 +658,7 @@ int flb_input_chunk_place_new_chunk(struct flb_input_chunk *ic, size_t chunk_siz
         flb_input_chunk_find_space_new_data(ic, chunk_size, overlimit);
     }
 
-    return !flb_routes_mask_is_empty(ic->routes_mask);
+    return !flb_routes_mask_is_empty(ic->routes_mask, ic->in->config);
 }
 
 /* Create an input chunk using a Chunk I/O */
@@ -669,17 +678,20 @@ struct flb_input_chunk *flb_input_chunk_map(struct flb_input_instance *in,
     const char *tag_buf;
     struct flb_input_chunk *ic;
 
-    /* Create context for the input instance */
-    ic = flb_calloc(1, sizeof(struct flb_input_chunk));
+    /* Create context for the input instance, the routes mask follows it */
+    ic = flb_calloc(1, sizeof(struct flb_input_chunk) +
+                    FLB_ROUTES_MASK_BYTES(in->config));
     if (!ic) {
         flb_errno();
         return NULL;
     }
+    ic->routes_mask = (uint64_t *) (ic + 1);
     ic->event_type = event_type;
     ic->busy = FLB_FALSE;
     ic->fs_backlog = FLB_TRUE;
     ic->chunk = chunk;
     ic->in = in;
+    ic->create_time = 0;
     msgpack_packer_init(&ic->mp_pck, ic, flb_input_chunk_write);
 
     ret = cio_chunk_get_content(ic->chunk, &buf_data, &buf_size);
@@ -938,13 +950,15 @@ struct flb_input_chunk *flb_input_chunk_create(struct flb_input_instance *in,
         return NULL;
     }
 
-    /* Create context for the input instance */
-    ic = flb_calloc(1, sizeof(struct flb_input_chunk));
+    /* Create context for the input instance, the routes mask follows it */
+    ic = flb_calloc(1, sizeof(struct flb_input_chunk) +
+                    FLB_ROUTES_MASK_BYTES(in->config));
     if (!ic) {
         flb_errno();
         cio_chunk_close(chunk, CIO_TRUE);
         return NULL;
     }
+    ic->routes_mask = (uint64_t *) (ic + 1);
 
     /*
      * Check chunk content type to be created: depending of the value set by
@@ -957,6 +971,7 @@ struct flb_input_chunk *flb_input_chunk_create(struct flb_input_instance *in,
     ic->fs_backlog = FLB_FALSE;
     ic->in = in;
     ic->stream_off = 0;
+    ic->create_time = time(NULL);
     ic->task = NULL;
 #ifdef FLB_HAVE_METRICS
     ic->total_records = 0;
@@ -986,6 +1001,38 @@ struct flb_input_chunk *flb_input_chunk_create(struct flb_input_instance *in,
     return ic;
 }
 
+/*
+ * Tiered storage: the spilled chunks that are up use memory too. Keep the
+ * bytes they hold in the instance storage context so the usage is known
+ * without walking the chunks. It must be called every time a chunk of a
+ * tiered instance might have changed its state.
+ */
+static void input_chunk_spill_update(struct flb_input_chunk *ic, int release)
+{
+    ssize_t bytes;
+    size_t size = 0;
+    struct cio_chunk *ch;
+    struct flb_storage_input *si;
+
+    si = (struct flb_storage_input *) ic->in->storage;
+    if (!si || !si->spill_stream) {
+        return;
+    }
+
+    ch = (struct cio_chunk *) ic->chunk;
+    if (release == FLB_FALSE && ch->st == si->spill_stream &&
+        cio_chunk_is_up(ch) == CIO_TRUE) {
+        bytes = cio_chunk_get_content_size(ch);
+        if (bytes > 0) {
+            size = bytes;
+        }
+    }
+
+    si->spill_up_size -= ic->spill_up_size;
+    si->spill_up_size += size;
+    ic->spill_up_size = size;
+}
+
 int flb_input_chunk_destroy(struct flb_input_chunk *ic, int del)
 {
     int tag_len;
@@ -1012,7 +1059,8 @@ int flb_input_chunk_destroy(struct flb_input_chunk *ic, int del)
             continue;
         }
 
-        if (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id) != 0) {
+        if (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id,
+                                    ic->in->config) != 0) {
             o_ins->fs_chunks_size -= bytes;
             flb_debug("[input chunk] remove chunk %s with %ld bytes from plugin %s, "
                       "the updated fs_chunks_size is %ld bytes", flb_input_chunk_get_name(ic),
@@ -1058,6 +1106,7 @@ int flb_input_chunk_destroy(struct flb_input_chunk *ic, int del)
         }
     }
 
+    input_chunk_spill_update(ic, FLB_TRUE);
     cio_chunk_close(ic->chunk, del);
     mk_list_del(&ic->_head);
     flb_free(ic);
@@ -1112,7 +1161,7 @@ static struct flb_input_chunk *input_chunk_get(struct flb_input_instance *in,
      * that the chunk will flush to, we need to modify the routes_mask of the oldest chunks
      * (based in creation time) to get enough space for the incoming chunk.
      */
-    if (!flb_routes_mask_is_empty(ic->routes_mask)
+    if (!flb_routes_mask_is_empty(ic->routes_mask, ic->in->config)
         && flb_input_chunk_place_new_chunk(ic, chunk_size) == 0) {
         /*
          * If the chunk is not newly created, the chunk might already have logs inside.
@@ -1120,7 +1169,8 @@ static struct flb_input_chunk *input_chunk_get(struct flb_input_instance *in,
          * If the routes_mask is cleared after trying to append new data, we destroy
          * the chunk.
          */
-        if (new_chunk || flb_routes_mask_is_empty(ic->routes_mask) == FLB_TRUE) {
+        if (new_chunk ||
+            flb_routes_mask_is_empty(ic->routes_mask, ic->in->config) == FLB_TRUE) {
             flb_input_chunk_destroy(ic, FLB_TRUE);
         }
 
@@ -1170,6 +1220,15 @@ size_t flb_input_chunk_total_size(struct flb_input_instance *in)
 
     storage = (struct flb_storage_input *) in->storage;
     total = cio_stream_size_chunks_up(storage->stream);
+
+    /*
+     * Tiered storage: spilled chunks that are up use memory too. The spill
+     * stream might hold backlog chunks as well, so only our own are tracked.
+     */
+    if (storage->spill_stream) {
+        total += storage->spill_up_size;
+    }
+
     return total;
 }
 
@@ -1183,12 +1242,19 @@ size_t flb_input_chunk_total_size(struct flb_input_instance *in)
 size_t flb_input_chunk_set_limits(struct flb_input_instance *in)
 {
     size_t total;
+    struct flb_storage_input *si;
 
     /* Gather total number of enqueued bytes */
     total = flb_input_chunk_total_size(in);
     /* Register the total into the context variable */
     in->mem_chunks_size = total;
 
+    /* Tiered storage: let the engine spill chunks to the file system */
+    si = (struct flb_storage_input *) in->storage;
+    if (si->spill_stream && total >= si->spill_limit) {
+        in->config->storage_tiers_spill = FLB_TRUE;
+    }
+
     /*
      * After the adjustments, validate if the plugin is overlimit or paused
      * and perform further adjustments.
@@ -1199,7 +1265,7 @@ size_t flb_input_chunk_set_limits(struct flb_input_instance *in)
         in->mem_buf_status == FLB_INPUT_PAUSED) {
         in->mem_buf_status = FLB_INPUT_RUNNING;
         if (in->p->cb_resume) {
-            in->p->cb_resume(in->context, in->config);
+            flb_input_resume(in);
             flb_info("[input] %s resume (mem buf overlimit)",
                       in->name);
         }
@@ -1210,7 +1276,7 @@ size_t flb_input_chunk_set_limits(struct flb_input_instance *in)
         in->storage_buf_status == FLB_INPUT_PAUSED) {
         in->storage_buf_status = FLB_INPUT_RUNNING;
         if (in->p->cb_resume) {
-            in->p->cb_resume(in->context, in->config);
+            flb_input_resume(in);
             flb_info("[input] %s resume (storage buf overlimit %d/%d)",
                       in->name,
                       ((struct flb_storage_input *)in->storage)->cio->total_chunks,
@@ -1231,9 +1297,7 @@ static inline int flb_input_chunk_protect(struct flb_input_instance *i)
         flb_warn("[input] %s paused (mem buf overlimit)",
                  i->name);
         if (!flb_input_buf_paused(i)) {
-            if (i->p->cb_pause) {
-                i->p->cb_pause(i->context, i->config);
-            }
+            flb_input_pause(i);
         }
         i->mem_buf_status = FLB_INPUT_PAUSED;
         return FLB_TRUE;
@@ -1244,9 +1308,7 @@ static inline int flb_input_chunk_protect(struct flb_input_instance *i)
                  ((struct flb_storage_input *)i->storage)->cio->total_chunks,
                  ((struct flb_storage_input *)i->storage)->cio->max_chunks_up);
         if (!flb_input_buf_paused(i)) {
-            if (i->p->cb_pause) {
-                i->p->cb_pause(i->context, i->config);
-            }
+            flb_input_pause(i);
         }
         i->storage_buf_status = FLB_INPUT_PAUSED;
         return FLB_TRUE;
@@ -1278,6 +1340,7 @@ int flb_input_chunk_set_up_down(struct flb_input_chunk *ic)
     if (flb_input_chunk_is_mem_overlimit(in) == FLB_TRUE) {
         if (cio_chunk_is_up(ic->chunk) == CIO_TRUE) {
             cio_chunk_down(ic->chunk);
+            input_chunk_spill_update(ic, FLB_FALSE);
 
             /* Adjust new counters */
             total = flb_input_chunk_total_size(ic->in);
@@ -1296,10 +1359,119 @@ int flb_input_chunk_is_up(struct flb_input_chunk *ic)
 
 }
 
+/*
+ * A chunk of a tiered instance can be moved to the file system once it's
+ * not written anymore (locked) and no output is reading its content. Tasks
+ * waiting for a retry get the content again when they are re-dispatched.
+ */
+int flb_input_chunk_is_spillable(struct flb_input_chunk *ic)
+{
+    struct flb_task *task;
+    struct cio_chunk *ch;
+    struct flb_storage_input *si;
+
+    si = (struct flb_storage_input *) ic->in->storage;
+    ch = (struct cio_chunk *) ic->chunk;
+    if (!si->spill_stream || ch->st != si->stream) {
+        return FLB_FALSE;
+    }
+
+    if (cio_chunk_is_locked(ch) == CIO_FALSE) {
+        return FLB_FALSE;
+    }
+
+    task = ic->task;
+    if (task && (task->users > 0 || task->status == FLB_TASK_NEW)) {
+        return FLB_FALSE;
+    }
+
+    return FLB_TRUE;
+}
+
+/*
+ * Move the content of a memory chunk to a new chunk with the same name in
+ * the spill stream and release the memory. The new chunk is left down.
+ */
+int flb_input_chunk_spill(struct flb_input_chunk *ic)
+{
+    int ret;
+    int err;
+    int meta_len = 0;
+    char *meta = NULL;
+    char *buf = NULL;
+    size_t size = 0;
+    struct cio_chunk *ch;
+    struct cio_chunk *chunk;
+    struct flb_storage_input *si;
+
+    si = (struct flb_storage_input *) ic->in->storage;
+    ch = (struct cio_chunk *) ic->chunk;
+
+    ret = cio_chunk_get_content(ch, &buf, &size);
+    if (ret == -1) {
+        return -1;
+    }
+
+    ret = cio_meta_read(ch, &meta, &meta_len);
+    if (ret == -1) {
+        return -1;
+    }
+
+    chunk = cio_chunk_open(si->cio, si->spill_stream, ch->name,
+                           CIO_OPEN, size + meta_len, &err);
+    if (!chunk) {
+        flb_error("[input chunk] could not create spill chunk: %s:%s",
+                  si->spill_stream->name, ch->name);
+        return -1;
+    }
+
+    if (cio_chunk_is_up(chunk) == CIO_FALSE) {
+        ret = cio_chunk_up_force(chunk);
+        if (ret == -1) {
+            cio_chunk_close(chunk, CIO_TRUE);
+            return -1;
+        }
+    }
+
+    ret = cio_meta_write(chunk, meta, meta_len);
+    if (ret == -1) {
+        cio_chunk_close(chunk, CIO_TRUE);
+        return -1;
+    }
+
+    if (size > 0) {
+        ret = cio_chunk_write(chunk, buf, size);
+        if (ret == -1) {
+            cio_chunk_close(chunk, CIO_TRUE);
+            return -1;
+        }
+    }
+
+    if (cio_chunk_is_locked(ch)) {
+        cio_chunk_lock(chunk);
+    }
+
+    /* sync the content and release the memory */
+    cio_chunk_down(chunk);
+
+    flb_debug("[input chunk] %s spilled %zu bytes to the file system",
+              ch->name, size);
+
+    cio_chunk_close(ch, CIO_TRUE);
+    ic->chunk = chunk;
+    input_chunk_spill_update(ic, FLB_FALSE);
+
+    return 0;
+}
+
 int flb_input_chunk_down(struct flb_input_chunk *ic)
 {
+    int ret;
+
     if (cio_chunk_is_up(ic->chunk) == CIO_TRUE) {
-        return cio_chunk_down(ic->chunk);
+        ret = cio_chunk_down(ic->chunk);
+        input_chunk_spill_update(ic, FLB_FALSE);
+        return ret;
     }
 
     return 0;
@@ -1307,57 +1479,366 @@ int flb_input_chunk_down(struct flb_input_chunk *ic)
 
 int flb_input_chunk_set_up(struct flb_input_chunk *ic)
 {
+    int ret;
+
     if (cio_chunk_is_up(ic->chunk) == CIO_FALSE) {
-        return cio_chunk_up(ic->chunk);
+        ret = cio_chunk_up(ic->chunk);
+        input_chunk_spill_update(ic, FLB_FALSE);
+        return ret;
     }
 
     return 0;
 }
 
-/* Append a RAW MessagPack buffer to the input instance */
-int flb_input_chunk_append_raw(struct flb_input_instance *in,
-                               const char *tag, size_t tag_len,
-                               const void *buf, size_t buf_size)
+/*
+ * Chunk packing: a chunk that is still under the instance target size is
+ * kept open for its Tag until it gets older than 'chunk.max_age'. Data is
+ * never held back when the instance cannot ingest more records or the
+ * service is stopping.
+ */
+int flb_input_chunk_is_ready(struct flb_input_chunk *ic, time_t now)
+{
+    struct flb_input_instance *in = ic->in;
+
+    if (in->chunk_max_age <= 0 || ic->fs_backlog == FLB_TRUE) {
+        return FLB_TRUE;
+    }
+
+    if (cio_chunk_is_locked(ic->chunk)) {
+        return FLB_TRUE;
+    }
+
+    if (now - ic->create_time >= in->chunk_max_age) {
+        return FLB_TRUE;
+    }
+
+    if (flb_input_buf_paused(in) == FLB_TRUE ||
+        in->config->is_ingestion_active == FLB_FALSE ||
+        in->config->is_shutting_down == FLB_TRUE) {
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+/*
+ * Maximum size of a merged chunk: the smallest 'batch.size' of the output
+ * instances the chunk routes to or, with chunk packing, the instance
+ * target size. Zero means the chunk is not merged.
+ */
+static size_t input_chunk_merge_limit(struct flb_input_chunk *ic,
+                                      int *max_records)
+{
+    int records = 0;
+    size_t limit = 0;
+    struct mk_list *head;
+    struct flb_output_instance *o_ins;
+
+    mk_list_foreach(head, &ic->in->config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        if (o_ins->batch_size == 0) {
+            continue;
+        }
+
+        if (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id,
+                                    ic->in->config) == 0) {
+            continue;
+        }
+
+        if (limit == 0 || o_ins->batch_size < limit) {
+            limit = o_ins->batch_size;
+        }
+        if (o_ins->batch_records > 0 &&
+            (records == 0 || o_ins->batch_records < records)) {
+            records = o_ins->batch_records;
+        }
+    }
+
+    if (limit == 0 && ic->in->chunk_max_age > 0) {
+        limit = ic->in->chunk_target_size;
+    }
+
+    *max_records = records;
+    return limit;
+}
+
+static int input_chunk_is_mergeable(struct flb_input_chunk *ic, size_t limit)
+{
+    ssize_t size;
+
+    if (limit == 0) {
+        return FLB_FALSE;
+    }
+
+    if (ic->busy == FLB_TRUE || ic->task || ic->fs_backlog == FLB_TRUE ||
+        ic->event_type != FLB_INPUT_LOGS) {
+        return FLB_FALSE;
+    }
+
+    if (cio_chunk_is_up(ic->chunk) == CIO_FALSE) {
+        return FLB_FALSE;
+    }
+
+    size = flb_input_chunk_get_size(ic);
+    if (size <= 0 || size >= limit) {
+        return FLB_FALSE;
+    }
+
+    return FLB_TRUE;
+}
+
+/* Number of records in the chunk, for the 'batch.records' limit */
+static int input_chunk_records(struct flb_input_chunk *ic)
+{
+#ifdef FLB_HAVE_METRICS
+    return ic->total_records;
+#else
+    int ret;
+    char *buf;
+    size_t size;
+
+    ret = cio_chunk_get_content(ic->chunk, &buf, &size);
+    if (ret == -1) {
+        return 0;
+    }
+
+    return flb_mp_count(buf, size);
+#endif
+}
+
+/* Append the content of 'src' to 'dst' and destroy 'src' */
+static int input_chunk_merge(struct flb_input_chunk *dst,
+                             struct flb_input_chunk *src)
+{
+    int ret;
+    int locked;
+    int tag_len;
+    char *buf;
+    size_t size;
+    size_t dst_size;
+    ssize_t pre_size;
+    ssize_t post_size;
+    size_t out_size;
+    const char *tag_buf;
+    void *open_ic;
+    struct flb_input_instance *in = dst->in;
+
+    ret = cio_chunk_get_content(src->chunk, &buf, &size);
+    if (ret == -1) {
+        return -1;
+    }
+
+    /*
+     * The stream processor resumes from 'stream_off' on the next append, so
+     * records of 'dst' not processed yet cannot be followed by records that
+     * were already processed in 'src': keep those chunks apart.
+     */
+    dst_size = cio_chunk_get_content_size(dst->chunk);
+    if (src->stream_off > 0 && dst->stream_off != dst_size) {
+        return -1;
+    }
+
+    pre_size = flb_input_chunk_get_real_size(dst);
+
+    locked = cio_chunk_is_locked(dst->chunk);
+    if (locked) {
+        cio_chunk_unlock(dst->chunk);
+    }
+    ret = cio_chunk_write(dst->chunk, buf, size);
+    if (locked) {
+        cio_chunk_lock(dst->chunk);
+    }
+    if (ret == -1) {
+        flb_error("[input chunk] could not merge chunk %s into %s",
+                  flb_input_chunk_get_name(src), flb_input_chunk_get_name(dst));
+        return -1;
+    }
+
+#ifdef FLB_HAVE_METRICS
+    dst->total_records += src->total_records;
+#endif
+    /* the unprocessed records of 'src' are now at the end of 'dst' */
+    if (dst->stream_off == dst_size) {
+        dst->stream_off = dst_size + src->stream_off;
+    }
+
+    post_size = flb_input_chunk_get_real_size(dst);
+    if (pre_size >= 0 && post_size > pre_size) {
+        flb_input_chunk_update_output_instances(dst, post_size - pre_size);
+    }
+
+    flb_debug("[input chunk] merged %zu bytes of chunk %s into %s",
+              size, flb_input_chunk_get_name(src),
+              flb_input_chunk_get_name(dst));
+
+    flb_input_chunk_destroy(src, FLB_TRUE);
+
+    /* if 'src' was the open chunk for the Tag, keep writing into 'dst' */
+    if (locked || flb_input_chunk_get_tag(dst, &tag_buf, &tag_len) == -1) {
+        return 0;
+    }
+
+    ret = flb_hash_get(in->ht_log_chunks, tag_buf, tag_len,
+                       &open_ic, &out_size);
+    if (ret == -1) {
+        flb_hash_add(in->ht_log_chunks, tag_buf, tag_len, dst, 0);
+    }
+
+    return 0;
+}
+
+/*
+ * Merge the small chunks of the same Tag waiting to be dispatched, so
+ * outputs get fewer and larger payloads. Chunks are visited oldest first
+ * and appended to the oldest chunk of their Tag while both share the routes
+ * and the result fits in the merge limit (output 'batch.size' and
+ * 'batch.records', or 'chunk.target_size' with chunk packing). Returns the
+ * number of merged chunks.
+ */
+int flb_input_chunk_coalesce(struct flb_input_instance *in)
+{
+    int ret;
+    int count = 0;
+    int merged = 0;
+    int batching = FLB_FALSE;
+    int tag_len;
+    int max_records;
+    size_t limit;
+    size_t out_size;
+    ssize_t size;
+    ssize_t dst_size;
+    const char *tag_buf;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_hash *ht;
+    struct flb_input_chunk *ic;
+    struct flb_input_chunk *dst;
+    struct flb_output_instance *o_ins;
+
+    mk_list_foreach(head, &in->config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        if (o_ins->batch_size > 0) {
+            batching = FLB_TRUE;
+            break;
+        }
+    }
+
+    if (in->chunk_max_age <= 0 && batching == FLB_FALSE) {
+        return 0;
+    }
+
+    mk_list_foreach(head, &in->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        limit = input_chunk_merge_limit(ic, &max_records);
+        if (input_chunk_is_mergeable(ic, limit) == FLB_TRUE) {
+            count++;
+        }
+    }
+
+    if (count < 2) {
+        return 0;
+    }
+
+    ht = flb_hash_create(FLB_HASH_EVICT_NONE, count, -1);
+    if (!ht) {
+        return -1;
+    }
+
+    mk_list_foreach_safe(head, tmp, &in->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        limit = input_chunk_merge_limit(ic, &max_records);
+        if (input_chunk_is_mergeable(ic, limit) == FLB_FALSE) {
+            continue;
+        }
+
+        ret = flb_input_chunk_get_tag(ic, &tag_buf, &tag_len);
+        if (ret == -1 || tag_len <= 0) {
+            continue;
+        }
+
+        ret = flb_hash_get(ht, tag_buf, tag_len, (void *) &dst, &out_size);
+        if (ret >= 0 &&
+            memcmp(dst->routes_mask, ic->routes_mask,
+                   FLB_ROUTES_MASK_BYTES(in->config)) == 0) {
+            size = flb_input_chunk_get_size(ic);
+            dst_size = flb_input_chunk_get_size(dst);
+            if (max_records > 0 &&
+                input_chunk_records(dst) +
+                input_chunk_records(ic) > max_records) {
+                size = -1;
+            }
+            if (size > 0 && dst_size + size <= limit) {
+                ret = input_chunk_merge(dst, ic);
+                if (ret == 0) {
+                    merged++;
+                    continue;
+                }
+            }
+        }
+
+        /* the chunk becomes the merge target for the Tag */
+        flb_hash_add(ht, tag_buf, tag_len, ic, 0);
+    }
+
+    flb_hash_destroy(ht);
+
+    return merged;
+}
+
+/* Update 'input' metrics */
+static void input_metrics_add(struct flb_input_instance *in,
+                              int records, size_t bytes)
+{
+#ifdef FLB_HAVE_METRICS
+    uint64_t ts;
+
+    if (records <= 0) {
+        return;
+    }
+
+    /* timestamp */
+    ts = cmt_time_now();
+
+    /* fluentbit_input_records_total */
+    cmt_counter_add(in->cmt_records, ts, records,
+                    1, (char *[]) {(char *) flb_input_name(in)});
+
+    /* fluentbit_input_bytes_total */
+    cmt_counter_add(in->cmt_bytes, ts, bytes,
+                    1, (char *[]) {(char *) flb_input_name(in)});
+
+    /* OLD api */
+    flb_metrics_sum(FLB_METRIC_N_RECORDS, records, in->metrics);
+    flb_metrics_sum(FLB_METRIC_N_BYTES, bytes, in->metrics);
+#endif
+}
+
+/*
+ * Write a buffer into a chunk. When 'counted' is set the input metrics were
+ * already updated for this buffer and when 'filtered' is set the filters
+ * already ran over it (filter workers).
+ */
+static int input_chunk_append(struct flb_input_instance *in,
+                              const char *tag, size_t tag_len,
+                              const void *buf, size_t buf_size,
+                              int counted, int filtered)
 {
     int ret;
     int set_down = FLB_FALSE;
     int min;
     int meta_size;
     int new_chunk = FLB_FALSE;
-    uint64_t ts;
     size_t diff;
     size_t size;
     size_t pre_size;
     struct flb_input_chunk *ic;
     struct flb_storage_input *si;
 
-    /* Check if the input plugin has been paused */
-    if (flb_input_buf_paused(in) == FLB_TRUE) {
-        flb_debug("[input chunk] %s is paused, cannot append records",
-                  in->name);
-        return -1;
-    }
-
     if (buf_size == 0) {
         flb_debug("[input chunk] skip ingesting data with 0 bytes");
         return -1;
     }
 
-    /*
-     * Some callers might not set a custom tag, on that case just inherit
-     * the fixed instance tag or instance name.
-     */
-    if (!tag) {
-        if (in->tag && in->tag_len > 0) {
-            tag = in->tag;
-            tag_len = in->tag_len;
-        }
-        else {
-            tag = in->name;
-            tag_len = strlen(in->name);
-        }
-    }
-
     /*
      * Get a target input chunk, can be one with remaining space available
      * or a new one.
@@ -1401,26 +1882,13 @@ int flb_input_chunk_append_raw(struct flb_input_instance *in,
 
     /* Update 'input' metrics */
 #ifdef FLB_HAVE_METRICS
-    if (ic->total_records > 0) {
-        /* timestamp */
-        ts = cmt_time_now();
-
-        /* fluentbit_input_records_total */
-        cmt_counter_add(in->cmt_records, ts, ic->added_records,
-                        1, (char *[]) {(char *) flb_input_name(in)});
-
-        /* fluentbit_input_bytes_total */
-        cmt_counter_add(in->cmt_bytes, ts, buf_size,
-                        1, (char *[]) {(char *) flb_input_name(in)});
-
-        /* OLD api */
-        flb_metrics_sum(FLB_METRIC_N_RECORDS, ic->added_records, in->metrics);
-        flb_metrics_sum(FLB_METRIC_N_BYTES, buf_size, in->metrics);
+    if (counted == FLB_FALSE && ic->total_records > 0) {
+        input_metrics_add(in, ic->added_records, buf_size);
     }
 #endif
 
     /* Apply filters */
-    if (in->event_type == FLB_INPUT_LOGS) {
+    if (in->event_type == FLB_INPUT_LOGS && filtered == FLB_FALSE) {
         flb_filter_do(ic,
                       buf, buf_size,
                       tag, tag_len, in->config);
@@ -1462,8 +1930,8 @@ int flb_input_chunk_append_raw(struct flb_input_instance *in,
         flb_input_chunk_update_output_instances(ic, diff);
     }
 
-    /* Lock buffers where size > 2MB */
-    if (size > FLB_INPUT_CHUNK_FS_MAX_SIZE) {
+    /* Lock buffers where size > chunk.target_size (2MB by default) */
+    if (size > in->chunk_target_size) {
         cio_chunk_lock(ic->chunk);
     }
 
@@ -1530,8 +1998,9 @@ int flb_input_chunk_append_raw(struct flb_input_instance *in,
             size = cio_chunk_get_content_size(ic->chunk);
 
             /* Do we have less than 1% available ? */
-            min = (FLB_INPUT_CHUNK_FS_MAX_SIZE * 0.01);
-            if (FLB_INPUT_CHUNK_FS_MAX_SIZE - size < min) {
+            min = (in->chunk_target_size * 0.01);
+            if (size >= in->chunk_target_size ||
+                in->chunk_target_size - size < min) {
                 cio_chunk_down(ic->chunk);
             }
         }
@@ -1542,6 +2011,100 @@ int flb_input_chunk_append_raw(struct flb_input_instance *in,
     return 0;
 }
 
+/* Append a buffer that was accepted by the input instance */
+static int input_chunk_append_raw(struct flb_input_instance *in,
+                                  const char *tag, size_t tag_len,
+                                  const void *buf, size_t buf_size)
+{
+    int ret;
+
+    /*
+     * Filter workers: the buffer is filtered in a worker thread and appended
+     * later by flb_input_chunk_append_filtered(), keeping the input order.
+     */
+    if (in->config->filter_pool && in->event_type == FLB_INPUT_LOGS) {
+        ret = flb_filter_pool_submit(in->config->filter_pool, in,
+                                     tag, tag_len, buf, buf_size);
+        if (ret != FLB_FILTER_POOL_INLINE) {
+            if (ret == 0) {
+                input_metrics_add(in, flb_mp_count(buf, buf_size), buf_size);
+            }
+            return ret;
+        }
+    }
+
+    return input_chunk_append(in, tag, tag_len, buf, buf_size,
+                              FLB_FALSE, FLB_FALSE);
+}
+
+/* Append a RAW MessagPack buffer to the input instance */
+int flb_input_chunk_append_raw(struct flb_input_instance *in,
+                               const char *tag, size_t tag_len,
+                               const void *buf, size_t buf_size)
+{
+    struct flb_input_thread *th;
+
+    /* Check if the input plugin has been paused */
+    if (flb_input_buf_paused(in) == FLB_TRUE) {
+        flb_debug("[input chunk] %s is paused, cannot append records",
+                  in->name);
+        return -1;
+    }
+
+    if (buf_size == 0) {
+        flb_debug("[input chunk] skip ingesting data with 0 bytes");
+        return -1;
+    }
+
+    /*
+     * Some callers might not set a custom tag, on that case just inherit
+     * the fixed instance tag or instance name.
+     */
+    if (!tag) {
+        if (in->tag && in->tag_len > 0) {
+            tag = in->tag;
+            tag_len = in->tag_len;
+        }
+        else {
+            tag = in->name;
+            tag_len = strlen(in->name);
+        }
+    }
+
+    /* Input threads hand the buffer to the engine, it owns the chunks */
+    th = flb_input_thread_get();
+    if (th) {
+        return flb_input_thread_append(th, in, tag, tag_len, buf, buf_size);
+    }
+
+    return input_chunk_append_raw(in, tag, tag_len, buf, buf_size);
+}
+
+/*
+ * Append a buffer queued by an input thread. The input is not checked for
+ * pause: the data was accepted when it was queued.
+ */
+int flb_input_chunk_append_queued(struct flb_input_instance *in,
+                                  const char *tag, size_t tag_len,
+                                  const void *buf, size_t buf_size)
+{
+    return input_chunk_append_raw(in, tag, tag_len, buf, buf_size);
+}
+
+/*
+ * Append a buffer coming back from the filter workers. Input metrics were
+ * updated when the buffer was submitted and the input is not checked for
+ * pause: the data was already accepted.
+ */
+int flb_input_chunk_append_filtered(struct flb_input_instance *in,
+                                    const char *tag, size_t tag_len,
+                                    const void *buf, size_t buf_size,
+                                    int filtered)
+{
+    return input_chunk_append(in, tag, tag_len, buf, buf_size,
+                              FLB_TRUE, filtered);
+}
+
 /* Retrieve a raw buffer from a dyntag node */
 const void *flb_input_chunk_flush(struct flb_input_chunk *ic, size_t *size)
 {
@@ -1553,6 +2116,7 @@ const void *flb_input_chunk_flush(struct flb_input_chunk *ic, size_t *size)
         if (ret == -1) {
             return NULL;
         }
+        input_chunk_spill_update(ic, FLB_FALSE);
     }
 
     /*
@@ -1690,7 +2254,8 @@ void flb_input_chunk_update_output_instances(struct flb_input_chunk *ic,
             continue;
         }
 
-        if (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id) != 0) {
+        if (flb_routes_mask_get_bit(ic->routes_mask, o_ins->id,
+                                    ic->in->config) != 0) {
             /*
              * if there is match on any index of 1's in the binary, it indicates
              * that the input chunk will flush to this output instance
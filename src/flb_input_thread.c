@@ -0,0 +1,596 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_latency.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_input_plugin.h>
+#include <fluent-bit/flb_input_thread.h>
+#include <fluent-bit/flb_thread_storage.h>
+
+/*
+ * Threaded inputs
+ * ===============
+ *
+ * When an input instance sets 'dedicated_thread on', the plugin runs in its own
+ * thread with a private event loop and scheduler: cb_init(), the collectors,
+ * the pause/resume callbacks and cb_exit() are invoked by that thread, so a
+ * slow collector cannot delay the engine or the other inputs.
+ *
+ * Chunks are still owned by the engine. Buffers appended by the thread are
+ * copied and linked to a queue, the engine is notified through a channel
+ * and appends them in the same order, serializing every write to the input
+ * chunks. When the queue grows over the limit (mem_buf_limit or 8MB) the
+ * thread blocks until the engine catches up.
+ */
+
+FLB_TLS_DEFINE(struct flb_input_thread, flb_input_thread_ctx);
+
+static int tls_ready = FLB_FALSE;
+static pthread_once_t tls_once = PTHREAD_ONCE_INIT;
+
+static void input_thread_tls_init()
+{
+    FLB_TLS_INIT(flb_input_thread_ctx);
+    tls_ready = FLB_TRUE;
+}
+
+/* Return the context of the input thread calling, NULL for other threads */
+struct flb_input_thread *flb_input_thread_get()
+{
+    struct flb_input_thread *th;
+
+    if (tls_ready == FLB_FALSE) {
+        return NULL;
+    }
+
+    th = FLB_TLS_GET(flb_input_thread_ctx);
+    return th;
+}
+
+static void msg_destroy(struct flb_input_thread_msg *msg)
+{
+    flb_sds_destroy(msg->tag);
+    flb_free(msg);
+}
+
+/* Queue a buffer for the engine, this runs in the input thread */
+int flb_input_thread_append(struct flb_input_thread *th,
+                            struct flb_input_instance *in,
+                            const char *tag, size_t tag_len,
+                            const void *buf, size_t size)
+{
+    int n;
+    int notify;
+    uint64_t val = 1;
+    struct flb_input_thread_msg *msg;
+
+    msg = flb_malloc(sizeof(struct flb_input_thread_msg) + size);
+    if (!msg) {
+        flb_errno();
+        return -1;
+    }
+    msg->tag = flb_sds_create_len(tag, tag_len);
+    if (!msg->tag) {
+        flb_free(msg);
+        return -1;
+    }
+    msg->buf = (char *) msg + sizeof(struct flb_input_thread_msg);
+    memcpy(msg->buf, buf, size);
+    msg->size = size;
+    msg->in = in;
+
+    pthread_mutex_lock(&th->mutex);
+
+    /*
+     * Backpressure: wait for the engine. Before the collectors are started
+     * the engine is waiting for cb_init() and cannot drain the queue.
+     */
+    while (th->running == FLB_TRUE && th->stopping == FLB_FALSE &&
+           th->queued > 0 && th->queued + size > th->queue_max) {
+        pthread_cond_wait(&th->cond, &th->mutex);
+    }
+
+    notify = (mk_list_is_empty(&th->msgs) == 0);
+    mk_list_add(&msg->_head, &th->msgs);
+    th->queued += size;
+
+    pthread_mutex_unlock(&th->mutex);
+
+    /* wake up the engine only if it does not have pending messages */
+    if (notify) {
+        n = flb_pipe_w(th->ch_msgs[1], &val, sizeof(val));
+        if (n == -1) {
+            flb_errno();
+        }
+    }
+
+    return 0;
+}
+
+/* Append the queued buffers to the input chunks, this runs in the engine */
+static void input_thread_drain(struct flb_input_thread *th)
+{
+    int ret;
+    struct mk_list *tmp;
+    struct mk_list list;
+    struct mk_list *head;
+    struct flb_input_thread_msg *msg;
+
+    mk_list_init(&list);
+
+    pthread_mutex_lock(&th->mutex);
+    if (mk_list_is_empty(&th->msgs) != 0) {
+        mk_list_cat(&th->msgs, &list);
+        mk_list_init(&th->msgs);
+    }
+    th->queued = 0;
+    pthread_cond_broadcast(&th->cond);
+    flb_latency_merge(th->ins->cb_latency, th->latency);
+    pthread_mutex_unlock(&th->mutex);
+
+    mk_list_foreach_safe(head, tmp, &list) {
+        msg = mk_list_entry(head, struct flb_input_thread_msg, _head);
+        mk_list_del(&msg->_head);
+
+        ret = flb_input_chunk_append_queued(msg->in, msg->tag,
+                                            flb_sds_len(msg->tag),
+                                            msg->buf, msg->size);
+        if (ret == -1) {
+            flb_plg_error(msg->in, "could not append records from the "
+                          "input thread");
+        }
+        msg_destroy(msg);
+    }
+}
+
+/* Engine callback: the input thread has queued some buffers */
+static int cb_thread_msgs(void *data)
+{
+    int n;
+    uint64_t val;
+    struct flb_input_thread *th = data;
+
+    n = flb_pipe_r(th->ch_msgs[0], &val, sizeof(val));
+    if (n == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    input_thread_drain(th);
+    return 0;
+}
+
+/* Run the collector owning the event */
+static void thread_collect(struct flb_input_thread *th, struct mk_event *event)
+{
+    int ret;
+    uint64_t usec;
+    uint64_t start;
+    struct mk_list *head;
+    struct flb_input_instance *ins = th->ins;
+    struct flb_input_collector *coll = NULL;
+
+    mk_list_foreach(head, &ins->collectors) {
+        coll = mk_list_entry(head, struct flb_input_collector, _head_ins);
+        if (&coll->event == event) {
+            break;
+        }
+        coll = NULL;
+    }
+
+    if (!coll) {
+        return;
+    }
+
+    if (coll->type == FLB_COLLECT_TIME && coll->fd_timer != -1) {
+        flb_utils_timer_consume(coll->fd_timer);
+    }
+
+    if (coll->running == FLB_FALSE) {
+        return;
+    }
+
+    /*
+     * The engine is not blocked by this callback, but a slow collector
+     * delays this input: account the time in the thread histogram.
+     */
+    start = flb_latency_now();
+    coll->cb_collect(ins, th->config, ins->context);
+    usec = flb_latency_now() - start;
+
+    pthread_mutex_lock(&th->mutex);
+    ret = flb_latency_add(th->latency, usec,
+                          FLB_LATENCY_STALL_USEC(th->config->engine_stall_threshold));
+    pthread_mutex_unlock(&th->mutex);
+
+    if (ret == FLB_TRUE) {
+        flb_warn("[input] %s collector callback blocked its dedicated thread "
+                 "for %.2f ms", flb_input_name(ins), usec / 1000.0);
+    }
+}
+
+/* Process a request from the engine, returns FLB_FALSE on stop */
+static int thread_ctl(struct flb_input_thread *th)
+{
+    int n;
+    uint64_t msg;
+    struct mk_list *head;
+    struct flb_input_collector *coll;
+    struct flb_input_instance *ins = th->ins;
+
+    n = flb_pipe_r(th->ch_ctl[0], &msg, sizeof(msg));
+    if (n <= 0) {
+        flb_errno();
+        return FLB_TRUE;
+    }
+
+    if (msg == FLB_INPUT_THREAD_START) {
+        mk_list_foreach(head, &ins->collectors) {
+            coll = mk_list_entry(head, struct flb_input_collector, _head_ins);
+            flb_input_collector_start(coll->id, ins);
+        }
+
+        pthread_mutex_lock(&th->mutex);
+        th->running = FLB_TRUE;
+        pthread_mutex_unlock(&th->mutex);
+    }
+    else if (msg == FLB_INPUT_THREAD_PAUSE) {
+        if (ins->p->cb_pause && ins->context) {
+            ins->p->cb_pause(ins->context, th->config);
+        }
+    }
+    else if (msg == FLB_INPUT_THREAD_RESUME) {
+        if (ins->p->cb_resume && ins->context) {
+            ins->p->cb_resume(ins->context, th->config);
+        }
+    }
+    else if (msg == FLB_INPUT_THREAD_STOP) {
+        return FLB_FALSE;
+    }
+
+    return FLB_TRUE;
+}
+
+static void input_thread(void *data)
+{
+    int ret = 0;
+    int running = FLB_TRUE;
+    char tmp[16];
+    struct mk_list *head;
+    struct mk_event *event;
+    struct flb_sched *sched;
+    struct flb_input_collector *coll;
+    struct flb_input_thread *th = data;
+    struct flb_input_instance *ins = th->ins;
+    struct flb_config *config = th->config;
+
+    FLB_TLS_SET(flb_input_thread_ctx, th);
+
+    /* async interfaces and timers created by the plugin use this thread */
+    flb_engine_evl_set(th->evl);
+
+    snprintf(tmp, sizeof(tmp) - 1, "flb-in-%s", ins->p->name);
+    mk_utils_worker_rename(tmp);
+
+    sched = flb_sched_create(config, th->evl);
+    if (!sched) {
+        flb_plg_error(ins, "could not create thread scheduler");
+        ret = -1;
+    }
+    else {
+        th->sched = sched;
+        flb_sched_ctx_set(sched);
+
+        if (ins->p->cb_init) {
+            ret = ins->p->cb_init(ins, config, ins->data);
+        }
+    }
+
+    pthread_mutex_lock(&th->mutex);
+    th->init_ret = ret;
+    th->init_done = FLB_TRUE;
+    pthread_cond_broadcast(&th->cond);
+    pthread_mutex_unlock(&th->mutex);
+
+    if (ret != 0) {
+        running = FLB_FALSE;
+    }
+
+    while (running) {
+        mk_event_wait(th->evl);
+        mk_event_foreach(event, th->evl) {
+            if (event == &th->event_ctl) {
+                running = thread_ctl(th);
+            }
+            else if (event->type == FLB_ENGINE_EV_CORE) {
+                thread_collect(th, event);
+            }
+            else if (event->type & FLB_ENGINE_EV_SCHED) {
+                flb_sched_event_handler(config, event);
+            }
+            else if (event->type == FLB_ENGINE_EV_CUSTOM) {
+                event->handler(event);
+            }
+            else {
+                flb_plg_warn(ins, "unhandled event type => %i", event->type);
+            }
+        }
+
+        flb_sched_timer_cleanup(sched);
+    }
+
+    if (ret == 0) {
+        /* unregister the collectors before the plugin releases its fds */
+        mk_list_foreach(head, &ins->collectors) {
+            coll = mk_list_entry(head, struct flb_input_collector, _head_ins);
+            flb_input_collector_pause(coll->id, ins);
+        }
+
+        if (ins->p->cb_exit && ins->context) {
+            ins->p->cb_exit(ins->context, config);
+        }
+    }
+
+    if (sched) {
+        flb_sched_destroy(sched);
+        th->sched = NULL;
+    }
+    flb_sched_ctx_set(NULL);
+    flb_engine_evl_set(NULL);
+    FLB_TLS_SET(flb_input_thread_ctx, NULL);
+}
+
+static void input_thread_destroy(struct flb_input_thread *th)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_input_thread_msg *msg;
+
+    mk_list_foreach_safe(head, tmp, &th->msgs) {
+        msg = mk_list_entry(head, struct flb_input_thread_msg, _head);
+        mk_list_del(&msg->_head);
+        msg_destroy(msg);
+    }
+
+    if (th->ch_msgs[0] > 0) {
+        mk_event_del(th->config->evl, &th->event);
+        flb_pipe_destroy(th->ch_msgs);
+    }
+    if (th->ch_ctl[0] > 0) {
+        mk_event_del(th->evl, &th->event_ctl);
+        flb_pipe_destroy(th->ch_ctl);
+    }
+    if (th->evl) {
+        mk_event_loop_destroy(th->evl);
+    }
+    if (th->tp) {
+        flb_tp_destroy(th->tp);
+    }
+
+    if (th->latency) {
+        flb_latency_destroy(th->latency);
+    }
+
+    pthread_cond_destroy(&th->cond);
+    pthread_mutex_destroy(&th->mutex);
+    flb_free(th);
+}
+
+/* Stop the thread and wait for it, 'drain' appends the pending buffers */
+static void input_thread_stop(struct flb_input_instance *ins, int drain)
+{
+    struct flb_input_thread *th = ins->thread;
+
+    pthread_mutex_lock(&th->mutex);
+    th->stopping = FLB_TRUE;
+    pthread_cond_broadcast(&th->cond);
+    pthread_mutex_unlock(&th->mutex);
+
+    if (th->th && th->th->status == FLB_THREAD_POOL_RUNNING) {
+        flb_input_thread_signal(ins, FLB_INPUT_THREAD_STOP);
+        pthread_join(th->th->tid, NULL);
+        th->th->status = FLB_THREAD_POOL_STOPPED;
+    }
+
+    if (drain == FLB_TRUE) {
+        input_thread_drain(th);
+    }
+
+    input_thread_destroy(th);
+    ins->thread = NULL;
+}
+
+/*
+ * Create the thread of an input instance and run the plugin cb_init() on
+ * it, the caller waits for the result.
+ */
+int flb_input_thread_init(struct flb_input_instance *ins,
+                          struct flb_config *config)
+{
+    int ret;
+    struct flb_input_thread *th;
+
+    if (ins->threaded == FLB_TRUE) {
+        flb_error("[input] %s: plugin collectors run in coroutines, "
+                  "'dedicated_thread' is not supported", flb_input_name(ins));
+        return -1;
+    }
+
+    pthread_once(&tls_once, input_thread_tls_init);
+
+    th = flb_calloc(1, sizeof(struct flb_input_thread));
+    if (!th) {
+        flb_errno();
+        return -1;
+    }
+    th->ins = ins;
+    th->config = config;
+    th->queue_max = FLB_INPUT_THREAD_QUEUE_MAX;
+    if (ins->mem_buf_limit > 0) {
+        th->queue_max = ins->mem_buf_limit;
+    }
+    mk_list_init(&th->msgs);
+    pthread_mutex_init(&th->mutex, NULL);
+    pthread_cond_init(&th->cond, NULL);
+
+    th->latency = flb_latency_create();
+    if (!th->latency) {
+        input_thread_destroy(th);
+        return -1;
+    }
+
+    th->evl = mk_event_loop_create(64);
+    if (!th->evl) {
+        flb_error("[input] %s: could not create thread event loop",
+                  flb_input_name(ins));
+        input_thread_destroy(th);
+        return -1;
+    }
+
+    /* Engine requests, the thread listens in its own event loop */
+    ret = mk_event_channel_create(th->evl,
+                                  &th->ch_ctl[0], &th->ch_ctl[1],
+                                  &th->event_ctl);
+    if (ret == -1) {
+        flb_error("[input] %s: could not create thread channel",
+                  flb_input_name(ins));
+        input_thread_destroy(th);
+        return -1;
+    }
+
+    /* Queued buffers notifications, handled by the engine */
+    ret = mk_event_channel_create(config->evl,
+                                  &th->ch_msgs[0], &th->ch_msgs[1],
+                                  &th->event);
+    if (ret == -1) {
+        flb_error("[input] %s: could not create engine channel",
+                  flb_input_name(ins));
+        input_thread_destroy(th);
+        return -1;
+    }
+    th->event.type = FLB_ENGINE_EV_CUSTOM;
+    th->event.handler = cb_thread_msgs;
+
+    th->tp = flb_tp_create(config);
+    if (!th->tp) {
+        input_thread_destroy(th);
+        return -1;
+    }
+
+    th->th = flb_tp_thread_create(th->tp, input_thread, th, config);
+    if (!th->th) {
+        flb_error("[input] %s: could not register thread",
+                  flb_input_name(ins));
+        input_thread_destroy(th);
+        return -1;
+    }
+    ins->thread = th;
+
+    ret = flb_tp_thread_start(th->tp, th->th);
+    if (ret == -1) {
+        flb_error("[input] %s: could not start thread", flb_input_name(ins));
+        input_thread_destroy(th);
+        ins->thread = NULL;
+        return -1;
+    }
+
+    /* wait for the plugin initialization */
+    pthread_mutex_lock(&th->mutex);
+    while (th->init_done == FLB_FALSE) {
+        pthread_cond_wait(&th->cond, &th->mutex);
+    }
+    ret = th->init_ret;
+    pthread_mutex_unlock(&th->mutex);
+
+    if (ret != 0) {
+        input_thread_stop(ins, FLB_FALSE);
+        return ret;
+    }
+
+    flb_info("[input] %s running in a dedicated thread", flb_input_name(ins));
+    return 0;
+}
+
+/* Send a request to the input thread */
+int flb_input_thread_signal(struct flb_input_instance *ins, uint64_t msg)
+{
+    int n;
+    struct flb_input_thread *th = ins->thread;
+
+    if (!th) {
+        return -1;
+    }
+
+    n = flb_pipe_w(th->ch_ctl[1], &msg, sizeof(msg));
+    if (n == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    return 0;
+}
+
+int flb_input_thread_collectors_start(struct flb_input_instance *ins)
+{
+    return flb_input_thread_signal(ins, FLB_INPUT_THREAD_START);
+}
+
+/* Stop the thread of an instance, the buffers it queued are appended */
+void flb_input_thread_destroy(struct flb_input_instance *ins)
+{
+    if (!ins->thread) {
+        return;
+    }
+
+    input_thread_stop(ins, FLB_TRUE);
+}
+
+/* Move the collector samples of the thread to the instance histogram */
+void flb_input_thread_latency_sync(struct flb_input_instance *ins)
+{
+    struct flb_input_thread *th = ins->thread;
+
+    if (!th) {
+        return;
+    }
+
+    pthread_mutex_lock(&th->mutex);
+    flb_latency_merge(ins->cb_latency, th->latency);
+    pthread_mutex_unlock(&th->mutex);
+}
+
+void flb_input_thread_exit_all(struct flb_config *config)
+{
+    struct mk_list *head;
+    struct flb_input_instance *ins;
+
+    mk_list_foreach(head, &config->inputs) {
+        ins = mk_list_entry(head, struct flb_input_instance, _head);
+        flb_input_thread_destroy(ins);
+    }
+}
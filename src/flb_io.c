@@ -45,6 +45,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <assert.h>
 
@@ -400,6 +401,182 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, const void *data,
     return ret;
 }
 
+#ifndef FLB_SYSTEM_WINDOWS
+/*
+ * Wait until the socket is writable again. In async mode the co-routine
+ * yields to the event loop, otherwise we do the same lazy sleep used by
+ * net_io_write().
+ */
+static int net_io_writev_wait(struct flb_coro *co,
+                              struct flb_upstream_conn *u_conn, int *tries)
+{
+    int ret;
+    int error;
+    uint32_t mask;
+    char so_error_buf[256];
+    struct flb_upstream *u = u_conn->u;
+
+    if (!co || !(u->flags & FLB_IO_ASYNC)) {
+        sleep(1);
+        (*tries)++;
+        if (*tries == 30) {
+            return -1;
+        }
+        return 0;
+    }
+
+    if (u_conn->event.status == MK_EVENT_NONE) {
+        u_conn->event.mask = MK_EVENT_EMPTY;
+    }
+    ret = mk_event_add(u_conn->evl,
+                       u_conn->fd,
+                       FLB_ENGINE_EV_THREAD,
+                       MK_EVENT_WRITE, &u_conn->event);
+    if (ret == -1) {
+        return -1;
+    }
+
+    u_conn->coro = co;
+    flb_coro_yield(co, FLB_FALSE);
+    u_conn->coro = NULL;
+
+    mask = u_conn->event.mask;
+    ret = mk_event_del(u_conn->evl, &u_conn->event);
+    if (ret == -1) {
+        return -1;
+    }
+
+    if (!(mask & MK_EVENT_WRITE)) {
+        return -1;
+    }
+
+    error = flb_socket_error(u_conn->fd);
+    if (error != 0) {
+        strerror_r(error, so_error_buf, sizeof(so_error_buf) - 1);
+        flb_error("[io fd=%i] error sending data to: %s:%i (%s)",
+                  u_conn->fd, u->tcp_host, u->tcp_port, so_error_buf);
+        return -1;
+    }
+
+    MK_EVENT_NEW(&u_conn->event);
+    return 0;
+}
+
+static int net_io_writev(struct flb_coro *co,
+                         struct flb_upstream_conn *u_conn,
+                         const struct mk_iovec *iov, int iovcnt,
+                         size_t *out_len)
+{
+    int i;
+    int ret;
+    int tries = 0;
+    ssize_t bytes;
+    size_t total = 0;
+    struct mk_iovec vec[FLB_IO_IOV_MAX];
+    struct mk_iovec *cur;
+
+    if (u_conn->fd <= 0) {
+        ret = flb_io_net_connect(u_conn, co);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
+    /* writev(2) does not update the vector, keep a local copy */
+    memcpy(vec, iov, sizeof(struct mk_iovec) * iovcnt);
+    cur = vec;
+
+    while (iovcnt > 0) {
+        bytes = writev(u_conn->fd, cur, iovcnt);
+        if (bytes == -1) {
+            if (!FLB_WOULDBLOCK()) {
+                return -1;
+            }
+            ret = net_io_writev_wait(co, u_conn, &tries);
+            if (ret == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        flb_trace("[io coro=%p] [fd %i] writev(2)=%zd", co, u_conn->fd, bytes);
+        tries = 0;
+        total += bytes;
+
+        /* skip the buffers that were fully written */
+        for (i = 0; i < iovcnt && (size_t) bytes >= cur[i].iov_len; i++) {
+            bytes -= cur[i].iov_len;
+        }
+        cur += i;
+        iovcnt -= i;
+
+        if (iovcnt > 0) {
+            cur->iov_base = (char *) cur->iov_base + bytes;
+            cur->iov_len -= bytes;
+
+            /* partial write: let the event loop run before continuing */
+            if (co && (u_conn->u->flags & FLB_IO_ASYNC)) {
+                ret = net_io_writev_wait(co, u_conn, &tries);
+                if (ret == -1) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    *out_len = total;
+    return total;
+}
+#endif
+
+/*
+ * Write a list of buffers to an upstream connection. Plain TCP connections
+ * pass the whole list to writev(2), so a caller can send a small header and
+ * a large payload it does not own (e.g. the mapped content of a chunk)
+ * without composing them in a new buffer. TLS connections, and lists longer
+ * than FLB_IO_IOV_MAX, write every buffer with flb_io_net_write().
+ */
+int flb_io_net_writev(struct flb_upstream_conn *u_conn,
+                      const struct mk_iovec *iov, int iovcnt,
+                      size_t *out_len)
+{
+    int i;
+    int ret = 0;
+    size_t len;
+    size_t total = 0;
+    struct flb_coro *coro = flb_coro_get();
+
+    *out_len = 0;
+
+#ifndef FLB_SYSTEM_WINDOWS
+    if (!u_conn->tls_session && iovcnt <= FLB_IO_IOV_MAX) {
+        ret = net_io_writev(coro, u_conn, iov, iovcnt, out_len);
+        if (ret == -1 && u_conn->fd > 0) {
+            flb_socket_close(u_conn->fd);
+            u_conn->fd = -1;
+            u_conn->event.fd = -1;
+        }
+        flb_trace("[io coro=%p] [net_writev] ret=%i total=%lu",
+                  coro, ret, *out_len);
+        return ret;
+    }
+#endif
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        ret = flb_io_net_write(u_conn, iov[i].iov_base, iov[i].iov_len, &len);
+        if (ret == -1) {
+            return -1;
+        }
+        total += len;
+    }
+
+    *out_len = total;
+    return total;
+}
+
 ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
 {
     int ret = -1;
@@ -0,0 +1,234 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_latency.h>
+
+#include <time.h>
+#include <string.h>
+
+static inline int latency_msb(uint64_t val)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(val);
+#else
+    int bit = 0;
+
+    while (val >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static inline int latency_index(uint64_t usec)
+{
+    int bit;
+    int shift;
+
+    if (usec < FLB_LATENCY_LINEAR) {
+        return (int) usec;
+    }
+
+    bit = latency_msb(usec);
+    if (bit > FLB_LATENCY_MAX_BIT) {
+        return FLB_LATENCY_BUCKETS - 1;
+    }
+
+    /* 32 = 2^5, the first log bucket group starts at bit 5 */
+    shift = bit - FLB_LATENCY_SUB_BITS;
+    return FLB_LATENCY_LINEAR + ((bit - 5) * FLB_LATENCY_SUB) +
+           (int) ((usec >> shift) & (FLB_LATENCY_SUB - 1));
+}
+
+/* highest value that falls in a bucket */
+static inline uint64_t latency_bucket_value(int idx)
+{
+    int bit;
+    int sub;
+    uint64_t low;
+
+    if (idx < FLB_LATENCY_LINEAR) {
+        return idx;
+    }
+
+    idx -= FLB_LATENCY_LINEAR;
+    bit = (idx / FLB_LATENCY_SUB) + 5;
+    sub = idx % FLB_LATENCY_SUB;
+
+    low = ((uint64_t) (FLB_LATENCY_SUB + sub)) << (bit - FLB_LATENCY_SUB_BITS);
+    return low + (((uint64_t) 1) << (bit - FLB_LATENCY_SUB_BITS)) - 1;
+}
+
+struct flb_latency *flb_latency_create()
+{
+    struct flb_latency *lat;
+
+    lat = flb_calloc(1, sizeof(struct flb_latency));
+    if (!lat) {
+        flb_errno();
+        return NULL;
+    }
+
+    return lat;
+}
+
+void flb_latency_destroy(struct flb_latency *lat)
+{
+    flb_free(lat);
+}
+
+/* Monotonic time in microseconds */
+uint64_t flb_latency_now()
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#else
+    struct flb_time tm;
+
+    flb_time_get(&tm);
+    return flb_time_to_nanosec(&tm) / 1000;
+#endif
+}
+
+/*
+ * Register a sample, returns FLB_TRUE if it's over the stall threshold
+ * (zero disables the check).
+ */
+int flb_latency_add(struct flb_latency *lat, uint64_t usec,
+                    uint64_t stall_usec)
+{
+    if (!lat) {
+        return FLB_FALSE;
+    }
+
+    lat->count++;
+    lat->buckets[latency_index(usec)]++;
+
+    if (usec > lat->max) {
+        lat->max = usec;
+    }
+
+    if (stall_usec > 0 && usec >= stall_usec) {
+        lat->stalls++;
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+/* Add the samples of 'src' to 'dst' and reset 'src' */
+void flb_latency_merge(struct flb_latency *dst, struct flb_latency *src)
+{
+    int i;
+
+    if (!dst || !src || src->count == 0) {
+        return;
+    }
+
+    for (i = 0; i < FLB_LATENCY_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->stalls += src->stalls;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+
+    memset(src, '\0', sizeof(struct flb_latency));
+}
+
+/* Value under which 'q' (0.0 - 1.0) of the samples are, in microseconds */
+uint64_t flb_latency_quantile(struct flb_latency *lat, double q)
+{
+    int i;
+    uint64_t val;
+    uint64_t rank;
+    uint64_t total = 0;
+
+    if (lat->count == 0) {
+        return 0;
+    }
+
+    rank = (uint64_t) (q * lat->count);
+    if ((double) rank < q * lat->count || rank == 0) {
+        rank++;
+    }
+
+    for (i = 0; i < FLB_LATENCY_BUCKETS; i++) {
+        total += lat->buckets[i];
+        if (total >= rank) {
+            /* the last bucket also holds the out of range values */
+            if (i == FLB_LATENCY_BUCKETS - 1) {
+                return lat->max;
+            }
+            val = latency_bucket_value(i);
+            return val < lat->max ? val : lat->max;
+        }
+    }
+
+    return lat->max;
+}
+
+#ifdef FLB_HAVE_METRICS
+/* [OLD METRICS] callback latency of a plugin instance */
+int flb_latency_metrics_add(struct flb_metrics *metrics)
+{
+    flb_metrics_add(FLB_METRIC_CB_P50, "cb_p50_usec", metrics);
+    flb_metrics_add(FLB_METRIC_CB_P99, "cb_p99_usec", metrics);
+    flb_metrics_add(FLB_METRIC_CB_MAX, "cb_max_usec", metrics);
+    flb_metrics_add(FLB_METRIC_CB_STALLS, "cb_stalls", metrics);
+
+    return 0;
+}
+
+void flb_latency_metrics_set(struct flb_latency *lat,
+                             struct flb_metrics *metrics)
+{
+    struct flb_metric *m;
+
+    if (!lat || !metrics) {
+        return;
+    }
+
+    m = flb_metrics_get_id(FLB_METRIC_CB_P50, metrics);
+    if (m) {
+        m->val = flb_latency_quantile(lat, 0.5);
+    }
+    m = flb_metrics_get_id(FLB_METRIC_CB_P99, metrics);
+    if (m) {
+        m->val = flb_latency_quantile(lat, 0.99);
+    }
+    m = flb_metrics_get_id(FLB_METRIC_CB_MAX, metrics);
+    if (m) {
+        m->val = lat->max;
+    }
+    m = flb_metrics_get_id(FLB_METRIC_CB_STALLS, metrics);
+    if (m) {
+        m->val = lat->stalls;
+    }
+}
+#endif
@@ -28,6 +28,11 @@
 #include <fluent-bit/flb_version.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_metrics.h>
+#include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_thread.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_latency.h>
 #include <msgpack.h>
 
 static int id_exists(int id, struct flb_metrics *metrics)
@@ -311,6 +316,186 @@ static int attach_build_info(struct flb_config *ctx, struct cmt *cmt, uint64_t t
     return 0;
 }
 
+static int attach_task_map(struct flb_config *ctx, struct cmt *cmt,
+                           uint64_t ts, char *hostname)
+{
+    struct cmt_gauge *g;
+    struct cmt_counter *c;
+
+    /* capacity */
+    g = cmt_gauge_create(cmt, "fluentbit", "task_map", "slots",
+                         "Maximum number of concurrent tasks.",
+                         1, (char *[]) {"hostname"});
+    if (!g) {
+        return -1;
+    }
+    cmt_gauge_set(g, ts, ctx->tasks_map_size, 1, (char *[]) {hostname});
+
+    /* occupancy */
+    g = cmt_gauge_create(cmt, "fluentbit", "task_map", "slots_used",
+                         "Number of task IDs in use.",
+                         1, (char *[]) {"hostname"});
+    if (!g) {
+        return -1;
+    }
+    cmt_gauge_set(g, ts, flb_task_map_used(ctx), 1, (char *[]) {hostname});
+
+    /* high water mark */
+    g = cmt_gauge_create(cmt, "fluentbit", "task_map", "slots_peak",
+                         "Highest number of task IDs in use at the same time.",
+                         1, (char *[]) {"hostname"});
+    if (!g) {
+        return -1;
+    }
+    cmt_gauge_set(g, ts, ctx->tasks_map_peak, 1, (char *[]) {hostname});
+
+    /* exhaustion */
+    c = cmt_counter_create(cmt, "fluentbit", "task_map", "full_total",
+                           "Number of chunks whose task was delayed because "
+                           "no task ID was available.",
+                           1, (char *[]) {"hostname"});
+    if (!c) {
+        return -1;
+    }
+    cmt_counter_set(c, ts, ctx->tasks_map_full, 1, (char *[]) {hostname});
+
+    return 0;
+}
+
+static int attach_storage_backlog(struct flb_config *ctx, struct cmt *cmt,
+                                  uint64_t ts, char *hostname)
+{
+    struct cmt_gauge *g;
+
+    if (!ctx->storage_path) {
+        return 0;
+    }
+
+    g = cmt_gauge_create(cmt, "fluentbit", "storage_backlog", "load_seconds",
+                         "Seconds spent scanning and registering the chunks "
+                         "found in the storage path at startup.",
+                         1, (char *[]) {"hostname"});
+    if (!g) {
+        return -1;
+    }
+    cmt_gauge_set(g, ts, ctx->storage_bl_load_time, 1, (char *[]) {hostname});
+
+    g = cmt_gauge_create(cmt, "fluentbit", "storage_backlog",
+                         "first_chunk_seconds",
+                         "Seconds from startup until the first backlog chunk "
+                         "was queued, zero if none has been queued yet.",
+                         1, (char *[]) {"hostname"});
+    if (!g) {
+        return -1;
+    }
+    cmt_gauge_set(g, ts, ctx->storage_bl_queue_time, 1, (char *[]) {hostname});
+
+    return 0;
+}
+
+static void latency_set(struct cmt_gauge *g, struct cmt_gauge *g_max,
+                        struct cmt_counter *c, uint64_t ts, char *label,
+                        struct flb_latency *lat)
+{
+    if (!lat) {
+        return;
+    }
+
+    cmt_gauge_set(g, ts, flb_latency_quantile(lat, 0.5) / 1000000.0,
+                  2, (char *[]) {label, "0.5"});
+    cmt_gauge_set(g, ts, flb_latency_quantile(lat, 0.99) / 1000000.0,
+                  2, (char *[]) {label, "0.99"});
+    cmt_gauge_set(g_max, ts, lat->max / 1000000.0, 1, (char *[]) {label});
+    cmt_counter_set(c, ts, lat->stalls, 1, (char *[]) {label});
+}
+
+static int attach_engine_latency(struct flb_config *ctx, struct cmt *cmt,
+                                 uint64_t ts, char *hostname)
+{
+    struct cmt_gauge *g;
+    struct cmt_gauge *g_max;
+    struct cmt_counter *c;
+
+    g = cmt_gauge_create(cmt, "fluentbit", "engine", "event_latency_seconds",
+                         "Time spent handling an event loop event.",
+                         2, (char *[]) {"hostname", "quantile"});
+    g_max = cmt_gauge_create(cmt, "fluentbit", "engine",
+                             "event_latency_max_seconds",
+                             "Maximum time spent handling an event loop event.",
+                             1, (char *[]) {"hostname"});
+    c = cmt_counter_create(cmt, "fluentbit", "engine", "stalls_total",
+                           "Number of events that blocked the engine longer "
+                           "than engine.stall_threshold.",
+                           1, (char *[]) {"hostname"});
+    if (!g || !g_max || !c) {
+        return -1;
+    }
+
+    latency_set(g, g_max, c, ts, hostname, ctx->engine_latency);
+    return 0;
+}
+
+static int attach_callback_latency(struct flb_config *ctx, struct cmt *cmt,
+                                   uint64_t ts)
+{
+    struct mk_list *head;
+    struct cmt_gauge *g;
+    struct cmt_gauge *g_max;
+    struct cmt_counter *c;
+    struct flb_input_instance *i_ins;
+    struct flb_output_instance *o_ins;
+
+    /* inputs: collector callbacks */
+    g = cmt_gauge_create(cmt, "fluentbit", "input", "callback_latency_seconds",
+                         "Time spent in the collector callback.",
+                         2, (char *[]) {"name", "quantile"});
+    g_max = cmt_gauge_create(cmt, "fluentbit", "input",
+                             "callback_latency_max_seconds",
+                             "Maximum time spent in the collector callback.",
+                             1, (char *[]) {"name"});
+    c = cmt_counter_create(cmt, "fluentbit", "input", "callback_stalls_total",
+                           "Number of collector callbacks longer than "
+                           "engine.stall_threshold.",
+                           1, (char *[]) {"name"});
+    if (!g || !g_max || !c) {
+        return -1;
+    }
+
+    mk_list_foreach(head, &ctx->inputs) {
+        i_ins = mk_list_entry(head, struct flb_input_instance, _head);
+        flb_input_thread_latency_sync(i_ins);
+        latency_set(g, g_max, c, ts, (char *) flb_input_name(i_ins),
+                    i_ins->cb_latency);
+    }
+
+    /* outputs: flush callbacks running in the engine thread */
+    g = cmt_gauge_create(cmt, "fluentbit", "output", "callback_latency_seconds",
+                         "Time spent in the flush callback until it yields.",
+                         2, (char *[]) {"name", "quantile"});
+    g_max = cmt_gauge_create(cmt, "fluentbit", "output",
+                             "callback_latency_max_seconds",
+                             "Maximum time spent in the flush callback until "
+                             "it yields.",
+                             1, (char *[]) {"name"});
+    c = cmt_counter_create(cmt, "fluentbit", "output", "callback_stalls_total",
+                           "Number of flush callbacks that blocked the engine.",
+                           1, (char *[]) {"name"});
+    if (!g || !g_max || !c) {
+        return -1;
+    }
+
+    mk_list_foreach(head, &ctx->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        if (flb_output_is_threaded(o_ins) == FLB_TRUE) {
+            continue;
+        }
+        latency_set(g, g_max, c, ts, (char *) flb_output_name(o_ins),
+                    o_ins->cb_latency);
+    }
+
+    return 0;
+}
+
 /* Append internal Fluent Bit metrics to context */
 int flb_metrics_fluentbit_add(struct flb_config *ctx, struct cmt *cmt)
 {
@@ -332,6 +517,10 @@ int flb_metrics_fluentbit_add(struct flb_config *ctx, struct cmt *cmt)
     attach_uptime(ctx, cmt, ts, hostname);
     attach_process_start_time_seconds(ctx, cmt, ts, hostname);
     attach_build_info(ctx, cmt, ts, hostname);
+    attach_task_map(ctx, cmt, ts, hostname);
+    attach_storage_backlog(ctx, cmt, ts, hostname);
+    attach_engine_latency(ctx, cmt, ts, hostname);
+    attach_callback_latency(ctx, cmt, ts);
 
     return 0;
 }
@@ -29,7 +29,9 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_thread.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_filter_thread.h>
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_http_server.h>
 #include <fluent-bit/flb_metrics.h>
@@ -62,6 +64,8 @@ static int collect_inputs(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
             continue;
         }
 
+        flb_input_thread_latency_sync(i);
+        flb_latency_metrics_set(i->cb_latency, i->metrics);
         flb_metrics_dump_values(&buf, &s, i->metrics);
         msgpack_pack_str(mp_pck, i->metrics->title_len);
         msgpack_pack_str_body(mp_pck, i->metrics->title, i->metrics->title_len);
@@ -136,6 +140,7 @@ static int collect_outputs(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
             continue;
         }
 
+        flb_latency_metrics_set(i->cb_latency, i->metrics);
         flb_metrics_dump_values(&buf, &s, i->metrics);
         msgpack_pack_str(mp_pck, i->metrics->title_len);
         msgpack_pack_str_body(mp_pck, i->metrics->title, i->metrics->title_len);
@@ -238,6 +243,7 @@ struct cmt *flb_me_get_cmetrics(struct flb_config *ctx)
     struct flb_input_instance *i;     /* inputs */
     struct flb_filter_instance *f;    /* filter */
     struct flb_output_instance *o;    /* output */
+    struct flb_filter_pool *pool;     /* filter workers */
     struct cmt *cmt;
 
     cmt = cmt_create();
@@ -271,6 +277,18 @@ struct cmt *flb_me_get_cmetrics(struct flb_config *ctx)
         }
     }
 
+    /* Filter workers */
+    if (ctx->filter_pool) {
+        pool = ctx->filter_pool;
+        ret = cmt_cat(cmt, pool->cmt);
+        if (ret == -1) {
+            flb_error("[metrics exporter] could not append metrics from "
+                      "filter workers");
+            cmt_destroy(cmt);
+            return NULL;
+        }
+    }
+
     mk_list_foreach(head, &ctx->outputs) {
         o = mk_list_entry(head, struct flb_output_instance, _head);
         ret = cmt_cat(cmt, o->cmt);
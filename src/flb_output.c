@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
@@ -28,6 +30,7 @@
 #include <fluent-bit/flb_env.h>
 #include <fluent-bit/flb_coro.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_router.h>
 #include <fluent-bit/flb_kv.h>
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_uri.h>
@@ -183,6 +186,8 @@ int flb_output_task_flush(struct flb_task *task,
                           struct flb_config *config)
 {
     int ret;
+    uint64_t start;
+    uint64_t usec;
     struct flb_output_flush *out_flush;
 
     if (flb_output_is_threaded(out_ins) == FLB_TRUE) {
@@ -205,7 +210,19 @@ int flb_output_task_flush(struct flb_task *task,
         }
 
         flb_task_users_inc(task);
+
+        /* Engine profiler: the flush runs until its first yield */
+        start = flb_latency_now();
         flb_coro_resume(out_flush->coro);
+        usec = flb_latency_now() - start;
+
+        ret = flb_latency_add(out_ins->cb_latency, usec,
+                              FLB_LATENCY_STALL_USEC(config->engine_stall_threshold));
+        if (ret == FLB_TRUE) {
+            flb_warn("[output] %s flush callback blocked the engine for "
+                     "%.2f ms", flb_output_name(out_ins), usec / 1000.0);
+            config->engine_stall_reported = FLB_TRUE;
+        }
     }
 
     return 0;
@@ -256,6 +273,10 @@ int flb_output_instance_destroy(struct flb_output_instance *ins)
     }
 #endif
 
+    if (ins->cb_latency) {
+        flb_latency_destroy(ins->cb_latency);
+    }
+
     /* destroy callback context */
     if (ins->callback) {
         flb_callback_destroy(ins->callback);
@@ -282,6 +303,7 @@ int flb_output_instance_destroy(struct flb_output_instance *ins)
     flb_output_free_properties(ins);
 
     mk_list_del(&ins->_head);
+    flb_router_cache_invalidate(ins->config);
     flb_free(ins);
 
     return 0;
@@ -494,6 +516,10 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
     /* Storage */
     instance->total_limit_size = -1;
 
+    /* Flush batching */
+    instance->batch_size = 0;
+    instance->batch_records = 0;
+
     /* Parent plugin flags */
     flags = instance->flags;
     if (flags & FLB_IO_TCP) {
@@ -535,6 +561,7 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
     mk_list_init(&instance->flush_list_destroy);
 
     mk_list_add(&instance->_head, &config->outputs);
+    flb_router_cache_invalidate(config);
 
     /* Tests */
     instance->test_formatter.callback = plugin->test_formatter.callback;
@@ -560,6 +587,8 @@ int flb_output_set_property(struct flb_output_instance *ins,
 {
     int len;
     int ret;
+    long records;
+    char *end;
     ssize_t limit;
     flb_sds_t tmp;
     struct flb_kv *kv;
@@ -737,6 +766,27 @@ int flb_output_set_property(struct flb_output_instance *ins,
         flb_sds_destroy(tmp);
         ins->total_limit_size = (size_t) limit;
     }
+    else if (prop_key_check("batch.size", k, len) == 0 && tmp) {
+        limit = flb_utils_size_to_bytes(tmp);
+        flb_sds_destroy(tmp);
+        if (limit < 0) {
+            return -1;
+        }
+        ins->batch_size = (size_t) limit;
+    }
+    else if (prop_key_check("batch.records", k, len) == 0 && tmp) {
+        errno = 0;
+        records = strtol(tmp, &end, 10);
+        if (errno != 0 || end == tmp || *end != '\0' ||
+            records < 0 || records > INT_MAX) {
+            flb_error("[config] invalid batch.records '%s' for %s plugin",
+                      tmp, ins->name);
+            flb_sds_destroy(tmp);
+            return -1;
+        }
+        flb_sds_destroy(tmp);
+        ins->batch_records = (int) records;
+    }
     else if (prop_key_check("workers", k, len) == 0 && tmp) {
         /* Set the number of workers */
         ins->tp_workers = atoi(tmp);
@@ -913,9 +963,16 @@ int flb_output_init_all(struct flb_config *config)
                         "dropped_records", ins->metrics);
             flb_metrics_add(FLB_METRIC_OUT_RETRIED_RECORDS,
                         "retried_records", ins->metrics);
+            flb_latency_metrics_add(ins->metrics);
         }
 #endif
 
+        /* Engine profiler */
+        ins->cb_latency = flb_latency_create();
+        if (!ins->cb_latency) {
+            return -1;
+        }
+
 #ifdef FLB_HAVE_PROXY_GO
         /* Proxy plugins have their own initialization */
         if (p->type == FLB_OUTPUT_PLUGIN_PROXY) {
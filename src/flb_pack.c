@@ -20,6 +20,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
@@ -30,6 +32,9 @@
 #include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_unescape.h>
+#include <fluent-bit/flb_utf8.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_pthread.h>
 
 /* cmetrics */
 #include <cmetrics/cmetrics.h>
@@ -38,8 +43,48 @@
 
 #include <msgpack.h>
 #include <jsmn/jsmn.h>
+#include <xxhash.h>
 
-#define try_to_write_str  flb_utils_write_str
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JSON_SCAN_SSE2
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define JSON_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+
+/*
+ * Write only the last value of a repeated map key ('json.dedup_keys'),
+ * can be disabled when the records are known to have unique keys.
+ *
+ * The encoder is called from places without a config context, so the
+ * option is process-wide: it is read once, from the first engine started.
+ * Other contexts in the same process (library mode) keep that value.
+ */
+static int json_dedup_keys = FLB_TRUE;
+static int json_opts_set = FLB_FALSE;
+static pthread_mutex_t json_opts_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int flb_pack_init(struct flb_config *config)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&json_opts_mutex);
+    if (json_opts_set == FLB_FALSE) {
+        json_dedup_keys = config->json_dedup_keys;
+        json_opts_set = FLB_TRUE;
+    }
+    else if (json_dedup_keys != config->json_dedup_keys) {
+        flb_warn("[pack] %s is process-wide, keeping '%s'",
+                 FLB_CONF_STR_JSON_DEDUP_KEYS,
+                 json_dedup_keys ? "on" : "off");
+        ret = -1;
+    }
+    pthread_mutex_unlock(&json_opts_mutex);
+
+    return ret;
+}
 
 int flb_json_tokenise(const char *js, size_t len,
                       struct flb_pack_state *state)
@@ -50,6 +95,16 @@ int flb_json_tokenise(const char *js, size_t len,
     size_t new_size;
     void *tmp;
 
+    /* the tokens array is allocated on the first use */
+    if (!state->tokens) {
+        state->tokens = flb_calloc(new_tokens, sizeof(jsmntok_t));
+        if (!state->tokens) {
+            flb_errno();
+            return -1;
+        }
+        state->tokens_size = new_tokens;
+    }
+
     ret = jsmn_parse(&state->parser, js, len,
                      state->tokens, state->tokens_size);
     while (ret == JSMN_ERROR_NOMEM) {
@@ -85,6 +140,14 @@ int flb_json_tokenise(const char *js, size_t len,
     return 0;
 }
 
+/*
+ * jsmn based conversion
+ * ---------------------
+ * The single-pass parser (flb_pack_json.c) only accepts valid JSON. jsmn
+ * also accepts missing or repeated commas and trailing commas, so when the
+ * parser rejects a buffer it is converted again from the jsmn tokens, as
+ * previous versions did, and such messages are not lost.
+ */
 static inline int is_float(const char *buf, int len)
 {
     const char *end = buf + len;
@@ -221,6 +284,111 @@ static char *tokens_to_msgpack(struct flb_pack_state *state,
     return buf;
 }
 
+/* Complete messages only, see pack_json_to_msgpack() */
+static int pack_json_jsmn(const char *js, size_t len, char **buffer,
+                          size_t *size, int *root_type, int *records)
+{
+    int ret;
+    int out;
+    int last;
+    char *buf;
+    struct flb_pack_state state;
+
+    ret = flb_pack_state_init(&state);
+    if (ret != 0) {
+        return -1;
+    }
+
+    ret = flb_json_tokenise(js, len, &state);
+    if (ret != 0 || state.tokens_count == 0) {
+        flb_pack_state_reset(&state);
+        return -1;
+    }
+
+    buf = tokens_to_msgpack(&state, js, &out, &last, records);
+    if (!buf) {
+        flb_pack_state_reset(&state);
+        return -1;
+    }
+
+    *root_type = state.tokens[0].type;
+    *size = out;
+    *buffer = buf;
+
+    flb_pack_state_reset(&state);
+    return 0;
+}
+
+/*
+ * Concatenated messages, see flb_pack_json_state(). The whole buffer is
+ * tokenized again and the jsmn parser is reset when done, since its fields
+ * keep the scan position of flb_pack_json_scan() between calls.
+ */
+static int pack_json_state_jsmn(const char *js, size_t len,
+                                char **buffer, int *size,
+                                struct flb_pack_state *state)
+{
+    int i;
+    int ret;
+    int out;
+    int found = 0;
+    int delim = 0;
+    int last = 0;
+    int records;
+    char *buf;
+    jsmntok_t *t;
+
+    jsmn_init(&state->parser);
+    state->tokens_count = 0;
+
+    ret = flb_json_tokenise(js, len, state);
+    jsmn_init(&state->parser);
+
+    if (ret == FLB_ERR_JSON_PART) {
+        /*
+         * Count the complete messages in the array of tokens, if any, and
+         * process them.
+         */
+        for (i = 1; i < state->tokens_size; i++) {
+            t = &state->tokens[i];
+
+            if (t->start < (state->tokens[i - 1]).start) {
+                break;
+            }
+
+            if (t->parent == -1 && (t->end != 0)) {
+                found++;
+                delim = i;
+            }
+        }
+
+        if (found == 0) {
+            return ret;
+        }
+        state->tokens_count += delim;
+    }
+    else if (ret != 0) {
+        return ret;
+    }
+
+    if (state->tokens_count == 0) {
+        state->last_byte = last;
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    buf = tokens_to_msgpack(state, js, &out, &last, &records);
+    state->tokens_count = 0;
+    if (!buf) {
+        return -1;
+    }
+
+    *size = out;
+    *buffer = buf;
+    state->last_byte = last;
+
+    return 0;
+}
+
 /*
  * It parse a JSON string and convert it to MessagePack format, this packer is
  * useful when a complete JSON message exists, otherwise it will fail until
@@ -232,43 +400,28 @@ static char *tokens_to_msgpack(struct flb_pack_state *state,
 static int pack_json_to_msgpack(const char *js, size_t len, char **buffer,
                                 size_t *size, int *root_type, int *records)
 {
-    int ret = -1;
-    int n_records;
-    int out;
+    int ret;
     int last;
-    char *buf = NULL;
     struct flb_pack_state state;
 
     ret = flb_pack_state_init(&state);
     if (ret != 0) {
         return -1;
     }
-    ret = flb_json_tokenise(js, len, &state);
-    if (ret != 0) {
-        ret = -1;
-        goto flb_pack_json_end;
-    }
 
-    if (state.tokens_count == 0) {
-        ret = -1;
-        goto flb_pack_json_end;
-    }
+    ret = flb_pack_json_msgpack(&state, js, len, FLB_FALSE,
+                                buffer, size, root_type, records, &last);
+    flb_pack_state_reset(&state);
 
-    buf = tokens_to_msgpack(&state, js, &out, &last, &n_records);
-    if (!buf) {
-        ret = -1;
-        goto flb_pack_json_end;
+    if (ret == FLB_ERR_JSON_INVAL) {
+        /* not valid JSON, but maybe accepted by jsmn */
+        return pack_json_jsmn(js, len, buffer, size, root_type, records);
+    }
+    else if (ret != 0) {
+        return -1;
     }
 
-    *root_type = state.tokens[0].type;
-    *size = out;
-    *buffer = buf;
-    *records = n_records;
-    ret = 0;
-
- flb_pack_json_end:
-    flb_pack_state_reset(&state);
-    return ret;
+    return 0;
 }
 
 /* Pack unlimited serialized JSON messages into msgpack */
@@ -298,13 +451,10 @@ int flb_pack_state_init(struct flb_pack_state *s)
 
     jsmn_init(&s->parser);
 
+    /* tokens are only used by flb_json_tokenise() */
     size = sizeof(jsmntok_t) * tokens;
-    s->tokens = flb_calloc(1, size);
-    if (!s->tokens) {
-        flb_errno();
-        return -1;
-    }
-    s->tokens_size   = tokens;
+    s->tokens = NULL;
+    s->tokens_size   = 0;
     s->tokens_count  = 0;
     s->last_byte     = 0;
     s->multiple      = FLB_FALSE;
@@ -312,7 +462,6 @@ int flb_pack_state_init(struct flb_pack_state *s)
     s->buf_data = flb_malloc(size);
     if (!s->buf_data) {
         flb_errno();
-        flb_free(s->tokens);
         return -1;
     }
     s->buf_size = size;
@@ -335,72 +484,59 @@ void flb_pack_state_reset(struct flb_pack_state *s)
 /*
  * It parse a JSON string and convert it to MessagePack format. The main
  * difference of this function and the previous flb_pack_json() is that it
- * keeps a parser and tokens state, allowing to process big messages and
- * resume the parsing process instead of start from zero.
+ * keeps a parser state, allowing to process big messages and resume the
+ * parsing process instead of start from zero. The incoming buffer may have
+ * multiple JSON messages concatenated and likely the last one is only
+ * incomplete: the complete ones are converted and the end of the last one
+ * is set in 'state->last_byte'.
  */
 int flb_pack_json_state(const char *js, size_t len,
                         char **buffer, int *size,
                         struct flb_pack_state *state)
 {
     int ret;
-    int out;
-    int delim = 0;
-    int last =  0;
+    int last = 0;
     int records;
+    int root_type;
+    size_t out_size;
     char *buf;
-    jsmntok_t *t;
 
-    ret = flb_json_tokenise(js, len, state);
     state->multiple = FLB_TRUE;
-    if (ret == FLB_ERR_JSON_PART && state->multiple == FLB_TRUE) {
-        /*
-         * If the caller enabled 'multiple' flag, it means that the incoming
-         * JSON message may have multiple messages concatenated and likely
-         * the last one is only incomplete.
-         *
-         * The following routine aims to determinate how many JSON messages
-         * are OK in the array of tokens, if any, process them and adjust
-         * the JSMN context/buffers.
-         */
-        int i;
-        int found = 0;
-
-        for (i = 1; i < state->tokens_size; i++) {
-            t = &state->tokens[i];
-
-            if (t->start < (state->tokens[i - 1]).start) {
-                break;
-            }
-
-            if (t->parent == -1 && (t->end != 0)) {
-                found++;
-                delim = i;
-            }
-
-        }
 
-        if (found > 0) {
-            state->tokens_count += delim;
-        }
-        else {
-            return ret;
-        }
+    /*
+     * Only parse the buffer when it has a complete message. The content of
+     * an incomplete message is still validated each time the buffer doubles
+     * its size, so an invalid message is not kept until it is complete.
+     */
+    ret = flb_pack_json_scan(state, js, len);
+    if (ret == FLB_ERR_JSON_PART && len >= state->buf_len * 2) {
+        state->buf_len = len;
+        ret = 0;
     }
-    else if (ret != 0) {
+    if (ret != 0) {
+        if (ret == FLB_ERR_JSON_PART) {
+            flb_trace("[json pack] incomplete");
+        }
+        state->last_byte = last;
         return ret;
     }
 
-    if (state->tokens_count == 0) {
-        state->last_byte = last;
-        return FLB_ERR_JSON_INVAL;
+    ret = flb_pack_json_msgpack(state, js, len, FLB_TRUE, &buf, &out_size,
+                                &root_type, &records, &last);
+    if (ret == FLB_ERR_JSON_INVAL) {
+        /* not valid JSON, but maybe accepted by jsmn */
+        return pack_json_state_jsmn(js, len, buffer, size, state);
     }
-
-    buf = tokens_to_msgpack(state, js, &out, &last, &records);
-    if (!buf) {
-        return -1;
+    else if (ret == FLB_ERR_JSON_PART) {
+        flb_trace("[json pack] incomplete");
+        state->last_byte = 0;
+        return ret;
+    }
+    else if (ret != 0) {
+        return ret;
     }
 
-    *size = out;
+    *size = out_size;
     *buffer = buf;
     state->last_byte = last;
 
@@ -486,20 +622,401 @@ void flb_pack_print_metrics(const char *data, size_t bytes)
 
 }
 
-static inline int try_to_write(char *buf, int *off, size_t left,
-                               const char *str, size_t str_len)
+/*
+ * JSON output buffer: the encoder appends to it in a single pass. A buffer
+ * created from an sds or a heap allocation doubles its size when it runs
+ * out of space, a caller provided buffer (flb_msgpack_to_json()) cannot
+ * grow and the encoding fails instead.
+ */
+#define JSON_BUF_FIXED  0
+#define JSON_BUF_HEAP   1
+#define JSON_BUF_SDS    2
+
+struct json_buf {
+    int type;
+    char *buf;
+    size_t len;                  /* bytes written                  */
+    size_t size;                 /* usable bytes, NUL excluded     */
+};
+
+/*
+ * Characters that must be escaped in a JSON string: the value is the
+ * character that follows the backslash, 'u' means \u00XX and zero means
+ * the byte is copied as is. Bytes over 0x7f are handled apart.
+ */
+static const char json_escape[128] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',     /* 0x00 */
+    'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',     /* 0x08 */
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',     /* 0x10 */
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',     /* 0x18 */
+    0, 0, '"', 0, 0, 0, 0, 0,                   /* 0x20 */
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,                     /* 0x30 */
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,                     /* 0x40 */
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,                     /* 0x50 */
+    0, 0, 0, 0, '\\', 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,                     /* 0x60 */
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,                     /* 0x70 */
+    0, 0, 0, 0, 0, 0, 0, 'u'
+};
+
+static const char json_hex[] = "0123456789abcdef";
+
+/*
+ * String scanning: return the position of the first byte from 'i' that
+ * cannot be copied as is, that is a character to escape or a byte over
+ * 0x7e. Log records are mostly long ASCII strings, the x86_64 (SSE2 and
+ * AVX2 when the CPU supports it) and ARMv8 versions check 16 or 32 bytes
+ * at once.
+ */
+static inline size_t json_scan_sw(const char *str, size_t len, size_t i)
 {
-    if (str_len <= 0){
-        str_len = strlen(str);
+    unsigned char c;
+
+    while (i < len) {
+        c = (unsigned char) str[i];
+        if (c >= 0x80 || json_escape[c] != 0) {
+            break;
+        }
+        i++;
     }
-    if (left <= *off+str_len) {
+
+    return i;
+}
+
+#if defined(JSON_SCAN_SSE2)
+
+static inline size_t json_scan_sse2(const char *str, size_t len, size_t i)
+{
+    int mask;
+    __m128i v;
+    __m128i m;
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i del = _mm_set1_epi8(0x7f);
+
+    while (len - i >= 16) {
+        v = _mm_loadu_si128((const __m128i *) (str + i));
+
+        /* signed compare: bytes over 0x7f are negative */
+        m = _mm_or_si128(_mm_cmplt_epi8(v, space),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                      _mm_or_si128(_mm_cmpeq_epi8(v, bslash),
+                                                   _mm_cmpeq_epi8(v, del))));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    return json_scan_sw(str, len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t json_scan_avx2(const char *str, size_t len, size_t i)
+{
+    unsigned int mask;
+    __m256i v;
+    __m256i m;
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+
+    while (len - i >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) (str + i));
+        m = _mm256_or_si256(_mm256_cmpgt_epi8(space, v),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                            _mm256_or_si256(
+                                                _mm256_cmpeq_epi8(v, bslash),
+                                                _mm256_cmpeq_epi8(v, del))));
+        mask = (unsigned int) _mm256_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 32;
+    }
+
+    return json_scan_sse2(str, len, i);
+}
+
+static int json_scan_avx2_available(void)
+{
+    static int available = -1;
+
+    /* a concurrent first call stores the same value */
+    if (available == -1) {
+        available = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+
+    return available;
+}
+
+static inline size_t json_scan(const char *str, size_t len, size_t i)
+{
+    if (len - i >= 64 && json_scan_avx2_available()) {
+        return json_scan_avx2(str, len, i);
+    }
+    return json_scan_sse2(str, len, i);
+}
+
+#elif defined(JSON_SCAN_NEON)
+
+static inline size_t json_scan(const char *str, size_t len, size_t i)
+{
+    uint8x16_t v;
+    uint8x16_t m;
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+    const uint8x16_t del = vdupq_n_u8(0x7f);
+
+    while (len - i >= 16) {
+        v = vld1q_u8((const uint8_t *) (str + i));
+        m = vorrq_u8(vorrq_u8(vcltq_u8(v, space), vcgeq_u8(v, del)),
+                     vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, bslash)));
+        if (vmaxvq_u8(m) != 0) {
+            break;
+        }
+        i += 16;
+    }
+
+    return json_scan_sw(str, len, i);
+}
+
+#else
+
+static inline size_t json_scan(const char *str, size_t len, size_t i)
+{
+    return json_scan_sw(str, len, i);
+}
+
+#endif
+
+/*
+ * Length of the UTF-8 sequence at 's' if flb_utils_write_str() would copy
+ * it as is (leading byte and continuation bytes well formed), zero
+ * otherwise. It only does so where char is signed, elsewhere the bytes
+ * are always left to flb_utils_write_str().
+ */
+static inline size_t json_utf8_seq(const char *s, size_t avail)
+{
+    size_t i;
+    size_t n;
+
+    if (CHAR_MIN == 0) {
+        return 0;
+    }
+
+    n = flb_utf8_len(s);
+    if (n > avail || ((unsigned char) s[0] & 0xC0) != 0xC0) {
+        return 0;
+    }
+
+    for (i = 1; i < n; i++) {
+        if (((unsigned char) s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+
+    return n;
+}
+
+static int json_buf_grow(struct json_buf *jb, size_t bytes)
+{
+    size_t size;
+    char *tmp;
+
+    if (jb->type == JSON_BUF_FIXED) {
+        return FLB_FALSE;
+    }
+
+    size = jb->size * 2;
+    if (size < jb->len + bytes) {
+        size = jb->len + bytes;
+    }
+
+    if (jb->type == JSON_BUF_SDS) {
+        tmp = flb_sds_increase(jb->buf, size - jb->size);
+    }
+    else {
+        tmp = flb_realloc(jb->buf, size + 1);
+    }
+    if (!tmp) {
+        flb_errno();
+        return FLB_FALSE;
+    }
+
+    jb->buf = tmp;
+    jb->size = size;
+    return FLB_TRUE;
+}
+
+static inline int json_buf_reserve(struct json_buf *jb, size_t bytes)
+{
+    if (jb->size - jb->len >= bytes) {
+        return FLB_TRUE;
+    }
+    return json_buf_grow(jb, bytes);
+}
+
+static inline int json_buf_write(struct json_buf *jb,
+                                 const char *str, size_t len)
+{
+    if (!json_buf_reserve(jb, len)) {
+        return FLB_FALSE;
+    }
+    memcpy(jb->buf + jb->len, str, len);
+    jb->len += len;
+    return FLB_TRUE;
+}
+
+static inline int json_buf_char(struct json_buf *jb, char c)
+{
+    if (!json_buf_reserve(jb, 1)) {
         return FLB_FALSE;
     }
-    memcpy(buf+*off, str, str_len);
-    *off += str_len;
+    jb->buf[jb->len++] = c;
     return FLB_TRUE;
 }
 
+static int json_buf_u64(struct json_buf *jb, uint64_t val, int negative)
+{
+    char tmp[24];
+    char *p;
+
+    p = tmp + sizeof(tmp);
+    do {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while (val > 0);
+
+    if (negative) {
+        *--p = '-';
+    }
+
+    return json_buf_write(jb, p, (tmp + sizeof(tmp)) - p);
+}
+
+static int json_buf_double(struct json_buf *jb, double val)
+{
+    int ret;
+    int len;
+    int64_t i64;
+    char tmp[512];
+
+    /* integral values in the int64 range are printed as 'N.0' */
+    if (val > -9.2e18 && val < 9.2e18 && val == (double) (int64_t) val) {
+        i64 = (int64_t) val;
+        if (i64 < 0) {
+            ret = json_buf_u64(jb, (uint64_t) -i64, FLB_TRUE);
+        }
+        else {
+            ret = json_buf_u64(jb, (uint64_t) i64, signbit(val));
+        }
+        return ret && json_buf_write(jb, ".0", 2);
+    }
+
+    if (val == (double) (long long int) val) {
+        len = snprintf(tmp, sizeof(tmp) - 1, "%.1f", val);
+    }
+    else {
+        len = snprintf(tmp, sizeof(tmp) - 1, "%.16g", val);
+    }
+    return json_buf_write(jb, tmp, len);
+}
+
+/*
+ * Write the escaped content of a string. Plain ASCII and valid UTF-8 are
+ * copied in runs, invalid or truncated UTF-8 is passed to
+ * flb_utils_write_str() so those bytes are replaced in the same way.
+ */
+static int json_buf_str(struct json_buf *jb, const char *str, size_t len)
+{
+    int off;
+    char esc;
+    size_t i = 0;
+    size_t n;
+    size_t start;
+    size_t last;
+    size_t end;
+    unsigned char c;
+    char *p;
+
+    while (i < len) {
+        start = i;
+        while (1) {
+            i = json_scan(str, len, i);
+            if (i == len || (unsigned char) str[i] < 0x80) {
+                break;
+            }
+            n = json_utf8_seq(str + i, len - i);
+            if (n == 0) {
+                break;
+            }
+            i += n;
+        }
+        if (i > start && !json_buf_write(jb, str + start, i - start)) {
+            return FLB_FALSE;
+        }
+        if (i == len) {
+            break;
+        }
+
+        c = (unsigned char) str[i];
+        if (c < 0x80) {
+            if (!json_buf_reserve(jb, 6)) {
+                return FLB_FALSE;
+            }
+            p = jb->buf + jb->len;
+            esc = json_escape[c];
+            *p++ = '\\';
+            *p++ = esc;
+            if (esc == 'u') {
+                *p++ = '0';
+                *p++ = '0';
+                *p++ = json_hex[c >> 4];
+                *p++ = json_hex[c & 0xf];
+            }
+            jb->len = p - jb->buf;
+            i++;
+            continue;
+        }
+
+        /*
+         * A UTF-8 sequence takes up to 6 bytes: extend the segment until
+         * 6 bytes have been seen after the last non-ASCII one, so every
+         * sequence (and the truncation check) is evaluated as if the
+         * whole string was given.
+         */
+        last = i;
+        end = i;
+        while (end < len && end < last + 6) {
+            if ((unsigned char) str[end] >= 0x80) {
+                last = end;
+            }
+            end++;
+        }
+
+        if (!json_buf_reserve(jb, (end - i) * 6 + 1)) {
+            return FLB_FALSE;
+        }
+        off = jb->len;
+        if (flb_utils_write_str(jb->buf, &off, jb->size,
+                                str + i, end - i) == FLB_FALSE) {
+            return FLB_FALSE;
+        }
+        jb->len = off;
+        i = end;
+    }
+
+    return FLB_TRUE;
+}
 
 /*
  * Check if a key exists in the map using the 'offset' as an index to define
@@ -532,164 +1049,201 @@ static inline int key_exists_in_map(msgpack_object key, msgpack_object map, int
     return FLB_FALSE;
 }
 
-static int msgpack2json(char *buf, int *off, size_t left,
-                        const msgpack_object *o)
+/*
+ * Repeated keys of large maps: walk the keys from the last one and
+ * remember them in an open addressing table of entry indexes, an entry
+ * whose key was already seen is flagged in 'skip'. Small maps use
+ * key_exists_in_map(), that is faster for a few keys and does not need
+ * an allocation.
+ */
+#define JSON_DEDUP_MIN_KEYS  32      /* smaller maps are scanned */
+
+static int json_dedup_slots(int n)
+{
+    int slots = 64;
+
+    while (slots < n * 2) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+static void json_dedup_map(const msgpack_object *o, uint32_t *table,
+                           int slots, char *skip)
 {
     int i;
-    int dup;
-    int ret = FLB_FALSE;
-    int loop;
-    int packed;
+    int j;
+    uint32_t s;
+    uint32_t mask = slots - 1;
+    msgpack_object *k;
+    msgpack_object *p;
+
+    memset(table, '\0', sizeof(uint32_t) * slots);
+
+    for (i = o->via.map.size - 1; i >= 0; i--) {
+        skip[i] = FLB_FALSE;
+        k = &o->via.map.ptr[i].key;
+        if (k->type != MSGPACK_OBJECT_STR) {
+            continue;
+        }
+
+        s = (uint32_t) XXH3_64bits(k->via.str.ptr, k->via.str.size) & mask;
+        while (table[s] != 0) {
+            j = table[s] - 1;
+            p = &o->via.map.ptr[j].key;
+            if (p->via.str.size == k->via.str.size &&
+                memcmp(p->via.str.ptr, k->via.str.ptr, k->via.str.size) == 0) {
+                skip[i] = FLB_TRUE;
+                break;
+            }
+            s = (s + 1) & mask;
+        }
+
+        if (table[s] == 0) {
+            table[s] = i + 1;
+        }
+    }
+}
+
+static int msgpack2json(struct json_buf *jb, const msgpack_object *o);
+
+/*
+ * Write the entries of a map, 'packed' is the number of entries already
+ * written in the current object. When a key is repeated only the last
+ * entry is written.
+ */
+static int msgpack2json_map_entries(struct json_buf *jb,
+                                    const msgpack_object *o, int packed)
+{
+    int i;
+    int ret = FLB_TRUE;
+    int slots;
+    int dedup;
+    char *skip = NULL;
+    uint32_t *table = NULL;
+    msgpack_object_kv *p;
+
+    dedup = json_dedup_keys;
+    if (dedup && o->via.map.size >= JSON_DEDUP_MIN_KEYS) {
+        slots = json_dedup_slots(o->via.map.size);
+
+        /* on failure the remaining keys are scanned */
+        table = flb_malloc(sizeof(uint32_t) * slots + o->via.map.size);
+        if (table) {
+            skip = (char *) (table + slots);
+            json_dedup_map(o, table, slots, skip);
+        }
+    }
+
+    for (i = 0; i < o->via.map.size; i++) {
+        p = o->via.map.ptr + i;
+        if (skip) {
+            if (skip[i]) {
+                continue;
+            }
+        }
+        else if (dedup && key_exists_in_map(p->key, *o, i + 1) == FLB_TRUE) {
+            continue;
+        }
+
+        if (packed > 0 && !json_buf_char(jb, ',')) {
+            ret = FLB_FALSE;
+            break;
+        }
+
+        if (!msgpack2json(jb, &p->key) ||
+            !json_buf_char(jb, ':') ||
+            !msgpack2json(jb, &p->val)) {
+            ret = FLB_FALSE;
+            break;
+        }
+        packed++;
+    }
+
+    if (table) {
+        flb_free(table);
+    }
+
+    return ret;
+}
+
+static int msgpack2json(struct json_buf *jb, const msgpack_object *o)
+{
+    int i;
+    int len;
+    char temp[32];
 
     switch(o->type) {
     case MSGPACK_OBJECT_NIL:
-        ret = try_to_write(buf, off, left, "null", 4);
-        break;
+        return json_buf_write(jb, "null", 4);
 
     case MSGPACK_OBJECT_BOOLEAN:
-        ret = try_to_write(buf, off, left,
-                           (o->via.boolean ? "true":"false"),0);
-
-        break;
+        if (o->via.boolean) {
+            return json_buf_write(jb, "true", 4);
+        }
+        return json_buf_write(jb, "false", 5);
 
     case MSGPACK_OBJECT_POSITIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%"PRIu64, o->via.u64);
-            ret = try_to_write(buf, off, left, temp, i);
-        }
-        break;
+        return json_buf_u64(jb, o->via.u64, FLB_FALSE);
 
     case MSGPACK_OBJECT_NEGATIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%"PRId64, o->via.i64);
-            ret = try_to_write(buf, off, left, temp, i);
+        if (o->via.i64 < 0) {
+            return json_buf_u64(jb, -((uint64_t) o->via.i64), FLB_TRUE);
         }
-        break;
+        return json_buf_u64(jb, o->via.i64, FLB_FALSE);
+
     case MSGPACK_OBJECT_FLOAT32:
     case MSGPACK_OBJECT_FLOAT64:
-        {
-            char temp[512] = {0};
-            if (o->via.f64 == (double)(long long int)o->via.f64) {
-                i = snprintf(temp, sizeof(temp)-1, "%.1f", o->via.f64);
-            }
-            else {
-                i = snprintf(temp, sizeof(temp)-1, "%.16g", o->via.f64);
-            }
-            ret = try_to_write(buf, off, left, temp, i);
-        }
-        break;
+        return json_buf_double(jb, o->via.f64);
 
     case MSGPACK_OBJECT_STR:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.str.size > 0 ?
-             try_to_write_str(buf, off, left, o->via.str.ptr, o->via.str.size)
-             : 1/* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
-        }
-        break;
+        return json_buf_char(jb, '"') &&
+               json_buf_str(jb, o->via.str.ptr, o->via.str.size) &&
+               json_buf_char(jb, '"');
 
     case MSGPACK_OBJECT_BIN:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.bin.size > 0 ?
-             try_to_write_str(buf, off, left, o->via.bin.ptr, o->via.bin.size)
-              : 1 /* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
-        }
-        break;
+        return json_buf_char(jb, '"') &&
+               json_buf_str(jb, o->via.bin.ptr, o->via.bin.size) &&
+               json_buf_char(jb, '"');
 
     case MSGPACK_OBJECT_EXT:
-        if (!try_to_write(buf, off, left, "\"", 1)) {
-            goto msg2json_end;
+        if (!json_buf_char(jb, '"')) {
+            return FLB_FALSE;
         }
         /* ext body. fortmat is similar to printf(1) */
-        {
-            char temp[32] = {0};
-            int  len;
-            loop = o->via.ext.size;
-            for(i=0; i<loop; i++) {
-                len = snprintf(temp, sizeof(temp)-1, "\\x%02x", (char)o->via.ext.ptr[i]);
-                if (!try_to_write(buf, off, left, temp, len)) {
-                    goto msg2json_end;
-                }
+        for (i = 0; i < o->via.ext.size; i++) {
+            len = snprintf(temp, sizeof(temp) - 1, "\\x%02x",
+                           (char) o->via.ext.ptr[i]);
+            if (!json_buf_write(jb, temp, len)) {
+                return FLB_FALSE;
             }
         }
-        if (!try_to_write(buf, off, left, "\"", 1)) {
-            goto msg2json_end;
-        }
-        ret = FLB_TRUE;
-        break;
+        return json_buf_char(jb, '"');
 
     case MSGPACK_OBJECT_ARRAY:
-        loop = o->via.array.size;
-
-        if (!try_to_write(buf, off, left, "[", 1)) {
-            goto msg2json_end;
+        if (!json_buf_char(jb, '[')) {
+            return FLB_FALSE;
         }
-        if (loop != 0) {
-            msgpack_object* p = o->via.array.ptr;
-            if (!msgpack2json(buf, off, left, p)) {
-                goto msg2json_end;
+        for (i = 0; i < o->via.array.size; i++) {
+            if (i > 0 && !json_buf_char(jb, ',')) {
+                return FLB_FALSE;
             }
-            for (i=1; i<loop; i++) {
-                if (!try_to_write(buf, off, left, ",", 1) ||
-                    !msgpack2json(buf, off, left, p+i)) {
-                    goto msg2json_end;
-                }
+            if (!msgpack2json(jb, o->via.array.ptr + i)) {
+                return FLB_FALSE;
             }
         }
-
-        ret = try_to_write(buf, off, left, "]", 1);
-        break;
+        return json_buf_char(jb, ']');
 
     case MSGPACK_OBJECT_MAP:
-        loop = o->via.map.size;
-        if (!try_to_write(buf, off, left, "{", 1)) {
-            goto msg2json_end;
-        }
-        if (loop != 0) {
-            msgpack_object k;
-            msgpack_object_kv *p = o->via.map.ptr;
-
-            packed = 0;
-            dup = FLB_FALSE;
-
-            k = o->via.map.ptr[0].key;
-            for (i = 0; i < loop; i++) {
-                k = o->via.map.ptr[i].key;
-                dup = key_exists_in_map(k, *o, i + 1);
-                if (dup == FLB_TRUE) {
-                    continue;
-                }
-
-                if (packed > 0) {
-                    if (!try_to_write(buf, off, left, ",", 1)) {
-                        goto msg2json_end;
-                    }
-                }
-
-                if (
-                    !msgpack2json(buf, off, left, &(p+i)->key) ||
-                    !try_to_write(buf, off, left, ":", 1)  ||
-                    !msgpack2json(buf, off, left, &(p+i)->val) ) {
-                    goto msg2json_end;
-                }
-                packed++;
-            }
-        }
-
-        ret = try_to_write(buf, off, left, "}", 1);
-        break;
+        return json_buf_char(jb, '{') &&
+               msgpack2json_map_entries(jb, o, 0) &&
+               json_buf_char(jb, '}');
 
     default:
         flb_warn("[%s] unknown msgpack type %i", __FUNCTION__, o->type);
     }
 
- msg2json_end:
-    return ret;
+    return FLB_FALSE;
 }
 
 /**
@@ -704,31 +1258,35 @@ static int msgpack2json(char *buf, int *off, size_t left,
 int flb_msgpack_to_json(char *json_str, size_t json_size,
                         const msgpack_object *obj)
 {
-    int ret = -1;
-    int off = 0;
+    int ret;
+    struct json_buf jb;
 
-    if (json_str == NULL || obj == NULL) {
+    if (json_str == NULL || obj == NULL || json_size == 0) {
         return -1;
     }
 
-    ret = msgpack2json(json_str, &off, json_size - 1, obj);
-    json_str[off] = '\0';
-    return ret ? off: ret;
+    jb.type = JSON_BUF_FIXED;
+    jb.buf = json_str;
+    jb.len = 0;
+    jb.size = json_size - 1;
+
+    ret = msgpack2json(&jb, obj);
+    json_str[jb.len] = '\0';
+    return ret ? jb.len : ret;
 }
 
 flb_sds_t flb_msgpack_raw_to_json_sds(const void *in_buf, size_t in_size)
 {
     int ret;
     size_t off = 0;
-    size_t out_size;
     msgpack_unpacked result;
-    msgpack_object *root;
-    flb_sds_t out_buf;
-    flb_sds_t tmp_buf;
+    struct json_buf jb;
 
-    out_size = in_size * 3 / 2;
-    out_buf = flb_sds_create_size(out_size);
-    if (!out_buf) {
+    jb.type = JSON_BUF_SDS;
+    jb.len = 0;
+    jb.size = in_size * 3 / 2;
+    jb.buf = flb_sds_create_size(jb.size);
+    if (!jb.buf) {
         flb_errno();
         return NULL;
     }
@@ -736,36 +1294,22 @@ flb_sds_t flb_msgpack_raw_to_json_sds(const void *in_buf, size_t in_size)
     msgpack_unpacked_init(&result);
     ret = msgpack_unpack_next(&result, in_buf, in_size, &off);
     if (ret != MSGPACK_UNPACK_SUCCESS) {
-        flb_sds_destroy(out_buf);
+        flb_sds_destroy(jb.buf);
         msgpack_unpacked_destroy(&result);
         return NULL;
     }
 
-    root = &result.data;
-    while (1) {
-        ret = flb_msgpack_to_json(out_buf, out_size, root);
-        if (ret <= 0) {
-            tmp_buf = flb_sds_increase(out_buf, 256);
-            if (tmp_buf) {
-                out_buf = tmp_buf;
-                out_size += 256;
-            }
-            else {
-                flb_errno();
-                flb_sds_destroy(out_buf);
-                msgpack_unpacked_destroy(&result);
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
+    ret = msgpack2json(&jb, &result.data);
+    msgpack_unpacked_destroy(&result);
+    if (!ret) {
+        flb_sds_destroy(jb.buf);
+        return NULL;
     }
 
-    msgpack_unpacked_destroy(&result);
-    flb_sds_len_set(out_buf, ret);
+    jb.buf[jb.len] = '\0';
+    flb_sds_len_set(jb.buf, jb.len);
 
-    return out_buf;
+    return jb.buf;
 }
 
 /*
@@ -812,64 +1356,69 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
                                           int json_format, int date_format,
                                           flb_sds_t date_key)
 {
-    int i;
+    int ret;
     int len;
-    int ok = MSGPACK_UNPACK_SUCCESS;
+    int packed;
     int records = 0;
-    int map_size;
     size_t off = 0;
     char time_formatted[32];
     size_t s;
-    flb_sds_t out_tmp;
-    flb_sds_t out_js;
-    flb_sds_t out_buf = NULL;
     msgpack_unpacked result;
     msgpack_object root;
     msgpack_object map;
-    msgpack_sbuffer tmp_sbuf;
-    msgpack_packer tmp_pck;
+    msgpack_object key;
+    msgpack_object val;
     msgpack_object *obj;
-    msgpack_object *k;
-    msgpack_object *v;
+    struct json_buf jb;
     struct tm tm;
     struct flb_time tms;
 
-    /* Iterate the original buffer and perform adjustments */
-    records = flb_mp_count(data, bytes);
-    if (records <= 0) {
+    if (flb_mp_count(data, bytes) <= 0) {
         return NULL;
     }
 
-    /* For json lines and streams mode we need a pre-allocated buffer */
-    if (json_format == FLB_PACK_JSON_FORMAT_LINES ||
-        json_format == FLB_PACK_JSON_FORMAT_STREAM) {
-        out_buf = flb_sds_create_size(bytes + bytes / 4);
-        if (!out_buf) {
-            flb_errno();
-            return NULL;
-        }
+    jb.type = JSON_BUF_SDS;
+    jb.len = 0;
+    jb.size = bytes * 3 / 2;
+    jb.buf = flb_sds_create_size(jb.size);
+    if (!jb.buf) {
+        flb_errno();
+        return NULL;
     }
 
-    /* Create temporary msgpack buffer */
-    msgpack_sbuffer_init(&tmp_sbuf);
-    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
+    if (date_key != NULL) {
+        key.type = MSGPACK_OBJECT_STR;
+        key.via.str.ptr = date_key;
+        key.via.str.size = flb_sds_len(date_key);
+    }
 
     /*
-     * If the format is the original msgpack style of one big array,
-     * registrate the array, otherwise is not necessary. FYI, original format:
+     * Records are written directly to the output buffer, the format defines
+     * how they are concatenated:
+     *
+     * FLB_PACK_JSON_FORMAT_JSON: the original msgpack style of one big
+     * array:
+     *
+     *     [{'ts':abc,'k1':1},{'ts':abc,'k1':2},{N}]
+     *
+     * FLB_PACK_JSON_FORMAT_LINES: add  breakline (\n) after each record
      *
-     * [
-     *   [timestamp, map],
-     *   [timestamp, map],
-     *   [T, M]...
-     * ]
+     *     {'ts':abc,'k1':1}
+     *     {'ts':abc,'k1':2}
+     *     {N}
+     *
+     * FLB_PACK_JSON_FORMAT_STREAM: no separators, e.g:
+     *
+     *     {'ts':abc,'k1':1}{'ts':abc,'k1':2}{N}
      */
+    ret = FLB_TRUE;
     if (json_format == FLB_PACK_JSON_FORMAT_JSON) {
-        msgpack_pack_array(&tmp_pck, records);
+        ret = json_buf_char(&jb, '[');
     }
 
     msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off) == ok) {
+    while (ret && msgpack_unpack_next(&result, data, bytes, &off) ==
+           MSGPACK_UNPACK_SUCCESS) {
         /* Each array must have two entries: time and record */
         root = result.data;
         if (root.type != MSGPACK_OBJECT_ARRAY) {
@@ -887,24 +1436,23 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
         if (map.type != MSGPACK_OBJECT_MAP) {
             continue;
         }
-        map_size = map.via.map.size;
 
-        if (date_key != NULL) {
-            msgpack_pack_map(&tmp_pck, map_size + 1);
+        if (records > 0 && json_format == FLB_PACK_JSON_FORMAT_JSON) {
+            ret = json_buf_char(&jb, ',');
         }
-        else {
-            msgpack_pack_map(&tmp_pck, map_size);
-        }
-
-        if (date_key != NULL) {
-            /* Append date key */
-            msgpack_pack_str(&tmp_pck, flb_sds_len(date_key));
-            msgpack_pack_str_body(&tmp_pck, date_key, flb_sds_len(date_key));
+        ret = ret && json_buf_char(&jb, '{');
 
-            /* Append date value */
+        /*
+         * The date key goes first, unless the record has a key with the
+         * same name: as with any other repeated key the last one wins.
+         */
+        packed = 0;
+        if (ret && date_key != NULL &&
+            key_exists_in_map(key, map, 0) == FLB_FALSE) {
             switch (date_format) {
             case FLB_PACK_JSON_DATE_DOUBLE:
-                msgpack_pack_double(&tmp_pck, flb_time_to_double(&tms));
+                val.type = MSGPACK_OBJECT_FLOAT64;
+                val.via.f64 = flb_time_to_double(&tms);
                 break;
             case FLB_PACK_JSON_DATE_ISO8601:
             /* Format the time, use microsecond precision not nanoseconds */
@@ -917,117 +1465,52 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
                                ".%06" PRIu64 "Z",
                                (uint64_t) tms.tm.tv_nsec / 1000);
                 s += len;
-                msgpack_pack_str(&tmp_pck, s);
-                msgpack_pack_str_body(&tmp_pck, time_formatted, s);
+                val.type = MSGPACK_OBJECT_STR;
+                val.via.str.ptr = time_formatted;
+                val.via.str.size = s;
                 break;
             case FLB_PACK_JSON_DATE_EPOCH:
-                msgpack_pack_uint64(&tmp_pck, (long long unsigned)(tms.tm.tv_sec));
+                val.type = MSGPACK_OBJECT_POSITIVE_INTEGER;
+                val.via.u64 = (uint64_t) tms.tm.tv_sec;
                 break;
+            default:
+                val.type = MSGPACK_OBJECT_NIL;
             }
-        }
-
-        /* Append remaining keys/values */
-        for (i = 0; i < map_size; i++) {
-            k = &map.via.map.ptr[i].key;
-            v = &map.via.map.ptr[i].val;
-            msgpack_pack_object(&tmp_pck, *k);
-            msgpack_pack_object(&tmp_pck, *v);
-        }
 
-        /*
-         * If the format is the original msgpack style, just continue since
-         * we don't care about separator or JSON convertion at this point.
-         */
-        if (json_format == FLB_PACK_JSON_FORMAT_JSON) {
-            continue;
+            ret = msgpack2json(&jb, &key) &&
+                  json_buf_char(&jb, ':') &&
+                  msgpack2json(&jb, &val);
+            packed++;
         }
 
-        /*
-         * Here we handle two types of records concatenation:
-         *
-         * FLB_PACK_JSON_FORMAT_LINES: add  breakline (\n) after each record
-         *
-         *
-         *     {'ts':abc,'k1':1}
-         *     {'ts':abc,'k1':2}
-         *     {N}
-         *
-         * FLB_PACK_JSON_FORMAT_STREAM: no separators, e.g:
-         *
-         *     {'ts':abc,'k1':1}{'ts':abc,'k1':2}{N}
-         */
-        if (json_format == FLB_PACK_JSON_FORMAT_LINES ||
-            json_format == FLB_PACK_JSON_FORMAT_STREAM) {
-
-            /* Encode current record into JSON in a temporary variable */
-            out_js = flb_msgpack_raw_to_json_sds(tmp_sbuf.data, tmp_sbuf.size);
-            if (!out_js) {
-                flb_sds_destroy(out_buf);
-                msgpack_sbuffer_destroy(&tmp_sbuf);
-                msgpack_unpacked_destroy(&result);
-                return NULL;
-            }
-
-            /*
-             * One map record has been converted, now append it to the
-             * outgoing out_buf sds variable.
-             */
-            out_tmp = flb_sds_cat(out_buf, out_js, flb_sds_len(out_js));
-            if (!out_tmp) {
-                flb_sds_destroy(out_js);
-                flb_sds_destroy(out_buf);
-                msgpack_sbuffer_destroy(&tmp_sbuf);
-                msgpack_unpacked_destroy(&result);
-                return NULL;
-            }
-
-            /* Release temporary json sds buffer */
-            flb_sds_destroy(out_js);
-
-            /* If a realloc happened, check the returned address */
-            if (out_tmp != out_buf) {
-                out_buf = out_tmp;
-            }
+        /* Append remaining keys/values */
+        ret = ret &&
+              msgpack2json_map_entries(&jb, &map, packed) &&
+              json_buf_char(&jb, '}');
 
-            /* Append the breakline only for json lines mode */
-            if (json_format == FLB_PACK_JSON_FORMAT_LINES) {
-                out_tmp = flb_sds_cat(out_buf, "\n", 1);
-                if (!out_tmp) {
-                    flb_sds_destroy(out_buf);
-                    msgpack_sbuffer_destroy(&tmp_sbuf);
-                    msgpack_unpacked_destroy(&result);
-                    return NULL;
-                }
-                if (out_tmp != out_buf) {
-                    out_buf = out_tmp;
-                }
-            }
-            msgpack_sbuffer_clear(&tmp_sbuf);
+        /* Append the breakline only for json lines mode */
+        if (json_format == FLB_PACK_JSON_FORMAT_LINES) {
+            ret = ret && json_buf_char(&jb, '\n');
         }
+        records++;
     }
 
     /* Release the unpacker */
     msgpack_unpacked_destroy(&result);
 
-    /* Format to JSON */
-    if (json_format == FLB_PACK_JSON_FORMAT_JSON) {
-        out_buf = flb_msgpack_raw_to_json_sds(tmp_sbuf.data, tmp_sbuf.size);
-        msgpack_sbuffer_destroy(&tmp_sbuf);
-
-        if (!out_buf) {
-            return NULL;
-        }
-    }
-    else {
-        msgpack_sbuffer_destroy(&tmp_sbuf);
+    if (ret && json_format == FLB_PACK_JSON_FORMAT_JSON) {
+        ret = json_buf_char(&jb, ']');
     }
 
-    if (out_buf && flb_sds_len(out_buf) == 0) {
-        flb_sds_destroy(out_buf);
+    if (!ret || records == 0) {
+        flb_sds_destroy(jb.buf);
         return NULL;
     }
 
-    return out_buf;
+    jb.buf[jb.len] = '\0';
+    flb_sds_len_set(jb.buf, jb.len);
+
+    return jb.buf;
 }
 
 /**
@@ -1039,9 +1522,7 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
  */
 char *flb_msgpack_to_json_str(size_t size, const msgpack_object *obj)
 {
-    int ret;
-    char *buf = NULL;
-    char *tmp;
+    struct json_buf jb;
 
     if (obj == NULL) {
         return NULL;
@@ -1051,33 +1532,22 @@ char *flb_msgpack_to_json_str(size_t size, const msgpack_object *obj)
         size = 128;
     }
 
-    buf = flb_malloc(size);
-    if (!buf) {
+    jb.type = JSON_BUF_HEAP;
+    jb.len = 0;
+    jb.size = size;
+    jb.buf = flb_malloc(size + 1);
+    if (!jb.buf) {
         flb_errno();
         return NULL;
     }
 
-    while (1) {
-        ret = flb_msgpack_to_json(buf, size, obj);
-        if (ret <= 0) {
-            /* buffer is small. retry.*/
-            size += 128;
-            tmp = flb_realloc(buf, size);
-            if (tmp) {
-                buf = tmp;
-            }
-            else {
-                flb_free(buf);
-                flb_errno();
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
+    if (!msgpack2json(&jb, obj)) {
+        flb_free(jb.buf);
+        return NULL;
     }
+    jb.buf[jb.len] = '\0';
 
-    return buf;
+    return jb.buf;
 }
 
 int flb_pack_time_now(msgpack_packer *pck)
@@ -0,0 +1,1235 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * JSON to MessagePack
+ * ===================
+ * The JSON text is parsed in a single pass and every value is written as
+ * msgpack as soon as it is read, there is no tokens array. Maps and arrays
+ * get a one byte header when they are opened; containers with more than 15
+ * entries need a bigger header, their position is recorded and the buffer
+ * is expanded once at the end (json_pack_fixups()).
+ *
+ * Strings and the content of incomplete messages are scanned 16 bytes at a
+ * time for the structural characters when SSE2 or NEON are available.
+ *
+ * The input must be valid JSON, except that strings can contain raw control
+ * characters. A NUL byte is handled as the end of the buffer. Buffers
+ * rejected here are converted again by the callers in flb_pack.c with jsmn,
+ * which accepts missing and trailing commas.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_error.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_unescape.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JSON_PACK_SSE2
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define JSON_PACK_NEON
+#include <arm_neon.h>
+#endif
+
+/* Scan modes of an incomplete message, see flb_pack_json_scan() */
+#define JSON_SCAN_VALUE       -1   /* jsmn_init() value of 'toksuper' */
+#define JSON_SCAN_STRING       1
+#define JSON_SCAN_ESCAPE       2
+#define JSON_SCAN_PRIMITIVE    3
+
+#define JSON_PACK_LEVELS      32   /* nesting levels before allocating   */
+#define JSON_PACK_FIXUPS      16   /* big containers before allocating   */
+
+/* An open map or array */
+struct json_pack_level {
+    int type;                      /* JSMN_OBJECT or JSMN_ARRAY          */
+    size_t offset;                 /* header position in the output      */
+    size_t count;                  /* number of entries                  */
+};
+
+/* A closed container that needs a map16/32 or array16/32 header */
+struct json_pack_fixup {
+    int type;
+    size_t offset;
+    size_t count;
+};
+
+struct json_pack {
+    const char *js;
+    size_t len;
+    size_t pos;
+
+    /* msgpack output */
+    char *buf;
+    size_t buf_len;
+    size_t buf_size;
+
+    /* open containers */
+    struct json_pack_level *levels;
+    int depth;
+    int levels_size;
+
+    /* containers with a 16/32 bits header */
+    struct json_pack_fixup *fixups;
+    int fixups_count;
+    int fixups_size;
+    size_t fixups_bytes;
+
+    /* unescaped strings */
+    struct flb_pack_state *state;
+
+    struct json_pack_level levels_local[JSON_PACK_LEVELS];
+    struct json_pack_fixup fixups_local[JSON_PACK_FIXUPS];
+};
+
+/* Whitespace and the characters that end a number or a literal */
+static const unsigned char json_delim[256] = {
+    ['\t'] = 1, ['\n'] = 1, ['\r'] = 1, [' '] = 1,
+    [','] = 2, [']'] = 2, ['}'] = 2
+};
+
+/* Characters tracked by the scan of incomplete messages */
+static const unsigned char json_struct[256] = {
+    ['"'] = 1, ['\\'] = 1,
+    ['{'] = 2, ['}'] = 2, ['['] = 2, [']'] = 2
+};
+
+#define json_is_space(c)   (json_delim[(unsigned char) (c)] == 1)
+
+/* Position of the next '"' or '\' from 'i', 'len' if there is none */
+#if defined(JSON_PACK_SSE2)
+static inline size_t json_find_quote(const char *js, size_t len, size_t i)
+{
+    int mask;
+    __m128i v;
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+
+    while (i + 16 <= len) {
+        v = _mm_loadu_si128((const __m128i *) (js + i));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                              _mm_cmpeq_epi8(v, bslash)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    while (i < len && js[i] != '"' && js[i] != '\\') {
+        i++;
+    }
+    return i;
+}
+
+/* Position of the next '"', '{', '}', '[' or ']' from 'i' */
+static inline size_t json_find_struct(const char *js, size_t len, size_t i)
+{
+    int mask;
+    __m128i v;
+    __m128i m;
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i brace = _mm_set1_epi8('{');
+    const __m128i bracket = _mm_set1_epi8('[');
+    const __m128i close = _mm_set1_epi8(0x02);
+
+    while (i + 16 <= len) {
+        v = _mm_loadu_si128((const __m128i *) (js + i));
+        /* '}' and ']' are the opening character plus two */
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, brace),
+                         _mm_cmpeq_epi8(v, bracket));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_sub_epi8(v, close), brace));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_sub_epi8(v, close), bracket));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    while (i < len && (json_struct[(unsigned char) js[i]] == 0 ||
+                       js[i] == '\\')) {
+        i++;
+    }
+    return i;
+}
+#elif defined(JSON_PACK_NEON)
+static inline size_t json_find_quote(const char *js, size_t len, size_t i)
+{
+    uint8x16_t v;
+    uint8x16_t m;
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+
+    while (i + 16 <= len) {
+        v = vld1q_u8((const uint8_t *) (js + i));
+        m = vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, bslash));
+        if (vmaxvq_u8(m) != 0) {
+            break;
+        }
+        i += 16;
+    }
+
+    while (i < len && js[i] != '"' && js[i] != '\\') {
+        i++;
+    }
+    return i;
+}
+
+static inline size_t json_find_struct(const char *js, size_t len, size_t i)
+{
+    uint8x16_t v;
+    uint8x16_t m;
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t brace = vdupq_n_u8('{');
+    const uint8x16_t bracket = vdupq_n_u8('[');
+    const uint8x16_t close = vdupq_n_u8(0x02);
+
+    while (i + 16 <= len) {
+        v = vld1q_u8((const uint8_t *) (js + i));
+        m = vorrq_u8(vceqq_u8(v, brace), vceqq_u8(v, bracket));
+        m = vorrq_u8(m, vceqq_u8(vsubq_u8(v, close), brace));
+        m = vorrq_u8(m, vceqq_u8(vsubq_u8(v, close), bracket));
+        m = vorrq_u8(m, vceqq_u8(v, quote));
+        if (vmaxvq_u8(m) != 0) {
+            break;
+        }
+        i += 16;
+    }
+
+    while (i < len && (json_struct[(unsigned char) js[i]] == 0 ||
+                       js[i] == '\\')) {
+        i++;
+    }
+    return i;
+}
+#else
+static inline size_t json_find_quote(const char *js, size_t len, size_t i)
+{
+    while (i < len && js[i] != '"' && js[i] != '\\') {
+        i++;
+    }
+    return i;
+}
+
+static inline size_t json_find_struct(const char *js, size_t len, size_t i)
+{
+    while (i < len && (json_struct[(unsigned char) js[i]] == 0 ||
+                       js[i] == '\\')) {
+        i++;
+    }
+    return i;
+}
+#endif
+
+static inline size_t json_skip_space(const char *js, size_t len, size_t i)
+{
+    while (i < len && json_is_space(js[i])) {
+        i++;
+    }
+    return i;
+}
+
+/* Length of the buffer up to the first NUL byte from 'from' */
+static inline size_t json_len(const char *js, size_t len, size_t from)
+{
+    const char *nul;
+
+    if (from >= len) {
+        return len;
+    }
+
+    nul = memchr(js + from, '\0', len - from);
+    if (nul) {
+        return nul - js;
+    }
+    return len;
+}
+
+static inline int json_type(char c)
+{
+    switch (c) {
+    case '{':
+        return JSMN_OBJECT;
+    case '[':
+        return JSMN_ARRAY;
+    case '"':
+        return JSMN_STRING;
+    default:
+        return JSMN_PRIMITIVE;
+    }
+}
+
+/*
+ * Output
+ * ------
+ */
+
+static int json_pack_grow(struct json_pack *jp, size_t bytes)
+{
+    size_t size;
+    char *tmp;
+
+    size = jp->buf_size * 2;
+    if (size < jp->buf_len + bytes) {
+        size = jp->buf_len + bytes;
+    }
+
+    tmp = flb_realloc(jp->buf, size);
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    jp->buf = tmp;
+    jp->buf_size = size;
+
+    return 0;
+}
+
+static inline int json_pack_reserve(struct json_pack *jp, size_t bytes)
+{
+    if (jp->buf_len + bytes > jp->buf_size) {
+        return json_pack_grow(jp, bytes);
+    }
+    return 0;
+}
+
+static inline void json_store16(char *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void json_store32(char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline void json_store64(char *p, uint64_t v)
+{
+    json_store32(p, v >> 32);
+    json_store32(p + 4, v);
+}
+
+/* Positive integer, same encoding than msgpack_pack_int64() */
+static inline void json_pack_uint(struct json_pack *jp, uint64_t v)
+{
+    char *p = jp->buf + jp->buf_len;
+
+    if (v < 128) {
+        p[0] = v;
+        jp->buf_len += 1;
+    }
+    else if (v < 256) {
+        p[0] = 0xcc;
+        p[1] = v;
+        jp->buf_len += 2;
+    }
+    else if (v < 65536) {
+        p[0] = 0xcd;
+        json_store16(p + 1, v);
+        jp->buf_len += 3;
+    }
+    else if (v < 4294967296ULL) {
+        p[0] = 0xce;
+        json_store32(p + 1, v);
+        jp->buf_len += 5;
+    }
+    else {
+        p[0] = 0xcf;
+        json_store64(p + 1, v);
+        jp->buf_len += 9;
+    }
+}
+
+/* Negative integer */
+static inline void json_pack_int(struct json_pack *jp, int64_t v)
+{
+    char *p = jp->buf + jp->buf_len;
+
+    if (v >= -32) {
+        p[0] = v;
+        jp->buf_len += 1;
+    }
+    else if (v >= -128) {
+        p[0] = 0xd0;
+        p[1] = v;
+        jp->buf_len += 2;
+    }
+    else if (v >= -32768) {
+        p[0] = 0xd1;
+        json_store16(p + 1, (uint16_t) v);
+        jp->buf_len += 3;
+    }
+    else if (v >= -2147483648LL) {
+        p[0] = 0xd2;
+        json_store32(p + 1, (uint32_t) v);
+        jp->buf_len += 5;
+    }
+    else {
+        p[0] = 0xd3;
+        json_store64(p + 1, (uint64_t) v);
+        jp->buf_len += 9;
+    }
+}
+
+static inline void json_pack_double(struct json_pack *jp, double d)
+{
+    uint64_t v;
+    char *p = jp->buf + jp->buf_len;
+
+    memcpy(&v, &d, sizeof(v));
+    p[0] = 0xcb;
+    json_store64(p + 1, v);
+    jp->buf_len += 9;
+}
+
+static inline int json_pack_str(struct json_pack *jp,
+                                const char *str, size_t len)
+{
+    char *p;
+
+    if (json_pack_reserve(jp, len + 5) != 0) {
+        return -1;
+    }
+
+    p = jp->buf + jp->buf_len;
+    if (len < 32) {
+        *p++ = 0xa0 | len;
+    }
+    else if (len < 256) {
+        *p++ = 0xd9;
+        *p++ = len;
+    }
+    else if (len < 65536) {
+        *p++ = 0xda;
+        json_store16(p, len);
+        p += 2;
+    }
+    else {
+        *p++ = 0xdb;
+        json_store32(p, len);
+        p += 4;
+    }
+    memcpy(p, str, len);
+    jp->buf_len = (p - jp->buf) + len;
+
+    return 0;
+}
+
+/*
+ * Containers
+ * ----------
+ */
+
+static int json_pack_open(struct json_pack *jp, int type)
+{
+    int size;
+    struct json_pack_level *tmp;
+
+    if (jp->depth == jp->levels_size) {
+        size = jp->levels_size * 2;
+        if (jp->levels == jp->levels_local) {
+            tmp = flb_malloc(sizeof(struct json_pack_level) * size);
+            if (tmp) {
+                memcpy(tmp, jp->levels,
+                       sizeof(struct json_pack_level) * jp->levels_size);
+            }
+        }
+        else {
+            tmp = flb_realloc(jp->levels,
+                              sizeof(struct json_pack_level) * size);
+        }
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        jp->levels = tmp;
+        jp->levels_size = size;
+    }
+
+    if (json_pack_reserve(jp, 1) != 0) {
+        return -1;
+    }
+
+    jp->levels[jp->depth].type = type;
+    jp->levels[jp->depth].offset = jp->buf_len;
+    jp->levels[jp->depth].count = 0;
+    jp->depth++;
+
+    /* fixmap or fixarray, replaced on close if it has more entries */
+    jp->buf_len++;
+
+    return 0;
+}
+
+static int json_pack_close(struct json_pack *jp)
+{
+    int size;
+    struct json_pack_level *lv;
+    struct json_pack_fixup *tmp;
+    struct json_pack_fixup *fx;
+
+    lv = &jp->levels[jp->depth - 1];
+    jp->depth--;
+
+    if (lv->count < 16) {
+        jp->buf[lv->offset] = (lv->type == JSMN_OBJECT ? 0x80 : 0x90) |
+                              lv->count;
+        return 0;
+    }
+
+    if (lv->count > UINT32_MAX) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    if (jp->fixups_count == jp->fixups_size) {
+        size = jp->fixups_size * 2;
+        if (jp->fixups == jp->fixups_local) {
+            tmp = flb_malloc(sizeof(struct json_pack_fixup) * size);
+            if (tmp) {
+                memcpy(tmp, jp->fixups,
+                       sizeof(struct json_pack_fixup) * jp->fixups_size);
+            }
+        }
+        else {
+            tmp = flb_realloc(jp->fixups,
+                              sizeof(struct json_pack_fixup) * size);
+        }
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        jp->fixups = tmp;
+        jp->fixups_size = size;
+    }
+
+    fx = &jp->fixups[jp->fixups_count++];
+    fx->type = lv->type;
+    fx->offset = lv->offset;
+    fx->count = lv->count;
+    jp->fixups_bytes += (lv->count < 65536) ? 2 : 4;
+
+    return 0;
+}
+
+static int json_fixup_cmp(const void *a, const void *b)
+{
+    const struct json_pack_fixup *fa = a;
+    const struct json_pack_fixup *fb = b;
+
+    if (fa->offset < fb->offset) {
+        return -1;
+    }
+    return fa->offset > fb->offset;
+}
+
+/*
+ * Write the 16/32 bits headers of the big containers: the buffer is
+ * expanded once and the content is moved from the end, every byte is moved
+ * at most once.
+ */
+static int json_pack_fixups(struct json_pack *jp)
+{
+    int i;
+    int extra;
+    size_t end;
+    size_t shift;
+    char *p;
+    struct json_pack_fixup *fx;
+
+    if (jp->fixups_count == 0) {
+        return 0;
+    }
+
+    if (json_pack_reserve(jp, jp->fixups_bytes) != 0) {
+        return -1;
+    }
+
+    /* containers are closed inner first */
+    qsort(jp->fixups, jp->fixups_count, sizeof(struct json_pack_fixup),
+          json_fixup_cmp);
+
+    end = jp->buf_len;
+    shift = jp->fixups_bytes;
+
+    for (i = jp->fixups_count - 1; i >= 0; i--) {
+        fx = &jp->fixups[i];
+        memmove(jp->buf + fx->offset + 1 + shift, jp->buf + fx->offset + 1,
+                end - fx->offset - 1);
+
+        extra = (fx->count < 65536) ? 2 : 4;
+        shift -= extra;
+
+        p = jp->buf + fx->offset + shift;
+        if (extra == 2) {
+            p[0] = (fx->type == JSMN_OBJECT) ? 0xde : 0xdc;
+            json_store16(p + 1, fx->count);
+        }
+        else {
+            p[0] = (fx->type == JSMN_OBJECT) ? 0xdf : 0xdd;
+            json_store32(p + 1, fx->count);
+        }
+        end = fx->offset;
+    }
+
+    jp->buf_len += jp->fixups_bytes;
+    jp->fixups_count = 0;
+    jp->fixups_bytes = 0;
+
+    return 0;
+}
+
+/*
+ * Values
+ * ------
+ */
+
+/* String starting at the opening quote */
+static int json_pack_string(struct json_pack *jp)
+{
+    int escaped = FLB_FALSE;
+    int i;
+    int out_len;
+    size_t start;
+    size_t len;
+    size_t pos;
+    char c;
+    char *tmp;
+    const char *js = jp->js;
+    struct flb_pack_state *state = jp->state;
+
+    start = jp->pos + 1;
+    pos = start;
+
+    while (1) {
+        pos = json_find_quote(js, jp->len, pos);
+        if (pos >= jp->len) {
+            return FLB_ERR_JSON_PART;
+        }
+
+        if (js[pos] == '"') {
+            break;
+        }
+
+        /* escape sequence, same validation than jsmn */
+        escaped = FLB_TRUE;
+        if (pos + 1 >= jp->len) {
+            return FLB_ERR_JSON_PART;
+        }
+
+        c = js[pos + 1];
+        switch (c) {
+        case '"': case '/': case '\\': case 'b':
+        case 'f': case 'r': case 'n': case 't':
+            pos += 2;
+            break;
+        case 'u':
+            pos += 2;
+            for (i = 0; i < 4; i++, pos++) {
+                if (pos >= jp->len) {
+                    return FLB_ERR_JSON_PART;
+                }
+                c = js[pos];
+                if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') ||
+                      (c >= 'a' && c <= 'f'))) {
+                    return FLB_ERR_JSON_INVAL;
+                }
+            }
+            break;
+        default:
+            return FLB_ERR_JSON_INVAL;
+        }
+    }
+
+    len = pos - start;
+    jp->pos = pos + 1;
+
+    if (!escaped) {
+        return json_pack_str(jp, js + start, len);
+    }
+
+    if (state->buf_size < len + 1) {
+        tmp = flb_realloc(state->buf_data, len + 1);
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        state->buf_data = tmp;
+        state->buf_size = len + 1;
+    }
+
+    out_len = flb_unescape_string_utf8(js + start, len, state->buf_data);
+    return json_pack_str(jp, state->buf_data, out_len);
+}
+
+static int json_pack_literal(struct json_pack *jp,
+                             const char *lit, size_t lit_len, int type)
+{
+    size_t avail = jp->len - jp->pos;
+
+    if (avail < lit_len) {
+        if (memcmp(jp->js + jp->pos, lit, avail) == 0) {
+            return FLB_ERR_JSON_PART;
+        }
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    if (memcmp(jp->js + jp->pos, lit, lit_len) != 0) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    if (json_pack_reserve(jp, 1) != 0) {
+        return -1;
+    }
+    jp->buf[jp->buf_len++] = type;
+    jp->pos += lit_len;
+
+    return 0;
+}
+
+static const double json_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Numbers: integers are packed as int64 (uint64 above INT64_MAX), numbers
+ * with a fraction or an exponent and bigger integers as double. Doubles
+ * with up to 15 digits and a small exponent are exact products and do not
+ * need strtod(3).
+ */
+static int json_pack_number(struct json_pack *jp)
+{
+    int negative = FLB_FALSE;
+    int is_float = FLB_FALSE;
+    int overflow = FLB_FALSE;
+    int digits = 0;
+    int exp_neg = FLB_FALSE;
+    int exp_val = 0;
+    int exp10 = 0;
+    size_t start;
+    size_t pos;
+    uint64_t m = 0;
+    double d;
+    const char *js = jp->js;
+    size_t len = jp->len;
+
+    start = jp->pos;
+    pos = start;
+
+    if (js[pos] == '-') {
+        negative = FLB_TRUE;
+        pos++;
+        if (pos >= len) {
+            return FLB_ERR_JSON_PART;
+        }
+    }
+
+    /* integer part */
+    if (js[pos] == '0') {
+        pos++;
+    }
+    else if (js[pos] >= '1' && js[pos] <= '9') {
+        while (pos < len && js[pos] >= '0' && js[pos] <= '9') {
+            if (m > (UINT64_MAX - (js[pos] - '0')) / 10) {
+                overflow = FLB_TRUE;
+            }
+            m = m * 10 + (js[pos] - '0');
+            digits++;
+            pos++;
+        }
+    }
+    else {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    /* fraction */
+    if (pos < len && js[pos] == '.') {
+        is_float = FLB_TRUE;
+        pos++;
+        if (pos >= len) {
+            return FLB_ERR_JSON_PART;
+        }
+        if (js[pos] < '0' || js[pos] > '9') {
+            return FLB_ERR_JSON_INVAL;
+        }
+        while (pos < len && js[pos] >= '0' && js[pos] <= '9') {
+            if (m == 0 && js[pos] == '0') {
+                /* leading zeros are not significant digits */
+                exp10--;
+            }
+            else {
+                if (m > (UINT64_MAX - (js[pos] - '0')) / 10) {
+                    overflow = FLB_TRUE;
+                }
+                m = m * 10 + (js[pos] - '0');
+                digits++;
+                exp10--;
+            }
+            pos++;
+        }
+    }
+
+    /* exponent */
+    if (pos < len && (js[pos] == 'e' || js[pos] == 'E')) {
+        is_float = FLB_TRUE;
+        pos++;
+        if (pos < len && (js[pos] == '+' || js[pos] == '-')) {
+            exp_neg = (js[pos] == '-');
+            pos++;
+        }
+        if (pos >= len) {
+            return FLB_ERR_JSON_PART;
+        }
+        if (js[pos] < '0' || js[pos] > '9') {
+            return FLB_ERR_JSON_INVAL;
+        }
+        while (pos < len && js[pos] >= '0' && js[pos] <= '9') {
+            if (exp_val < 100000) {
+                exp_val = exp_val * 10 + (js[pos] - '0');
+            }
+            pos++;
+        }
+    }
+
+    /* a number is complete only when the next character is known */
+    if (pos >= len) {
+        return FLB_ERR_JSON_PART;
+    }
+    if (json_delim[(unsigned char) js[pos]] == 0) {
+        return FLB_ERR_JSON_INVAL;
+    }
+    jp->pos = pos;
+
+    if (json_pack_reserve(jp, 9) != 0) {
+        return -1;
+    }
+
+    if (!is_float && !overflow) {
+        if (!negative) {
+            json_pack_uint(jp, m);
+            return 0;
+        }
+        else if (m == 0) {
+            json_pack_uint(jp, 0);
+            return 0;
+        }
+        else if (m <= (uint64_t) INT64_MAX + 1) {
+            json_pack_int(jp, (int64_t) (0 - m));
+            return 0;
+        }
+    }
+
+    exp10 += exp_neg ? -exp_val : exp_val;
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    if (!overflow && digits <= 15 && exp10 >= -22 && exp10 <= 22) {
+        d = (double) m;
+        if (exp10 < 0) {
+            d /= json_pow10[-exp10];
+        }
+        else {
+            d *= json_pow10[exp10];
+        }
+        json_pack_double(jp, negative ? -d : d);
+        return 0;
+    }
+#endif
+
+    /* the number is followed by a delimiter, strtod() stops there */
+    d = strtod(js + start, NULL);
+    json_pack_double(jp, d);
+
+    return 0;
+}
+
+/* Parse one root value starting at jp->pos, written at the end of jp->buf */
+static int json_pack_root(struct json_pack *jp)
+{
+    int ret;
+    char c;
+    struct json_pack_level *lv;
+
+ value:
+    c = jp->js[jp->pos];
+    switch (c) {
+    case '{':
+    case '[':
+        ret = json_pack_open(jp, json_type(c));
+        if (ret != 0) {
+            return ret;
+        }
+        jp->pos = json_skip_space(jp->js, jp->len, jp->pos + 1);
+        if (jp->pos >= jp->len) {
+            return FLB_ERR_JSON_PART;
+        }
+        if (jp->js[jp->pos] == (c == '{' ? '}' : ']')) {
+            jp->pos++;
+            ret = json_pack_close(jp);
+            if (ret != 0) {
+                return ret;
+            }
+            goto next;
+        }
+        if (c == '{') {
+            goto key;
+        }
+        goto value;
+    case '"':
+        ret = json_pack_string(jp);
+        break;
+    case 't':
+        ret = json_pack_literal(jp, "true", 4, 0xc3);
+        goto primitive;
+    case 'f':
+        ret = json_pack_literal(jp, "false", 5, 0xc2);
+        goto primitive;
+    case 'n':
+        ret = json_pack_literal(jp, "null", 4, 0xc0);
+        goto primitive;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        ret = json_pack_number(jp);
+        break;
+    default:
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    if (ret != 0) {
+        return ret;
+    }
+    goto next;
+
+ primitive:
+    if (ret != 0) {
+        return ret;
+    }
+    if (jp->pos >= jp->len) {
+        return FLB_ERR_JSON_PART;
+    }
+    if (json_delim[(unsigned char) jp->js[jp->pos]] == 0) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+ next:
+    /* a value has been written, continue with the parent container */
+    if (jp->depth == 0) {
+        return 0;
+    }
+
+    lv = &jp->levels[jp->depth - 1];
+    lv->count++;
+
+    jp->pos = json_skip_space(jp->js, jp->len, jp->pos);
+    if (jp->pos >= jp->len) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    c = jp->js[jp->pos];
+    if (c == ',') {
+        jp->pos = json_skip_space(jp->js, jp->len, jp->pos + 1);
+        if (jp->pos >= jp->len) {
+            return FLB_ERR_JSON_PART;
+        }
+        if (lv->type == JSMN_OBJECT) {
+            goto key;
+        }
+        goto value;
+    }
+    else if ((c == '}' && lv->type == JSMN_OBJECT) ||
+             (c == ']' && lv->type == JSMN_ARRAY)) {
+        jp->pos++;
+        ret = json_pack_close(jp);
+        if (ret != 0) {
+            return ret;
+        }
+        goto next;
+    }
+    return FLB_ERR_JSON_INVAL;
+
+ key:
+    /* jp->pos is at the first non space character of a map key */
+    if (jp->js[jp->pos] != '"') {
+        return FLB_ERR_JSON_INVAL;
+    }
+    ret = json_pack_string(jp);
+    if (ret != 0) {
+        return ret;
+    }
+    jp->pos = json_skip_space(jp->js, jp->len, jp->pos);
+    if (jp->pos >= jp->len) {
+        return FLB_ERR_JSON_PART;
+    }
+    if (jp->js[jp->pos] != ':') {
+        return FLB_ERR_JSON_INVAL;
+    }
+    jp->pos = json_skip_space(jp->js, jp->len, jp->pos + 1);
+    if (jp->pos >= jp->len) {
+        return FLB_ERR_JSON_PART;
+    }
+    goto value;
+}
+
+static void json_pack_destroy(struct json_pack *jp)
+{
+    if (jp->levels != jp->levels_local) {
+        flb_free(jp->levels);
+    }
+    if (jp->fixups != jp->fixups_local) {
+        flb_free(jp->fixups);
+    }
+}
+
+/*
+ * Convert the JSON messages found in 'js' to msgpack. If 'partial' is set
+ * an incomplete message after the complete ones is not an error, the end of
+ * the last complete message is set in 'last_byte'. On success the buffer
+ * must be released with flb_free().
+ */
+int flb_pack_json_msgpack(struct flb_pack_state *state,
+                          const char *js, size_t len, int partial,
+                          char **out_buf, size_t *out_size,
+                          int *root_type, int *out_records, int *last_byte)
+{
+    int ret = 0;
+    int records = 0;
+    int fixups;
+    size_t fixups_bytes;
+    size_t offset;
+    size_t start;
+    size_t end = 0;
+    struct json_pack jp;
+
+    memset(&jp, '\0', offsetof(struct json_pack, levels_local));
+    jp.js = js;
+    jp.len = json_len(js, len, 0);
+    jp.levels = jp.levels_local;
+    jp.levels_size = JSON_PACK_LEVELS;
+    jp.fixups = jp.fixups_local;
+    jp.fixups_size = JSON_PACK_FIXUPS;
+    jp.state = state;
+
+    jp.buf_size = jp.len + 16;
+    jp.buf = flb_malloc(jp.buf_size);
+    if (!jp.buf) {
+        flb_errno();
+        return -1;
+    }
+
+    while (1) {
+        jp.pos = json_skip_space(js, jp.len, jp.pos);
+        if (jp.pos >= jp.len) {
+            break;
+        }
+
+        if (records == 0) {
+            *root_type = json_type(js[jp.pos]);
+        }
+
+        start = jp.pos;
+        offset = jp.buf_len;
+        fixups = jp.fixups_count;
+        fixups_bytes = jp.fixups_bytes;
+
+        ret = json_pack_root(&jp);
+        if (ret == FLB_ERR_JSON_PART && partial && records > 0 &&
+            json_type(js[start]) != JSMN_OBJECT &&
+            json_type(js[start]) != JSMN_ARRAY) {
+            /*
+             * An incomplete string or number at the root: like jsmn, wait
+             * for it before returning the messages in front of it. The
+             * scan resumes at its first byte.
+             */
+            jsmn_init(&state->parser);
+            state->parser.pos = start;
+            break;
+        }
+        else if (ret == FLB_ERR_JSON_PART && partial && records > 0) {
+            /* drop the incomplete message */
+            jp.buf_len = offset;
+            jp.fixups_count = fixups;
+            jp.fixups_bytes = fixups_bytes;
+            ret = 0;
+            break;
+        }
+        else if (ret != 0) {
+            break;
+        }
+
+        records++;
+        end = jp.pos;
+    }
+
+    if (ret == 0 && records == 0) {
+        ret = FLB_ERR_JSON_INVAL;
+    }
+
+    if (ret == 0) {
+        ret = json_pack_fixups(&jp);
+    }
+
+    if (ret != 0) {
+        if (ret == FLB_ERR_JSON_PART) {
+            flb_trace("[json pack] incomplete");
+        }
+        json_pack_destroy(&jp);
+        flb_free(jp.buf);
+        return ret;
+    }
+
+    json_pack_destroy(&jp);
+
+    *out_buf = jp.buf;
+    *out_size = jp.buf_len;
+    *out_records = records;
+    *last_byte = end;
+
+    return 0;
+}
+
+/*
+ * Check if an incomplete buffer has at least one complete message. The scan
+ * only looks for the strings and the brackets and it resumes where the
+ * previous call stopped, the position, nesting level and mode are stored in
+ * the jsmn parser of the state (so jsmn_init() resets it). It returns zero
+ * when the buffer can be parsed with flb_pack_json_msgpack().
+ */
+int flb_pack_json_scan(struct flb_pack_state *state, const char *js,
+                       size_t len)
+{
+    int ret = FLB_ERR_JSON_PART;
+    int depth;
+    int mode;
+    size_t pos;
+    unsigned char c;
+
+    pos = state->parser.pos;
+    depth = state->parser.toknext;
+    mode = state->parser.toksuper;
+
+    len = json_len(js, len, pos);
+
+    while (pos < len) {
+        if (mode == JSON_SCAN_ESCAPE) {
+            pos++;
+            mode = JSON_SCAN_STRING;
+            continue;
+        }
+        else if (mode == JSON_SCAN_STRING) {
+            pos = json_find_quote(js, len, pos);
+            if (pos >= len) {
+                break;
+            }
+            if (js[pos] == '\\') {
+                mode = JSON_SCAN_ESCAPE;
+                pos++;
+                continue;
+            }
+            pos++;
+            mode = JSON_SCAN_VALUE;
+            if (depth == 0) {
+                ret = 0;
+                break;
+            }
+            continue;
+        }
+        else if (mode == JSON_SCAN_PRIMITIVE) {
+            while (pos < len && json_delim[(unsigned char) js[pos]] == 0) {
+                pos++;
+            }
+            if (pos < len) {
+                ret = 0;
+                break;
+            }
+            continue;
+        }
+
+        if (depth > 0) {
+            pos = json_find_struct(js, len, pos);
+            if (pos >= len) {
+                break;
+            }
+        }
+        else {
+            pos = json_skip_space(js, len, pos);
+            if (pos >= len) {
+                break;
+            }
+        }
+
+        c = js[pos++];
+        if (c == '"') {
+            mode = JSON_SCAN_STRING;
+        }
+        else if (c == '{' || c == '[') {
+            depth++;
+        }
+        else if (c == '}' || c == ']') {
+            depth--;
+            if (depth <= 0) {
+                /* complete, or an error reported by the parser */
+                ret = 0;
+                break;
+            }
+        }
+        else if (depth == 0) {
+            /* a primitive, or an error reported by the parser */
+            if (c == '-' || (c >= '0' && c <= '9') ||
+                c == 't' || c == 'f' || c == 'n') {
+                mode = JSON_SCAN_PRIMITIVE;
+            }
+            else {
+                ret = 0;
+                break;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        jsmn_init(&state->parser);
+        return 0;
+    }
+
+    if (depth == 0 && mode == JSON_SCAN_VALUE) {
+        /* empty or only whitespace */
+        jsmn_init(&state->parser);
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    state->parser.pos = pos;
+    state->parser.toknext = depth;
+    state->parser.toksuper = mode;
+
+    return FLB_ERR_JSON_PART;
+}
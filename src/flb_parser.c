@@ -24,6 +24,7 @@
 #include <fluent-bit/flb_str.h>
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_parser_decoder.h>
+#include <fluent-bit/flb_parser_time.h>
 #include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_utils.h>
@@ -131,6 +132,9 @@ static void flb_interim_parser_destroy(struct flb_parser *parser)
     if (parser->time_fmt_year) {
         flb_free(parser->time_fmt_year);
     }
+    if (parser->time_fast) {
+        flb_parser_time_destroy(parser->time_fast);
+    }
     if (parser->time_key) {
         flb_free(parser->time_key);
     }
@@ -304,6 +308,13 @@ struct flb_parser *flb_parser_create(const char *name, const char *format,
             }
             p->time_offset = diff;
         }
+
+        /* Compile the format for flb_parser_time_lookup() */
+        ret = flb_parser_time_compile(p);
+        if (ret == -1) {
+            flb_interim_parser_destroy(p);
+            return NULL;
+        }
     }
 
     if (time_key) {
@@ -334,6 +345,9 @@ void flb_parser_destroy(struct flb_parser *parser)
     if (parser->time_fmt_year) {
         flb_free(parser->time_fmt_year);
     }
+    if (parser->time_fast) {
+        flb_parser_time_destroy(parser->time_fast);
+    }
     if (parser->time_key) {
         flb_free(parser->time_key);
     }
@@ -1013,6 +1027,14 @@ int flb_parser_time_lookup(const char *time_str, size_t tsize,
         return -1;
     }
 
+    /* Compiled format, it returns -1 for anything it does not handle */
+    if (parser->time_fast) {
+        ret = flb_parser_time_fast(parser, time_str, tsize, now, tm, ns);
+        if (ret == 0) {
+            goto time_offset;
+        }
+    }
+
     /*
      * Some records coming from old Syslog messages do not contain the
      * year, so it's required to ingest this information in the value
@@ -1106,6 +1128,7 @@ int flb_parser_time_lookup(const char *time_str, size_t tsize,
         }
     }
 
+ time_offset:
 #ifdef FLB_HAVE_GMTOFF
     if (parser->time_with_tz == FLB_FALSE) {
         tm->tm_gmtoff = parser->time_offset;
@@ -0,0 +1,644 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Compiled time formats
+ * =====================
+ * flb_strptime() interprets the format string on every record. The formats
+ * used by most parsers, like '%Y-%m-%dT%H:%M:%S.%L%z' or
+ * '%d/%b/%Y:%H:%M:%S %z', are built from a handful of conversions, so when
+ * the parser is created the format is compiled into a short list of
+ * operations, each one doing exactly what flb_strptime() does for that
+ * conversion. Anything the compiled scanner does not handle (other
+ * conversions, time zone names, etc) makes it return -1 and the caller falls
+ * back to the generic path, so the results and messages are the same.
+ *
+ * The fields parsed up to the seconds (%S) are cached together with the
+ * bytes they were read from: consecutive records in the same second only
+ * compare that prefix and parse what comes after it (%L, %z).
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_parser_time.h>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Same limit than the temporary buffer used by flb_parser_time_lookup() */
+#define TIME_STR_MAX      63
+
+#define TIME_OPS_MAX      32
+#define TIME_PREFIX_MAX   32
+
+enum {
+    TIME_OP_LITERAL = 0,
+    TIME_OP_SPACE,        /* white-space in the format */
+    TIME_OP_YEAR,         /* %Y */
+    TIME_OP_MON,          /* %m */
+    TIME_OP_MON_NAME,     /* %b, %h */
+    TIME_OP_MDAY,         /* %d */
+    TIME_OP_HOUR,         /* %H */
+    TIME_OP_MIN,          /* %M */
+    TIME_OP_SEC,          /* %S */
+    TIME_OP_FRAC,         /* %L */
+    TIME_OP_TZ            /* %z */
+};
+
+/* Fields set by the operations */
+#define TIME_F_YEAR    (1 << 0)
+#define TIME_F_MON     (1 << 1)
+#define TIME_F_MDAY    (1 << 2)
+#define TIME_F_HOUR    (1 << 3)
+#define TIME_F_MIN     (1 << 4)
+#define TIME_F_SEC     (1 << 5)
+#define TIME_F_YDAY    (1 << 6)   /* tm_yday and tm_wday */
+#define TIME_F_TZ      (1 << 7)   /* tm_isdst and tm_gmtoff */
+
+#define TIME_F_DATE    (TIME_F_YEAR | TIME_F_MON | TIME_F_MDAY)
+
+struct time_op {
+    unsigned char type;
+    unsigned char chr;    /* TIME_OP_LITERAL */
+};
+
+struct time_fields {
+    int set;
+    int gmtoff;
+    struct tm tm;
+};
+
+struct flb_parser_time {
+    int with_year;
+    int ops_len;
+    int ops_cached;       /* leading operations kept in the cache, or 0 */
+    int date_after;       /* date operations after ops_cached */
+    struct time_op ops[TIME_OPS_MAX];
+
+    pthread_mutex_t lock;
+
+    /* last seen second */
+    int prefix_len;
+    char prefix[TIME_PREFIX_MAX];
+    time_t prefix_day;
+    struct time_fields prefix_fields;
+
+    /* current day, formats without a year */
+    time_t now_day;
+    struct tm now_tm;
+};
+
+static const char *time_months[12] = {
+    "jan", "feb", "mar", "apr", "may", "jun",
+    "jul", "aug", "sep", "oct", "nov", "dec"
+};
+
+static const double time_frac_div[10] = {
+    1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+static const int time_mon_lengths[2][12] = {
+    { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 },
+    { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 }
+};
+
+#define time_isleap(y) (((y) % 4) == 0 && (((y) % 100) != 0 || ((y) % 400) == 0))
+
+static int time_leaps_thru_end_of(const int y)
+{
+    return (y >= 0) ? (y / 4 - y / 100 + y / 400) :
+        -(time_leaps_thru_end_of(-(y + 1)) + 1);
+}
+
+/* Day of the year and of the week, as computed by flb_strptime() */
+static void time_set_yday(struct time_fields *f)
+{
+    int i;
+    int year;
+    const int *mon_lens;
+    struct tm *tm = &f->tm;
+
+    year = tm->tm_year + 1900;
+    mon_lens = time_mon_lengths[time_isleap(year)];
+
+    tm->tm_yday = tm->tm_mday - 1;
+    for (i = 0; i < tm->tm_mon; i++) {
+        tm->tm_yday += mon_lens[i];
+    }
+
+    tm->tm_wday = 4 + ((year - 1970) % 7) * (365 % 7) +
+        time_leaps_thru_end_of(year - 1) -
+        time_leaps_thru_end_of(1970 - 1) + tm->tm_yday;
+    tm->tm_wday %= 7;
+    if (tm->tm_wday < 0) {
+        tm->tm_wday += 7;
+    }
+
+    f->set |= TIME_F_YDAY;
+}
+
+/*
+ * Number conversion with the same rules than flb_strptime(): it stops when
+ * another digit would exceed 'ulim'. Returns 1 if the byte after the number
+ * was looked at, 0 if not, or -1 on error.
+ */
+static inline int time_num(const unsigned char **buf, const unsigned char *end,
+                           int *dest, int llim, int ulim)
+{
+    int peek;
+    int result = 0;
+    int rulim = ulim;
+    const unsigned char *p = *buf;
+
+    if (p >= end || *p < '0' || *p > '9') {
+        return -1;
+    }
+
+    do {
+        result = (result * 10) + (*p++ - '0');
+        rulim /= 10;
+        peek = (result * 10 <= ulim && rulim);
+    } while (peek && p < end && *p >= '0' && *p <= '9');
+
+    if (result < llim || result > ulim) {
+        return -1;
+    }
+
+    *dest = result;
+    *buf = p;
+    return peek;
+}
+
+static inline int time_mon_name(const unsigned char **buf,
+                                const unsigned char *end, int *dest)
+{
+    int i;
+    char name[3];
+    const unsigned char *p = *buf;
+
+    if (end - p < 3) {
+        return -1;
+    }
+
+    name[0] = tolower(p[0]);
+    name[1] = tolower(p[1]);
+    name[2] = tolower(p[2]);
+
+    for (i = 0; i < 12; i++) {
+        if (memcmp(time_months[i], name, 3) == 0) {
+            break;
+        }
+    }
+    if (i == 12) {
+        return -1;
+    }
+
+    /* Let the generic path deal with full month names */
+    if (i != 4 && end - p > 3 && isalpha(p[3])) {
+        return -1;
+    }
+
+    *dest = i;
+    *buf = p + 3;
+    return 0;
+}
+
+/* %z: ISO 8601 offsets, 'Z', 'UT' and 'GMT' */
+static inline int time_tz(const unsigned char **buf, const unsigned char *end,
+                          int *offset)
+{
+    int c;
+    int offs = 0;
+    const unsigned char *p = *buf;
+
+    while (p < end && isspace(*p)) {
+        p++;
+    }
+    if (p >= end) {
+        return -1;
+    }
+
+    c = *p++;
+    if (c == 'G') {
+        if (p >= end || *p++ != 'M') {
+            return -1;
+        }
+        c = 'U';
+    }
+    if (c == 'U') {
+        if (p >= end || *p++ != 'T') {
+            return -1;
+        }
+    }
+    else if (c == '+' || c == '-') {
+        if (end - p < 2 || !isdigit(p[0]) || !isdigit(p[1])) {
+            return -1;
+        }
+        offs = ((p[0] - '0') * 10 + (p[1] - '0')) * 3600;
+        p += 2;
+        if (p < end && *p == ':') {
+            p++;
+        }
+        if (p < end && isdigit(*p)) {
+            offs += (*p++ - '0') * 600;
+            if (p >= end || !isdigit(*p)) {
+                return -1;
+            }
+            offs += (*p++ - '0') * 60;
+        }
+        if (c == '-') {
+            offs = -offs;
+        }
+    }
+    else if (c != 'Z') {
+        /* time zone names */
+        return -1;
+    }
+
+    *offset = offs;
+    *buf = p;
+    return 0;
+}
+
+/* %L, same digits than parse_subseconds() reads with strtod(3) */
+static inline int time_frac(const unsigned char **buf, const unsigned char *end,
+                            double *ns)
+{
+    int n;
+    int len;
+    uint32_t val = 0;
+    const unsigned char *p = *buf;
+
+    len = end - p;
+    if (len > 9) {
+        len = 9;
+    }
+
+    for (n = 0; n < len && p[n] >= '0' && p[n] <= '9'; n++) {
+        val = (val * 10) + (p[n] - '0');
+    }
+
+    /* an exponent would be consumed by strtod(3) */
+    if (n == 0 || (n < len && (p[n] == 'e' || p[n] == 'E'))) {
+        return -1;
+    }
+
+    *ns = (double) val / time_frac_div[n];
+    *buf = p + n;
+    return 0;
+}
+
+static void time_fields_commit(struct time_fields *f, struct tm *tm)
+{
+    if (f->set & TIME_F_YEAR) {
+        tm->tm_year = f->tm.tm_year;
+    }
+    if (f->set & TIME_F_MON) {
+        tm->tm_mon = f->tm.tm_mon;
+    }
+    if (f->set & TIME_F_MDAY) {
+        tm->tm_mday = f->tm.tm_mday;
+    }
+    if (f->set & TIME_F_HOUR) {
+        tm->tm_hour = f->tm.tm_hour;
+    }
+    if (f->set & TIME_F_MIN) {
+        tm->tm_min = f->tm.tm_min;
+    }
+    if (f->set & TIME_F_SEC) {
+        tm->tm_sec = f->tm.tm_sec;
+    }
+    if (f->set & TIME_F_YDAY) {
+        tm->tm_yday = f->tm.tm_yday;
+        tm->tm_wday = f->tm.tm_wday;
+    }
+    if (f->set & TIME_F_TZ) {
+        tm->tm_isdst = 0;
+#ifdef FLB_HAVE_GMTOFF
+        tm->tm_gmtoff = f->gmtoff;
+#endif
+    }
+}
+
+int flb_parser_time_compile(struct flb_parser *parser)
+{
+    int i;
+    int n = 0;
+    int frac = FLB_FALSE;
+    int type;
+    const char *fmt = parser->time_fmt_full;
+    struct time_op ops[TIME_OPS_MAX];
+    struct flb_parser_time *pt;
+
+    /* formats without a year are parsed as '%Y <format>' */
+    if (parser->time_with_year == FLB_FALSE) {
+        ops[n++].type = TIME_OP_SPACE;
+    }
+
+    while (*fmt) {
+        if (n == TIME_OPS_MAX) {
+            return 0;
+        }
+
+        if (isspace((unsigned char) *fmt)) {
+            type = TIME_OP_SPACE;
+        }
+        else if (*fmt != '%') {
+            ops[n].chr = *fmt;
+            type = TIME_OP_LITERAL;
+        }
+        else {
+            switch (*++fmt) {
+            case 'Y':
+                type = TIME_OP_YEAR;
+                break;
+            case 'm':
+                type = TIME_OP_MON;
+                break;
+            case 'b':
+            case 'h':
+                type = TIME_OP_MON_NAME;
+                break;
+            case 'd':
+                type = TIME_OP_MDAY;
+                break;
+            case 'H':
+                type = TIME_OP_HOUR;
+                break;
+            case 'M':
+                type = TIME_OP_MIN;
+                break;
+            case 'S':
+                type = TIME_OP_SEC;
+                break;
+            case 'L':
+                type = TIME_OP_FRAC;
+                break;
+            case 'z':
+                type = TIME_OP_TZ;
+                break;
+            default:
+                /* not supported, use flb_strptime() */
+                return 0;
+            }
+        }
+
+        /* the part after %L is parsed on its own by the generic path */
+        if (frac && type != TIME_OP_LITERAL && type != TIME_OP_SPACE &&
+            type != TIME_OP_TZ) {
+            return 0;
+        }
+        if (type == TIME_OP_FRAC) {
+            frac = FLB_TRUE;
+        }
+
+        ops[n++].type = type;
+        fmt++;
+    }
+
+    pt = flb_calloc(1, sizeof(struct flb_parser_time));
+    if (!pt) {
+        flb_errno();
+        return -1;
+    }
+    pt->with_year = parser->time_with_year;
+    pt->ops_len = n;
+    memcpy(pt->ops, ops, sizeof(struct time_op) * n);
+    pt->now_day = -1;
+    pthread_mutex_init(&pt->lock, NULL);
+
+    /* cache the operations up to the last %S, before %L or %z */
+    for (i = 0; i < n; i++) {
+        type = ops[i].type;
+        if (type == TIME_OP_FRAC || type == TIME_OP_TZ) {
+            break;
+        }
+        if (type == TIME_OP_SEC) {
+            pt->ops_cached = i + 1;
+        }
+    }
+    for (i = pt->ops_cached; i < n; i++) {
+        type = ops[i].type;
+        if (type == TIME_OP_YEAR || type == TIME_OP_MON ||
+            type == TIME_OP_MON_NAME || type == TIME_OP_MDAY) {
+            pt->date_after = FLB_TRUE;
+        }
+    }
+
+    parser->time_fast = pt;
+    return 0;
+}
+
+void flb_parser_time_destroy(struct flb_parser_time *pt)
+{
+    pthread_mutex_destroy(&pt->lock);
+    flb_free(pt);
+}
+
+/*
+ * Parse 'str' with the compiled format. Returns 0 on success or -1 if the
+ * string must be parsed by the generic path.
+ */
+int flb_parser_time_fast(struct flb_parser *parser,
+                         const char *str, size_t len, time_t now,
+                         struct tm *tm, double *ns)
+{
+    int i;
+    int val;
+    int locked;
+    int peek = 0;
+    double frac = 0;
+    time_t day = 0;
+    time_t time_now;
+    const unsigned char *p = (const unsigned char *) str;
+    const unsigned char *end = p + len;
+    struct tm tmy;
+    struct time_op *op;
+    struct time_fields f;
+    struct flb_parser_time *pt = parser->time_fast;
+
+    if (len > TIME_STR_MAX || (!pt->with_year && len + 6 > TIME_STR_MAX)) {
+        return -1;
+    }
+
+    /* Parsers are shared between threads, the cache is best effort */
+    locked = (pthread_mutex_trylock(&pt->lock) == 0);
+
+    f.set = 0;
+    i = 0;
+
+    if (!pt->with_year) {
+        if (now <= 0) {
+            time_now = time(NULL);
+        }
+        else {
+            time_now = now;
+        }
+        day = time_now / 86400;
+
+        if (locked && pt->now_day == day) {
+            tmy = pt->now_tm;
+        }
+        else {
+            gmtime_r(&time_now, &tmy);
+            if (locked) {
+                pt->now_day = day;
+                pt->now_tm = tmy;
+            }
+        }
+        f.tm.tm_year = tmy.tm_year;
+        f.set |= TIME_F_YEAR;
+    }
+
+    if (locked && pt->prefix_len > 0 && len >= pt->prefix_len &&
+        (pt->with_year || pt->prefix_day == day) &&
+        memcmp(str, pt->prefix, pt->prefix_len) == 0) {
+        f = pt->prefix_fields;
+        p += pt->prefix_len;
+        i = pt->ops_cached;
+    }
+
+    for (; i < pt->ops_len; i++) {
+        op = &pt->ops[i];
+
+        if (op->type == TIME_OP_SPACE) {
+            while (p < end && isspace(*p)) {
+                p++;
+            }
+            continue;
+        }
+
+        if (p >= end) {
+            goto error;
+        }
+
+        switch (op->type) {
+        case TIME_OP_LITERAL:
+            if (*p++ != op->chr) {
+                goto error;
+            }
+            break;
+        case TIME_OP_YEAR:
+            if (time_num(&p, end, &val, 0, 9999) == -1) {
+                goto error;
+            }
+            f.tm.tm_year = val - 1900;
+            f.set |= TIME_F_YEAR;
+            break;
+        case TIME_OP_MON:
+            if (time_num(&p, end, &val, 1, 12) == -1) {
+                goto error;
+            }
+            f.tm.tm_mon = val - 1;
+            f.set |= TIME_F_MON;
+            break;
+        case TIME_OP_MON_NAME:
+            if (time_mon_name(&p, end, &f.tm.tm_mon) == -1) {
+                goto error;
+            }
+            f.set |= TIME_F_MON;
+            break;
+        case TIME_OP_MDAY:
+            if (time_num(&p, end, &f.tm.tm_mday, 1, 31) == -1) {
+                goto error;
+            }
+            f.set |= TIME_F_MDAY;
+            break;
+        case TIME_OP_HOUR:
+            if (time_num(&p, end, &f.tm.tm_hour, 0, 23) == -1) {
+                goto error;
+            }
+            f.set |= TIME_F_HOUR;
+            break;
+        case TIME_OP_MIN:
+            if (time_num(&p, end, &f.tm.tm_min, 0, 59) == -1) {
+                goto error;
+            }
+            f.set |= TIME_F_MIN;
+            break;
+        case TIME_OP_SEC:
+            peek = time_num(&p, end, &f.tm.tm_sec, 0, 60);
+            if (peek == -1) {
+                goto error;
+            }
+            f.set |= TIME_F_SEC;
+            break;
+        case TIME_OP_FRAC:
+            if (time_frac(&p, end, &frac) == -1) {
+                goto error;
+            }
+            /* flb_strptime() finished the first part of the format */
+            if ((f.set & TIME_F_DATE) == TIME_F_DATE &&
+                !(f.set & TIME_F_YDAY)) {
+                time_set_yday(&f);
+            }
+            break;
+        case TIME_OP_TZ:
+            if (time_tz(&p, end, &f.gmtoff) == -1) {
+                goto error;
+            }
+            f.set |= TIME_F_TZ;
+            break;
+        }
+
+        /*
+         * Save the second: the bytes read so far decide the fields, as long
+         * as %S did not look at the next byte.
+         */
+        if (i + 1 == pt->ops_cached && locked && peek == 0 &&
+            (const char *) p - str <= TIME_PREFIX_MAX) {
+            if ((f.set & TIME_F_DATE) == TIME_F_DATE && !pt->date_after) {
+                time_set_yday(&f);
+            }
+            pt->prefix_len = (const char *) p - str;
+            memcpy(pt->prefix, str, pt->prefix_len);
+            pt->prefix_day = day;
+            pt->prefix_fields = f;
+        }
+    }
+
+    if (locked) {
+        pthread_mutex_unlock(&pt->lock);
+    }
+
+    if ((f.set & TIME_F_DATE) == TIME_F_DATE && !(f.set & TIME_F_YDAY)) {
+        time_set_yday(&f);
+    }
+
+    /* Make the timestamp default to today */
+    if (!pt->with_year) {
+        tm->tm_mon = tmy.tm_mon;
+        tm->tm_mday = tmy.tm_mday;
+    }
+    time_fields_commit(&f, tm);
+    *ns = frac;
+
+    return 0;
+
+ error:
+    if (locked) {
+        pthread_mutex_unlock(&pt->lock);
+    }
+    return -1;
+}
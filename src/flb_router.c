@@ -25,8 +25,11 @@
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_input_chunk.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_filter.h>
 #include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_hash.h>
 #include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_router_matcher.h>
 
 #ifdef FLB_HAVE_REGEX
 #include <onigmo.h>
@@ -160,6 +163,259 @@ int flb_router_connect_direct(struct flb_input_instance *in,
     return 0;
 }
 
+/*
+ * Router cache
+ * ============
+ *
+ * Every append needs the list of filters matching the Tag and the routes
+ * mask of the new chunks. The 'match' rules of the filters and outputs are
+ * compiled in two matchers (see flb_router_matcher.c) and the results are
+ * computed once per distinct Tag and kept in a bounded cache (least
+ * recently used Tags are evicted).
+ *
+ * The cache is only used from the engine thread. The returned entry is
+ * valid until the next lookup: callers that may append records again (e.g:
+ * filters emitting records) must copy what they need first.
+ *
+ * Any change in the filter or output instances invalidates the cache.
+ */
+static void cache_destroy(struct flb_router_cache *cache)
+{
+    if (cache->ht) {
+        flb_hash_destroy(cache->ht);
+    }
+    if (cache->scratch) {
+        flb_free(cache->scratch);
+    }
+    flb_router_matcher_destroy(cache->filters_matcher);
+    flb_router_matcher_destroy(cache->outputs_matcher);
+    flb_free(cache->filters);
+    flb_free(cache->filters_mask);
+    flb_free(cache);
+}
+
+static int cache_compile(struct flb_router_cache *cache,
+                         struct flb_config *config)
+{
+    int i = 0;
+    int ret;
+    int max_id;
+    void *regex = NULL;
+    struct mk_list *head;
+    struct flb_filter_instance *f_ins;
+    struct flb_output_instance *o_ins;
+
+    /* filters are numbered by their position, so results keep the order */
+    cache->n_filters = mk_list_size(&config->filters);
+    max_id = (cache->n_filters > 0) ? cache->n_filters - 1 : 0;
+
+    cache->filters_matcher = flb_router_matcher_create(max_id);
+    if (!cache->filters_matcher) {
+        return -1;
+    }
+    cache->filters = flb_calloc(cache->n_filters + 1,
+                                sizeof(struct flb_filter_instance *));
+    cache->filters_mask = flb_calloc(cache->filters_matcher->words,
+                                     sizeof(uint64_t));
+    if (!cache->filters || !cache->filters_mask) {
+        flb_errno();
+        return -1;
+    }
+
+    mk_list_foreach(head, &config->filters) {
+        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
+#ifdef FLB_HAVE_REGEX
+        regex = f_ins->match_regex;
+#endif
+        ret = flb_router_matcher_add(cache->filters_matcher, i,
+                                     f_ins->match, regex);
+        if (ret == -1) {
+            return -1;
+        }
+        cache->filters[i++] = f_ins;
+    }
+
+    /* outputs are numbered by instance id, results are routes masks */
+    cache->outputs_matcher = flb_router_matcher_create(FLB_ROUTES_MASK_MAX_VALUE(config) - 1);
+    if (!cache->outputs_matcher) {
+        return -1;
+    }
+
+    mk_list_foreach(head, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+#ifdef FLB_HAVE_REGEX
+        regex = o_ins->match_regex;
+#endif
+        if (!o_ins->match && !regex) {
+            continue;
+        }
+        if (o_ins->id >= FLB_ROUTES_MASK_MAX_VALUE(config)) {
+            flb_warn("[router] output %s id %i exceeds the routes mask limit",
+                     flb_output_name(o_ins), o_ins->id);
+            continue;
+        }
+        ret = flb_router_matcher_add(cache->outputs_matcher, o_ins->id,
+                                     o_ins->match, regex);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static struct flb_router_cache *cache_get(struct flb_config *config)
+{
+    struct flb_router_cache *cache;
+
+    if (config->router_cache) {
+        return config->router_cache;
+    }
+
+    cache = flb_calloc(1, sizeof(struct flb_router_cache));
+    if (!cache) {
+        flb_errno();
+        return NULL;
+    }
+
+    if (config->router_cache_size > 0) {
+        cache->ht = flb_hash_create(FLB_HASH_EVICT_LRU,
+                                    config->router_cache_size,
+                                    config->router_cache_size);
+        if (!cache->ht) {
+            cache_destroy(cache);
+            return NULL;
+        }
+    }
+
+    if (cache_compile(cache, config) == -1) {
+        flb_error("[router] could not compile match rules");
+        cache_destroy(cache);
+        return NULL;
+    }
+
+    config->router_cache = cache;
+    return cache;
+}
+
+static struct flb_router_cache_entry *cache_entry_create(struct flb_router_cache *cache,
+                                                         const char *tag,
+                                                         int tag_len,
+                                                         size_t *out_size)
+{
+    int i;
+    int n = 0;
+    int ret;
+    size_t size;
+    struct flb_router_cache_entry *entry;
+
+    ret = flb_router_matcher_match(cache->filters_matcher, tag, tag_len,
+                                   cache->filters_mask);
+    if (ret == -1) {
+        return NULL;
+    }
+    if (ret == FLB_TRUE) {
+        for (i = 0; i < cache->n_filters; i++) {
+            if (cache->filters_mask[i / 64] & (1ULL << (i % 64))) {
+                n++;
+            }
+        }
+    }
+
+    size = sizeof(struct flb_router_cache_entry) +
+           (sizeof(uint64_t) * cache->outputs_matcher->words) +
+           (sizeof(struct flb_filter_instance *) * n);
+    entry = flb_calloc(1, size);
+    if (!entry) {
+        flb_errno();
+        return NULL;
+    }
+    entry->routes_size = cache->outputs_matcher->words;
+
+    n = 0;
+    if (ret == FLB_TRUE) {
+        for (i = 0; i < cache->n_filters; i++) {
+            if (cache->filters_mask[i / 64] & (1ULL << (i % 64))) {
+                flb_router_cache_filters(entry)[n++] = cache->filters[i];
+            }
+        }
+    }
+    entry->n_filters = n;
+
+    ret = flb_router_matcher_match(cache->outputs_matcher, tag, tag_len,
+                                   flb_router_cache_routes(entry));
+    if (ret == -1) {
+        flb_free(entry);
+        return NULL;
+    }
+    entry->has_routes = ret;
+
+    *out_size = size;
+    return entry;
+}
+
+struct flb_router_cache_entry *flb_router_cache_get(struct flb_config *config,
+                                                    const char *tag,
+                                                    int tag_len)
+{
+    int ret;
+    size_t size;
+    void *out_buf;
+    size_t out_size;
+    struct flb_router_cache *cache;
+    struct flb_router_cache_entry *entry;
+
+    cache = cache_get(config);
+    if (!cache) {
+        return NULL;
+    }
+
+    if (cache->ht && tag_len > 0) {
+        ret = flb_hash_get(cache->ht, tag, tag_len, &out_buf, &out_size);
+        if (ret >= 0) {
+            return out_buf;
+        }
+    }
+
+    entry = cache_entry_create(cache, tag, tag_len, &size);
+    if (!entry) {
+        return NULL;
+    }
+
+    if (cache->ht && tag_len > 0) {
+        ret = flb_hash_add(cache->ht, tag, tag_len, entry, size);
+        if (ret >= 0) {
+            flb_free(entry);
+            ret = flb_hash_get(cache->ht, tag, tag_len, &out_buf, &out_size);
+            if (ret >= 0) {
+                return out_buf;
+            }
+            return NULL;
+        }
+    }
+
+    /* not cached: keep the result until the next lookup */
+    if (cache->scratch) {
+        flb_free(cache->scratch);
+    }
+    cache->scratch = entry;
+
+    return entry;
+}
+
+/* Drop every cached result, the cache is created again on the next lookup */
+void flb_router_cache_invalidate(struct flb_config *config)
+{
+    struct flb_router_cache *cache = config->router_cache;
+
+    if (!cache) {
+        return;
+    }
+
+    cache_destroy(cache);
+    config->router_cache = NULL;
+}
+
 /*
  * This routine defines static routes for the plugins that have registered
  * tags. It check where data should go before the service start running, each
@@ -167,12 +423,18 @@ int flb_router_connect_direct(struct flb_input_instance *in,
  */
 int flb_router_io_set(struct flb_config *config)
 {
+    int ret;
     int in_count = 0;
     int out_count = 0;
+    uint64_t *routes_mask;
     struct mk_list *i_head;
     struct mk_list *o_head;
     struct flb_input_instance *i_ins;
     struct flb_output_instance *o_ins;
+    struct flb_router_cache *cache;
+
+    /* match rules are final from now on */
+    flb_router_cache_invalidate(config);
 
     /* Quick setup for 1:1 */
     mk_list_foreach(i_head, &config->inputs) {
@@ -199,10 +461,22 @@ int flb_router_io_set(struct flb_config *config)
                       i_ins->name, o_ins->name);
             o_ins->match = flb_sds_create_len("*", 1);
             flb_router_connect(i_ins, o_ins);
+            flb_router_cache_invalidate(config);
             return 0;
         }
     }
 
+    cache = cache_get(config);
+    if (!cache) {
+        return -1;
+    }
+
+    routes_mask = flb_calloc(config->routes_mask_size, sizeof(uint64_t));
+    if (!routes_mask) {
+        flb_errno();
+        return -1;
+    }
+
     /* N:M case, iterate all input instances */
     mk_list_foreach(i_head, &config->inputs) {
         i_ins = mk_list_entry(i_head, struct flb_input_instance, _head);
@@ -219,6 +493,13 @@ int flb_router_io_set(struct flb_config *config)
 
         flb_trace("[router] input=%s tag=%s", i_ins->name, i_ins->tag);
 
+        ret = flb_router_matcher_match(cache->outputs_matcher,
+                                       i_ins->tag, i_ins->tag_len, routes_mask);
+        if (ret == -1) {
+            flb_free(routes_mask);
+            return -1;
+        }
+
         /* Try to find a match with output instances */
         mk_list_foreach(o_head, &config->outputs) {
             o_ins = mk_list_entry(o_head, struct flb_output_instance, _head);
@@ -232,14 +513,7 @@ int flb_router_io_set(struct flb_config *config)
                 continue;
             }
 
-            if (flb_router_match(i_ins->tag, i_ins->tag_len, o_ins->match
-#ifdef FLB_HAVE_REGEX
-                , o_ins->match_regex
-#else
-                , NULL
-#endif
-            )) {
-
+            if (flb_routes_mask_get_bit(routes_mask, o_ins->id, config)) {
                 if (!flb_router_match_type(i_ins->event_type, o_ins)) {
                     if (i_ins->event_type == FLB_INPUT_LOGS) {
                         flb_debug("[router] data generated by %s input are logs, "
@@ -266,6 +540,7 @@ int flb_router_io_set(struct flb_config *config)
         }
     }
 
+    flb_free(routes_mask);
     return 0;
 }
 
@@ -296,4 +571,6 @@ void flb_router_exit(struct flb_config *config)
             flb_free(r);
         }
     }
+
+    flb_router_cache_invalidate(config);
 }
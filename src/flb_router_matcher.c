@@ -0,0 +1,550 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_router_matcher.h>
+
+#ifdef FLB_HAVE_REGEX
+#include <fluent-bit/flb_regex.h>
+#include <onigmo.h>
+#endif
+
+#include <xxhash.h>
+#include <string.h>
+
+/* buckets of the DFA states hash table */
+#define MATCHER_TABLE_SIZE   256
+
+struct flb_router_matcher_node {
+    int star;                   /* node reached with '*', -1 if none */
+    int is_star;                /* the node loops on any character   */
+
+    int n_edges;
+    unsigned char *chars;       /* literal edges                     */
+    int *next;
+
+    int n_ids;                  /* patterns ending on this node      */
+    int *ids;
+};
+
+struct flb_router_matcher_state {
+    uint64_t hash;
+    int n_nodes;
+    int *nodes;                 /* sorted trie nodes                 */
+    uint64_t *mask;             /* accepted patterns, NULL if none   */
+    struct flb_router_matcher_state **next;  /* one per class, lazy  */
+    struct flb_router_matcher_state *chain;  /* hash table bucket    */
+    struct mk_list _head;
+};
+
+static int node_create(struct flb_router_matcher *m, int is_star)
+{
+    int size;
+    struct flb_router_matcher_node *tmp;
+    struct flb_router_matcher_node *node;
+
+    if (m->n_nodes == m->size_nodes) {
+        size = m->size_nodes * 2;
+        tmp = flb_realloc(m->nodes,
+                          sizeof(struct flb_router_matcher_node) * size);
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        m->nodes = tmp;
+        m->size_nodes = size;
+    }
+
+    node = &m->nodes[m->n_nodes];
+    memset(node, 0, sizeof(struct flb_router_matcher_node));
+    node->star = -1;
+    node->is_star = is_star;
+
+    return m->n_nodes++;
+}
+
+static int node_edge_add(struct flb_router_matcher *m, int id, unsigned char c)
+{
+    int n;
+    int child;
+    int *next;
+    unsigned char *chars;
+    struct flb_router_matcher_node *node;
+
+    /* the nodes array might move */
+    child = node_create(m, FLB_FALSE);
+    if (child == -1) {
+        return -1;
+    }
+
+    node = &m->nodes[id];
+    n = node->n_edges + 1;
+
+    chars = flb_realloc(node->chars, n);
+    if (!chars) {
+        flb_errno();
+        return -1;
+    }
+    node->chars = chars;
+
+    next = flb_realloc(node->next, sizeof(int) * n);
+    if (!next) {
+        flb_errno();
+        return -1;
+    }
+    node->next = next;
+
+    node->chars[n - 1] = c;
+    node->next[n - 1] = child;
+    node->n_edges = n;
+
+    return child;
+}
+
+static int node_id_add(struct flb_router_matcher_node *node, int id)
+{
+    int *ids;
+
+    ids = flb_realloc(node->ids, sizeof(int) * (node->n_ids + 1));
+    if (!ids) {
+        flb_errno();
+        return -1;
+    }
+    node->ids = ids;
+    node->ids[node->n_ids++] = id;
+
+    return 0;
+}
+
+static void state_destroy(struct flb_router_matcher_state *s)
+{
+    flb_free(s->nodes);
+    flb_free(s->mask);
+    flb_free(s->next);
+    flb_free(s);
+}
+
+/* Drop the DFA, it is built again on the next match */
+static void states_flush(struct flb_router_matcher *m)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_router_matcher_state *s;
+
+    mk_list_foreach_safe(head, tmp, &m->states) {
+        s = mk_list_entry(head, struct flb_router_matcher_state, _head);
+        mk_list_del(&s->_head);
+        state_destroy(s);
+    }
+
+    if (m->table) {
+        memset(m->table, 0,
+               sizeof(struct flb_router_matcher_state *) * MATCHER_TABLE_SIZE);
+    }
+    m->n_states = 0;
+    m->start = NULL;
+}
+
+struct flb_router_matcher *flb_router_matcher_create(int max_id)
+{
+    struct flb_router_matcher *m;
+
+    m = flb_calloc(1, sizeof(struct flb_router_matcher));
+    if (!m) {
+        flb_errno();
+        return NULL;
+    }
+    m->words = (max_id / 64) + 1;
+    mk_list_init(&m->states);
+    mk_list_init(&m->regex);
+
+    m->table = flb_calloc(MATCHER_TABLE_SIZE,
+                          sizeof(struct flb_router_matcher_state *));
+    if (!m->table) {
+        flb_errno();
+        flb_free(m);
+        return NULL;
+    }
+
+    m->size_nodes = 16;
+    m->nodes = flb_malloc(sizeof(struct flb_router_matcher_node) *
+                          m->size_nodes);
+    if (!m->nodes) {
+        flb_errno();
+        flb_free(m->table);
+        flb_free(m);
+        return NULL;
+    }
+
+    /* root node */
+    node_create(m, FLB_FALSE);
+
+    return m;
+}
+
+void flb_router_matcher_destroy(struct flb_router_matcher *m)
+{
+    int i;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_router_matcher_regex *r;
+
+    if (!m) {
+        return;
+    }
+
+    states_flush(m);
+
+    for (i = 0; i < m->n_nodes; i++) {
+        flb_free(m->nodes[i].chars);
+        flb_free(m->nodes[i].next);
+        flb_free(m->nodes[i].ids);
+    }
+    flb_free(m->nodes);
+
+    mk_list_foreach_safe(head, tmp, &m->regex) {
+        r = mk_list_entry(head, struct flb_router_matcher_regex, _head);
+        mk_list_del(&r->_head);
+        flb_free(r);
+    }
+
+    flb_free(m->table);
+    flb_free(m->buf);
+    flb_free(m->marks);
+    flb_free(m);
+}
+
+/*
+ * Register a pattern: 'id' is the bit set in the result mask when the Tag
+ * matches 'pattern' (wildcards) or 'regex' (a struct flb_regex owned by the
+ * caller). Any of them can be NULL.
+ */
+int flb_router_matcher_add(struct flb_router_matcher *m, int id,
+                           const char *pattern, void *regex)
+{
+    int i;
+    int cur = 0;
+    int next;
+    const char *p;
+    struct flb_router_matcher_node *node;
+    struct flb_router_matcher_regex *r;
+
+    if (id < 0 || id >= m->words * 64) {
+        flb_warn("[router] matcher id %i out of range", id);
+        return -1;
+    }
+
+    /* the automaton changes */
+    states_flush(m);
+
+    if (regex) {
+        r = flb_malloc(sizeof(struct flb_router_matcher_regex));
+        if (!r) {
+            flb_errno();
+            return -1;
+        }
+        r->id = id;
+        r->regex = regex;
+        mk_list_add(&r->_head, &m->regex);
+    }
+
+    if (!pattern) {
+        return 0;
+    }
+
+    for (p = pattern; *p; p++) {
+        node = &m->nodes[cur];
+
+        if (*p == '*') {
+            /* successive '*' are the same as a single one */
+            if (node->is_star) {
+                continue;
+            }
+            if (node->star == -1) {
+                next = node_create(m, FLB_TRUE);
+                if (next == -1) {
+                    return -1;
+                }
+                m->nodes[cur].star = next;
+            }
+            cur = m->nodes[cur].star;
+            continue;
+        }
+
+        next = -1;
+        for (i = 0; i < node->n_edges; i++) {
+            if (node->chars[i] == (unsigned char) *p) {
+                next = node->next[i];
+                break;
+            }
+        }
+        if (next == -1) {
+            next = node_edge_add(m, cur, (unsigned char) *p);
+            if (next == -1) {
+                return -1;
+            }
+        }
+        cur = next;
+    }
+
+    return node_id_add(&m->nodes[cur], id);
+}
+
+static inline void set_add(struct flb_router_matcher *m, int *count, int node)
+{
+    if (m->marks[node] != m->gen) {
+        m->marks[node] = m->gen;
+        m->buf[(*count)++] = node;
+    }
+}
+
+/* '*' also matches an empty string: add the star nodes reachable for free */
+static int set_closure(struct flb_router_matcher *m, int count)
+{
+    int i;
+    int star;
+
+    for (i = 0; i < count; i++) {
+        star = m->nodes[m->buf[i]].star;
+        if (star != -1) {
+            set_add(m, &count, star);
+        }
+    }
+
+    return count;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+/* Find or create the DFA state for the set of nodes in m->buf */
+static struct flb_router_matcher_state *state_get(struct flb_router_matcher *m,
+                                                  int count)
+{
+    int i;
+    int j;
+    int id;
+    uint64_t hash;
+    struct flb_router_matcher_node *node;
+    struct flb_router_matcher_state *s;
+
+    qsort(m->buf, count, sizeof(int), int_cmp);
+    hash = XXH3_64bits(m->buf, sizeof(int) * count);
+
+    for (s = m->table[hash % MATCHER_TABLE_SIZE]; s; s = s->chain) {
+        if (s->hash == hash && s->n_nodes == count &&
+            memcmp(s->nodes, m->buf, sizeof(int) * count) == 0) {
+            return s;
+        }
+    }
+
+    s = flb_calloc(1, sizeof(struct flb_router_matcher_state));
+    if (!s) {
+        flb_errno();
+        return NULL;
+    }
+    s->hash = hash;
+    s->n_nodes = count;
+
+    s->next = flb_calloc(m->n_classes,
+                         sizeof(struct flb_router_matcher_state *));
+    if (!s->next) {
+        flb_errno();
+        flb_free(s);
+        return NULL;
+    }
+
+    if (count > 0) {
+        s->nodes = flb_malloc(sizeof(int) * count);
+        if (!s->nodes) {
+            flb_errno();
+            state_destroy(s);
+            return NULL;
+        }
+        memcpy(s->nodes, m->buf, sizeof(int) * count);
+    }
+
+    for (i = 0; i < count; i++) {
+        node = &m->nodes[s->nodes[i]];
+        for (j = 0; j < node->n_ids; j++) {
+            if (!s->mask) {
+                s->mask = flb_calloc(m->words, sizeof(uint64_t));
+                if (!s->mask) {
+                    flb_errno();
+                    state_destroy(s);
+                    return NULL;
+                }
+            }
+            id = node->ids[j];
+            s->mask[id / 64] |= (1ULL << (id % 64));
+        }
+    }
+
+    s->chain = m->table[hash % MATCHER_TABLE_SIZE];
+    m->table[hash % MATCHER_TABLE_SIZE] = s;
+    mk_list_add(&s->_head, &m->states);
+    m->n_states++;
+
+    return s;
+}
+
+/* Compute the transition of a state for a class of characters */
+static struct flb_router_matcher_state *state_step(struct flb_router_matcher *m,
+                                                   struct flb_router_matcher_state *s,
+                                                   int class)
+{
+    int i;
+    int j;
+    int count = 0;
+    struct flb_router_matcher_node *node;
+    struct flb_router_matcher_state *next;
+
+    m->gen++;
+    for (i = 0; i < s->n_nodes; i++) {
+        node = &m->nodes[s->nodes[i]];
+        if (node->is_star) {
+            set_add(m, &count, s->nodes[i]);
+        }
+
+        /* class 0 is never used by a literal edge */
+        if (class == 0) {
+            continue;
+        }
+        for (j = 0; j < node->n_edges; j++) {
+            if (m->classes[node->chars[j]] == class) {
+                set_add(m, &count, node->next[j]);
+            }
+        }
+    }
+    count = set_closure(m, count);
+
+    next = state_get(m, count);
+    if (next) {
+        s->next[class] = next;
+    }
+
+    return next;
+}
+
+static int matcher_compile(struct flb_router_matcher *m)
+{
+    int i;
+    int j;
+    int count = 0;
+    unsigned char c;
+
+    memset(m->classes, 0, sizeof(m->classes));
+    m->n_classes = 1;
+    for (i = 0; i < m->n_nodes; i++) {
+        for (j = 0; j < m->nodes[i].n_edges; j++) {
+            c = m->nodes[i].chars[j];
+            if (m->classes[c] == 0) {
+                m->classes[c] = m->n_classes++;
+            }
+        }
+    }
+
+    flb_free(m->buf);
+    flb_free(m->marks);
+    m->buf = flb_malloc(sizeof(int) * m->n_nodes);
+    m->marks = flb_calloc(m->n_nodes, sizeof(uint32_t));
+    if (!m->buf || !m->marks) {
+        flb_errno();
+        return -1;
+    }
+    m->gen = 1;
+
+    set_add(m, &count, 0);
+    count = set_closure(m, count);
+
+    m->start = state_get(m, count);
+    if (!m->start) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Match a Tag against every pattern, 'mask' must have room for m->words
+ * elements. Returns FLB_TRUE if any pattern matched, FLB_FALSE if none
+ * and -1 on error.
+ */
+int flb_router_matcher_match(struct flb_router_matcher *m,
+                             const char *tag, int tag_len, uint64_t *mask)
+{
+    int i;
+    int ret = FLB_FALSE;
+    struct mk_list *head;
+    struct flb_router_matcher_regex *r;
+    struct flb_router_matcher_state *s;
+    struct flb_router_matcher_state *next;
+
+    memset(mask, 0, sizeof(uint64_t) * m->words);
+
+    /* too many states: start over to keep memory bounded */
+    if (m->n_states > FLB_ROUTER_MATCHER_MAX_STATES) {
+        states_flush(m);
+    }
+
+    if (!m->start && matcher_compile(m) == -1) {
+        return -1;
+    }
+
+    s = m->start;
+    for (i = 0; i < tag_len && s->n_nodes > 0; i++) {
+        next = s->next[m->classes[(unsigned char) tag[i]]];
+        if (!next) {
+            next = state_step(m, s, m->classes[(unsigned char) tag[i]]);
+            if (!next) {
+                return -1;
+            }
+        }
+        s = next;
+    }
+
+    if (s->mask) {
+        memcpy(mask, s->mask, sizeof(uint64_t) * m->words);
+        ret = FLB_TRUE;
+    }
+
+#ifdef FLB_HAVE_REGEX
+    mk_list_foreach(head, &m->regex) {
+        r = mk_list_entry(head, struct flb_router_matcher_regex, _head);
+        if (onig_match(((struct flb_regex *) r->regex)->regex,
+                       (const unsigned char *) tag,
+                       (const unsigned char *) tag + tag_len,
+                       (const unsigned char *) tag, 0,
+                       ONIG_OPTION_NONE) > 0) {
+            mask[r->id / 64] |= (1ULL << (r->id % 64));
+            ret = FLB_TRUE;
+        }
+    }
+#else
+    (void) head;
+    (void) r;
+#endif
+
+    return ret;
+}
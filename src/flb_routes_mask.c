@@ -21,10 +21,35 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_log.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_router.h>
 #include <fluent-bit/flb_routes_mask.h>
 
 
+/*
+ * Size the routes masks from the output instances: called when the engine
+ * starts, before any chunk is created.
+ */
+void flb_routes_mask_set_size(struct flb_config *config)
+{
+    int max_id = 0;
+    struct mk_list *head;
+    struct flb_output_instance *o_ins;
+
+    mk_list_foreach(head, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        if (o_ins->id > max_id) {
+            max_id = o_ins->id;
+        }
+    }
+
+    config->routes_mask_size = (max_id / FLB_ROUTES_MASK_ELEMENT_BITS) + 1;
+
+    /* cached masks have the old size */
+    flb_router_cache_invalidate(config);
+}
+
 /*
  * Set the routes_mask for input chunk with a router_match on tag, return a
  * non-zero value if any routes matched
@@ -34,34 +59,23 @@ int flb_routes_mask_set_by_tag(uint64_t *routes_mask,
                                int tag_len,
                                struct flb_input_instance *in)
 {
-    int has_routes = 0;
-    struct mk_list *o_head;
-    struct flb_output_instance *o_ins;
+    struct flb_router_cache_entry *match;
+
     if (!in) {
         return 0;
     }
 
-    /* Clear the bit field */
-    memset(routes_mask, 0, sizeof(uint64_t) * FLB_ROUTES_MASK_ELEMENTS);
-
     /* Find all matching routes for the given tag */
-    mk_list_foreach(o_head, &in->config->outputs) {
-        o_ins = mk_list_entry(o_head,
-                              struct flb_output_instance, _head);
-
-        if (flb_router_match(tag, tag_len, o_ins->match
-#ifdef FLB_HAVE_REGEX
-                             , o_ins->match_regex
-#else
-                             , NULL
-#endif
-                             )) {
-            flb_routes_mask_set_bit(routes_mask, o_ins->id);
-            has_routes = 1;
-        }
+    match = flb_router_cache_get(in->config, tag, tag_len);
+    if (!match) {
+        memset(routes_mask, 0, FLB_ROUTES_MASK_BYTES(in->config));
+        return 0;
     }
 
-    return has_routes;
+    memcpy(routes_mask, flb_router_cache_routes(match),
+           FLB_ROUTES_MASK_BYTES(in->config));
+
+    return match->has_routes;
 }
 
 /*
@@ -71,12 +85,13 @@ int flb_routes_mask_set_by_tag(uint64_t *routes_mask,
  * 4th bit in the 2nd value of the bitfield array.
  *
  */
-void flb_routes_mask_set_bit(uint64_t *routes_mask, int value)
+void flb_routes_mask_set_bit(uint64_t *routes_mask, int value,
+                             struct flb_config *config)
 {
     int index;
     uint64_t bit;
 
-    if (value < 0 || value > FLB_ROUTES_MASK_MAX_VALUE) {
+    if (value < 0 || value >= FLB_ROUTES_MASK_MAX_VALUE(config)) {
         flb_warn("[routes_mask] Can't set bit (%d) past limits of bitfield",
                  value);
         return;
@@ -94,12 +109,13 @@ void flb_routes_mask_set_bit(uint64_t *routes_mask, int value)
  * 4th bit in the 2nd value of the bitfield array.
  *
  */
-void flb_routes_mask_clear_bit(uint64_t *routes_mask, int value)
+void flb_routes_mask_clear_bit(uint64_t *routes_mask, int value,
+                               struct flb_config *config)
 {
     int index;
     uint64_t bit;
 
-    if (value < 0 || value > FLB_ROUTES_MASK_MAX_VALUE) {
+    if (value < 0 || value >= FLB_ROUTES_MASK_MAX_VALUE(config)) {
         flb_warn("[routes_mask] Can't set bit (%d) past limits of bitfield",
                  value);
         return;
@@ -118,12 +134,13 @@ void flb_routes_mask_clear_bit(uint64_t *routes_mask, int value)
  * if the 4th bit in the 2nd value of the bitfield array is set.
  *
  */
-int flb_routes_mask_get_bit(uint64_t *routes_mask, int value)
+int flb_routes_mask_get_bit(uint64_t *routes_mask, int value,
+                            struct flb_config *config)
 {
     int index;
     uint64_t bit;
 
-    if (value < 0 || value > FLB_ROUTES_MASK_MAX_VALUE) {
+    if (value < 0 || value >= FLB_ROUTES_MASK_MAX_VALUE(config)) {
         flb_warn("[routes_mask] Can't get bit (%d) past limits of bitfield",
                  value);
         return 0;
@@ -134,11 +151,16 @@ int flb_routes_mask_get_bit(uint64_t *routes_mask, int value)
     return (routes_mask[index] & bit) != 0ULL;
 }
 
-int flb_routes_mask_is_empty(uint64_t *routes_mask)
+/* Check a whole element at a time */
+int flb_routes_mask_is_empty(uint64_t *routes_mask, struct flb_config *config)
 {
-    uint64_t empty[FLB_ROUTES_MASK_ELEMENTS];
+    int i;
+
+    for (i = 0; i < config->routes_mask_size; i++) {
+        if (routes_mask[i] != 0) {
+            return FLB_FALSE;
+        }
+    }
 
-    /* Clear the tmp bitfield */
-    memset(empty, 0, sizeof(empty));
-    return memcmp(routes_mask, empty, sizeof(empty)) == 0;
+    return FLB_TRUE;
 }
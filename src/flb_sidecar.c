@@ -0,0 +1,359 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2021 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_compat.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_coro.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_sidecar.h>
+
+/*
+ * Filters usually run on the engine thread outside of a coroutine, where
+ * only blocking I/O is possible. When the caller runs inside a coroutine the
+ * non-blocking path is used so the engine keeps working while we wait.
+ */
+static inline void io_mode_set(struct flb_sidecar *sc)
+{
+    if (flb_coro_get()) {
+        sc->u->flags |= FLB_IO_ASYNC;
+    }
+    else {
+        sc->u->flags &= ~(FLB_IO_ASYNC);
+    }
+}
+
+static void breaker_success(struct flb_sidecar *sc)
+{
+    if (sc->state != FLB_SIDECAR_CLOSED) {
+        flb_info("[sidecar] %s: connection to %s:%i restored",
+                 sc->name, sc->u->tcp_host, sc->u->tcp_port);
+    }
+
+    sc->state = FLB_SIDECAR_CLOSED;
+    sc->failures = 0;
+    sc->backoff = sc->backoff_base;
+}
+
+static void breaker_failure(struct flb_sidecar *sc)
+{
+    sc->failures++;
+
+    /* a failed probe re-opens the circuit right away */
+    if (sc->state == FLB_SIDECAR_HALF_OPEN ||
+        sc->failures >= sc->max_failures) {
+        sc->state = FLB_SIDECAR_OPEN;
+        sc->retry_at = time(NULL) + sc->backoff;
+
+        flb_warn("[sidecar] %s: %s:%i unavailable after %i failures, "
+                 "retrying in %i seconds",
+                 sc->name, sc->u->tcp_host, sc->u->tcp_port,
+                 sc->failures, sc->backoff);
+
+        sc->backoff *= 2;
+        if (sc->backoff > sc->backoff_max) {
+            sc->backoff = sc->backoff_max;
+        }
+    }
+}
+
+struct flb_sidecar *flb_sidecar_create(struct flb_config *config,
+                                       const char *name,
+                                       const char *host, int port)
+{
+    struct flb_sidecar *sc;
+
+    sc = flb_calloc(1, sizeof(struct flb_sidecar));
+    if (!sc) {
+        flb_errno();
+        return NULL;
+    }
+    sc->config = config;
+
+    sc->name = flb_strdup(name);
+    if (!sc->name) {
+        flb_free(sc);
+        return NULL;
+    }
+
+    sc->u = flb_upstream_create(config, host, port, FLB_IO_TCP, NULL);
+    if (!sc->u) {
+        flb_error("[sidecar] %s: could not create upstream for %s:%i",
+                  name, host, port);
+        flb_free(sc->name);
+        flb_free(sc);
+        return NULL;
+    }
+    sc->u->flags &= ~(FLB_IO_ASYNC);
+
+    sc->state = FLB_SIDECAR_CLOSED;
+    sc->max_failures = FLB_SIDECAR_MAX_FAILURES;
+    sc->backoff_base = FLB_SIDECAR_BACKOFF_BASE;
+    sc->backoff_max = FLB_SIDECAR_BACKOFF_MAX;
+    sc->backoff = sc->backoff_base;
+
+    return sc;
+}
+
+void flb_sidecar_destroy(struct flb_sidecar *sc)
+{
+    if (!sc) {
+        return;
+    }
+
+    if (sc->u) {
+        flb_upstream_destroy(sc->u);
+    }
+    flb_free(sc->name);
+    flb_free(sc);
+}
+
+/*
+ * Check the circuit breaker: returns FLB_FALSE while the sidecar is known to
+ * be down, so callers can skip the round trip and use default values.
+ */
+int flb_sidecar_available(struct flb_sidecar *sc)
+{
+    if (sc->state == FLB_SIDECAR_OPEN) {
+        if (time(NULL) < sc->retry_at) {
+            return FLB_FALSE;
+        }
+        sc->state = FLB_SIDECAR_HALF_OPEN;
+    }
+
+    return FLB_TRUE;
+}
+
+static int read_all(struct flb_upstream_conn *u_conn, char *buf, size_t len)
+{
+    ssize_t ret;
+    size_t total = 0;
+
+    while (total < len) {
+        ret = flb_io_net_read(u_conn, buf + total, len - total);
+        if (ret <= 0) {
+            return -1;
+        }
+        total += ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Line protocol: write the request and read the reply with a single read,
+ * 'out' is always NULL terminated.
+ */
+int flb_sidecar_request(struct flb_sidecar *sc,
+                        const char *buf, size_t len,
+                        char *out, size_t out_size, size_t *out_len)
+{
+    int ret;
+    int attempt;
+    size_t bytes;
+    ssize_t bytes_read;
+    struct flb_upstream_conn *u_conn;
+
+    if (flb_sidecar_available(sc) == FLB_FALSE) {
+        return -1;
+    }
+
+    io_mode_set(sc);
+    for (attempt = 0; attempt < FLB_SIDECAR_RETRIES; attempt++) {
+        u_conn = flb_upstream_conn_get(sc->u);
+        if (!u_conn) {
+            continue;
+        }
+
+        ret = flb_io_net_write(u_conn, buf, len, &bytes);
+        if (ret == -1) {
+            flb_upstream_conn_recycle(u_conn, FLB_FALSE);
+            flb_upstream_conn_release(u_conn);
+            continue;
+        }
+
+        bytes_read = flb_io_net_read(u_conn, out, out_size - 1);
+        if (bytes_read <= 0) {
+            /* peer closed a kept alive connection, try a fresh one */
+            flb_upstream_conn_recycle(u_conn, FLB_FALSE);
+            flb_upstream_conn_release(u_conn);
+            continue;
+        }
+
+        out[bytes_read] = '\0';
+        *out_len = bytes_read;
+        flb_upstream_conn_release(u_conn);
+        breaker_success(sc);
+        return 0;
+    }
+
+    breaker_failure(sc);
+    return -1;
+}
+
+int flb_sidecar_batch_init(struct flb_sidecar_batch *batch, size_t size)
+{
+    uint32_t count = 0;
+
+    batch->count = 0;
+    batch->buf = flb_sds_create_size(size + FLB_SIDECAR_FRAME_HEADER);
+    if (!batch->buf) {
+        return -1;
+    }
+
+    /* room for the records counter, set when the request is sent */
+    return flb_sds_cat_safe(&batch->buf, (char *) &count,
+                            FLB_SIDECAR_FRAME_HEADER);
+}
+
+int flb_sidecar_batch_append(struct flb_sidecar_batch *batch,
+                             const char *data, size_t len)
+{
+    int ret;
+    uint32_t be_len;
+
+    be_len = htonl(len);
+    ret = flb_sds_cat_safe(&batch->buf, (char *) &be_len,
+                           FLB_SIDECAR_FRAME_HEADER);
+    if (ret == -1) {
+        return -1;
+    }
+
+    ret = flb_sds_cat_safe(&batch->buf, data, len);
+    if (ret == -1) {
+        return -1;
+    }
+
+    batch->count++;
+    return 0;
+}
+
+void flb_sidecar_batch_destroy(struct flb_sidecar_batch *batch)
+{
+    if (batch->buf) {
+        flb_sds_destroy(batch->buf);
+        batch->buf = NULL;
+    }
+    batch->count = 0;
+}
+
+void flb_sidecar_replies_destroy(flb_sds_t *replies, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (replies[i]) {
+            flb_sds_destroy(replies[i]);
+            replies[i] = NULL;
+        }
+    }
+}
+
+static int batch_read_replies(struct flb_upstream_conn *u_conn,
+                              int count, flb_sds_t *replies)
+{
+    int i;
+    uint32_t len;
+
+    for (i = 0; i < count; i++) {
+        if (read_all(u_conn, (char *) &len, FLB_SIDECAR_FRAME_HEADER) == -1) {
+            return -1;
+        }
+
+        len = ntohl(len);
+        if (len > FLB_SIDECAR_MAX_REPLY) {
+            flb_error("[sidecar] invalid batch reply size %u", len);
+            return -1;
+        }
+
+        replies[i] = flb_sds_create_size(len + 1);
+        if (!replies[i]) {
+            flb_errno();
+            return -1;
+        }
+
+        if (read_all(u_conn, replies[i], len) == -1) {
+            return -1;
+        }
+        flb_sds_len_set(replies[i], len);
+        replies[i][len] = '\0';
+    }
+
+    return 0;
+}
+
+/*
+ * Batch protocol: send every record of the batch in one request and read
+ * back one reply per record. 'replies' must have room for batch->count
+ * entries; on success the caller owns them (flb_sidecar_replies_destroy()).
+ */
+int flb_sidecar_batch_request(struct flb_sidecar *sc,
+                              struct flb_sidecar_batch *batch,
+                              flb_sds_t *replies)
+{
+    int ret;
+    int attempt;
+    size_t bytes;
+    uint32_t be_count;
+    struct flb_upstream_conn *u_conn;
+
+    if (batch->count == 0) {
+        return 0;
+    }
+
+    if (flb_sidecar_available(sc) == FLB_FALSE) {
+        return -1;
+    }
+
+    be_count = htonl(batch->count);
+    memcpy(batch->buf, &be_count, FLB_SIDECAR_FRAME_HEADER);
+
+    io_mode_set(sc);
+    for (attempt = 0; attempt < FLB_SIDECAR_RETRIES; attempt++) {
+        u_conn = flb_upstream_conn_get(sc->u);
+        if (!u_conn) {
+            continue;
+        }
+
+        ret = flb_io_net_write(u_conn, batch->buf, flb_sds_len(batch->buf),
+                               &bytes);
+        if (ret != -1) {
+            ret = batch_read_replies(u_conn, batch->count, replies);
+        }
+
+        if (ret == -1) {
+            /* the stream is out of sync, never reuse this connection */
+            flb_sidecar_replies_destroy(replies, batch->count);
+            flb_upstream_conn_recycle(u_conn, FLB_FALSE);
+            flb_upstream_conn_release(u_conn);
+            continue;
+        }
+
+        flb_upstream_conn_release(u_conn);
+        breaker_success(sc);
+        return 0;
+    }
+
+    breaker_failure(sc);
+    return -1;
+}
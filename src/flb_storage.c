@@ -24,6 +24,7 @@
 #include <fluent-bit/flb_storage.h>
 #include <fluent-bit/flb_scheduler.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_http_server.h>
 
 static void metrics_append_general(msgpack_packer *mp_pck,
@@ -70,6 +71,89 @@ static void metrics_append_general(msgpack_packer *mp_pck,
     msgpack_pack_uint64(mp_pck, storage_st.chunks_fs_down);
 }
 
+/* Tier occupancy of an instance using 'storage.type tiered' */
+static void metrics_append_tiers(msgpack_packer *mp_pck,
+                                 struct flb_input_instance *i,
+                                 struct flb_storage_input *si)
+{
+    int len;
+    char buf[32];
+    ssize_t size;
+    size_t mem_size = 0;
+    uint64_t mem_chunks = 0;
+    uint64_t fs_chunks = 0;
+    uint64_t fs_chunks_up = 0;
+    struct mk_list *head;
+    struct cio_chunk *ch;
+    struct flb_input_chunk *ic;
+
+    mk_list_foreach(head, &i->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        ch = (struct cio_chunk *) ic->chunk;
+        if (ch->st == si->spill_stream) {
+            fs_chunks++;
+            if (cio_chunk_is_up(ch) == CIO_FALSE) {
+                continue;
+            }
+            fs_chunks_up++;
+        }
+        else {
+            mem_chunks++;
+        }
+
+        size = cio_chunk_get_content_size(ch);
+        if (size > 0) {
+            mem_size += size;
+        }
+    }
+
+    msgpack_pack_str(mp_pck, 5);
+    msgpack_pack_str_body(mp_pck, "tiers", 5);
+    msgpack_pack_map(mp_pck, 7);
+
+    /* tiers['mem_chunks'] */
+    msgpack_pack_str(mp_pck, 10);
+    msgpack_pack_str_body(mp_pck, "mem_chunks", 10);
+    msgpack_pack_uint64(mp_pck, mem_chunks);
+
+    /* tiers['fs_chunks'] */
+    msgpack_pack_str(mp_pck, 9);
+    msgpack_pack_str_body(mp_pck, "fs_chunks", 9);
+    msgpack_pack_uint64(mp_pck, fs_chunks);
+
+    /* tiers['fs_chunks_up'] */
+    msgpack_pack_str(mp_pck, 12);
+    msgpack_pack_str_body(mp_pck, "fs_chunks_up", 12);
+    msgpack_pack_uint64(mp_pck, fs_chunks_up);
+
+    /* tiers['mem_size']: memory chunks and spilled chunks up */
+    msgpack_pack_str(mp_pck, 8);
+    msgpack_pack_str_body(mp_pck, "mem_size", 8);
+    flb_utils_bytes_to_human_readable_size(mem_size, buf, sizeof(buf) - 1);
+    len = strlen(buf);
+    msgpack_pack_str(mp_pck, len);
+    msgpack_pack_str_body(mp_pck, buf, len);
+
+    /* tiers['spill_limit'] */
+    msgpack_pack_str(mp_pck, 11);
+    msgpack_pack_str_body(mp_pck, "spill_limit", 11);
+    flb_utils_bytes_to_human_readable_size(si->spill_limit,
+                                           buf, sizeof(buf) - 1);
+    len = strlen(buf);
+    msgpack_pack_str(mp_pck, len);
+    msgpack_pack_str_body(mp_pck, buf, len);
+
+    /* tiers['spilled'] */
+    msgpack_pack_str(mp_pck, 7);
+    msgpack_pack_str_body(mp_pck, "spilled", 7);
+    msgpack_pack_uint64(mp_pck, si->spilled);
+
+    /* tiers['promoted'] */
+    msgpack_pack_str(mp_pck, 8);
+    msgpack_pack_str_body(mp_pck, "promoted", 8);
+    msgpack_pack_uint64(mp_pck, si->promoted);
+}
+
 static void metrics_append_input(msgpack_packer *mp_pck,
                                  struct flb_config *ctx,
                                  struct flb_storage_metrics *sm)
@@ -90,6 +174,7 @@ static void metrics_append_input(msgpack_packer *mp_pck,
     struct mk_list *h_chunks;
     struct flb_input_instance *i;
     struct flb_input_chunk *ic;
+    struct flb_storage_input *si;
 
     msgpack_pack_str(mp_pck, 12);
     msgpack_pack_str_body(mp_pck, "input_chunks", 12);
@@ -105,8 +190,14 @@ static void metrics_append_input(msgpack_packer *mp_pck,
         msgpack_pack_str(mp_pck, len);
         msgpack_pack_str_body(mp_pck, tmp, len);
 
-        /* Map for 'status' and 'chunks' */
-        msgpack_pack_map(mp_pck, 2);
+        /* Map for 'status', 'chunks' and 'tiers' (tiered storage only) */
+        si = (struct flb_storage_input *) i->storage;
+        if (si && si->spill_stream) {
+            msgpack_pack_map(mp_pck, 3);
+        }
+        else {
+            msgpack_pack_map(mp_pck, 2);
+        }
 
         /*
          * Status
@@ -229,6 +320,10 @@ static void metrics_append_input(msgpack_packer *mp_pck,
         len = strlen(buf);
         msgpack_pack_str(mp_pck, len);
         msgpack_pack_str_body(mp_pck, buf, len);
+
+        if (si && si->spill_stream) {
+            metrics_append_tiers(mp_pck, i, si);
+        }
     }
 }
 
@@ -327,12 +422,14 @@ static void print_storage_info(struct flb_config *ctx, struct cio_ctx *cio)
 {
     char *sync;
     char *checksum;
+    char *compress;
     struct flb_input_instance *in;
 
     flb_info("[storage] version=%s, initializing...", cio_version());
 
     if (cio->root_path) {
-        flb_info("[storage] root path '%s'", cio->root_path);
+        flb_info("[storage] root path '%s'%s", cio->root_path,
+                 (cio->flags & CIO_WAL) ? ", write-ahead log" : "");
     }
     else {
         flb_info("[storage] in-memory");
@@ -346,14 +443,22 @@ static void print_storage_info(struct flb_config *ctx, struct cio_ctx *cio)
     }
 
     if (cio->flags & CIO_CHECKSUM) {
-        checksum = "enabled";
+        checksum = (cio->flags & CIO_CRC32C) ? "crc32c" : "crc32";
     }
     else {
         checksum = "disabled";
     }
 
-    flb_info("[storage] %s synchronization mode, checksum %s, max_chunks_up=%i",
-             sync, checksum, ctx->storage_max_chunks_up);
+    if (cio->flags & CIO_COMPRESS) {
+        compress = "enabled";
+    }
+    else {
+        compress = "disabled";
+    }
+
+    flb_info("[storage] %s synchronization mode, checksum %s, compression %s, "
+             "max_chunks_up=%i",
+             sync, checksum, compress, ctx->storage_max_chunks_up);
 
     /* Storage input plugin */
     if (ctx->storage_input_plugin) {
@@ -384,8 +489,10 @@ static int log_cb(struct cio_ctx *ctx, int level, const char *file, int line,
 int flb_storage_input_create(struct cio_ctx *cio,
                              struct flb_input_instance *in)
 {
+    char name[256];
     struct flb_storage_input *si;
     struct cio_stream *stream;
+    struct cio_stream *spill_stream = NULL;
 
     /* storage config: get stream type */
     if (in->storage_type == -1) {
@@ -399,11 +506,40 @@ int flb_storage_input_create(struct cio_ctx *cio,
         return -1;
     }
 
+    if (in->storage_tiered == FLB_TRUE) {
+        if (cio->root_path == NULL) {
+            flb_error("[storage] instance '%s' requested tiered storage "
+                      "but no filesystem path was defined.",
+                      flb_input_name(in));
+            return -1;
+        }
+
+        /*
+         * The spilled chunks use the file system stream named after the
+         * instance (like a 'filesystem' instance), so they are recovered
+         * by storage_backlog after a restart. The memory chunks get their
+         * own stream.
+         */
+        spill_stream = cio_stream_get(cio, in->name);
+        if (!spill_stream) {
+            spill_stream = cio_stream_create(cio, in->name, CIO_STORE_FS);
+            if (!spill_stream) {
+                flb_error("[storage] cannot create spill stream for "
+                          "instance %s", in->name);
+                return -1;
+            }
+        }
+        snprintf(name, sizeof(name) - 1, "%s.mem", in->name);
+    }
+    else {
+        snprintf(name, sizeof(name) - 1, "%s", in->name);
+    }
+
     /* Check for duplicates */
-    stream = cio_stream_get(cio, in->name);
+    stream = cio_stream_get(cio, name);
     if (!stream) {
         /* create stream for input instance */
-        stream = cio_stream_create(cio, in->name, in->storage_type);
+        stream = cio_stream_create(cio, name, in->storage_type);
         if (!stream) {
             flb_error("[storage] cannot create stream for instance %s",
                       in->name);
@@ -412,7 +548,7 @@ int flb_storage_input_create(struct cio_ctx *cio,
     }
 
     /* allocate storage context for the input instance */
-    si = flb_malloc(sizeof(struct flb_storage_input));
+    si = flb_calloc(1, sizeof(struct flb_storage_input));
     if (!si) {
         flb_errno();
         return -1;
@@ -421,6 +557,22 @@ int flb_storage_input_create(struct cio_ctx *cio,
     si->stream = stream;
     si->cio = cio;
     si->type = in->storage_type;
+
+    if (spill_stream) {
+        si->spill_stream = spill_stream;
+        si->spill_limit = in->storage_spill_limit;
+
+        /* by default spill before the instance gets paused */
+        if (si->spill_limit == 0) {
+            if (in->mem_buf_limit > 0) {
+                si->spill_limit = in->mem_buf_limit / 4 * 3;
+            }
+            else {
+                si->spill_limit = FLB_STORAGE_SPILL_LIMIT;
+            }
+        }
+        in->config->storage_tiers++;
+    }
     in->storage = si;
 
     return 0;
@@ -442,6 +594,93 @@ void flb_storage_input_destroy(struct flb_input_instance *in)
     in->storage = NULL;
 }
 
+/*
+ * Tiered storage: when the memory used by a tiered instance crosses its
+ * spill limit, the newest chunks that are not written nor being flushed
+ * anymore are moved to the file system, until the usage goes under 3/4 of
+ * the limit. When the usage drops under half of the limit, the oldest
+ * spilled chunks are put up again so their content is in memory by the
+ * time they are flushed. Spilled chunks keep their file until delivered.
+ *
+ * The engine calls this function at the end of the event loop iteration
+ * where a limit was crossed, and periodically to promote chunks.
+ */
+void flb_storage_tiers_balance(struct flb_config *ctx)
+{
+    int ret;
+    size_t total;
+    ssize_t size;
+    struct mk_list *head;
+    struct mk_list *c_head;
+    struct cio_chunk *ch;
+    struct flb_input_chunk *ic;
+    struct flb_input_instance *in;
+    struct flb_storage_input *si;
+
+    mk_list_foreach(head, &ctx->inputs) {
+        in = mk_list_entry(head, struct flb_input_instance, _head);
+        si = (struct flb_storage_input *) in->storage;
+        if (!si || !si->spill_stream) {
+            continue;
+        }
+
+        total = flb_input_chunk_total_size(in);
+        if (total >= si->spill_limit) {
+            mk_list_foreach_r(c_head, &in->chunks) {
+                if (total < si->spill_limit / 4 * 3) {
+                    break;
+                }
+
+                ic = mk_list_entry(c_head, struct flb_input_chunk, _head);
+                if (flb_input_chunk_is_spillable(ic) == FLB_FALSE) {
+                    continue;
+                }
+
+                size = flb_input_chunk_get_size(ic);
+                ret = flb_input_chunk_spill(ic);
+                if (ret == -1) {
+                    break;
+                }
+                si->spilled++;
+                if (size > 0) {
+                    total -= (size_t) size > total ? total : (size_t) size;
+                }
+            }
+        }
+        else if (total < si->spill_limit / 2) {
+            mk_list_foreach(c_head, &in->chunks) {
+                ic = mk_list_entry(c_head, struct flb_input_chunk, _head);
+                ch = (struct cio_chunk *) ic->chunk;
+                if (ch->st != si->spill_stream ||
+                    cio_chunk_is_up(ch) == CIO_TRUE) {
+                    continue;
+                }
+
+                ret = flb_input_chunk_set_up(ic);
+                if (ret == CIO_CORRUPTED) {
+                    continue;
+                }
+                else if (ret != CIO_OK) {
+                    /* most likely the max number of chunks up was reached */
+                    break;
+                }
+                si->promoted++;
+
+                total = flb_input_chunk_total_size(in);
+                if (total >= si->spill_limit / 2) {
+                    break;
+                }
+            }
+        }
+
+        /* refresh the counters, it might resume the instance */
+        flb_input_chunk_set_limits(in);
+    }
+
+    /* wait for the next append over the limit to try again */
+    ctx->storage_tiers_spill = FLB_FALSE;
+}
+
 static int storage_contexts_create(struct flb_config *config)
 {
     int c = 0;
@@ -480,6 +719,7 @@ int flb_storage_create(struct flb_config *ctx)
 {
     int ret;
     int flags;
+    struct flb_time tm;
     struct flb_input_instance *in = NULL;
     struct cio_ctx *cio;
 
@@ -505,6 +745,39 @@ int flb_storage_create(struct flb_config *ctx)
         flags |= CIO_CHECKSUM;
     }
 
+    /*
+     * checksum algorithm for new chunks: crc32 by default so chunks stay
+     * readable by previous releases; crc32c (CPU crc32 instruction when
+     * available) is opt-in. Existing chunks are verified with the
+     * algorithm recorded in their header.
+     */
+    if (ctx->storage_checksum_type &&
+        strcasecmp(ctx->storage_checksum_type, "crc32c") == 0) {
+        flags |= CIO_CRC32C;
+    }
+    else if (ctx->storage_checksum_type &&
+             strcasecmp(ctx->storage_checksum_type, "crc32") != 0) {
+        flb_error("[storage] invalid checksum type '%s'",
+                  ctx->storage_checksum_type);
+        return -1;
+    }
+
+    /* compression of finalized chunks */
+    if (ctx->storage_compress == FLB_TRUE) {
+        flags |= CIO_COMPRESS;
+    }
+
+    /* write-ahead log instead of one file per chunk */
+    if (ctx->storage_wal == FLB_TRUE) {
+        flags |= CIO_WAL;
+    }
+
+    /*
+     * Backlog chunks are registered 'down' reading their headers only, the
+     * content is mapped and verified when storage_backlog queues them.
+     */
+    flags |= CIO_LAZY_LOAD;
+
     /* Create chunkio context */
     cio = cio_create(ctx->storage_path, log_cb, CIO_LOG_DEBUG, flags);
     if (!cio) {
@@ -520,6 +793,8 @@ int flb_storage_create(struct flb_config *ctx)
     cio_set_max_chunks_up(ctx->cio, ctx->storage_max_chunks_up);
 
     /* Load content from the file system if any */
+    flb_time_get(&tm);
+    ctx->storage_bl_start = tm.tm;
     ret = cio_load(ctx->cio, NULL);
     if (ret == -1) {
         flb_error("[storage] error scanning root path content: %s",
@@ -530,6 +805,7 @@ int flb_storage_create(struct flb_config *ctx)
 
     /* Sort chunks */
     cio_qsort(ctx->cio, sort_chunk_cmp);
+    ctx->storage_bl_load_time = flb_storage_elapsed(ctx);
 
     /*
      * If we have a filesystem storage path, create an instance of the
@@ -564,6 +840,34 @@ int flb_storage_create(struct flb_config *ctx)
     return 0;
 }
 
+/* Seconds since the storage backlog recovery started */
+double flb_storage_elapsed(struct flb_config *ctx)
+{
+    struct flb_time now;
+    struct flb_time start;
+    struct flb_time diff;
+
+    flb_time_get(&now);
+    start.tm = ctx->storage_bl_start;
+    flb_time_diff(&now, &start, &diff);
+
+    return flb_time_to_double(&diff);
+}
+
+/*
+ * Commit the chunks content written since the last call. This is a no-op
+ * unless the write-ahead log is enabled, where records are grouped and
+ * stored with a single write per engine loop iteration.
+ */
+int flb_storage_flush(struct flb_config *ctx)
+{
+    if (!ctx->cio) {
+        return 0;
+    }
+
+    return cio_flush(ctx->cio);
+}
+
 void flb_storage_destroy(struct flb_config *ctx)
 {
     struct cio_ctx *cio;
@@ -33,25 +33,95 @@
 #include <fluent-bit/flb_scheduler.h>
 
 /*
- * Every task created must have an unique ID, this function lookup the
- * lowest number available in the tasks_map.
+ * Every task created must have an unique ID, the available IDs are kept in a
+ * stack (tasks_map_free) so taking and releasing one never scans the map.
  *
  * This 'id' is used by the task interface to communicate with the engine event
  * loop about some action.
  */
 
-static inline int map_get_task_id(struct flb_config *config)
+int flb_task_map_create(struct flb_config *config)
 {
     int i;
-    int map_size = (sizeof(config->tasks_map) / sizeof(struct flb_task_map));
+    int size;
 
-    for (i = 0; i < map_size; i++) {
-        if (config->tasks_map[i].task == NULL) {
-            return i;
-        }
+    size = config->tasks_map_size;
+    if (size <= 0) {
+        flb_error("[task] invalid %s value %i",
+                  FLB_CONF_STR_TASK_MAP_SIZE, size);
+        return -1;
+    }
+    else if (size > FLB_TASK_MAP_MAX) {
+        flb_warn("[task] %s=%i exceeds the task ID space, using %i",
+                 FLB_CONF_STR_TASK_MAP_SIZE, size, FLB_TASK_MAP_MAX);
+        size = FLB_TASK_MAP_MAX;
     }
 
-    return -1;
+    config->tasks_map = flb_calloc(size, sizeof(struct flb_task_map));
+    if (!config->tasks_map) {
+        flb_errno();
+        return -1;
+    }
+
+    config->tasks_map_free = flb_malloc(sizeof(int) * size);
+    if (!config->tasks_map_free) {
+        flb_errno();
+        flb_free(config->tasks_map);
+        config->tasks_map = NULL;
+        return -1;
+    }
+
+    /* Push the IDs in reverse order so the lowest ones are used first */
+    for (i = 0; i < size; i++) {
+        config->tasks_map_free[i] = size - 1 - i;
+    }
+    config->tasks_map_size = size;
+    config->tasks_map_free_count = size;
+    config->tasks_map_peak = 0;
+    config->tasks_map_full = 0;
+
+    return 0;
+}
+
+void flb_task_map_destroy(struct flb_config *config)
+{
+    if (config->tasks_map) {
+        flb_free(config->tasks_map);
+        config->tasks_map = NULL;
+    }
+    if (config->tasks_map_free) {
+        flb_free(config->tasks_map_free);
+        config->tasks_map_free = NULL;
+    }
+    config->tasks_map_free_count = 0;
+}
+
+/* Return the number of task IDs in use */
+int flb_task_map_used(struct flb_config *config)
+{
+    if (!config->tasks_map) {
+        return 0;
+    }
+    return config->tasks_map_size - config->tasks_map_free_count;
+}
+
+/* Take the ID on top of the free stack, -1 if the map is full */
+int flb_task_map_get_id(struct flb_config *config)
+{
+    int used;
+
+    if (config->tasks_map_free_count == 0) {
+        return -1;
+    }
+
+    config->tasks_map_free_count--;
+
+    used = config->tasks_map_size - config->tasks_map_free_count;
+    if (used > config->tasks_map_peak) {
+        config->tasks_map_peak = used;
+    }
+
+    return config->tasks_map_free[config->tasks_map_free_count];
 }
 
 static inline void map_set_task_id(int id, struct flb_task *task,
@@ -61,9 +131,10 @@ static inline void map_set_task_id(int id, struct flb_task *task,
 
 }
 
-static inline void map_free_task_id(int id, struct flb_config *config)
+void flb_task_map_free_id(int id, struct flb_config *config)
 {
     config->tasks_map[id].task = NULL;
+    config->tasks_map_free[config->tasks_map_free_count++] = id;
 }
 
 void flb_task_retry_destroy(struct flb_task_retry *retry)
@@ -242,8 +313,10 @@ static struct flb_task *task_alloc(struct flb_config *config)
     }
 
     /* Get ID and set back 'task' reference */
-    task_id = map_get_task_id(config);
+    task_id = flb_task_map_get_id(config);
     if (task_id == -1) {
+        flb_debug("[task] no task IDs available (%s=%i)",
+                  FLB_CONF_STR_TASK_MAP_SIZE, config->tasks_map_size);
         flb_free(task);
         return NULL;
     }
@@ -359,9 +432,15 @@ struct flb_task *flb_task_create(uint64_t ref_id,
     /* allocate task */
     task = task_alloc(config);
     if (!task) {
+        /* count the delayed chunks, not every dispatch attempt */
+        if (config->tasks_map_free_count == 0 && !ic->task_delayed) {
+            ic->task_delayed = FLB_TRUE;
+            config->tasks_map_full++;
+        }
         *err = FLB_TRUE;
         return NULL;
     }
+    ic->task_delayed = FLB_FALSE;
 
 #ifdef FLB_HAVE_METRICS
     total_events = ((struct flb_input_chunk *) ic)->total_records;
@@ -422,7 +501,8 @@ struct flb_task *flb_task_create(uint64_t ref_id,
             continue;
         }
 
-        if (flb_routes_mask_get_bit(task_ic->routes_mask, o_ins->id) != 0) {
+        if (flb_routes_mask_get_bit(task_ic->routes_mask, o_ins->id,
+                                    config) != 0) {
             route = flb_malloc(sizeof(struct flb_task_route));
             if (!route) {
                 flb_errno();
@@ -458,7 +538,7 @@ void flb_task_destroy(struct flb_task *task, int del)
     flb_debug("[task] destroy task=%p (task_id=%i)", task, task->id);
 
     /* Release task_id */
-    map_free_task_id(task->id, task->config);
+    flb_task_map_free_id(task->id, task->config);
 
     /* Remove routes */
     mk_list_foreach_safe(head, tmp, &task->routes) {
@@ -220,6 +220,14 @@ int is_same_metric(char *s1, char *s2) {
     return 1;
 }
 
+/* callback latencies (cb_*_usec) are exposed as gauges */
+static int is_gauge_metric(char *s)
+{
+    size_t p = extract_metric_name_end_position(s);
+
+    return p > 5 && strncmp(s + p - 5, "_usec", 5) == 0;
+}
+
 /* derive HELP text from metricname */
 /* if help text length > 128, increase init memory for metric_helptxt */
 flb_sds_t metrics_help_txt(char *metric_name, flb_sds_t *metric_helptxt)
@@ -257,6 +265,18 @@ flb_sds_t metrics_help_txt(char *metric_name, flb_sds_t *metric_helptxt)
     else if (strstr(metric_name, "output_retried_records")) {
         return flb_sds_cat(*metric_helptxt, " Number of retried records.\n", 28);
     }
+    else if (strstr(metric_name, "_cb_p50_usec")) {
+        return flb_sds_cat(*metric_helptxt, " Median callback time in microseconds.\n", 39);
+    }
+    else if (strstr(metric_name, "_cb_p99_usec")) {
+        return flb_sds_cat(*metric_helptxt, " 99th percentile of the callback time in microseconds.\n", 55);
+    }
+    else if (strstr(metric_name, "_cb_max_usec")) {
+        return flb_sds_cat(*metric_helptxt, " Maximum callback time in microseconds.\n", 40);
+    }
+    else if (strstr(metric_name, "_cb_stalls")) {
+        return flb_sds_cat(*metric_helptxt, " Number of callbacks that blocked the engine.\n", 46);
+    }
     else {
         return (flb_sds_cat(*metric_helptxt, " Fluentbit metrics.\n", 20));
     }
@@ -403,7 +423,15 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
                 sds_metric = flb_sds_cat(sds_metric, k.via.str.ptr, k.via.str.size);
                 sds_metric = flb_sds_cat(sds_metric, "_", 1);
                 sds_metric = flb_sds_cat(sds_metric, mk.via.str.ptr, mk.via.str.size);
-                sds_metric = flb_sds_cat(sds_metric, "_total{name=\"", 13);
+
+                /* callback latencies (cb_*_usec) are gauges, not counters */
+                if (mk.via.str.size > 5 &&
+                    strncmp(mk.via.str.ptr + mk.via.str.size - 5, "_usec", 5) == 0) {
+                    sds_metric = flb_sds_cat(sds_metric, "{name=\"", 7);
+                }
+                else {
+                    sds_metric = flb_sds_cat(sds_metric, "_total{name=\"", 13);
+                }
                 sds_metric = flb_sds_cat(sds_metric, sk.via.str.ptr, sk.via.str.size);
                 sds_metric = flb_sds_cat(sds_metric, "\"} ", 3);
                 sds_metric = flb_sds_cat(sds_metric, tmp, len);
@@ -432,7 +460,12 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
     null_check(tmp_sds);
     tmp_sds = flb_sds_cat(sds, metrics_arr[0], extract_metric_name_end_position(metrics_arr[0]));
     null_check(tmp_sds);
-    tmp_sds = flb_sds_cat(sds, " counter\n", 9);
+    if (is_gauge_metric(metrics_arr[0])) {
+        tmp_sds = flb_sds_cat(sds, " gauge\n", 7);
+    }
+    else {
+        tmp_sds = flb_sds_cat(sds, " counter\n", 9);
+    }
     null_check(tmp_sds);
 
     for (i = 0; i < num_metrics; i++) {
@@ -453,7 +486,12 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
             null_check(tmp_sds);
             tmp_sds = flb_sds_cat(sds, metrics_arr[i+1], extract_metric_name_end_position(metrics_arr[i+1]));
             null_check(tmp_sds);
-            tmp_sds = flb_sds_cat(sds, " counter\n", 9);
+            if (is_gauge_metric(metrics_arr[i+1])) {
+                tmp_sds = flb_sds_cat(sds, " gauge\n", 7);
+            }
+            else {
+                tmp_sds = flb_sds_cat(sds, " counter\n", 9);
+            }
             null_check(tmp_sds);
         }
     }
@@ -850,14 +850,20 @@ int flb_ml_parsers_init(struct flb_config *ctx)
 int flb_ml_auto_flush_init(struct flb_ml *ml)
 {
     int ret;
+    struct flb_sched *sched;
     struct flb_config *ctx;
 
     if (!ml) {
         return -1;
     }
 
+    /* the timer runs in the thread creating it (e.g: threaded inputs) */
     ctx = ml->config;
-    if (!ctx->sched) {
+    sched = flb_sched_ctx_get();
+    if (!sched) {
+        sched = ctx->sched;
+    }
+    if (!sched) {
         flb_error("[multiline] scheduler context has not been created");
         return -1;
     }
@@ -868,7 +874,7 @@ int flb_ml_auto_flush_init(struct flb_ml *ml)
     }
 
     /* Create flush timer */
-    ret = flb_sched_timer_cb_create(ctx->sched,
+    ret = flb_sched_timer_cb_create(sched,
                                     FLB_SCHED_TIMER_CB_PERM,
                                     ml->flush_ms,
                                     cb_ml_flush_timer,
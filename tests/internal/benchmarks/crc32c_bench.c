@@ -0,0 +1,88 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Micro benchmark: checksum of a chunk sized buffer with the CRC32 table
+ * used by chunkio so far and with CRC32C.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <chunkio/cio_crc32.h>
+#include <cmetrics/cmt_time.h>
+
+#define BENCH_SIZE    (2 * 1024 * 1024)
+#define BENCH_ROUNDS  64
+
+static uint32_t checksum(int crc32c, const void *buf, size_t len)
+{
+    crc_t crc;
+
+    if (crc32c) {
+        crc = cio_crc32c_init();
+        crc = cio_crc32c_update(crc, buf, len);
+        return (uint32_t) cio_crc32c_finalize(crc);
+    }
+
+    crc = cio_crc32_init();
+    crc = cio_crc32_update(crc, buf, len);
+    return (uint32_t) cio_crc32_finalize(crc);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int rounds = BENCH_ROUNDS;
+    uint64_t t0;
+    uint64_t t_crc32;
+    uint64_t t_crc32c_sw;
+    uint64_t t_crc32c;
+    uint32_t sum = 0;
+    double mb;
+    unsigned char *buf;
+
+    if (argc > 1) {
+        rounds = atoi(argv[1]);
+        if (rounds <= 0) {
+            fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    buf = flb_malloc(BENCH_SIZE);
+    if (!buf) {
+        return 1;
+    }
+    for (i = 0; i < BENCH_SIZE; i++) {
+        buf[i] = (unsigned char) i;
+    }
+
+    t0 = cmt_time_now();
+    for (i = 0; i < rounds; i++) {
+        sum += checksum(FLB_FALSE, buf, BENCH_SIZE);
+    }
+    t_crc32 = cmt_time_now() - t0;
+
+    t0 = cmt_time_now();
+    for (i = 0; i < rounds; i++) {
+        sum += crc32c_update_sw(crc32c_init(), buf, BENCH_SIZE);
+    }
+    t_crc32c_sw = cmt_time_now() - t0;
+
+    t0 = cmt_time_now();
+    for (i = 0; i < rounds; i++) {
+        sum += checksum(FLB_TRUE, buf, BENCH_SIZE);
+    }
+    t_crc32c = cmt_time_now() - t0;
+
+    mb = (double) BENCH_SIZE * rounds / (1024 * 1024) * 1000000000.0;
+    printf("%i MB: crc32 %.0f MB/s, crc32c table %.0f MB/s, "
+           "crc32c %.0f MB/s (hardware=%s) [%u]\n",
+           (BENCH_SIZE / (1024 * 1024)) * rounds,
+           mb / t_crc32, mb / t_crc32c_sw, mb / t_crc32c,
+           crc32c_hw_available() ? "yes" : "no", sum & 1);
+
+    flb_free(buf);
+    return 0;
+}
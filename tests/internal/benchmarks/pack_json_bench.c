@@ -0,0 +1,157 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Micro benchmark: encode log like records (access logs, JSON messages
+ * and UTF-8 text) already unpacked, to measure the JSON encoder only,
+ * and parse the JSON back to msgpack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_pack.h>
+#include <msgpack.h>
+#include <cmetrics/cmt_time.h>
+
+#define BENCH_RECORDS  2000
+#define BENCH_ROUNDS   50
+
+static void sample_pack_str(msgpack_packer *pck, const char *str)
+{
+    msgpack_pack_str(pck, strlen(str));
+    msgpack_pack_str_body(pck, str, strlen(str));
+}
+
+static void sample_records(msgpack_sbuffer *sbuf, int type, int records)
+{
+    int i;
+    char line[512];
+    msgpack_packer pck;
+
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, records);
+
+    for (i = 0; i < records; i++) {
+        if (type == 0) {
+            snprintf(line, sizeof(line),
+                     "10.0.%i.%i - - [21/Jun/2021:10:%02i:%02i +0000] "
+                     "\"GET /api/v1/items/%i?page=%i HTTP/1.1\" 200 %i "
+                     "\"-\" \"Mozilla/5.0 (X11; Linux x86_64) "
+                     "AppleWebKit/537.36 (KHTML, like Gecko) "
+                     "Chrome/91.0.4472.114 Safari/537.36\"",
+                     i % 256, i % 100, i % 60, i % 60, i, i % 10, i * 7);
+        }
+        else if (type == 1) {
+            snprintf(line, sizeof(line),
+                     "{\"level\":\"info\",\"ts\":\"2021-06-21T10:00:%02iZ\","
+                     "\"caller\":\"server/handler.go:%i\",\"msg\":\"request "
+                     "completed\",\"path\":\"C:\\\\data\\\\%i\",\n"
+                     "\"latency\":%i}\t", i % 60, i, i, i % 1000);
+        }
+        else {
+            snprintf(line, sizeof(line),
+                     "Usuario %i inició sesión desde São Paulo — "
+                     "ユーザーがログインしました — Пользователь вошёл "
+                     "в систему 🚀 %i", i, i * 3);
+        }
+
+        msgpack_pack_map(&pck, 4);
+        sample_pack_str(&pck, "log");
+        sample_pack_str(&pck, line);
+        sample_pack_str(&pck, "stream");
+        sample_pack_str(&pck, "stdout");
+        sample_pack_str(&pck, "pod");
+        sample_pack_str(&pck, "api-server-5d8f7c9b6-x2x8z");
+        sample_pack_str(&pck, "seq");
+        msgpack_pack_uint64(&pck, i);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int c;
+    int ret;
+    int rounds = BENCH_ROUNDS;
+    int root_type;
+    size_t off;
+    size_t size;
+    size_t bytes;
+    size_t json_len = 0;
+    size_t out_size;
+    uint64_t t0;
+    uint64_t t;
+    double mb;
+    char *buf;
+    char *out_buf;
+    msgpack_sbuffer sbuf;
+    msgpack_unpacked result;
+    const char *names[] = {"access", "json", "utf8"};
+
+    if (argc > 1) {
+        rounds = atoi(argv[1]);
+        if (rounds <= 0) {
+            fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (c = 0; c < 3; c++) {
+        msgpack_sbuffer_init(&sbuf);
+        sample_records(&sbuf, c, BENCH_RECORDS);
+
+        off = 0;
+        msgpack_unpacked_init(&result);
+        ret = msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off);
+        if (ret != MSGPACK_UNPACK_SUCCESS) {
+            return 1;
+        }
+
+        size = sbuf.size * 4;
+        buf = flb_malloc(size);
+        if (!buf) {
+            return 1;
+        }
+
+        bytes = 0;
+        t0 = cmt_time_now();
+        for (i = 0; i < rounds; i++) {
+            ret = flb_msgpack_to_json(buf, size, &result.data);
+            if (ret <= 0) {
+                fprintf(stderr, "%s: encoding failed\n", names[c]);
+                return 1;
+            }
+            bytes += ret;
+            json_len = ret;
+        }
+        t = cmt_time_now() - t0;
+
+        mb = (double) bytes / (1024 * 1024);
+        printf("%-6s %.1f MB of JSON, %.0f MB/s\n",
+               names[c], mb, mb * 1000000000.0 / t);
+
+        /* and back to the same msgpack */
+        t0 = cmt_time_now();
+        for (i = 0; i < rounds; i++) {
+            ret = flb_pack_json(buf, json_len, &out_buf, &out_size,
+                                &root_type);
+            if (ret != 0) {
+                fprintf(stderr, "%s: parsing failed\n", names[c]);
+                return 1;
+            }
+            flb_free(out_buf);
+        }
+        t = cmt_time_now() - t0;
+
+        printf("%-6s %.1f MB of JSON parsed, %.0f MB/s\n",
+               names[c], mb, mb * 1000000000.0 / t);
+
+        flb_free(buf);
+        msgpack_unpacked_destroy(&result);
+        msgpack_sbuffer_destroy(&sbuf);
+    }
+
+    return 0;
+}
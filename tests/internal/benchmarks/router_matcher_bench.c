@@ -0,0 +1,124 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Micro benchmark: many Tags against a Kubernetes like set of rules, with
+ * one flb_router_match() call per pattern vs a single matcher scan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_router_matcher.h>
+#include <cmetrics/cmt_time.h>
+
+#define BENCH_PATTERNS  64
+#define BENCH_TAGS      2000
+#define BENCH_ROUNDS    10
+
+int main(int argc, char **argv)
+{
+    int i;
+    int j;
+    int r;
+    int len;
+    int ret = 0;
+    int rounds = BENCH_ROUNDS;
+    int hits_loop = 0;
+    int hits_matcher = 0;
+    uint64_t t0;
+    uint64_t t_loop;
+    uint64_t t_matcher;
+    uint64_t mask[BENCH_PATTERNS / 64];
+    char *patterns[BENCH_PATTERNS + 1];
+    char *tags[BENCH_TAGS];
+    struct flb_router_matcher *m;
+
+    if (argc > 1) {
+        rounds = atoi(argv[1]);
+        if (rounds <= 0) {
+            fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    m = flb_router_matcher_create(BENCH_PATTERNS - 1);
+    if (!m) {
+        return 1;
+    }
+
+    for (i = 0; i < BENCH_PATTERNS; i++) {
+        patterns[i] = flb_malloc(64);
+        if (i % 4 == 0) {
+            snprintf(patterns[i], 64, "kube.var.log.containers.app-%i*", i);
+        }
+        else if (i % 4 == 1) {
+            snprintf(patterns[i], 64, "kube.*_ns-%i_*", i);
+        }
+        else if (i % 4 == 2) {
+            snprintf(patterns[i], 64, "*container-%i.log", i);
+        }
+        else {
+            snprintf(patterns[i], 64, "host.%i.*", i);
+        }
+
+        if (flb_router_matcher_add(m, i, patterns[i], NULL) != 0) {
+            fprintf(stderr, "cannot add pattern %s\n", patterns[i]);
+            ret = 1;
+        }
+    }
+    patterns[BENCH_PATTERNS] = NULL;
+
+    for (i = 0; i < BENCH_TAGS; i++) {
+        tags[i] = flb_malloc(128);
+        snprintf(tags[i], 128,
+                 "kube.var.log.containers.app-%i-%x_ns-%i_container-%i.log",
+                 i % 97, i * 2654435761u, i % 13, i % 71);
+    }
+
+    t0 = cmt_time_now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < BENCH_TAGS; i++) {
+            len = strlen(tags[i]);
+            for (j = 0; j < BENCH_PATTERNS; j++) {
+                hits_loop += flb_router_match(tags[i], len, patterns[j], NULL);
+            }
+        }
+    }
+    t_loop = cmt_time_now() - t0;
+
+    t0 = cmt_time_now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < BENCH_TAGS; i++) {
+            len = strlen(tags[i]);
+            flb_router_matcher_match(m, tags[i], len, mask);
+            for (j = 0; j < BENCH_PATTERNS; j++) {
+                hits_matcher += (mask[j / 64] >> (j % 64)) & 1;
+            }
+        }
+    }
+    t_matcher = cmt_time_now() - t0;
+
+    if (hits_loop != hits_matcher) {
+        fprintf(stderr, "matches differ: router_match=%i matcher=%i\n",
+                hits_loop, hits_matcher);
+        ret = 1;
+    }
+
+    printf("%i tags x %i patterns: router_match %.2f ms, matcher %.2f ms "
+           "(%i DFA states)\n",
+           BENCH_TAGS * rounds, BENCH_PATTERNS,
+           t_loop / 1000000.0, t_matcher / 1000000.0, m->n_states);
+
+    flb_router_matcher_destroy(m);
+    for (i = 0; i < BENCH_PATTERNS; i++) {
+        flb_free(patterns[i]);
+    }
+    for (i = 0; i < BENCH_TAGS; i++) {
+        flb_free(tags[i]);
+    }
+
+    return ret;
+}
@@ -0,0 +1,67 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <chunkio/cio_crc32.h>
+
+#include "flb_tests_internal.h"
+
+static uint32_t checksum(int crc32c, const void *buf, size_t len)
+{
+    crc_t crc;
+
+    if (crc32c) {
+        crc = cio_crc32c_init();
+        crc = cio_crc32c_update(crc, buf, len);
+        return (uint32_t) cio_crc32c_finalize(crc);
+    }
+
+    crc = cio_crc32_init();
+    crc = cio_crc32_update(crc, buf, len);
+    return (uint32_t) cio_crc32_finalize(crc);
+}
+
+/* Standard check values for "123456789" */
+void test_crc32c_check_value()
+{
+    TEST_CHECK(checksum(FLB_FALSE, "123456789", 9) == 0xcbf43926);
+    TEST_CHECK(checksum(FLB_TRUE, "123456789", 9) == 0xe3069283);
+    TEST_CHECK(checksum(FLB_TRUE, "", 0) == 0);
+}
+
+/* The accelerated and the table-driven versions must always agree */
+void test_crc32c_sw_hw()
+{
+    int i;
+    int off;
+    size_t len;
+    crc_t a;
+    crc_t b;
+    unsigned char *buf;
+
+    buf = flb_malloc(4096 + 16);
+    TEST_CHECK(buf != NULL);
+    for (i = 0; i < 4096 + 16; i++) {
+        buf[i] = (unsigned char) (i * 2654435761u >> 13);
+    }
+
+    /* unaligned starts, odd lengths and incremental updates */
+    for (off = 0; off < 16; off++) {
+        for (len = 0; len < 4096; len += 61) {
+            a = crc32c_update(crc32c_init(), buf + off, len / 3);
+            a = crc32c_update(a, buf + off + len / 3, len - len / 3);
+            b = crc32c_update_sw(crc32c_init(), buf + off, len);
+            if (!TEST_CHECK(a == b)) {
+                TEST_MSG("offset=%i length=%zu", off, len);
+            }
+        }
+    }
+
+    flb_free(buf);
+}
+
+TEST_LIST = {
+    { "check_value" , test_crc32c_check_value },
+    { "sw_hw"       , test_crc32c_sw_hw },
+    { 0 }
+};
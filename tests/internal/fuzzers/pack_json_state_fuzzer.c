@@ -1,15 +1,28 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_error.h>
 
 int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    int ret;
     int out_size= 0;
     char *out_buf = NULL;
     struct flb_pack_state state;
 
     /* Target json packer */
     flb_pack_state_init(&state);
-    flb_pack_json_state(data, size, &out_buf, &out_size, &state);
+    flb_pack_json_state((const char *) data, size, &out_buf, &out_size, &state);
+    flb_pack_state_reset(&state);
+    if (out_buf != NULL)
+        flb_free(out_buf);
+
+    /* Same data received in two parts, the state is resumed */
+    out_buf = NULL;
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state((const char *) data, size / 2, &out_buf, &out_size, &state);
+    if (ret == FLB_ERR_JSON_PART) {
+        flb_pack_json_state((const char *) data, size, &out_buf, &out_size, &state);
+    }
     flb_pack_state_reset(&state);
     if (out_buf != NULL)
         flb_free(out_buf);
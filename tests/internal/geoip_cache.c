@@ -0,0 +1,159 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_network.h>
+
+#include "../../plugins/filter_apm_geoip/geoip_cache.h"
+#include "flb_tests_internal.h"
+
+static void addr_v4(const char *ip, uint8_t *addr)
+{
+    TEST_CHECK(inet_pton(AF_INET, ip, addr) == 1);
+}
+
+static void addr_v6(const char *ip, uint8_t *addr)
+{
+    TEST_CHECK(inet_pton(AF_INET6, ip, addr) == 1);
+}
+
+/* look 'addr' up, 'expected' is the cached fragment or NULL for a miss */
+static void check_get(struct geoip_cache *cache, int family,
+                      const uint8_t *addr, const char *expected)
+{
+    int ret;
+    msgpack_sbuffer sbuf;
+
+    msgpack_sbuffer_init(&sbuf);
+    ret = geoip_cache_get(cache, family, addr, &sbuf);
+    if (!expected) {
+        TEST_CHECK(ret == FLB_FALSE);
+        TEST_CHECK(sbuf.size == 0);
+    }
+    else if (TEST_CHECK(ret == FLB_TRUE)) {
+        TEST_CHECK(sbuf.size == strlen(expected) &&
+                   memcmp(sbuf.data, expected, sbuf.size) == 0);
+    }
+    msgpack_sbuffer_destroy(&sbuf);
+}
+
+void test_cache_hit()
+{
+    int ret;
+    uint8_t addr[16];
+    struct geoip_cache cache;
+
+    ret = geoip_cache_init(&cache, 16);
+    TEST_CHECK(ret == 0);
+
+    addr_v4("10.1.2.3", addr);
+    geoip_cache_set(&cache, AF_INET, addr, 16, "net-a", 5);
+
+    /* every address of the network is served by the cache */
+    check_get(&cache, AF_INET, addr, "net-a");
+    addr_v4("10.1.255.1", addr);
+    check_get(&cache, AF_INET, addr, "net-a");
+
+    /* prefixes not aligned to a byte */
+    addr_v4("192.168.3.4", addr);
+    geoip_cache_set(&cache, AF_INET, addr, 22, "net-b", 5);
+    addr_v4("192.168.0.1", addr);
+    check_get(&cache, AF_INET, addr, "net-b");
+
+    addr_v6("2001:db8:1::1", addr);
+    geoip_cache_set(&cache, AF_INET6, addr, 48, "net-c", 5);
+    addr_v6("2001:db8:1:ffff::2", addr);
+    check_get(&cache, AF_INET6, addr, "net-c");
+
+    TEST_CHECK(cache.hits == 4);
+    TEST_CHECK(cache.misses == 0);
+
+    geoip_cache_destroy(&cache);
+}
+
+void test_cache_miss()
+{
+    int ret;
+    uint8_t addr[16];
+    struct geoip_cache cache;
+
+    ret = geoip_cache_init(&cache, 16);
+    TEST_CHECK(ret == 0);
+
+    /* empty cache */
+    addr_v4("10.1.2.3", addr);
+    check_get(&cache, AF_INET, addr, NULL);
+
+    geoip_cache_set(&cache, AF_INET, addr, 16, "net-a", 5);
+
+    /* outside of the network */
+    addr_v4("10.2.0.1", addr);
+    check_get(&cache, AF_INET, addr, NULL);
+    addr_v4("192.168.3.4", addr);
+    geoip_cache_set(&cache, AF_INET, addr, 22, "net-b", 5);
+    addr_v4("192.168.4.1", addr);
+    check_get(&cache, AF_INET, addr, NULL);
+
+    /* same leading bytes, other family */
+    addr_v4("10.1.2.3", addr);
+    check_get(&cache, AF_INET6, addr, NULL);
+
+    TEST_CHECK(cache.hits == 0);
+    TEST_CHECK(cache.misses == 4);
+    geoip_cache_destroy(&cache);
+
+    /* a disabled cache never stores anything */
+    ret = geoip_cache_init(&cache, 0);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cache.ht == NULL);
+
+    geoip_cache_set(&cache, AF_INET, addr, 16, "net-a", 5);
+    check_get(&cache, AF_INET, addr, NULL);
+    geoip_cache_destroy(&cache);
+}
+
+/* The least recently used network goes first */
+void test_cache_eviction()
+{
+    int ret;
+    uint8_t a[16];
+    uint8_t b[16];
+    uint8_t c[16];
+    struct geoip_cache cache;
+
+    ret = geoip_cache_init(&cache, 2);
+    TEST_CHECK(ret == 0);
+
+    addr_v4("10.1.0.1", a);
+    addr_v4("10.2.0.1", b);
+    addr_v4("10.3.0.1", c);
+
+    geoip_cache_set(&cache, AF_INET, a, 16, "net-a", 5);
+    geoip_cache_set(&cache, AF_INET, b, 16, "net-b", 5);
+
+    /* touch 'a', 'b' becomes the eviction candidate */
+    check_get(&cache, AF_INET, a, "net-a");
+
+    geoip_cache_set(&cache, AF_INET, c, 16, "net-c", 5);
+    TEST_CHECK(cache.ht->total_count == 2);
+
+    check_get(&cache, AF_INET, b, NULL);
+    check_get(&cache, AF_INET, a, "net-a");
+    check_get(&cache, AF_INET, c, "net-c");
+
+    /* an evicted network is resolved and cached again */
+    geoip_cache_set(&cache, AF_INET, b, 16, "net-b", 5);
+    check_get(&cache, AF_INET, b, "net-b");
+    check_get(&cache, AF_INET, a, NULL);
+
+    TEST_CHECK(cache.hits == 4);
+    TEST_CHECK(cache.misses == 2);
+    geoip_cache_destroy(&cache);
+}
+
+TEST_LIST = {
+    { "cache_hit",      test_cache_hit },
+    { "cache_miss",     test_cache_miss },
+    { "cache_eviction", test_cache_eviction },
+    { 0 }
+};
@@ -1,6 +1,7 @@
 /* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_hash.h>
 
 #include "flb_tests_internal.h"
@@ -321,6 +322,87 @@ void test_older_eviction()
     flb_hash_destroy(ht);
 }
 
+void test_lru_eviction()
+{
+    int ret;
+    const char *out_buf;
+    size_t out_size;
+    struct flb_hash *ht;
+
+    ht = flb_hash_create(FLB_HASH_EVICT_LRU, 8, 2);
+    TEST_CHECK(ht != NULL);
+
+    ret = ht_add(ht, "key1", "value1");
+    TEST_CHECK(ret != -1);
+
+    ret = ht_add(ht, "key2", "value2");
+    TEST_CHECK(ret != -1);
+
+    /* key1 becomes the most recently used entry */
+    ret = flb_hash_get(ht, "key1", 4, (void *) &out_buf, &out_size);
+    TEST_CHECK(ret >= 0);
+
+    ret = ht_add(ht, "key3", "value3");
+    TEST_CHECK(ret != -1);
+
+    ret = flb_hash_get(ht, "key2", 4, (void *) &out_buf, &out_size);
+    TEST_CHECK(ret == -1);
+
+    ret = flb_hash_get(ht, "key1", 4, (void *) &out_buf, &out_size);
+    TEST_CHECK(ret >= 0);
+
+    ret = flb_hash_get(ht, "key3", 4, (void *) &out_buf, &out_size);
+    TEST_CHECK(ret >= 0);
+
+    /* key1 is now the least recently used one */
+    ret = ht_add(ht, "key4", "value4");
+    TEST_CHECK(ret != -1);
+
+    ret = flb_hash_get(ht, "key1", 4, (void *) &out_buf, &out_size);
+    TEST_CHECK(ret == -1);
+
+    ret = flb_hash_get(ht, "key3", 4, (void *) &out_buf, &out_size);
+    TEST_CHECK(ret >= 0);
+
+    flb_hash_destroy(ht);
+}
+
+/* Replacing the value of a stored key never evicts another entry */
+void test_replace_full()
+{
+    int ret;
+    const char *out_buf;
+    size_t out_size;
+    struct flb_hash *ht;
+
+    ht = flb_hash_create(FLB_HASH_EVICT_LRU, 8, 2);
+    TEST_CHECK(ht != NULL);
+
+    ret = ht_add(ht, "key1", "value1");
+    TEST_CHECK(ret != -1);
+
+    ret = ht_add(ht, "key2", "value2");
+    TEST_CHECK(ret != -1);
+
+    ret = ht_add(ht, "key2", "value3");
+    TEST_CHECK(ret != -1);
+    TEST_CHECK(ht->total_count == 2);
+
+    TEST_CHECK(flb_hash_exists(ht, "key1", 4) == FLB_TRUE);
+    TEST_CHECK(flb_hash_exists(ht, "key3", 4) == FLB_FALSE);
+
+    ret = flb_hash_get(ht, "key2", 4, (void *) &out_buf, &out_size);
+    TEST_CHECK(ret >= 0 && strcmp(out_buf, "value3") == 0);
+
+    /* a new key does */
+    ret = ht_add(ht, "key3", "value3");
+    TEST_CHECK(ret != -1);
+    TEST_CHECK(ht->total_count == 2);
+    TEST_CHECK(flb_hash_exists(ht, "key1", 4) == FLB_FALSE);
+
+    flb_hash_destroy(ht);
+}
+
 void test_pointer()
 {
     int ret;
@@ -364,6 +446,8 @@ TEST_LIST = {
     { "random_eviction", test_random_eviction },
     { "less_used_eviction", test_less_used_eviction },
     { "older_eviction", test_older_eviction },
+    { "lru_eviction", test_lru_eviction },
+    { "replace_full", test_replace_full },
     { "pointer", test_pointer },
     { 0 }
 };
@@ -6,6 +6,12 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_mp.h>
+#include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_storage.h>
+#include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_time.h>
+#include <chunkio/chunkio.h>
 #include "flb_tests_internal.h"
 
 #include "data/input_chunk/log/test_buffer_drop_chunks.h"
@@ -316,10 +322,678 @@ void flb_test_input_chunk_dropping_chunks()
     flb_destroy(ctx);
 }
 
+void flb_test_input_chunk_coalesce()
+{
+    int i;
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    int size = sizeof(TEST_BUFFER_DROP_CHUNKS) - 1;
+    flb_ctx_t *ctx;
+    size_t total_bytes;
+    struct flb_input_instance *i_ins;
+    struct flb_input_chunk *ic;
+    struct mk_list *tmp;
+    struct mk_list *head;
+
+    ctx = flb_create();
+
+    /* a long flush interval, chunks are dispatched by hand */
+    ret = flb_service_set(ctx,
+                          "flush", "60", "grace", "1",
+                          "Log_Level", "error",
+                          NULL);
+    TEST_CHECK_(ret == 0, "setting service options");
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(flb_input_set(ctx, in_ffd,
+                             "tag", "test",
+                             "chunk.max_age", "60",
+                             "chunk.target_size", "64K",
+                             NULL) == 0);
+
+    out_ffd = flb_output(ctx, (char *) "null", NULL);
+    flb_output_set(ctx, out_ffd, "match", "test", NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    i_ins = mk_list_entry_first(&ctx->config->inputs,
+                                struct flb_input_instance,
+                                _head);
+
+    /* create three small chunks for the same Tag */
+    for (i = 0; i < 3; i++) {
+        flb_lib_push(ctx, in_ffd, (char *) TEST_BUFFER_DROP_CHUNKS, size);
+        sleep(1);
+        mk_list_foreach(head, &i_ins->chunks) {
+            ic = mk_list_entry(head, struct flb_input_chunk, _head);
+            cio_chunk_lock(ic->chunk);
+        }
+    }
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == 3);
+
+    total_bytes = 0;
+    mk_list_foreach(head, &i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        total_bytes += flb_input_chunk_get_size(ic);
+    }
+
+    ret = flb_input_chunk_coalesce(i_ins);
+    TEST_CHECK(ret == 2);
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == 1);
+
+    ic = mk_list_entry_first(&i_ins->chunks, struct flb_input_chunk, _head);
+    TEST_CHECK(flb_input_chunk_get_size(ic) == total_bytes);
+
+    mk_list_foreach_safe(head, tmp, &i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        flb_input_chunk_destroy(ic, FLB_TRUE);
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/* records not seen by the stream processor are kept after a merge */
+void flb_test_input_chunk_coalesce_stream_off()
+{
+    int i;
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    int size = sizeof(TEST_BUFFER_DROP_CHUNKS) - 1;
+    flb_ctx_t *ctx;
+    size_t sizes[3];
+    struct flb_input_instance *i_ins;
+    struct flb_input_chunk *ic;
+    struct flb_input_chunk *chunks[3];
+    struct mk_list *tmp;
+    struct mk_list *head;
+
+    ctx = flb_create();
+
+    ret = flb_service_set(ctx,
+                          "flush", "60", "grace", "1",
+                          "Log_Level", "error",
+                          NULL);
+    TEST_CHECK_(ret == 0, "setting service options");
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(flb_input_set(ctx, in_ffd,
+                             "tag", "test",
+                             "chunk.max_age", "60",
+                             "chunk.target_size", "64K",
+                             NULL) == 0);
+
+    out_ffd = flb_output(ctx, (char *) "null", NULL);
+    flb_output_set(ctx, out_ffd, "match", "test", NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    i_ins = mk_list_entry_first(&ctx->config->inputs,
+                                struct flb_input_instance,
+                                _head);
+
+    for (i = 0; i < 3; i++) {
+        flb_lib_push(ctx, in_ffd, (char *) TEST_BUFFER_DROP_CHUNKS, size);
+        sleep(1);
+        mk_list_foreach(head, &i_ins->chunks) {
+            ic = mk_list_entry(head, struct flb_input_chunk, _head);
+            cio_chunk_lock(ic->chunk);
+        }
+    }
+    if (!TEST_CHECK(mk_list_size(&i_ins->chunks) == 3)) {
+        flb_stop(ctx);
+        flb_destroy(ctx);
+        return;
+    }
+
+    i = 0;
+    mk_list_foreach(head, &i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        chunks[i] = ic;
+        sizes[i] = cio_chunk_get_content_size(ic->chunk);
+        i++;
+    }
+
+    /*
+     * first chunk fully processed, the second one not processed at all and
+     * the third one processed: the second chunk is merged and its records
+     * are still pending, the third one cannot follow them.
+     */
+    chunks[0]->stream_off = sizes[0];
+    chunks[1]->stream_off = 0;
+    chunks[2]->stream_off = sizes[2];
+
+    ret = flb_input_chunk_coalesce(i_ins);
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == 2);
+
+    ic = mk_list_entry_first(&i_ins->chunks, struct flb_input_chunk, _head);
+    TEST_CHECK(ic == chunks[0]);
+    TEST_CHECK(cio_chunk_get_content_size(ic->chunk) == sizes[0] + sizes[1]);
+    TEST_CHECK(ic->stream_off == sizes[0]);
+
+    ic = mk_list_entry_last(&i_ins->chunks, struct flb_input_chunk, _head);
+    TEST_CHECK(ic == chunks[2]);
+    TEST_CHECK(ic->stream_off == sizes[2]);
+
+    /* a processed chunk after a fully processed one keeps its offset */
+    chunks[0]->stream_off = sizes[0] + sizes[1];
+    ret = flb_input_chunk_coalesce(i_ins);
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == 1);
+    TEST_CHECK(chunks[0]->stream_off == sizes[0] + sizes[1] + sizes[2]);
+
+    mk_list_foreach_safe(head, tmp, &i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        flb_input_chunk_destroy(ic, FLB_TRUE);
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+void flb_test_input_chunk_output_batching()
+{
+    int i;
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    int size = sizeof(TEST_BUFFER_DROP_CHUNKS) - 1;
+    char *buf;
+    size_t buf_size;
+    flb_ctx_t *ctx;
+    struct flb_input_instance *i_ins;
+    struct flb_input_chunk *ic;
+    struct mk_list *tmp;
+    struct mk_list *head;
+
+    ctx = flb_create();
+
+    ret = flb_service_set(ctx,
+                          "flush", "60", "grace", "1",
+                          "Log_Level", "error",
+                          NULL);
+    TEST_CHECK_(ret == 0, "setting service options");
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(flb_input_set(ctx, in_ffd, "tag", "test", NULL) == 0);
+
+    /* every pushed buffer is a single record */
+    out_ffd = flb_output(ctx, (char *) "null", NULL);
+    TEST_CHECK(flb_output_set(ctx, out_ffd, "batch.records", "-1", NULL) == -1);
+    TEST_CHECK(flb_output_set(ctx, out_ffd, "batch.records", "2x", NULL) == -1);
+    flb_output_set(ctx, out_ffd,
+                   "match", "test",
+                   "batch.size", "1M",
+                   "batch.records", "2",
+                   NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    i_ins = mk_list_entry_first(&ctx->config->inputs,
+                                struct flb_input_instance,
+                                _head);
+
+    for (i = 0; i < 3; i++) {
+        flb_lib_push(ctx, in_ffd, (char *) TEST_BUFFER_DROP_CHUNKS, size);
+        sleep(1);
+        mk_list_foreach(head, &i_ins->chunks) {
+            ic = mk_list_entry(head, struct flb_input_chunk, _head);
+            cio_chunk_lock(ic->chunk);
+        }
+    }
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == 3);
+
+    /* the records limit allows a single merge */
+    ret = flb_input_chunk_coalesce(i_ins);
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == 2);
+    ic = mk_list_entry_first(&i_ins->chunks, struct flb_input_chunk, _head);
+    cio_chunk_get_content(ic->chunk, &buf, &buf_size);
+    TEST_CHECK(flb_mp_count(buf, buf_size) == 2);
+#ifdef FLB_HAVE_METRICS
+    TEST_CHECK(ic->total_records == 2);
+#endif
+
+    mk_list_foreach_safe(head, tmp, &i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        flb_input_chunk_destroy(ic, FLB_TRUE);
+    }
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/* records appended by a dedicated thread input are written by the engine */
+void flb_test_input_chunk_dedicated_thread()
+{
+    int i;
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    int records = 0;
+    int size = sizeof(TEST_BUFFER_DROP_CHUNKS) - 1;
+    flb_ctx_t *ctx;
+    struct flb_input_instance *i_ins;
+    struct flb_input_chunk *ic;
+    struct mk_list *head;
+
+    ctx = flb_create();
+
+    ret = flb_service_set(ctx,
+                          "flush", "60", "grace", "1",
+                          "Log_Level", "error",
+                          NULL);
+    TEST_CHECK_(ret == 0, "setting service options");
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(flb_input_set(ctx, in_ffd,
+                             "tag", "test",
+                             "dedicated_thread", "on",
+                             NULL) == 0);
+
+    out_ffd = flb_output(ctx, (char *) "null", NULL);
+    flb_output_set(ctx, out_ffd, "match", "test", NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    i_ins = mk_list_entry_first(&ctx->config->inputs,
+                                struct flb_input_instance,
+                                _head);
+    TEST_CHECK(i_ins->thread != NULL);
+
+    for (i = 0; i < 3; i++) {
+        flb_lib_push(ctx, in_ffd, (char *) TEST_BUFFER_DROP_CHUNKS, size);
+    }
+    sleep(1);
+
+    mk_list_foreach(head, &i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        TEST_CHECK(cio_chunk_get_content_size(ic->chunk) > 0);
+#ifdef FLB_HAVE_METRICS
+        records += ic->total_records;
+#endif
+    }
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == 1);
+#ifdef FLB_HAVE_METRICS
+    TEST_CHECK(records == 3);
+#endif
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/*
+ * Tiered storage: the chunks are driven without the engine, records are
+ * appended to the instance and flb_storage_tiers_balance() is called like
+ * the engine does it.
+ */
+#define TIERS_PATH     "/tmp/input-chunk-tiers/"
+#define TIERS_RECORD   1000
+
+struct tiers_test {
+    struct flb_config *config;
+    struct flb_input_instance *in;
+    struct flb_output_instance *out;
+    struct flb_storage_input *si;
+};
+
+static int tiers_create(struct tiers_test *t, const char *spill_limit)
+{
+    int ret;
+
+    t->config = flb_config_init();
+    if (!TEST_CHECK(t->config != NULL)) {
+        return -1;
+    }
+    t->config->storage_path = flb_strdup(TIERS_PATH);
+
+    /* the lib input registers its collector on the event loop */
+    t->config->evl = mk_event_loop_create(8);
+    if (!TEST_CHECK(t->config->evl != NULL)) {
+        flb_config_exit(t->config);
+        return -1;
+    }
+
+    t->in = flb_input_new(t->config, "lib", NULL, FLB_TRUE);
+    t->out = flb_output_new(t->config, "null", NULL, FLB_TRUE);
+    if (!TEST_CHECK(t->in != NULL && t->out != NULL)) {
+        return -1;
+    }
+    flb_input_set_property(t->in, "storage.type", "tiered");
+    flb_input_set_property(t->in, "storage.spill_limit", (char *) spill_limit);
+    flb_output_set_property(t->out, "match", "*");
+
+    ret = flb_storage_create(t->config);
+    if (!TEST_CHECK(ret == 0)) {
+        return -1;
+    }
+    t->si = (struct flb_storage_input *) t->in->storage;
+    TEST_CHECK(t->si->spill_stream != NULL);
+
+    ret = flb_input_instance_init(t->in, t->config);
+    if (!TEST_CHECK(ret == 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void tiers_destroy(struct tiers_test *t)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_input_chunk *ic;
+
+    mk_list_foreach_safe(head, tmp, &t->in->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        flb_input_chunk_destroy(ic, FLB_TRUE);
+    }
+    TEST_CHECK(t->si->spill_up_size == 0);
+
+    flb_input_instance_exit(t->in, t->config);
+    flb_storage_destroy(t->config);
+    flb_output_instance_destroy(t->out);
+    flb_input_instance_destroy(t->in);
+    flb_config_exit(t->config);
+}
+
+/* append one record of about TIERS_RECORD bytes to its own chunk */
+static struct flb_input_chunk *tiers_append(struct tiers_test *t, int n)
+{
+    int ret;
+    int len;
+    char tag[32];
+    char *log;
+    struct flb_time tm;
+    struct flb_input_chunk *ic;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    log = flb_malloc(TIERS_RECORD);
+    memset(log, 'x', TIERS_RECORD);
+    flb_time_get(&tm);
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 2);
+    flb_time_append_to_msgpack(&tm, &mp_pck, 0);
+    msgpack_pack_map(&mp_pck, 1);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "log", 3);
+    msgpack_pack_str(&mp_pck, TIERS_RECORD);
+    msgpack_pack_str_body(&mp_pck, log, TIERS_RECORD);
+    flb_free(log);
+
+    len = snprintf(tag, sizeof(tag) - 1, "tiers.%i", n);
+    ret = flb_input_chunk_append_raw(t->in, tag, len,
+                                     mp_sbuf.data, mp_sbuf.size);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    if (!TEST_CHECK(ret == 0)) {
+        return NULL;
+    }
+
+    /* the newest chunk, locked like a chunk that has been flushed */
+    ic = mk_list_entry_last(&t->in->chunks, struct flb_input_chunk, _head);
+    cio_chunk_lock(ic->chunk);
+
+    return ic;
+}
+
+/* count the bytes in use walking the chunks */
+static size_t tiers_walk_size(struct tiers_test *t, int *spilled, int *up)
+{
+    ssize_t bytes;
+    size_t total = 0;
+    struct mk_list *head;
+    struct cio_chunk *ch;
+    struct flb_input_chunk *ic;
+
+    *spilled = 0;
+    *up = 0;
+    mk_list_foreach(head, &t->in->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        ch = (struct cio_chunk *) ic->chunk;
+        if (ch->st == t->si->spill_stream) {
+            (*spilled)++;
+        }
+        if (cio_chunk_is_up(ch) == CIO_FALSE) {
+            continue;
+        }
+        if (ch->st == t->si->spill_stream) {
+            (*up)++;
+        }
+        bytes = cio_chunk_get_content_size(ch);
+        if (bytes > 0) {
+            total += bytes;
+        }
+    }
+
+    return total;
+}
+
+/* chunks are spilled once the instance crosses its limit */
+void flb_test_input_chunk_tiers_spill()
+{
+    int i;
+    int up;
+    int ret;
+    int spilled;
+    size_t total;
+    struct tiers_test t;
+
+    ret = tiers_create(&t, "8K");
+    if (ret == -1) {
+        return;
+    }
+
+    /* under the limit nothing moves */
+    for (i = 0; i < 6; i++) {
+        TEST_CHECK(tiers_append(&t, i) != NULL);
+    }
+    TEST_CHECK(t.config->storage_tiers_spill == FLB_FALSE);
+    flb_storage_tiers_balance(t.config);
+    tiers_walk_size(&t, &spilled, &up);
+    TEST_CHECK(spilled == 0);
+    TEST_CHECK(t.si->spilled == 0);
+
+    /* crossing it flags the engine and the newest chunks are spilled */
+    for (i = 6; i < 10; i++) {
+        TEST_CHECK(tiers_append(&t, i) != NULL);
+    }
+    TEST_CHECK(t.config->storage_tiers_spill == FLB_TRUE);
+    flb_storage_tiers_balance(t.config);
+    TEST_CHECK(t.config->storage_tiers_spill == FLB_FALSE);
+
+    total = tiers_walk_size(&t, &spilled, &up);
+    TEST_CHECK(spilled > 0);
+    TEST_CHECK(t.si->spilled == spilled);
+    TEST_MSG("spilled=%i counter=%" PRIu64, spilled, t.si->spilled);
+    TEST_CHECK(up == 0);
+    TEST_CHECK(total < t.si->spill_limit / 4 * 3);
+    TEST_CHECK(flb_input_chunk_total_size(t.in) == total);
+    TEST_CHECK(t.in->mem_chunks_size == total);
+
+    /* the oldest chunks stay in memory */
+    TEST_CHECK(((struct cio_chunk *) mk_list_entry_first(&t.in->chunks,
+                                                         struct flb_input_chunk,
+                                                         _head)->chunk)->st ==
+               t.si->stream);
+
+    tiers_destroy(&t);
+}
+
+/* spilled chunks are promoted while usage is under half the limit */
+void flb_test_input_chunk_tiers_promote()
+{
+    int i;
+    int up;
+    int ret;
+    int spilled;
+    size_t total;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct cio_chunk *ch;
+    struct flb_input_chunk *ic;
+    struct tiers_test t;
+
+    ret = tiers_create(&t, "8K");
+    if (ret == -1) {
+        return;
+    }
+
+    for (i = 0; i < 12; i++) {
+        TEST_CHECK(tiers_append(&t, i) != NULL);
+    }
+    flb_storage_tiers_balance(t.config);
+    tiers_walk_size(&t, &spilled, &up);
+    TEST_CHECK(spilled >= 6);
+
+    /* usage between half and 3/4 of the limit: nothing is promoted */
+    flb_storage_tiers_balance(t.config);
+    TEST_CHECK(t.si->promoted == 0);
+
+    /* deliver the memory chunks */
+    mk_list_foreach_safe(head, tmp, &t.in->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        ch = (struct cio_chunk *) ic->chunk;
+        if (ch->st == t.si->stream) {
+            flb_input_chunk_destroy(ic, FLB_TRUE);
+        }
+    }
+    flb_input_chunk_set_limits(t.in);
+    TEST_CHECK(t.in->mem_chunks_size == 0);
+
+    /* the oldest spilled chunks are put up until half the limit */
+    flb_storage_tiers_balance(t.config);
+    total = tiers_walk_size(&t, &spilled, &up);
+    TEST_CHECK(up > 0 && up < spilled);
+    TEST_CHECK(t.si->promoted == up);
+    TEST_MSG("up=%i promoted=%" PRIu64, up, t.si->promoted);
+    TEST_CHECK(total >= t.si->spill_limit / 2);
+    TEST_CHECK(t.si->spill_up_size == total);
+    TEST_CHECK(flb_input_chunk_total_size(t.in) == total);
+
+    ic = mk_list_entry_first(&t.in->chunks, struct flb_input_chunk, _head);
+    TEST_CHECK(flb_input_chunk_is_up(ic) == FLB_TRUE);
+
+    /* promoted chunks going down are not counted anymore */
+    mk_list_foreach(head, &t.in->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        flb_input_chunk_down(ic);
+    }
+    TEST_CHECK(t.si->spill_up_size == 0);
+    TEST_CHECK(flb_input_chunk_total_size(t.in) == 0);
+
+    tiers_destroy(&t);
+}
+
+/* a task waiting for a retry gets the content of its spilled chunk back */
+void flb_test_input_chunk_tiers_retry()
+{
+    int i;
+    int err;
+    int ret;
+    char *buf;
+    char *content;
+    size_t size;
+    size_t buf_size;
+    const void *flush_buf;
+    struct cio_chunk *ch;
+    struct flb_task *task;
+    struct flb_task_retry *retry;
+    struct flb_input_chunk *ic;
+    struct tiers_test t;
+
+    ret = tiers_create(&t, "8K");
+    if (ret == -1) {
+        return;
+    }
+    t.config->sched = flb_sched_create(t.config, t.config->evl);
+    TEST_CHECK(t.config->sched != NULL);
+    t.config->tasks_map_size = 16;
+    TEST_CHECK(flb_task_map_create(t.config) == 0);
+    flb_routes_mask_set_size(t.config);
+
+    /* older chunks keep the instance just under its limit */
+    for (i = 0; i < 7; i++) {
+        TEST_CHECK(tiers_append(&t, i) != NULL);
+    }
+    TEST_CHECK(t.config->storage_tiers_spill == FLB_FALSE);
+
+    /* dispatch the newest chunk, the output asks for a retry */
+    ic = tiers_append(&t, 7);
+    if (!TEST_CHECK(ic != NULL)) {
+        flb_task_map_destroy(t.config);
+        tiers_destroy(&t);
+        return;
+    }
+    TEST_CHECK(t.config->storage_tiers_spill == FLB_TRUE);
+    flush_buf = flb_input_chunk_flush(ic, &size);
+    TEST_CHECK(flush_buf != NULL);
+    content = flb_malloc(size);
+    memcpy(content, flush_buf, size);
+
+    task = flb_task_create((uint64_t) ic, flush_buf, size, t.in, ic,
+                           "tiers.7", 7, t.config, &err);
+    if (!TEST_CHECK(task != NULL)) {
+        flb_free(content);
+        flb_task_map_destroy(t.config);
+        tiers_destroy(&t);
+        return;
+    }
+    TEST_CHECK(flb_input_chunk_is_spillable(ic) == FLB_FALSE);
+    task->status = FLB_TASK_RUNNING;
+    retry = flb_task_retry_create(task, t.out);
+    TEST_CHECK(retry != NULL);
+    TEST_CHECK(flb_input_chunk_is_spillable(ic) == FLB_TRUE);
+
+    /* while it waits for the retry the chunk is spilled */
+    flb_storage_tiers_balance(t.config);
+    TEST_CHECK(t.si->spilled > 0);
+
+    ch = (struct cio_chunk *) ic->chunk;
+    TEST_CHECK(ch->st == t.si->spill_stream);
+    TEST_CHECK(cio_chunk_is_up(ch) == CIO_FALSE);
+    TEST_CHECK(task->ic == ic);
+
+    /* re-dispatch: put the chunk up and read it like the engine does */
+    TEST_CHECK(flb_input_chunk_set_up(task->ic) == 0);
+    TEST_CHECK(t.si->spill_up_size == size);
+    buf = (char *) flb_input_chunk_flush(task->ic, &buf_size);
+    TEST_CHECK(buf != NULL);
+    TEST_CHECK(buf_size == size);
+    TEST_CHECK(buf && memcmp(buf, content, size) == 0);
+    TEST_CHECK(flb_input_chunk_total_size(t.in) ==
+               cio_stream_size_chunks_up(t.si->stream) + size);
+
+    /* delivered: the chunk is gone, so it is not counted anymore */
+    flb_task_retry_destroy(retry);
+    flb_task_destroy(task, FLB_TRUE);
+    TEST_CHECK(t.si->spill_up_size == 0);
+
+    flb_free(content);
+    flb_task_map_destroy(t.config);
+    tiers_destroy(&t);
+}
+
 /* Test list */
 TEST_LIST = {
     {"input_chunk_exceed_limit",       flb_test_input_chunk_exceed_limit},
     {"input_chunk_buffer_valid",       flb_test_input_chunk_buffer_valid},
     {"input_chunk_dropping_chunks",    flb_test_input_chunk_dropping_chunks},
+    {"input_chunk_coalesce",           flb_test_input_chunk_coalesce},
+    {"input_chunk_coalesce_stream_off", flb_test_input_chunk_coalesce_stream_off},
+    {"input_chunk_output_batching",    flb_test_input_chunk_output_batching},
+    {"input_chunk_dedicated_thread",   flb_test_input_chunk_dedicated_thread},
+    {"input_chunk_tiers_spill",        flb_test_input_chunk_tiers_spill},
+    {"input_chunk_tiers_promote",      flb_test_input_chunk_tiers_promote},
+    {"input_chunk_tiers_retry",        flb_test_input_chunk_tiers_retry},
     {NULL, NULL}
 };
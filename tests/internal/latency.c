@@ -0,0 +1,128 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_latency.h>
+
+#include "flb_tests_internal.h"
+
+/* Quantiles must be within the bucket resolution (6.25%) */
+static int near(uint64_t val, uint64_t expected)
+{
+    uint64_t diff;
+
+    diff = val > expected ? val - expected : expected - val;
+    return diff <= (expected / 16) + 1;
+}
+
+void test_latency_quantiles()
+{
+    int i;
+    struct flb_latency *lat;
+
+    lat = flb_latency_create();
+    TEST_CHECK(lat != NULL);
+
+    TEST_CHECK(flb_latency_quantile(lat, 0.5) == 0);
+
+    /* 1..10000 microseconds */
+    for (i = 1; i <= 10000; i++) {
+        flb_latency_add(lat, i, 0);
+    }
+
+    TEST_CHECK(lat->count == 10000);
+    TEST_CHECK(lat->max == 10000);
+    TEST_CHECK(lat->stalls == 0);
+    TEST_CHECK(near(flb_latency_quantile(lat, 0.5), 5000));
+    TEST_CHECK(near(flb_latency_quantile(lat, 0.99), 9900));
+    TEST_CHECK(flb_latency_quantile(lat, 1.0) == 10000);
+
+    flb_latency_destroy(lat);
+}
+
+void test_latency_small_and_large()
+{
+    struct flb_latency *lat;
+
+    lat = flb_latency_create();
+    TEST_CHECK(lat != NULL);
+
+    /* values under 32us are exact */
+    flb_latency_add(lat, 0, 0);
+    flb_latency_add(lat, 7, 0);
+    flb_latency_add(lat, 31, 0);
+    TEST_CHECK(flb_latency_quantile(lat, 0.1) == 0);
+    TEST_CHECK(flb_latency_quantile(lat, 0.5) == 7);
+    TEST_CHECK(flb_latency_quantile(lat, 1.0) == 31);
+
+    /* out of range values go to the last bucket, max is kept */
+    flb_latency_add(lat, ((uint64_t) 1) << 50, 0);
+    TEST_CHECK(lat->max == ((uint64_t) 1) << 50);
+    TEST_CHECK(flb_latency_quantile(lat, 1.0) == lat->max);
+
+    flb_latency_destroy(lat);
+}
+
+void test_latency_stalls()
+{
+    int ret;
+    struct flb_latency *lat;
+
+    lat = flb_latency_create();
+    TEST_CHECK(lat != NULL);
+
+    ret = flb_latency_add(lat, 1000, FLB_LATENCY_STALL_USEC(500));
+    TEST_CHECK(ret == FLB_FALSE);
+
+    ret = flb_latency_add(lat, 600000, FLB_LATENCY_STALL_USEC(500));
+    TEST_CHECK(ret == FLB_TRUE);
+
+    /* a zero threshold disables the check */
+    ret = flb_latency_add(lat, 600000, FLB_LATENCY_STALL_USEC(0));
+    TEST_CHECK(ret == FLB_FALSE);
+
+    TEST_CHECK(lat->stalls == 1);
+    TEST_CHECK(lat->count == 3);
+
+    flb_latency_destroy(lat);
+}
+
+void test_latency_merge()
+{
+    struct flb_latency *dst;
+    struct flb_latency *src;
+
+    dst = flb_latency_create();
+    src = flb_latency_create();
+    TEST_CHECK(dst != NULL && src != NULL);
+
+    flb_latency_add(dst, 100, FLB_LATENCY_STALL_USEC(500));
+    flb_latency_add(src, 200, FLB_LATENCY_STALL_USEC(500));
+    flb_latency_add(src, 600000, FLB_LATENCY_STALL_USEC(500));
+
+    flb_latency_merge(dst, src);
+    TEST_CHECK(dst->count == 3);
+    TEST_CHECK(dst->stalls == 1);
+    TEST_CHECK(dst->max == 600000);
+    TEST_CHECK(flb_latency_quantile(dst, 1.0) == dst->max);
+
+    /* the source is reset so the next merge only adds new samples */
+    TEST_CHECK(src->count == 0);
+    TEST_CHECK(src->stalls == 0);
+    TEST_CHECK(src->max == 0);
+
+    flb_latency_merge(dst, src);
+    TEST_CHECK(dst->count == 3);
+    TEST_CHECK(dst->max == 600000);
+
+    flb_latency_destroy(src);
+    flb_latency_destroy(dst);
+}
+
+TEST_LIST = {
+    {"quantiles",       test_latency_quantiles},
+    {"small_and_large", test_latency_small_and_large},
+    {"stalls",          test_latency_stalls},
+    {"merge",           test_latency_merge},
+    {0}
+};
@@ -6,8 +6,12 @@
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_socket.h>
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_coro.h>
+#include <fluent-bit/flb_upstream.h>
 
 #include <time.h>
+#include <pthread.h>
 #include "flb_tests_internal.h"
 
 #define TEST_HOSTv4           "127.0.0.1"
@@ -142,8 +146,102 @@ void test_ipv6_client_server()
     test_client_server(FLB_TRUE);
 }
 
+#ifndef FLB_SYSTEM_WINDOWS
+
+struct writev_reader {
+    int fd;
+    size_t size;
+    char *buf;
+};
+
+static void *writev_read(void *data)
+{
+    ssize_t ret;
+    struct writev_reader *r = data;
+
+    while (r->size < (4 * 1024 * 1024) + 64) {
+        ret = read(r->fd, r->buf + r->size, 65536);
+        if (ret <= 0) {
+            break;
+        }
+        r->size += ret;
+    }
+    return NULL;
+}
+
+/* A payload larger than the socket buffer forces partial writev(2) calls */
+void test_net_writev()
+{
+    int i;
+    int ret;
+    int fds[2];
+    size_t len = 0;
+    size_t payload = 4 * 1024 * 1024;
+    char head[32];
+    char tail[32];
+    char *body;
+    pthread_t tid;
+    struct mk_iovec iov[4];
+    struct flb_upstream u;
+    struct flb_upstream_conn u_conn;
+    struct writev_reader r;
+
+    flb_coro_init();
+
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    TEST_CHECK(ret == 0);
+
+    memset(&u, 0, sizeof(u));
+    memset(&u_conn, 0, sizeof(u_conn));
+    u.flags = FLB_IO_TCP;
+    u_conn.u = &u;
+    u_conn.fd = fds[0];
+
+    memset(head, 'h', sizeof(head));
+    memset(tail, 't', sizeof(tail));
+    body = flb_malloc(payload);
+    TEST_CHECK(body != NULL);
+    for (i = 0; i < payload; i++) {
+        body[i] = i % 251;
+    }
+
+    r.fd = fds[1];
+    r.size = 0;
+    r.buf = flb_malloc(payload + 64);
+    TEST_CHECK(r.buf != NULL);
+    pthread_create(&tid, NULL, writev_read, &r);
+
+    iov[0].iov_base = head;
+    iov[0].iov_len = sizeof(head);
+    iov[1].iov_base = body;
+    iov[1].iov_len = payload;
+    iov[2].iov_base = NULL;
+    iov[2].iov_len = 0;
+    iov[3].iov_base = tail;
+    iov[3].iov_len = sizeof(tail);
+
+    ret = flb_io_net_writev(&u_conn, iov, 4, &len);
+    TEST_CHECK(ret == payload + 64);
+    TEST_CHECK(len == payload + 64);
+
+    pthread_join(tid, NULL);
+    TEST_CHECK(r.size == payload + 64);
+    TEST_CHECK(memcmp(r.buf, head, sizeof(head)) == 0);
+    TEST_CHECK(memcmp(r.buf + sizeof(head), body, payload) == 0);
+    TEST_CHECK(memcmp(r.buf + sizeof(head) + payload, tail, sizeof(tail)) == 0);
+
+    flb_free(body);
+    flb_free(r.buf);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
 TEST_LIST = {
     { "ipv4_client_server", test_ipv4_client_server},
     { "ipv6_client_server", test_ipv6_client_server},
+#ifndef FLB_SYSTEM_WINDOWS
+    { "net_writev", test_net_writev},
+#endif
     { 0 }
 };
@@ -5,6 +5,8 @@
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_config.h>
 #include <monkey/mk_core.h>
 
 #include <sys/types.h>
@@ -285,6 +287,578 @@ void test_json_dup_keys()
     flb_free(data_out);
 }
 
+/* Repeated keys in a large map */
+void test_json_dup_keys_large()
+{
+    int i;
+    int len;
+    char key[16];
+    flb_sds_t out;
+    flb_sds_t expected;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    /* 300 entries, 100 different keys: k0..k99 */
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_map(&mp_pck, 300);
+    for (i = 0; i < 300; i++) {
+        len = snprintf(key, sizeof(key) - 1, "k%i", i % 100);
+        msgpack_pack_str(&mp_pck, len);
+        msgpack_pack_str_body(&mp_pck, key, len);
+        msgpack_pack_int(&mp_pck, i);
+    }
+
+    /* only the last value of every key is kept */
+    expected = flb_sds_create("{");
+    for (i = 200; i < 300; i++) {
+        flb_sds_printf(&expected, "%s\"k%i\":%i", (i > 200) ? "," : "",
+                       i % 100, i);
+    }
+    flb_sds_cat_safe(&expected, "}", 1);
+
+    out = flb_msgpack_raw_to_json_sds(mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(out != NULL);
+    if (!TEST_CHECK(strcmp(out, expected) == 0)) {
+        TEST_MSG("out=%s", out);
+    }
+    flb_sds_destroy(out);
+
+    flb_sds_destroy(expected);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+}
+
+/*
+ * 'json.dedup_keys' disabled: every entry is written. The option is set
+ * once per process, so this test must stay last in TEST_LIST.
+ */
+void test_json_dup_keys_disabled()
+{
+    int i;
+    int len;
+    int ret;
+    char key[16];
+    char *p;
+    flb_sds_t out;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    struct flb_config config;
+
+    /* 300 entries, 100 different keys: k0..k99 */
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_map(&mp_pck, 300);
+    for (i = 0; i < 300; i++) {
+        len = snprintf(key, sizeof(key) - 1, "k%i", i % 100);
+        msgpack_pack_str(&mp_pck, len);
+        msgpack_pack_str_body(&mp_pck, key, len);
+        msgpack_pack_int(&mp_pck, i);
+    }
+
+    memset(&config, '\0', sizeof(config));
+    config.json_dedup_keys = FLB_FALSE;
+    ret = flb_pack_init(&config);
+    TEST_CHECK(ret == 0);
+
+    out = flb_msgpack_raw_to_json_sds(mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(out != NULL);
+    for (i = 0, p = out; (p = strstr(p, "\"k0\":")) != NULL; i++, p++);
+    TEST_CHECK(i == 3);
+    flb_sds_destroy(out);
+
+    /* a second context can not change it */
+    config.json_dedup_keys = FLB_TRUE;
+    ret = flb_pack_init(&config);
+    TEST_CHECK(ret == -1);
+
+    out = flb_msgpack_raw_to_json_sds(mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(out != NULL);
+    for (i = 0, p = out; (p = strstr(p, "\"k0\":")) != NULL; i++, p++);
+    TEST_CHECK(i == 3);
+    flb_sds_destroy(out);
+
+    msgpack_sbuffer_destroy(&mp_sbuf);
+}
+
+/* Escaped output larger than the initial buffer guess */
+void test_json_pack_grow()
+{
+    int i;
+    int ret;
+    size_t len;
+    char *str;
+    char *buf;
+    char *json;
+    flb_sds_t out;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    msgpack_unpacked result;
+    size_t off = 0;
+
+    len = 64 * 1024;
+    str = flb_malloc(len);
+    TEST_CHECK(str != NULL);
+    for (i = 0; i < len; i++) {
+        str[i] = (i % 2) ? '\x01' : '"';
+    }
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 1);
+    msgpack_pack_str(&mp_pck, len);
+    msgpack_pack_str_body(&mp_pck, str, len);
+    flb_free(str);
+
+    out = flb_msgpack_raw_to_json_sds(mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(out != NULL);
+    TEST_CHECK(flb_sds_len(out) == 4 + (len / 2) * 8);
+    TEST_CHECK(strncmp(out, "[\"\\\"\\u0001", 10) == 0);
+    TEST_CHECK(strcmp(out + flb_sds_len(out) - 8, "\\u0001\"]") == 0);
+
+    msgpack_unpacked_init(&result);
+    ret = msgpack_unpack_next(&result, mp_sbuf.data, mp_sbuf.size, &off);
+    TEST_CHECK(ret == MSGPACK_UNPACK_SUCCESS);
+
+    json = flb_msgpack_to_json_str(16, &result.data);
+    TEST_CHECK(json != NULL);
+    TEST_CHECK(strcmp(json, out) == 0);
+    flb_free(json);
+
+    /* a fixed buffer must fit the JSON string and its NULL byte */
+    buf = flb_malloc(flb_sds_len(out) + 1);
+    TEST_CHECK(buf != NULL);
+    ret = flb_msgpack_to_json(buf, flb_sds_len(out), &result.data);
+    TEST_CHECK(ret <= 0);
+    ret = flb_msgpack_to_json(buf, flb_sds_len(out) + 1, &result.data);
+    TEST_CHECK(ret == flb_sds_len(out));
+    TEST_CHECK(strcmp(buf, out) == 0);
+    flb_free(buf);
+
+    msgpack_unpacked_destroy(&result);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    flb_sds_destroy(out);
+}
+
+/*
+ * Strings are scanned several bytes at once: put every kind of character
+ * to escape at every offset of strings around the vector sizes and compare
+ * with flb_utils_write_str().
+ */
+void test_json_escape_offsets()
+{
+    int i;
+    int ret;
+    int off;
+    int len;
+    int pos;
+    int slen;
+    char str[128];
+    char ref[1024];
+    char out[1024];
+    msgpack_object obj;
+    const char *special[] = {
+        "\"", "\\", "\n", "\x01", "\x1f", "\x7f",
+        "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+        "\xff", "\x80", "\xe2\x82", NULL
+    };
+
+    obj.type = MSGPACK_OBJECT_STR;
+    obj.via.str.ptr = str;
+
+    for (i = 0; special[i] != NULL; i++) {
+        slen = strlen(special[i]);
+        for (len = 1; len <= 100; len++) {
+            for (pos = 0; pos < len; pos++) {
+                memset(str, 'a', len);
+                memcpy(str + pos, special[i],
+                       (pos + slen > len) ? len - pos : slen);
+                obj.via.str.size = len;
+
+                off = 0;
+                ret = flb_utils_write_str(ref, &off, sizeof(ref), str, len);
+                TEST_CHECK(ret == FLB_TRUE);
+
+                ret = flb_msgpack_to_json(out, sizeof(out), &obj);
+                if (!TEST_CHECK(ret == off + 2 &&
+                                memcmp(out + 1, ref, off) == 0)) {
+                    TEST_MSG("special=%i length=%i offset=%i", i, len, pos);
+                    return;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Log like records (access logs, JSON messages and UTF-8 text) must survive
+ * the msgpack -> JSON -> msgpack round trip unchanged.
+ */
+#define ROUNDTRIP_RECORDS  200
+
+static void sample_pack_str(msgpack_packer *pck, const char *str)
+{
+    msgpack_pack_str(pck, strlen(str));
+    msgpack_pack_str_body(pck, str, strlen(str));
+}
+
+static void sample_records(msgpack_sbuffer *sbuf, int type, int records)
+{
+    int i;
+    char line[512];
+    msgpack_packer pck;
+
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, records);
+
+    for (i = 0; i < records; i++) {
+        if (type == 0) {
+            snprintf(line, sizeof(line),
+                     "10.0.%i.%i - - [21/Jun/2021:10:%02i:%02i +0000] "
+                     "\"GET /api/v1/items/%i?page=%i HTTP/1.1\" 200 %i "
+                     "\"-\" \"Mozilla/5.0 (X11; Linux x86_64) "
+                     "AppleWebKit/537.36 (KHTML, like Gecko) "
+                     "Chrome/91.0.4472.114 Safari/537.36\"",
+                     i % 256, i % 100, i % 60, i % 60, i, i % 10, i * 7);
+        }
+        else if (type == 1) {
+            snprintf(line, sizeof(line),
+                     "{\"level\":\"info\",\"ts\":\"2021-06-21T10:00:%02iZ\","
+                     "\"caller\":\"server/handler.go:%i\",\"msg\":\"request "
+                     "completed\",\"path\":\"C:\\\\data\\\\%i\",\n"
+                     "\"latency\":%i}\t", i % 60, i, i, i % 1000);
+        }
+        else {
+            snprintf(line, sizeof(line),
+                     "Usuario %i inició sesión desde São Paulo — "
+                     "ユーザーがログインしました — Пользователь вошёл "
+                     "в систему 🚀 %i", i, i * 3);
+        }
+
+        msgpack_pack_map(&pck, 4);
+        sample_pack_str(&pck, "log");
+        sample_pack_str(&pck, line);
+        sample_pack_str(&pck, "stream");
+        sample_pack_str(&pck, "stdout");
+        sample_pack_str(&pck, "pod");
+        sample_pack_str(&pck, "api-server-5d8f7c9b6-x2x8z");
+        sample_pack_str(&pck, "seq");
+        msgpack_pack_uint64(&pck, i);
+    }
+}
+
+void test_json_pack_roundtrip()
+{
+    int c;
+    int ret;
+    int root_type;
+    size_t off;
+    size_t size;
+    size_t out_size;
+    char *buf;
+    char *out_buf;
+    msgpack_sbuffer sbuf;
+    msgpack_unpacked result;
+
+    for (c = 0; c < 3; c++) {
+        msgpack_sbuffer_init(&sbuf);
+        sample_records(&sbuf, c, ROUNDTRIP_RECORDS);
+
+        off = 0;
+        msgpack_unpacked_init(&result);
+        ret = msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off);
+        TEST_CHECK(ret == MSGPACK_UNPACK_SUCCESS);
+
+        size = sbuf.size * 4;
+        buf = flb_malloc(size);
+        TEST_CHECK(buf != NULL);
+
+        ret = flb_msgpack_to_json(buf, size, &result.data);
+        TEST_CHECK(ret > 0);
+
+        out_buf = NULL;
+        ret = flb_pack_json(buf, ret, &out_buf, &out_size, &root_type);
+        if (TEST_CHECK(ret == 0)) {
+            if (!TEST_CHECK(out_size == sbuf.size &&
+                            memcmp(out_buf, sbuf.data, out_size) == 0)) {
+                TEST_MSG("record type=%i", c);
+            }
+            flb_free(out_buf);
+        }
+
+        flb_free(buf);
+        msgpack_unpacked_destroy(&result);
+        msgpack_sbuffer_destroy(&sbuf);
+    }
+}
+
+/* JSON numbers and the msgpack types they are converted to */
+void test_json_pack_numbers()
+{
+    int i;
+    int ret;
+    int len;
+    int root_type;
+    size_t out_size;
+    char *out_buf;
+    char tmp[64];
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    const char *json;
+    const int64_t ints[] = {
+        0, 0, 1, -1, 127, 128, -32, -33, 255, 256, -128, -129, 65535, 65536,
+        -32768, -32769, 4294967295LL, 4294967296LL, -2147483648LL,
+        -2147483649LL, INT64_MAX, INT64_MIN
+    };
+    const char *floats[] = {
+        "1.5", "-0.25", "1e3", "1E-2", "2.5e+2", "0.1", "-0.0",
+        "123456789.123456789", "0.000000000000000000000000001",
+        "18446744073709551616", "-9223372036854775809", "5e-324"
+    };
+
+    /* integers */
+    json = "[0,-0,1,-1,127,128,-32,-33,255,256,-128,-129,65535,65536,"
+           "-32768,-32769,4294967295,4294967296,-2147483648,-2147483649,"
+           "9223372036854775807,-9223372036854775808,18446744073709551615]";
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&pck, 23);
+    for (i = 0; i < sizeof(ints) / sizeof(int64_t); i++) {
+        msgpack_pack_int64(&pck, ints[i]);
+    }
+    msgpack_pack_uint64(&pck, UINT64_MAX);
+
+    ret = flb_pack_json(json, strlen(json), &out_buf, &out_size, &root_type);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(root_type == FLB_PACK_JSON_ARRAY);
+    TEST_CHECK(out_size == sbuf.size &&
+               memcmp(out_buf, sbuf.data, sbuf.size) == 0);
+    flb_free(out_buf);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    /* numbers with a fraction, an exponent, or too big for an integer */
+    for (i = 0; i < sizeof(floats) / sizeof(char *); i++) {
+        msgpack_sbuffer_init(&sbuf);
+        msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+        msgpack_pack_double(&pck, strtod(floats[i], NULL));
+
+        /* a number at the end of the buffer could be incomplete */
+        ret = flb_pack_json(floats[i], strlen(floats[i]), &out_buf, &out_size,
+                            &root_type);
+        TEST_CHECK(ret == -1);
+
+        len = snprintf(tmp, sizeof(tmp), "%s\n", floats[i]);
+        ret = flb_pack_json(tmp, len, &out_buf, &out_size, &root_type);
+        TEST_CHECK(ret == 0);
+        TEST_MSG("number: %s", floats[i]);
+        if (ret == 0) {
+            TEST_CHECK(root_type == FLB_PACK_JSON_PRIMITIVE);
+            TEST_CHECK(out_size == sbuf.size &&
+                       memcmp(out_buf, sbuf.data, sbuf.size) == 0);
+            TEST_MSG("number: %s", floats[i]);
+            flb_free(out_buf);
+        }
+        msgpack_sbuffer_destroy(&sbuf);
+    }
+}
+
+/* Malformed JSON is reported and never converted */
+void test_json_pack_invalid()
+{
+    int i;
+    int ret;
+    int out_size;
+    int root_type;
+    size_t size;
+    char *out_buf;
+    struct flb_pack_state state;
+    const char *tests[] = {
+        "{\"a\" 1}", "{1:2}", "[.5]", "[+1]", "{\"a\":1]", "[\"\\x\"]",
+        "[\"\\u12G4\"]", "{\"a\":1}}", "{\"a\":1} x", "hello world\n", ":",
+        ",", "  \n",
+        "{\"a\": \"b\" ] \"c\":1, \"very long incomplete message"
+    };
+
+    for (i = 0; i < sizeof(tests) / sizeof(char *); i++) {
+        ret = flb_pack_json(tests[i], strlen(tests[i]), &out_buf, &size,
+                            &root_type);
+        TEST_CHECK(ret == -1);
+        TEST_MSG("flb_pack_json: %s", tests[i]);
+
+        flb_pack_state_init(&state);
+        ret = flb_pack_json_state(tests[i], strlen(tests[i]), &out_buf,
+                                  &out_size, &state);
+        TEST_CHECK(ret == FLB_ERR_JSON_INVAL);
+        TEST_MSG("flb_pack_json_state: %s", tests[i]);
+        flb_pack_state_reset(&state);
+    }
+}
+
+/*
+ * Not valid JSON but accepted by jsmn (missing, repeated or trailing
+ * commas, truncated literals): converted like previous versions did.
+ */
+void test_json_pack_lenient()
+{
+    int i;
+    int ret;
+    int out_size;
+    int root_type;
+    size_t size;
+    char *out_buf;
+    struct flb_pack_state state;
+    struct {
+        const char *json;
+        const char *expected;
+        int len;
+    } tests[] = {
+        {"{\"a\":1,}",         "\x81\xa1\x61\x01", 4},
+        {"{\"a\":1,,\"b\":2}", "\x82\xa1\x61\x01\xa1\x62\x02", 7},
+        {"[1 2]",             "\x92\x01\x02", 3},
+        {"[1,]",              "\x91\x01", 2},
+        {"[1,,2]",            "\x92\x01\x02", 3},
+        {"[01]",              "\x91\x01", 2},
+        {"[tru]",             "\x91\xc3", 2},
+        {"[nul ]",            "\x91\xc0", 2},
+    };
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        ret = flb_pack_json(tests[i].json, strlen(tests[i].json), &out_buf,
+                            &size, &root_type);
+        if (!TEST_CHECK(ret == 0)) {
+            TEST_MSG("flb_pack_json: %s", tests[i].json);
+            continue;
+        }
+        TEST_CHECK(size == tests[i].len &&
+                   memcmp(out_buf, tests[i].expected, size) == 0);
+        TEST_MSG("flb_pack_json: %s", tests[i].json);
+        flb_free(out_buf);
+
+        flb_pack_state_init(&state);
+        ret = flb_pack_json_state(tests[i].json, strlen(tests[i].json),
+                                  &out_buf, &out_size, &state);
+        if (TEST_CHECK(ret == 0)) {
+            TEST_CHECK(out_size == tests[i].len &&
+                       memcmp(out_buf, tests[i].expected, out_size) == 0);
+            TEST_CHECK(state.last_byte == strlen(tests[i].json));
+            TEST_MSG("flb_pack_json_state: %s", tests[i].json);
+            flb_free(out_buf);
+        }
+        flb_pack_state_reset(&state);
+    }
+}
+
+/*
+ * A complete message followed by an incomplete string or number at the
+ * root: nothing is returned until the last one is complete.
+ */
+void test_json_pack_state_trailing()
+{
+    int i;
+    int ret;
+    int out_size;
+    char *out_buf;
+    struct flb_pack_state state;
+    const char *tests[] = {
+        "{\"a\":1} \"ab", "{\"a\":1} 12", "{\"a\":1} tr", "[1]\n[2]\n-3.5"
+    };
+
+    for (i = 0; i < sizeof(tests) / sizeof(char *); i++) {
+        flb_pack_state_init(&state);
+        ret = flb_pack_json_state(tests[i], strlen(tests[i]), &out_buf,
+                                  &out_size, &state);
+        TEST_CHECK(ret == FLB_ERR_JSON_PART);
+        TEST_MSG("flb_pack_json_state: %s", tests[i]);
+        flb_pack_state_reset(&state);
+    }
+
+    /* the same buffer, growing: the scan resumes at the incomplete value */
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state("{\"a\":1} \"ab", 11, &out_buf, &out_size,
+                              &state);
+    TEST_CHECK(ret == FLB_ERR_JSON_PART);
+    ret = flb_pack_json_state("{\"a\":1} \"abc", 12, &out_buf, &out_size,
+                              &state);
+    TEST_CHECK(ret == FLB_ERR_JSON_PART);
+    ret = flb_pack_json_state("{\"a\":1} \"abc\"", 13, &out_buf, &out_size,
+                              &state);
+    if (TEST_CHECK(ret == 0)) {
+        TEST_CHECK(out_size == 8 &&
+                   memcmp(out_buf, "\x81\xa1\x61\x01\xa3\x61\x62\x63", 8) == 0);
+        TEST_CHECK(state.last_byte == 13);
+        flb_free(out_buf);
+    }
+    flb_pack_state_reset(&state);
+}
+
+/* Maps and arrays with 16 and 32 bits headers, nested */
+void test_json_pack_containers()
+{
+    int i;
+    int j;
+    int k;
+    int ret;
+    int len;
+    int root_type;
+    int records;
+    int sizes[] = {0, 15, 16, 17, 300, 65535, 65536};
+    size_t out_size;
+    char *out_buf;
+    char key[32];
+    flb_sds_t json;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+
+    json = flb_sds_create_size(1024 * 1024);
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    /* two records, the second one has every container size */
+    for (j = 0; j < 2; j++) {
+        flb_sds_cat_safe(&json, "{", 1);
+        msgpack_pack_map(&pck, (j == 0) ? 1 : 7);
+
+        for (i = 0; i < ((j == 0) ? 1 : 7); i++) {
+            len = snprintf(key, sizeof(key), "k%i", i);
+            flb_sds_printf(&json, "%s\"%s\":[{", (i > 0) ? "," : "", key);
+            msgpack_pack_str(&pck, len);
+            msgpack_pack_str_body(&pck, key, len);
+            msgpack_pack_array(&pck, sizes[i] + 1);
+
+            /* a map with the same number of entries first */
+            msgpack_pack_map(&pck, sizes[i]);
+            for (k = 0; k < sizes[i]; k++) {
+                len = snprintf(key, sizeof(key), "%i", k);
+                flb_sds_printf(&json, "%s\"%s\":%i", (k > 0) ? "," : "",
+                               key, k);
+                msgpack_pack_str(&pck, len);
+                msgpack_pack_str_body(&pck, key, len);
+                msgpack_pack_int64(&pck, k);
+            }
+            flb_sds_cat_safe(&json, "}", 1);
+
+            for (k = 0; k < sizes[i]; k++) {
+                flb_sds_cat_safe(&json, ",[]", 3);
+                msgpack_pack_array(&pck, 0);
+            }
+            flb_sds_cat_safe(&json, "]", 1);
+        }
+        flb_sds_cat_safe(&json, "}\n", 2);
+    }
+
+    ret = flb_pack_json_recs(json, flb_sds_len(json), &out_buf, &out_size,
+                             &root_type, &records);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(records == 2);
+    TEST_CHECK(root_type == FLB_PACK_JSON_OBJECT);
+    TEST_CHECK(out_size == sbuf.size &&
+               memcmp(out_buf, sbuf.data, sbuf.size) == 0);
+
+    flb_free(out_buf);
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_sds_destroy(json);
+}
+
 void test_json_pack_bug342()
 {
     int i = 0;
@@ -633,10 +1207,22 @@ TEST_LIST = {
     { "json_pack_mult"     , test_json_pack_mult},
     { "json_pack_mult_iter", test_json_pack_mult_iter},
     { "json_dup_keys"      , test_json_dup_keys},
+    { "json_dup_keys_large", test_json_dup_keys_large},
+    { "json_pack_grow"     , test_json_pack_grow},
     { "json_pack_bug342"   , test_json_pack_bug342},
     { "json_pack_bug1278"  , test_json_pack_bug1278},
 
     /* Mixed bytes, check JSON encoding */
     { "utf8_to_json", test_utf8_to_json},
+    { "json_escape_offsets", test_json_escape_offsets},
+    { "json_pack_roundtrip", test_json_pack_roundtrip},
+    { "json_pack_numbers", test_json_pack_numbers},
+    { "json_pack_invalid", test_json_pack_invalid},
+    { "json_pack_lenient", test_json_pack_lenient},
+    { "json_pack_state_trailing", test_json_pack_state_trailing},
+    { "json_pack_containers", test_json_pack_containers},
+
+    /* sets a process-wide option, keep it last */
+    { "json_dup_keys_disabled", test_json_dup_keys_disabled},
     { 0 }
 };
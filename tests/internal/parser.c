@@ -416,6 +416,133 @@ void test_regex_parser_time_lookup()
     flb_config_exit(config);
 }
 
+/* Compiled time formats must give the same results than flb_strptime() */
+struct time_fast_check {
+    char *time_fmt;
+    int compiled;
+};
+
+struct time_fast_check time_fast_formats[] = {
+    {"%Y-%m-%dT%H:%M:%S.%L%z"   , FLB_TRUE},
+    {"%Y-%m-%dT%H:%M:%S.%LZ"    , FLB_TRUE},
+    {"%Y-%m-%dT%H:%M:%SZ"       , FLB_TRUE},
+    {"%Y-%m-%d %H:%M:%S"        , FLB_TRUE},
+    {"%Y-%m-%d %H:%M:%S,%L"     , FLB_TRUE},
+    {"%d/%b/%Y:%H:%M:%S %z"     , FLB_TRUE},
+    {"%m/%d/%Y %H:%M:%S %z"     , FLB_TRUE},
+    {"%H:%M:%S %Y-%m-%d"        , FLB_TRUE},
+    {"%b %d %H:%M:%S"           , FLB_TRUE},
+    {"%b %d %H:%M:%S.%L %z"     , FLB_TRUE},
+    {"%a %b %d %H:%M:%S.%L %Y"  , FLB_FALSE},
+    {"%Y-%m-%dT%H:%M:%S.%L %Y"  , FLB_FALSE},
+    {"%s"                       , FLB_FALSE},
+};
+
+char *time_fast_strings[] = {
+    "2017-07-17T20:17:03.123456789+05:30",
+    "2017-07-17T20:17:03.1Z",
+    "2017-07-17T20:17:03.12-0800",
+    "2017-07-17T20:17:03.5e3Z",
+    "2017-07-17T20:17:03Z",
+    "2017-07-17T20:17:04.001+0000",
+    "2017-07-17T20:17:04.001 GMT",
+    "2017-07-17T20:17:04.001 EST",
+    "2017-07-17T20:17:04.001+05:",
+    "2017-07-17T20:17:04.",
+    "2017-07-17T20:17:04.1234567891234Z",
+    "2017-7-1T2:3:4.5+01",
+    "2017-07-17T20:17:3.25 UT",
+    "2017-07-17 20:17:03,1234",
+    "2017-07-17 20:17:03",
+    "2017-02-30 24:00:00",
+    "20:17:03 2017-07-17",
+    "20:17:03 2017-07-18",
+    "17/Jul/2017:20:17:03 +0200",
+    "17/jul/2017:20:17:03 -0000",
+    "17/July/2017:20:17:03 +0200",
+    "1/May/2017:00:00:60 +0000",
+    "07/17/2017 20:17:03 +05:30",
+    "Feb 16 04:06:58",
+    "Feb  6 04:06:58.1234 -0600",
+    "Feb 16 04:06:5",
+    "Mayo 1 00:00:00",
+    "  Dec 31 23:59:59.999 Z",
+    "",
+    "garbage",
+};
+
+void test_parser_time_fast()
+{
+    int i;
+    int j;
+    int k;
+    int len;
+    int ret1;
+    int ret2;
+    double ns1;
+    double ns2;
+    time_t now;
+    char name[32];
+    struct tm tm1;
+    struct tm tm2;
+    struct flb_parser *p;
+    struct flb_parser_time *fast;
+    struct flb_config *config;
+
+    config = flb_config_init();
+    now = time(NULL);
+
+    for (i = 0; i < sizeof(time_fast_formats) / sizeof(struct time_fast_check); i++) {
+        snprintf(name, sizeof(name) - 1, "time_fast_%i", i);
+        p = flb_parser_create(name, "json", NULL, time_fast_formats[i].time_fmt,
+                              NULL, NULL, FLB_TRUE, FLB_FALSE, NULL, 0, NULL,
+                              config);
+        if (!TEST_CHECK(p != NULL)) {
+            continue;
+        }
+
+        TEST_CHECK((p->time_fast != NULL) == time_fast_formats[i].compiled);
+        TEST_MSG("format: '%s'", time_fast_formats[i].time_fmt);
+
+        /* twice, the second round uses the cached seconds */
+        for (k = 0; k < 2; k++) {
+            for (j = 0; j < sizeof(time_fast_strings) / sizeof(char *); j++) {
+                len = strlen(time_fast_strings[j]);
+
+                fast = p->time_fast;
+                p->time_fast = NULL;
+                memset(&tm1, 0x5a, sizeof(tm1));
+                ret1 = flb_parser_time_lookup(time_fast_strings[j], len, now,
+                                              p, &tm1, &ns1);
+                p->time_fast = fast;
+
+                memset(&tm2, 0x5a, sizeof(tm2));
+                ret2 = flb_parser_time_lookup(time_fast_strings[j], len, now,
+                                              p, &tm2, &ns2);
+
+                TEST_CHECK(ret1 == ret2 && ns1 == ns2 &&
+                           tm1.tm_year == tm2.tm_year &&
+                           tm1.tm_mon == tm2.tm_mon &&
+                           tm1.tm_mday == tm2.tm_mday &&
+                           tm1.tm_hour == tm2.tm_hour &&
+                           tm1.tm_min == tm2.tm_min &&
+                           tm1.tm_sec == tm2.tm_sec &&
+                           tm1.tm_yday == tm2.tm_yday &&
+                           tm1.tm_wday == tm2.tm_wday &&
+                           tm1.tm_isdst == tm2.tm_isdst);
+#ifdef FLB_HAVE_GMTOFF
+                TEST_CHECK(tm1.tm_gmtoff == tm2.tm_gmtoff);
+#endif
+                TEST_MSG("format: '%s' time: '%s'",
+                         time_fast_formats[i].time_fmt, time_fast_strings[j]);
+            }
+        }
+    }
+
+    flb_parser_exit(config);
+    flb_config_exit(config);
+}
+
 static char *get_msgpack_map_key(void *buf, size_t buf_size, char *key) {
     int i;
     size_t off = 0;
@@ -523,6 +650,7 @@ TEST_LIST = {
     { "time_lookup", test_parser_time_lookup},
     { "json_time_lookup", test_json_parser_time_lookup},
     { "regex_time_lookup", test_regex_parser_time_lookup},
+    { "time_fast", test_parser_time_fast},
     { "mysql_unquoted" , test_mysql_unquoted },
     { 0 }
 };
@@ -1,7 +1,11 @@
 /* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_filter.h>
+#include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_router_matcher.h>
 
 #include "flb_tests_internal.h"
 
@@ -49,7 +53,211 @@ void test_router_wildcard()
     TEST_CHECK(ret == FLB_TRUE);
 }
 
+/* Patterns and Tags used to compare the matcher with flb_router_match() */
+static char *matcher_patterns[] = {
+    "*", "cpu.*", "*.rpi", "*u.r*", "mem.*", "file.*.log", "**.log",
+    "kube.var.log.containers.*", "kube.*.ns-1_*", "kube.*.ns-2_*",
+    "*_container-3.log", "app.*.error", "app.a*", "*a*b*c*", "",
+    "test", "hogeeeeeee", "*.*", "a*a", NULL
+};
+
+static char *matcher_tags[] = {
+    "cpu.rpi", "file.apache.log", "file.log", "hoge", "test", "", "a",
+    "aa", "aba", "abc", "xaxbxcx", "app.web.error", "app.a", "app.b.error",
+    "kube.var.log.containers.pod_ns-1_container-3.log", "mem.local",
+    "kube.var.log.containers.pod_ns-2_container-1.log", "..", "*", NULL
+};
+
+static int matcher_build(struct flb_router_matcher *m, char **patterns)
+{
+    int i;
+
+    for (i = 0; patterns[i]; i++) {
+        if (flb_router_matcher_add(m, i, patterns[i], NULL) != 0) {
+            return -1;
+        }
+    }
+    return i;
+}
+
+void test_router_matcher()
+{
+    int i;
+    int j;
+    int n;
+    int ret;
+    int expected;
+    uint64_t mask[1];
+    struct flb_router_matcher *m;
+
+    m = flb_router_matcher_create(63);
+    TEST_CHECK(m != NULL);
+
+    n = matcher_build(m, matcher_patterns);
+    TEST_CHECK(n > 0);
+
+    for (i = 0; matcher_tags[i]; i++) {
+        ret = flb_router_matcher_match(m, matcher_tags[i],
+                                       strlen(matcher_tags[i]), mask);
+        TEST_CHECK(ret != -1);
+
+        for (j = 0; j < n; j++) {
+            expected = flb_router_match(matcher_tags[i],
+                                        strlen(matcher_tags[i]),
+                                        matcher_patterns[j], NULL);
+            TEST_CHECK(((mask[0] >> j) & 1) == expected);
+            if (((mask[0] >> j) & 1) != expected) {
+                fprintf(stderr, "tag=%s match=%s expected_to_match=%s\n",
+                        matcher_tags[i], matcher_patterns[j],
+                        expected ? "YES": "NO");
+            }
+        }
+    }
+
+    /* the Tag length is honored */
+    ret = flb_router_matcher_match(m, "testX", 4, mask);
+    TEST_CHECK(ret == FLB_TRUE);
+    TEST_CHECK((mask[0] >> 15) & 1);
+
+    /* ids out of the mask size are rejected */
+    ret = flb_router_matcher_add(m, 64, "x", NULL);
+    TEST_CHECK(ret == -1);
+
+    flb_router_matcher_destroy(m);
+}
+
+void test_router_cache()
+{
+    struct flb_config *config;
+    struct flb_filter_instance *f1;
+    struct flb_filter_instance *f2;
+    struct flb_filter_instance *f3;
+    struct flb_output_instance *o1;
+    struct flb_output_instance *o2;
+    struct flb_router_cache_entry *e;
+    struct flb_router_cache_entry *e2;
+    uint64_t *routes;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+    config->router_cache_size = 2;
+
+    f1 = flb_filter_new(config, "stdout", NULL);
+    f2 = flb_filter_new(config, "stdout", NULL);
+    TEST_CHECK(f1 != NULL && f2 != NULL);
+    flb_filter_set_property(f1, "match", "app.*");
+    flb_filter_set_property(f2, "match", "*");
+
+    o1 = flb_output_new(config, "null", NULL, FLB_TRUE);
+    o2 = flb_output_new(config, "null", NULL, FLB_TRUE);
+    TEST_CHECK(o1 != NULL && o2 != NULL);
+    flb_output_set_property(o1, "match", "app.*");
+    flb_output_set_property(o2, "match", "sys.*");
+
+    /* the Tag does not need to be NULL terminated */
+    e = flb_router_cache_get(config, "app.webX", 7);
+    TEST_CHECK(e != NULL);
+    TEST_CHECK(e->n_filters == 2);
+    TEST_CHECK(flb_router_cache_filters(e)[0] == f1);
+    TEST_CHECK(flb_router_cache_filters(e)[1] == f2);
+    TEST_CHECK(e->has_routes == FLB_TRUE);
+    routes = flb_router_cache_routes(e);
+    TEST_CHECK(flb_routes_mask_get_bit(routes, o1->id, config) == 1);
+    TEST_CHECK(flb_routes_mask_get_bit(routes, o2->id, config) == 0);
+
+    /* cached */
+    e2 = flb_router_cache_get(config, "app.web", 7);
+    TEST_CHECK(e2 == e);
+
+    e = flb_router_cache_get(config, "kube.x", 6);
+    TEST_CHECK(e != NULL);
+    TEST_CHECK(e->n_filters == 1 && flb_router_cache_filters(e)[0] == f2);
+    TEST_CHECK(e->has_routes == FLB_FALSE);
+
+    /* a third Tag evicts the least recently used one */
+    e = flb_router_cache_get(config, "sys.log", 7);
+    TEST_CHECK(e != NULL);
+    routes = flb_router_cache_routes(e);
+    TEST_CHECK(flb_routes_mask_get_bit(routes, o2->id, config) == 1);
+    TEST_CHECK(((struct flb_router_cache *) config->router_cache)->ht->total_count == 2);
+
+    /* a new filter invalidates the results */
+    f3 = flb_filter_new(config, "stdout", NULL);
+    TEST_CHECK(f3 != NULL);
+    TEST_CHECK(config->router_cache == NULL);
+    flb_filter_set_property(f3, "match", "sys.*");
+
+    e = flb_router_cache_get(config, "sys.log", 7);
+    TEST_CHECK(e != NULL);
+    TEST_CHECK(e->n_filters == 2 && flb_router_cache_filters(e)[1] == f3);
+
+    /* without cache, results are still computed */
+    flb_router_cache_invalidate(config);
+    config->router_cache_size = 0;
+    e = flb_router_cache_get(config, "app.web", 7);
+    TEST_CHECK(e != NULL);
+    TEST_CHECK(e->n_filters == 2);
+
+    flb_filter_instance_destroy(f1);
+    flb_filter_instance_destroy(f2);
+    flb_filter_instance_destroy(f3);
+    flb_output_instance_destroy(o1);
+    flb_output_instance_destroy(o2);
+    flb_config_exit(config);
+}
+
+/* Routes masks are sized from the output instances */
+void test_routes_mask_size()
+{
+    int i;
+    uint64_t *routes;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_config *config;
+    struct flb_output_instance *o_ins;
+    struct flb_router_cache_entry *e;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+    TEST_CHECK(config->routes_mask_size == FLB_ROUTES_MASK_DEFAULT_SIZE);
+
+    for (i = 0; i < 300; i++) {
+        o_ins = flb_output_new(config, "null", NULL, FLB_TRUE);
+        TEST_CHECK(o_ins != NULL);
+        flb_output_set_property(o_ins, "match", (i % 100 == 99) ? "app" : "none");
+    }
+
+    flb_routes_mask_set_size(config);
+    TEST_CHECK(config->routes_mask_size == 5);
+
+    e = flb_router_cache_get(config, "app", 3);
+    TEST_CHECK(e != NULL);
+    TEST_CHECK(e->has_routes == FLB_TRUE);
+    TEST_CHECK(e->routes_size == 5);
+
+    routes = flb_router_cache_routes(e);
+    TEST_CHECK(flb_routes_mask_get_bit(routes, 99, config) == 1);
+    TEST_CHECK(flb_routes_mask_get_bit(routes, 199, config) == 1);
+    TEST_CHECK(flb_routes_mask_get_bit(routes, 299, config) == 1);
+    TEST_CHECK(flb_routes_mask_get_bit(routes, 298, config) == 0);
+
+    flb_routes_mask_clear_bit(routes, 99, config);
+    flb_routes_mask_clear_bit(routes, 199, config);
+    TEST_CHECK(flb_routes_mask_is_empty(routes, config) == FLB_FALSE);
+    flb_routes_mask_clear_bit(routes, 299, config);
+    TEST_CHECK(flb_routes_mask_is_empty(routes, config) == FLB_TRUE);
+
+    mk_list_foreach_safe(head, tmp, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        flb_output_instance_destroy(o_ins);
+    }
+    flb_config_exit(config);
+}
+
 TEST_LIST = {
     { "wildcard", test_router_wildcard},
+    { "matcher",  test_router_matcher},
+    { "cache",    test_router_cache},
+    { "routes_mask_size", test_routes_mask_size},
     { 0 }
 };
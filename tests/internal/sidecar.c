@@ -0,0 +1,506 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_socket.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_sidecar.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+#include "flb_tests_internal.h"
+
+/* Test server modes */
+#define SERVER_LINE        0    /* line protocol                          */
+#define SERVER_BATCH       1    /* batch protocol                         */
+#define SERVER_SPLIT       2    /* batch, replies written a few bytes each */
+#define SERVER_BAD_SIZE    3    /* batch, reply size over the limit       */
+#define SERVER_SHORT       4    /* batch, closes after the first reply    */
+
+struct test_server {
+    int fd;
+    int port;
+    int mode;
+    int conns;                  /* connections to serve               */
+    int records;                /* records received by the last batch */
+    int bytes;                  /* record bytes received              */
+    pthread_t tid;
+};
+
+static int read_n(int fd, char *buf, size_t len)
+{
+    ssize_t ret;
+    size_t total = 0;
+
+    while (total < len) {
+        ret = recv(fd, buf + total, len - total, 0);
+        if (ret <= 0) {
+            return -1;
+        }
+        total += ret;
+    }
+    return 0;
+}
+
+/* write 'len' bytes in pieces of 'step' bytes so the client gets short reads */
+static void send_split(int fd, const char *buf, size_t len, size_t step)
+{
+    int on = 1;
+    size_t n;
+    size_t off = 0;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    while (off < len) {
+        n = (len - off < step) ? len - off : step;
+        send(fd, buf + off, n, 0);
+        off += n;
+        usleep(1000);
+    }
+}
+
+static void serve_batch(struct test_server *srv, int fd)
+{
+    int i;
+    uint32_t n;
+    uint32_t len;
+    uint32_t be_len;
+    char buf[2048];
+    char reply[2100];
+
+    if (read_n(fd, (char *) &n, 4) == -1) {
+        return;
+    }
+
+    n = ntohl(n);
+    srv->records = 0;
+    srv->bytes = 0;
+    for (i = 0; i < n; i++) {
+        if (read_n(fd, (char *) &len, 4) == -1) {
+            return;
+        }
+        len = ntohl(len);
+        if (len >= sizeof(buf) || read_n(fd, buf, len) == -1) {
+            return;
+        }
+        srv->records++;
+        srv->bytes += len;
+
+        if (srv->mode == SERVER_SHORT && i > 0) {
+            /* drop the connection in the middle of the replies */
+            return;
+        }
+
+        memcpy(reply + 4, "ok:", 3);
+        memcpy(reply + 7, buf, len);
+        len += 3;
+        be_len = htonl(srv->mode == SERVER_BAD_SIZE ?
+                       FLB_SIDECAR_MAX_REPLY + 1 : len);
+        memcpy(reply, &be_len, 4);
+
+        if (srv->mode == SERVER_SPLIT) {
+            send_split(fd, reply, len + 4, 3);
+        }
+        else {
+            send(fd, reply, len + 4, 0);
+        }
+    }
+}
+
+/* Answer every record with 'ok:<record>' */
+static void *server_worker(void *data)
+{
+    int c;
+    int fd;
+    int len;
+    char buf[256];
+    char reply[300];
+    ssize_t bytes;
+    struct test_server *srv = data;
+
+    for (c = 0; c < srv->conns; c++) {
+        fd = accept(srv->fd, NULL, NULL);
+        if (fd == -1) {
+            return NULL;
+        }
+
+        if (srv->mode == SERVER_LINE) {
+            bytes = recv(fd, buf, sizeof(buf) - 1, 0);
+            if (bytes > 0) {
+                buf[bytes] = '\0';
+                len = snprintf(reply, sizeof(reply), "ok:%s", buf);
+                send(fd, reply, len, 0);
+            }
+        }
+        else {
+            serve_batch(srv, fd);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static int server_start(struct test_server *srv, int mode, int conns)
+{
+    int on = 1;
+    socklen_t len;
+    struct sockaddr_in addr;
+
+    srv->mode = mode;
+    srv->conns = conns;
+    srv->records = 0;
+    srv->bytes = 0;
+    srv->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (srv->fd == -1) {
+        return -1;
+    }
+    setsockopt(srv->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(srv->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(srv->fd, 4) == -1) {
+        close(srv->fd);
+        return -1;
+    }
+
+    len = sizeof(addr);
+    getsockname(srv->fd, (struct sockaddr *) &addr, &len);
+    srv->port = ntohs(addr.sin_port);
+
+    return pthread_create(&srv->tid, NULL, server_worker, srv);
+}
+
+static void server_stop(struct test_server *srv)
+{
+    pthread_join(srv->tid, NULL);
+    close(srv->fd);
+}
+
+/* keepalive connections are registered in the engine event loop */
+static struct flb_config *test_config_create()
+{
+    struct flb_config *config;
+
+    config = flb_config_init();
+    if (!config) {
+        return NULL;
+    }
+
+    config->evl = mk_event_loop_create(8);
+    if (!config->evl) {
+        flb_config_exit(config);
+        return NULL;
+    }
+
+    flb_upstream_init();
+    flb_engine_evl_init();
+    flb_engine_evl_set(config->evl);
+
+    return config;
+}
+
+void test_line_request()
+{
+    int ret;
+    size_t len;
+    char out[128];
+    struct test_server srv;
+    struct flb_config *config;
+    struct flb_sidecar *sc;
+
+    config = test_config_create();
+    TEST_CHECK(config != NULL);
+
+    ret = server_start(&srv, SERVER_LINE, 1);
+    TEST_CHECK(ret == 0);
+
+    sc = flb_sidecar_create(config, "test", "127.0.0.1", srv.port);
+    TEST_CHECK(sc != NULL);
+
+    ret = flb_sidecar_request(sc, "hello\n", 6, out, sizeof(out), &len);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(len == 9);
+    TEST_CHECK(strcmp(out, "ok:hello\n") == 0);
+    TEST_CHECK(sc->state == FLB_SIDECAR_CLOSED);
+
+    server_stop(&srv);
+    flb_sidecar_destroy(sc);
+    flb_config_exit(config);
+}
+
+void test_batch_request()
+{
+    int ret;
+    flb_sds_t replies[3] = {0};
+    struct test_server srv;
+    struct flb_config *config;
+    struct flb_sidecar *sc;
+    struct flb_sidecar_batch batch;
+
+    config = test_config_create();
+    TEST_CHECK(config != NULL);
+
+    ret = server_start(&srv, SERVER_BATCH, 1);
+    TEST_CHECK(ret == 0);
+
+    sc = flb_sidecar_create(config, "test", "127.0.0.1", srv.port);
+    TEST_CHECK(sc != NULL);
+
+    ret = flb_sidecar_batch_init(&batch, 64);
+    TEST_CHECK(ret == 0);
+    flb_sidecar_batch_append(&batch, "a", 1);
+    flb_sidecar_batch_append(&batch, "", 0);
+    flb_sidecar_batch_append(&batch, "ccc", 3);
+    TEST_CHECK(batch.count == 3);
+
+    ret = flb_sidecar_batch_request(sc, &batch, replies);
+    TEST_CHECK(ret == 0);
+    if (ret == 0) {
+        TEST_CHECK(strcmp(replies[0], "ok:a") == 0);
+        TEST_CHECK(strcmp(replies[1], "ok:") == 0);
+        TEST_CHECK(strcmp(replies[2], "ok:ccc") == 0);
+    }
+
+    flb_sidecar_replies_destroy(replies, 3);
+    flb_sidecar_batch_destroy(&batch);
+    server_stop(&srv);
+    flb_sidecar_destroy(sc);
+    flb_config_exit(config);
+}
+
+/* Many records of different sizes, the request buffer grows */
+void test_batch_framing()
+{
+    int i;
+    int ret;
+    int bytes = 0;
+    char rec[1024];
+    char expected[1100];
+    flb_sds_t replies[40] = {0};
+    struct test_server srv;
+    struct flb_config *config;
+    struct flb_sidecar *sc;
+    struct flb_sidecar_batch batch;
+
+    config = test_config_create();
+    TEST_CHECK(config != NULL);
+
+    ret = server_start(&srv, SERVER_BATCH, 1);
+    TEST_CHECK(ret == 0);
+
+    sc = flb_sidecar_create(config, "test", "127.0.0.1", srv.port);
+    TEST_CHECK(sc != NULL);
+
+    ret = flb_sidecar_batch_init(&batch, 16);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_sds_len(batch.buf) == FLB_SIDECAR_FRAME_HEADER);
+
+    for (i = 0; i < 40; i++) {
+        memset(rec, 'a' + (i % 26), i * 25);
+        ret = flb_sidecar_batch_append(&batch, rec, i * 25);
+        TEST_CHECK(ret == 0);
+        bytes += i * 25;
+    }
+    TEST_CHECK(batch.count == 40);
+    TEST_CHECK(flb_sds_len(batch.buf) ==
+               FLB_SIDECAR_FRAME_HEADER * 41 + bytes);
+
+    ret = flb_sidecar_batch_request(sc, &batch, replies);
+    TEST_CHECK(ret == 0);
+    server_stop(&srv);
+
+    TEST_CHECK(srv.records == 40);
+    TEST_CHECK(srv.bytes == bytes);
+    if (ret == 0) {
+        for (i = 0; i < 40; i++) {
+            memcpy(expected, "ok:", 3);
+            memset(expected + 3, 'a' + (i % 26), i * 25);
+            if (!TEST_CHECK(flb_sds_len(replies[i]) == i * 25 + 3 &&
+                            memcmp(replies[i], expected, i * 25 + 3) == 0)) {
+                TEST_MSG("reply %i", i);
+            }
+        }
+    }
+
+    flb_sidecar_replies_destroy(replies, 40);
+    flb_sidecar_batch_destroy(&batch);
+
+    /* an empty batch is not sent */
+    ret = flb_sidecar_batch_init(&batch, 16);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_sidecar_batch_request(sc, &batch, replies) == 0);
+    flb_sidecar_batch_destroy(&batch);
+
+    flb_sidecar_destroy(sc);
+    flb_config_exit(config);
+}
+
+/* Replies arrive a few bytes at a time, headers split across reads */
+void test_batch_partial_reads()
+{
+    int i;
+    int ret;
+    char rec[8];
+    flb_sds_t replies[5] = {0};
+    struct test_server srv;
+    struct flb_config *config;
+    struct flb_sidecar *sc;
+    struct flb_sidecar_batch batch;
+
+    config = test_config_create();
+    TEST_CHECK(config != NULL);
+
+    ret = server_start(&srv, SERVER_SPLIT, 1);
+    TEST_CHECK(ret == 0);
+
+    sc = flb_sidecar_create(config, "test", "127.0.0.1", srv.port);
+    TEST_CHECK(sc != NULL);
+
+    flb_sidecar_batch_init(&batch, 64);
+    for (i = 0; i < 5; i++) {
+        snprintf(rec, sizeof(rec), "rec-%i", i);
+        flb_sidecar_batch_append(&batch, rec, strlen(rec));
+    }
+
+    ret = flb_sidecar_batch_request(sc, &batch, replies);
+    TEST_CHECK(ret == 0);
+    if (ret == 0) {
+        for (i = 0; i < 5; i++) {
+            snprintf(rec, sizeof(rec), "rec-%i", i);
+            TEST_CHECK(strncmp(replies[i], "ok:", 3) == 0 &&
+                       strcmp(replies[i] + 3, rec) == 0);
+            TEST_MSG("reply %i: %s", i, replies[i]);
+        }
+    }
+    TEST_CHECK(sc->state == FLB_SIDECAR_CLOSED);
+
+    flb_sidecar_replies_destroy(replies, 5);
+    flb_sidecar_batch_destroy(&batch);
+    server_stop(&srv);
+    flb_sidecar_destroy(sc);
+    flb_config_exit(config);
+}
+
+/*
+ * Oversized or missing replies fail the request on every attempt: the
+ * connection is dropped, no reply is returned and the failure counts for
+ * the circuit breaker.
+ */
+static void batch_error_reply(int mode)
+{
+    int i;
+    int ret;
+    flb_sds_t replies[3] = {0};
+    struct test_server srv;
+    struct flb_config *config;
+    struct flb_sidecar *sc;
+    struct flb_sidecar_batch batch;
+
+    config = test_config_create();
+    TEST_CHECK(config != NULL);
+
+    ret = server_start(&srv, mode, FLB_SIDECAR_RETRIES);
+    TEST_CHECK(ret == 0);
+
+    sc = flb_sidecar_create(config, "test", "127.0.0.1", srv.port);
+    TEST_CHECK(sc != NULL);
+
+    flb_sidecar_batch_init(&batch, 64);
+    flb_sidecar_batch_append(&batch, "a", 1);
+    flb_sidecar_batch_append(&batch, "b", 1);
+    flb_sidecar_batch_append(&batch, "c", 1);
+
+    ret = flb_sidecar_batch_request(sc, &batch, replies);
+    TEST_CHECK(ret == -1);
+    for (i = 0; i < 3; i++) {
+        TEST_CHECK(replies[i] == NULL);
+    }
+    TEST_CHECK(sc->failures == 1);
+
+    server_stop(&srv);
+    flb_sidecar_batch_destroy(&batch);
+    flb_sidecar_destroy(sc);
+    flb_config_exit(config);
+}
+
+void test_batch_error_bad_size()
+{
+    batch_error_reply(SERVER_BAD_SIZE);
+}
+
+void test_batch_error_short()
+{
+    batch_error_reply(SERVER_SHORT);
+}
+
+void test_circuit_breaker()
+{
+    int i;
+    int ret;
+    int fd;
+    int port;
+    size_t len;
+    char out[16];
+    socklen_t addr_len;
+    struct sockaddr_in addr;
+    struct flb_config *config;
+    struct flb_sidecar *sc;
+
+    /* grab a free port and release it so nobody listens there */
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    addr_len = sizeof(addr);
+    getsockname(fd, (struct sockaddr *) &addr, &addr_len);
+    port = ntohs(addr.sin_port);
+    close(fd);
+
+    config = test_config_create();
+    TEST_CHECK(config != NULL);
+
+    sc = flb_sidecar_create(config, "test", "127.0.0.1", port);
+    TEST_CHECK(sc != NULL);
+
+    for (i = 0; i < sc->max_failures; i++) {
+        TEST_CHECK(flb_sidecar_available(sc) == FLB_TRUE);
+        ret = flb_sidecar_request(sc, "x\n", 2, out, sizeof(out), &len);
+        TEST_CHECK(ret == -1);
+    }
+
+    /* the circuit is open: no more attempts until the backoff expires */
+    TEST_CHECK(sc->state == FLB_SIDECAR_OPEN);
+    TEST_CHECK(flb_sidecar_available(sc) == FLB_FALSE);
+    TEST_CHECK(sc->backoff == sc->backoff_base * 2);
+
+    /* expire the backoff: a single probe is allowed */
+    sc->retry_at = 0;
+    TEST_CHECK(flb_sidecar_available(sc) == FLB_TRUE);
+    TEST_CHECK(sc->state == FLB_SIDECAR_HALF_OPEN);
+
+    ret = flb_sidecar_request(sc, "x\n", 2, out, sizeof(out), &len);
+    TEST_CHECK(ret == -1);
+    TEST_CHECK(sc->state == FLB_SIDECAR_OPEN);
+    TEST_CHECK(sc->backoff == sc->backoff_base * 4);
+
+    flb_sidecar_destroy(sc);
+    flb_config_exit(config);
+}
+
+TEST_LIST = {
+    { "line_request",    test_line_request },
+    { "batch_request",   test_batch_request },
+    { "batch_framing",   test_batch_framing },
+    { "batch_partial",   test_batch_partial_reads },
+    { "batch_bad_size",  test_batch_error_bad_size },
+    { "batch_short",     test_batch_error_short },
+    { "circuit_breaker", test_circuit_breaker },
+    { 0 }
+};
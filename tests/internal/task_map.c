@@ -0,0 +1,139 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_task.h>
+
+#include "flb_tests_internal.h"
+
+static struct flb_config *map_config(int size)
+{
+    struct flb_config *config;
+
+    config = flb_calloc(1, sizeof(struct flb_config));
+    TEST_CHECK(config != NULL);
+    mk_list_init(&config->outputs);
+    config->tasks_map_size = size;
+
+    return config;
+}
+
+/* IDs come from a free stack: lowest first, last released reused first */
+void test_task_map_free_stack()
+{
+    int i;
+    int id;
+    int ret;
+    struct flb_config *config;
+
+    config = map_config(8);
+    ret = flb_task_map_create(config);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_task_map_used(config) == 0);
+
+    for (i = 0; i < 8; i++) {
+        id = flb_task_map_get_id(config);
+        TEST_CHECK(id == i);
+        TEST_MSG("expected id=%i got=%i", i, id);
+    }
+    TEST_CHECK(flb_task_map_used(config) == 8);
+    TEST_CHECK(config->tasks_map_peak == 8);
+
+    /* full */
+    TEST_CHECK(flb_task_map_get_id(config) == -1);
+
+    flb_task_map_free_id(5, config);
+    flb_task_map_free_id(2, config);
+    TEST_CHECK(flb_task_map_used(config) == 6);
+    TEST_CHECK(flb_task_map_get_id(config) == 2);
+    TEST_CHECK(flb_task_map_get_id(config) == 5);
+    TEST_CHECK(flb_task_map_get_id(config) == -1);
+
+    /* the peak is kept when IDs are released */
+    for (i = 0; i < 8; i++) {
+        flb_task_map_free_id(i, config);
+    }
+    TEST_CHECK(flb_task_map_used(config) == 0);
+    TEST_CHECK(config->tasks_map_peak == 8);
+
+    flb_task_map_destroy(config);
+    TEST_CHECK(flb_task_map_used(config) == 0);
+    flb_free(config);
+}
+
+/* The map size is limited by the bits of a task ID in the engine events */
+void test_task_map_clamp()
+{
+    int i;
+    int id;
+    int ret;
+    struct flb_config *config;
+
+    config = map_config(FLB_TASK_MAP_MAX + 100);
+    ret = flb_task_map_create(config);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(config->tasks_map_size == FLB_TASK_MAP_MAX);
+
+    for (i = 0; i < FLB_TASK_MAP_MAX; i++) {
+        id = flb_task_map_get_id(config);
+        if (!TEST_CHECK(id >= 0 && id < (1 << FLB_TASK_ID_BITS))) {
+            TEST_MSG("id=%i", id);
+            break;
+        }
+    }
+    TEST_CHECK(flb_task_map_get_id(config) == -1);
+    flb_task_map_destroy(config);
+
+    /* invalid sizes */
+    config->tasks_map_size = 0;
+    TEST_CHECK(flb_task_map_create(config) == -1);
+    config->tasks_map_size = -1;
+    TEST_CHECK(flb_task_map_create(config) == -1);
+
+    flb_free(config);
+}
+
+/* A chunk waiting for a task ID is counted once, not per attempt */
+void test_task_map_full_counter()
+{
+    int i;
+    int err;
+    int ret;
+    struct flb_task *task;
+    struct flb_config *config;
+    struct flb_input_chunk ic1;
+    struct flb_input_chunk ic2;
+    struct flb_input_instance ins;
+
+    memset(&ic1, '\0', sizeof(ic1));
+    memset(&ic2, '\0', sizeof(ic2));
+    memset(&ins, '\0', sizeof(ins));
+
+    config = map_config(1);
+    ret = flb_task_map_create(config);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_task_map_get_id(config) == 0);
+
+    for (i = 0; i < 5; i++) {
+        task = flb_task_create(0, "", 0, &ins, &ic1, "t", 1, config, &err);
+        TEST_CHECK(task == NULL && err == FLB_TRUE);
+    }
+    TEST_CHECK(config->tasks_map_full == 1);
+    TEST_CHECK(ic1.task_delayed == FLB_TRUE);
+
+    task = flb_task_create(0, "", 0, &ins, &ic2, "t", 1, config, &err);
+    TEST_CHECK(task == NULL && err == FLB_TRUE);
+    TEST_CHECK(config->tasks_map_full == 2);
+
+    flb_task_map_destroy(config);
+    flb_free(config);
+}
+
+TEST_LIST = {
+    { "free_stack"   , test_task_map_free_stack },
+    { "clamp"        , test_task_map_clamp },
+    { "full_counter" , test_task_map_full_counter },
+    { 0 }
+};
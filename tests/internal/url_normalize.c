@@ -0,0 +1,180 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_sds.h>
+
+#include "../../plugins/filter_apm_url_normalizer/url_normalize_native.h"
+#include "flb_tests_internal.h"
+
+static void check_path(struct url_normalizer *un,
+                       const char *path, const char *expected)
+{
+    int ret;
+    flb_sds_t out = NULL;
+
+    ret = url_normalizer_do(un, path, strlen(path), &out);
+    if (!TEST_CHECK(ret == 0)) {
+        TEST_MSG("path=%s", path);
+        return;
+    }
+    if (!TEST_CHECK(strcmp(out, expected) == 0)) {
+        TEST_MSG("path=%s expected=%s got=%s", path, expected, out);
+    }
+    flb_sds_destroy(out);
+}
+
+/* '/s' repeated 'n' times, or '/1' for the numeric segments */
+static flb_sds_t deep_path(int n, const char *segment)
+{
+    int i;
+    flb_sds_t path;
+
+    path = flb_sds_create_size(n * 8);
+    for (i = 0; i < n; i++) {
+        flb_sds_printf(&path, "/%s", segment);
+    }
+    return path;
+}
+
+void test_url_normalize_ids()
+{
+    struct url_normalizer *un;
+
+    un = url_normalizer_create();
+    TEST_CHECK(un != NULL);
+
+    check_path(un, "/users/42", "/users/{num}");
+    check_path(un, "/users/42/orders/7?page=2", "/users/{num}/orders/{num}");
+    check_path(un, "/files/0a1b2c3d4e", "/files/{hex}");
+    check_path(un, "/files/0a1b2c3", "/files/0a1b2c3");
+    check_path(un, "/files/deadbeef", "/files/deadbeef");
+    check_path(un, "/files/cafe1234#top", "/files/{hex}");
+    check_path(un, "/users/42x", "/users/42x");
+    check_path(un, "users/42/", "users/{num}");
+    check_path(un, "/a//42", "/a//{num}");
+    check_path(un, "/", "/");
+    check_path(un, "", "");
+
+    url_normalizer_destroy(un);
+}
+
+void test_url_normalize_uuid()
+{
+    struct url_normalizer *un;
+
+    un = url_normalizer_create();
+    TEST_CHECK(un != NULL);
+
+    check_path(un, "/s/123e4567-e89b-12d3-a456-426614174000",
+               "/s/{uuid}");
+    check_path(un, "/s/123E4567-E89B-12D3-A456-426614174000/x",
+               "/s/{uuid}/x");
+    /* misplaced dash, non hexadecimal digit, wrong length */
+    check_path(un, "/s/123e4567e-89b-12d3-a456-426614174000",
+               "/s/123e4567e-89b-12d3-a456-426614174000");
+    check_path(un, "/s/123e4567-e89b-12d3-a456-42661417400g",
+               "/s/123e4567-e89b-12d3-a456-42661417400g");
+    check_path(un, "/s/123e4567-e89b-12d3-a456-4266141740",
+               "/s/123e4567-e89b-12d3-a456-4266141740");
+
+    url_normalizer_destroy(un);
+}
+
+void test_url_normalize_templates()
+{
+    int ret;
+    struct url_normalizer *un;
+
+    un = url_normalizer_create();
+    TEST_CHECK(un != NULL);
+
+    ret = url_normalizer_add_template(un, "/api/users/:id/profile");
+    TEST_CHECK(ret == 0);
+    ret = url_normalizer_add_template(un, "/api/users/me/profile");
+    TEST_CHECK(ret == 0);
+    ret = url_normalizer_add_template(un, "/api/*/{item}");
+    TEST_CHECK(ret == 0);
+
+    /* literal segments take precedence over wildcards */
+    check_path(un, "/api/users/me/profile", "/api/users/me/profile");
+    check_path(un, "/api/users/abc/profile?x=1", "/api/users/:id/profile");
+    check_path(un, "/api/orders/77", "/api/*/{item}");
+    /* no template, segments are classified */
+    check_path(un, "/api/users/5/settings", "/api/users/{num}/settings");
+
+    url_normalizer_destroy(un);
+}
+
+/* Templates are matched up to URL_NORM_MAX_SEGMENTS segments */
+void test_url_normalize_segment_limit()
+{
+    int ret;
+    flb_sds_t path;
+    flb_sds_t expected;
+    struct url_normalizer *un;
+
+    un = url_normalizer_create();
+    TEST_CHECK(un != NULL);
+
+    /* a template with exactly the maximum number of segments */
+    path = deep_path(URL_NORM_MAX_SEGMENTS, "*");
+    ret = url_normalizer_add_template(un, path);
+    TEST_CHECK(ret == 0);
+    expected = path;
+
+    path = deep_path(URL_NORM_MAX_SEGMENTS, "x");
+    check_path(un, path, expected);
+    flb_sds_destroy(path);
+    flb_sds_destroy(expected);
+
+    /* one more segment: too deep for a template */
+    path = deep_path(URL_NORM_MAX_SEGMENTS + 1, "*");
+    ret = url_normalizer_add_template(un, path);
+    TEST_CHECK(ret == -1);
+    flb_sds_destroy(path);
+
+    url_normalizer_destroy(un);
+}
+
+/* Deeper paths skip the templates but their segments are normalized */
+void test_url_normalize_overflow()
+{
+    int ret;
+    flb_sds_t path;
+    flb_sds_t expected;
+    struct url_normalizer *un;
+
+    un = url_normalizer_create();
+    TEST_CHECK(un != NULL);
+
+    ret = url_normalizer_add_template(un, "/*");
+    TEST_CHECK(ret == 0);
+
+    path = deep_path(URL_NORM_MAX_SEGMENTS + 1, "12");
+    expected = deep_path(URL_NORM_MAX_SEGMENTS + 1, "{num}");
+    check_path(un, path, expected);
+
+    /* the query string and the trailing slash are dropped */
+    flb_sds_cat_safe(&path, "/?id=3", 6);
+    check_path(un, path, expected);
+    flb_sds_destroy(path);
+    flb_sds_destroy(expected);
+
+    path = deep_path(URL_NORM_MAX_SEGMENTS * 4, "deadbeef1");
+    expected = deep_path(URL_NORM_MAX_SEGMENTS * 4, "{hex}");
+    check_path(un, path, expected);
+    flb_sds_destroy(path);
+    flb_sds_destroy(expected);
+
+    url_normalizer_destroy(un);
+}
+
+TEST_LIST = {
+    { "ids"           , test_url_normalize_ids },
+    { "uuid"          , test_url_normalize_uuid },
+    { "templates"     , test_url_normalize_templates },
+    { "segment_limit" , test_url_normalize_segment_limit },
+    { "overflow"      , test_url_normalize_overflow },
+    { 0 }
+};
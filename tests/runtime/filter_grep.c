@@ -5,12 +5,36 @@
 #include "flb_tests_runtime.h"
 
 /* Test data */
+pthread_mutex_t result_mutex = PTHREAD_MUTEX_INITIALIZER;
+int result_count = 0;
+int result_last = -1;
+int result_unordered = 0;
 
 /* Test functions */
 void flb_test_filter_grep_regex(void);
 void flb_test_filter_grep_exclude(void);
 void flb_test_filter_grep_invalid(void);
+void flb_test_filter_grep_workers(void);
 
+/* Records must come out in the same order they were ingested */
+int callback_order(void *data, size_t size, void *cb_data)
+{
+    int ts;
+
+    if (size > 0) {
+        ts = atoi((char *) data + 1);
+
+        pthread_mutex_lock(&result_mutex);
+        if (ts <= result_last) {
+            result_unordered++;
+        }
+        result_last = ts;
+        result_count++;
+        pthread_mutex_unlock(&result_mutex);
+    }
+    free(data);
+    return 0;
+}
 
 void flb_test_filter_grep_regex(void)
 {
@@ -144,10 +168,75 @@ void flb_test_filter_grep_invalid(void)
     flb_destroy(ctx);
 }
 
+void flb_test_filter_grep_workers(void)
+{
+    int i;
+    int ret;
+    int bytes;
+    int expected = 0;
+    char p[100];
+    char val[32];
+    flb_ctx_t *ctx;
+    int in_ffd;
+    int out_ffd;
+    int filter_ffd;
+    struct flb_lib_out_cb cb;
+
+    cb.cb   = callback_order;
+    cb.data = NULL;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1",
+                    "filter.workers", "4", NULL);
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "tag", "test", NULL);
+
+    out_ffd = flb_output(ctx, (char *) "lib", &cb);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd, "match", "test", "format", "json", NULL);
+
+    filter_ffd = flb_filter(ctx, (char *) "grep", NULL);
+    TEST_CHECK(filter_ffd >= 0);
+    ret = flb_filter_set(ctx, filter_ffd, "match", "*", NULL);
+    TEST_CHECK(ret == 0);
+    ret = flb_filter_set(ctx, filter_ffd, "Exclude", "val 1", NULL);
+    TEST_CHECK(ret == 0);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < 1024; i++) {
+        snprintf(val, sizeof(val), "%d", i * i);
+        if (strchr(val, '1') == NULL) {
+            expected++;
+        }
+
+        memset(p, '\0', sizeof(p));
+        snprintf(p, sizeof(p), "[%d, {\"val\": \"%s\",\"END_KEY\": \"JSON_END\"}]", i, val);
+        bytes = flb_lib_push(ctx, in_ffd, p, strlen(p));
+        TEST_CHECK(bytes == strlen(p));
+    }
+
+    flb_time_msleep(2500); /* waiting flush */
+
+    pthread_mutex_lock(&result_mutex);
+    TEST_CHECK_(result_count == expected, "expected %i records, got %i",
+                expected, result_count);
+    TEST_CHECK_(result_unordered == 0, "%i records out of order",
+                result_unordered);
+    pthread_mutex_unlock(&result_mutex);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
 /* Test list */
 TEST_LIST = {
     {"regex",   flb_test_filter_grep_regex   },
     {"exclude", flb_test_filter_grep_exclude },
     {"invalid", flb_test_filter_grep_invalid },
+    {"workers", flb_test_filter_grep_workers },
     {NULL, NULL}
 };